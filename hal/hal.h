@@ -12,14 +12,30 @@
 #ifndef HAL_H
 #define HAL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined(__SYSRV_ARCH_RV64__)
+#include <rv64/cpu_local.h>
 #include <rv64/paging.h>
 #endif
 
+#define SRV_HAL_MAX_CPUS        8U  /**< Maximum number of CPUs the Kernel keeps per-CPU state for */
+#define SRV_HAL_CACHE_LINE_SIZE 64U /**< Size of a cache line, in bytes */
+
 typedef uintptr_t srv_physical_address_t; /**< Physical Address type, aliased to @c uintptr_t */
 typedef uintptr_t srv_virtual_address_t;  /**< Virtual Address type, aliased to @c uintptr_t */
+typedef uintptr_t srv_irq_state_t;        /**< Saved interrupt enable state */
+typedef uintptr_t srv_context_t;          /**< Saved register state of a suspended thread */
+
+/**
+ * @brief A range of physical memory
+ */
+typedef struct
+{
+    srv_physical_address_t base; /**< Address of the first byte in the range */
+    size_t                 size; /**< Size of the range, in bytes */
+} srv_physical_range_t;
 
 /**
  * @brief Unmask interrupts from being generated on the processor
@@ -27,47 +43,123 @@ typedef uintptr_t srv_virtual_address_t;  /**< Virtual Address type, aliased to
 void srv_hal_EnableInterrupts(void);
 
 /**
- * @brief Unmask interrupts from being generated on the processor
+ * @brief Mask interrupts from being generated on the processor
  */
 void srv_hal_DisableInterrupts(void);
 
 /**
- * @brief Mark a page table entry as valid
+ * @brief Mask interrupts on the processor, returning the previous state
+ *
+ * @return The interrupt state to hand back to @ref srv_hal_RestoreInterrupts
+ */
+srv_irq_state_t srv_hal_SaveAndDisableInterrupts(void);
+
+/**
+ * @brief Restore the interrupt state saved by @ref srv_hal_SaveAndDisableInterrupts
+ *
+ * @param[in] state The saved interrupt state
+ */
+void srv_hal_RestoreInterrupts(srv_irq_state_t state);
+
+/**
+ * @brief Stop the executing CPU until an interrupt is pending
+ *
+ * @details Wakes for any interrupt the CPU has enabled, even with interrupts
+ *          masked, so the caller can check for work with them masked and
+ *          then sleep without missing one. It may also wake for nothing.
+ */
+void srv_hal_WaitForInterrupt(void);
+
+/**
+ * @brief Point the executing CPU's traps at the HAL's entry code, and unmask timer and software interrupts
+ *
+ * @details Called once by every CPU, as early as it can. Interrupts stay
+ *          masked until @ref srv_hal_EnableInterrupts. From then on the HAL
+ *          calls the matching @c srv_trap_Handle function, with interrupts
+ *          masked, for every trap.
+ */
+void srv_hal_InitTraps(void);
+
+/**
+ * @brief Unmask interrupts from outside the executing CPU
  *
- * @param[in] pte Pointer to the Page Table Entry
+ * @details Left to the interrupt controller driver, once it is ready for
+ *          @ref srv_trap_HandleExternal to be called
  */
-void srv_hal_MarkPTEValid(page_table_entry_t* pte);
+void srv_hal_EnableExternalInterrupts(void);
 
 /**
- * @brief Mark a Page Table Entry as readable
+ * @brief Make a software interrupt pending on the executing CPU
  *
- * @param[in] pte Pointer to the Page Table Entry
+ * @details It is taken as soon as interrupts are unmasked, and
+ *          @ref srv_trap_HandleSoftware is called
  */
-void srv_hal_MarkPTEReadable(page_table_entry_t* pte);
+void srv_hal_RaiseSoftwareInterrupt(void);
 
 /**
- * @brief Marks a Page Table Entry as writable
+ * @brief Change the permissions of a run of Page Table Entries
  *
- * @param[in] pte Pointer to the Page Table Entry
+ * @details The permission bits of every valid leaf are replaced, and its
+ *          address, Accessed and Dirty bits are kept. Invalid entries and
+ *          entries pointing at tables are skipped. The TLB is not flushed, so
+ *          follow a batch of these with one @ref srv_hal_FlushTLBRange.
+ *
+ * @param[in,out] ptes  First entry of the run
+ * @param[in]     count Number of entries in the run
+ * @param[in]     flags New permission bits, from @ref SRV_PTE_PROT_MASK (plus Accessed and Dirty, which are only ever added)
  */
-void srv_hal_MarkPTEWritable(page_table_entry_t* pte);
+void srv_hal_ProtectPTERange(page_table_entry_t* ptes, size_t count, page_table_entry_t flags);
 
 /**
- * @brief Marks a Page Table Entry as executable
+ * @brief Clear the Dirty flag of a run of Page Table Entries
+ *
+ * @details Like @ref srv_hal_ProtectPTERange, this doesn't flush the TLB
  *
- * @param[in] pte Pointer to the Page Table Entry
+ * @param[in,out] ptes  First entry of the run
+ * @param[in]     count Number of entries in the run
+ *
+ * @return Number of valid leaves that were dirty
  */
-void srv_hal_MarkPTEExecutable(page_table_entry_t* pte);
+size_t srv_hal_ClearPTEDirtyRange(page_table_entry_t* ptes, size_t count);
 
 /**
- * @brief Gets the Dirty status of a Page Table Entry
+ * @brief Clear the Accessed flag of a run of Page Table Entries
+ *
+ * @details Like @ref srv_hal_ProtectPTERange, this doesn't flush the TLB
  *
- * @param[in] pte Pointer to the Page Table Entry
+ * @param[in,out] ptes  First entry of the run
+ * @param[in]     count Number of entries in the run
  *
- * @return @c true  if the PTE's "dirty" flag is set
- * @return @c false if the PTE's "dirty" flag is unset
+ * @return Number of valid leaves that had been accessed
  */
-bool srv_hal_IsPTEDirty(page_table_entry_t* pte);
+size_t srv_hal_ClearPTEAccessedRange(page_table_entry_t* ptes, size_t count);
+
+/**
+ * @brief Switch the executing CPU to a set of page tables
+ *
+ * @param[in] root Physical address of the root page table, or 0 to turn address translation off
+ */
+void srv_hal_SetPageTableRoot(srv_physical_address_t root);
+
+/**
+ * @brief Throw away every translation the executing CPU has cached
+ *
+ * @details Must be called after changing any page table entry the CPU might
+ *          be using, even one that was previously invalid
+ */
+void srv_hal_FlushTLB(void);
+
+/**
+ * @brief Throw away the translations the executing CPU has cached for a range of leaves
+ *
+ * @details Small ranges are flushed a page at a time, anything bigger all at
+ *          once. Only leaf entries are covered, so use @ref srv_hal_FlushTLB
+ *          after freeing a page table.
+ *
+ * @param[in] va   Start of the range
+ * @param[in] size Size of the range, in bytes
+ */
+void srv_hal_FlushTLBRange(srv_virtual_address_t va, size_t size);
 
 /**
  * @brief Write a character to the debug terminal
@@ -77,10 +169,166 @@ bool srv_hal_IsPTEDirty(page_table_entry_t* pte);
 void srv_hal_WriteDebugChar(char c);
 
 /**
- * @brief Get the ID of the currently executing CPU
+ * @brief Write a string of characters to the debug terminal
+ *
+ * @param[in] str    The characters to write. These do not need to be @c NUL terminated
+ * @param[in] length Number of characters to write
+ */
+void srv_hal_WriteDebugString(const char* str, size_t length);
+
+/**
+ * @brief Start a CPU that the firmware is holding
+ *
+ * @details The CPU begins executing at @c entry with address translation and
+ *          interrupts off. On RV64 it is handed its hart ID in @c a0 and
+ *          @c argument in @c a1. This returns as soon as the firmware has
+ *          accepted the request, not once the CPU is running.
+ *
+ * @param[in] hardware_id The CPU's hardware ID (hart ID on RV64)
+ * @param[in] entry       Physical address to start the CPU at
+ * @param[in] argument    Value passed to the CPU
+ *
+ * @return @c true if the firmware agreed to start the CPU
+ */
+bool srv_hal_StartCPU(uint32_t hardware_id, srv_physical_address_t entry, uintptr_t argument);
+
+/**
+ * @brief Raise a software interrupt on a set of other CPUs
+ *
+ * @details The interrupt lands in @ref srv_trap_HandleSoftware on each of
+ *          them. Use @ref srv_hal_RaiseSoftwareInterrupt for the executing
+ *          CPU.
+ *
+ * @param[in] hardware_mask Bit @c n set interrupts the CPU with hardware ID <tt>hardware_base + n</tt>
+ * @param[in] hardware_base Hardware ID bit 0 of @c hardware_mask stands for
+ *
+ * @return @c true if the interrupts were sent
+ */
+bool srv_hal_SendIPI(uint64_t hardware_mask, uint32_t hardware_base);
+
+/**
+ * @brief Build the context a new thread starts from
+ *
+ * @details The first switch to the context calls @c entry with @c argument,
+ *          on the stack below @c stack_top. @c entry must never return.
+ *
+ * @param[in] stack_top Top of the thread's stack
+ * @param[in] entry     Function the thread starts in
+ * @param[in] argument  Value passed to @c entry
+ *
+ * @return The context, for @ref srv_hal_SwitchContext
+ */
+srv_context_t srv_hal_InitContext(uintptr_t stack_top, void (*entry)(void*), void* argument);
+
+/**
+ * @brief Suspend the running thread and resume another
+ *
+ * @details Returns once something switches back to @c save. Interrupts are
+ *          left as they are, so the caller decides whether the switch can be
+ *          interrupted.
+ *
+ * @param[out] save Where to store the running thread's context
+ * @param[in]  next Context to resume, from an earlier switch or @ref srv_hal_InitContext
+ */
+void srv_hal_SwitchContext(srv_context_t* save, srv_context_t next);
+
+/**
+ * @brief Read the executing CPU's cycle counter
+ *
+ * @return The number of cycles executed since some arbitrary point in the past
+ */
+uint64_t srv_hal_GetCycleCount(void);
+
+/**
+ * @brief Choose how CPU timers are programmed
+ *
+ * @details Called once, before @ref srv_hal_SetTimer
+ *
+ * @param[in] has_compare_register Every CPU has a timer compare register the
+ *                                 Kernel can write itself (Sstc on RV64),
+ *                                 rather than asking the firmware
+ */
+void srv_hal_InitTimer(bool has_compare_register);
+
+/**
+ * @brief Read the platform timer
+ *
+ * @details Unlike the cycle counter, this ticks at a fixed rate and reads the
+ *          same on every CPU
+ *
+ * @return Ticks of the timebase since some arbitrary point in the past
+ */
+uint64_t srv_hal_GetTime(void);
+
+/**
+ * @brief Program the executing CPU's timer
+ *
+ * @details A timer interrupt already pending on the CPU is cleared, unless
+ *          @c deadline has passed too. Nothing is taken until timer
+ *          interrupts are unmasked.
+ *
+ * @param[in] deadline Value of @ref srv_hal_GetTime to interrupt at, or @c UINT64_MAX to never interrupt
+ */
+void srv_hal_SetTimer(uint64_t deadline);
+
+/**
+ * @brief Check whether the executing CPU has a vector unit the Kernel can use
+ *
+ * @return @c true if the vector unit is present
+ */
+bool srv_hal_HasVectorUnit(void);
+
+/**
+ * @brief   Start a section of code that uses the vector unit
+ * @details Masks interrupts and enables the vector unit. Keep the section short,
+ *          since interrupts stay masked until @ref srv_hal_VectorEnd.
+ *
+ * @return The interrupt state to hand back to @ref srv_hal_VectorEnd
+ */
+srv_irq_state_t srv_hal_VectorBegin(void);
+
+/**
+ * @brief End a section started by @ref srv_hal_VectorBegin
+ *
+ * @details The vector unit is switched back off, so its register contents are
+ *          discarded and never need to be saved on a context switch
+ *
+ * @param[in] state The value returned by @ref srv_hal_VectorBegin
+ */
+void srv_hal_VectorEnd(srv_irq_state_t state);
+
+/*
+ * Implemented by the Kernel, and called by the HAL from its trap entry code.
+ * Each may switch threads before it returns.
+ */
+
+/**
+ * @brief Handle a timer interrupt
+ *
+ * @details Must program the timer again (@ref srv_hal_SetTimer), which is
+ *          what clears the interrupt
+ */
+void srv_trap_HandleTimer(void);
+
+/**
+ * @brief Handle a software interrupt, which the HAL has already cleared
+ */
+void srv_trap_HandleSoftware(void);
+
+/**
+ * @brief Handle an interrupt from outside the CPU
+ */
+void srv_trap_HandleExternal(void);
+
+/**
+ * @brief Handle an exception, or an interrupt the HAL doesn't know
+ *
+ * @details Returning retries the instruction at @c pc
  *
- * @return The number of the executing CPU
+ * @param[in] cause What happened, as the processor reports it (@c scause on RV64)
+ * @param[in] pc    Address of the instruction that trapped
+ * @param[in] value Extra information about the exception, such as a faulting address (@c stval on RV64)
  */
-uint32_t srv_hal_GetExecutingCPU(void);
+void srv_trap_HandleException(uintptr_t cause, uintptr_t pc, uintptr_t value);
 
 #endif
@@ -0,0 +1,71 @@
+#
+# Thread context switching
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+# A context is the stack pointer of a suspended thread. Everything else it
+# needs is in a frame at the top of that stack, laid out as
+# rv64_context_frame_t in cpu.c. Switches only ever happen through a call,
+# so only the registers the calling convention says survive one are saved.
+# The Kernel does no floating point, so that is ra and s0-s11.
+#
+
+.section .text
+
+.equ CONTEXT_FRAME_SIZE, 112 # ra, s0-s11 and a pad to keep sp 16 byte aligned
+
+#
+# void srv_hal_SwitchContext(srv_context_t* save, srv_context_t next)
+#
+# a0 - Where to save the outgoing context
+# a1 - Context to switch to
+#
+.type srv_hal_SwitchContext, @function
+.global srv_hal_SwitchContext
+srv_hal_SwitchContext:
+    addi sp, sp, -CONTEXT_FRAME_SIZE
+    sd ra, 0(sp)
+    sd s0, 8(sp)
+    sd s1, 16(sp)
+    sd s2, 24(sp)
+    sd s3, 32(sp)
+    sd s4, 40(sp)
+    sd s5, 48(sp)
+    sd s6, 56(sp)
+    sd s7, 64(sp)
+    sd s8, 72(sp)
+    sd s9, 80(sp)
+    sd s10, 88(sp)
+    sd s11, 96(sp)
+    sd sp, 0(a0)
+
+    mv sp, a1
+    ld ra, 0(sp)
+    ld s0, 8(sp)
+    ld s1, 16(sp)
+    ld s2, 24(sp)
+    ld s3, 32(sp)
+    ld s4, 40(sp)
+    ld s5, 48(sp)
+    ld s6, 56(sp)
+    ld s7, 64(sp)
+    ld s8, 72(sp)
+    ld s9, 80(sp)
+    ld s10, 88(sp)
+    ld s11, 96(sp)
+    addi sp, sp, CONTEXT_FRAME_SIZE
+    ret
+
+#
+# First code run in a context built by srv_hal_InitContext(), reached
+# through the ra the first switch to it loads
+#
+# s0 - Entry point
+# s1 - Argument
+#
+.type rv64_context_Start, @function
+.global rv64_context_Start
+rv64_context_Start:
+    mv a0, s1
+    mv ra, zero # Entry points never return, and a backtrace should stop here
+    jr s0
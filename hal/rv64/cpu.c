@@ -7,12 +7,101 @@
 
 #include <hal.h>
 
-uint32_t srv_hal_GetExecutingCPU(void)
+#include "csr.h"
+#include "sbicall.h"
+
+/**
+ * @brief The frame @ref srv_hal_SwitchContext keeps at the top of a suspended thread's stack
+ *
+ * @note Must match the layout in context.s
+ */
+typedef struct
 {
-    uint32_t cpu_num;
+    uint64_t ra;      /**< Where the thread carries on from */
+    uint64_t s[12U];  /**< Callee-saved registers s0-s11 */
+    uint64_t padding; /**< Keeps the stack pointer 16 byte aligned */
+} rv64_context_frame_t;
+
+_Static_assert(sizeof(rv64_context_frame_t) == 112U, "context.s expects a 112 byte frame");
+
+extern void rv64_context_Start(void); /**< Calls the entry point of a new context, in context.s */
+
+bool srv_hal_StartCPU(uint32_t hardware_id, srv_physical_address_t entry, uintptr_t argument)
+{
+    /* Firmware older than SBI v0.2 released every hart at boot, and has no way to start one now */
+    if (!sbicall_ProbeExtension(SBICALL_EID_HSM))
+    {
+        return false;
+    }
+
+    const sbicall_ret_t ret = sbicall_Ecall(SBICALL_EID_HSM, SBICALL_HSM_HART_START, hardware_id, entry, argument, 0U, 0U, 0U);
+
+    return ret.error == SBICALL_SUCCESS;
+}
+
+bool srv_hal_SendIPI(uint64_t hardware_mask, uint32_t hardware_base)
+{
+    /* Every supervisor software interrupt goes through the firmware until there is an IMSIC driver */
+    return sbicall_SendIPI(hardware_mask, hardware_base);
+}
+
+srv_context_t srv_hal_InitContext(uintptr_t stack_top, void (*entry)(void*), void* argument)
+{
+    /* The psABI wants the stack pointer 16 byte aligned */
+    rv64_context_frame_t* frame = (rv64_context_frame_t*)((stack_top & ~15ULL) - sizeof(rv64_context_frame_t));
+
+    /* rv64_context_Start finds the entry point and argument in s0 and s1 */
+    *frame = (rv64_context_frame_t){
+        .ra = (uintptr_t)rv64_context_Start,
+        .s  = {[0] = (uintptr_t)entry, [1] = (uintptr_t)argument},
+    };
+
+    return (srv_context_t)frame;
+}
 
-    __asm__ volatile("mv %0, tp"
-                     : "=r"(cpu_num));
+uint64_t srv_hal_GetCycleCount(void)
+{
+    uint64_t cycles;
+
+    __asm__ volatile("rdcycle %0"
+                     : "=r"(cycles));
+
+    return cycles;
+}
+
+bool srv_hal_HasVectorUnit(void)
+{
+    uintptr_t sstatus;
+
+    /* sstatus.VS is read-only zero on harts without the V extension, so try to turn it on and see if it sticks */
+    __asm__ volatile("csrs sstatus, %1\n"
+                     "csrr %0, sstatus\n"
+                     "csrc sstatus, %1"
+                     : "=&r"(sstatus)
+                     : "r"(RV64_SSTATUS_VS_MASK));
+
+    return (sstatus & RV64_SSTATUS_VS_MASK) != 0UL;
+}
+
+srv_irq_state_t srv_hal_VectorBegin(void)
+{
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+
+    __asm__ volatile("csrs sstatus, %0"
+                     :
+                     : "r"(RV64_SSTATUS_VS_INITIAL)
+                     : "memory");
+
+    return irq_state;
+}
+
+void srv_hal_VectorEnd(srv_irq_state_t state)
+{
+    /* Turning the unit off again means there is never any vector state to save */
+    __asm__ volatile("csrc sstatus, %0"
+                     :
+                     : "r"(RV64_SSTATUS_VS_MASK)
+                     : "memory");
 
-    return cpu_num;
+    srv_hal_RestoreInterrupts(state);
 }
@@ -0,0 +1,66 @@
+/****************************************************************
+ * @file    cpu_local.h
+ * @brief   RV64 access to the executing CPU's local data block
+ *
+ * @details @c tp points at the executing CPU's block for as long as the
+ *          Kernel runs, so reaching a field of it is a single load off @c tp
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef CPU_LOCAL_H
+#define CPU_LOCAL_H
+
+#include <stdint.h>
+
+/**
+ * @brief Get the executing CPU's local data block
+ *
+ * @note The answer is only stable for as long as the caller can't be moved
+ *       to another CPU, e.g. while interrupts are masked
+ *
+ * @return The block set by @ref srv_hal_SetCPULocal
+ */
+static inline void* srv_hal_GetCPULocal(void)
+{
+    void* block;
+
+    /*
+     * Volatile, so every call reads tp afresh. A thread can be moved to
+     * another CPU between two calls, and a copy kept from the first would
+     * still point at the old CPU's block.
+     */
+    __asm__ volatile("mv %0, tp"
+                     : "=r"(block));
+
+    return block;
+}
+
+/**
+ * @brief Set the executing CPU's local data block
+ *
+ * @param[in] block The block. Its first member must be the CPU's logical number, as a @c uint32_t
+ */
+static inline void srv_hal_SetCPULocal(void* block)
+{
+    __asm__ volatile("mv tp, %0"
+                     :
+                     : "r"(block)
+                     : "memory");
+}
+
+/**
+ * @brief Get the ID of the currently executing CPU
+ *
+ * @details This is the logical number the Kernel gave the CPU when it was
+ *          brought up, counting from 0 for the boot CPU, rather than its
+ *          hardware ID. It is read out of the CPU's local data block.
+ *
+ * @return The number of the executing CPU
+ */
+static inline uint32_t srv_hal_GetExecutingCPU(void)
+{
+    return *(const uint32_t*)srv_hal_GetCPULocal();
+}
+
+#endif
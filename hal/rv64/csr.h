@@ -0,0 +1,28 @@
+/****************************************************************
+ * @file    csr.h
+ * @brief   RV64 Control and Status Register definitions
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef CSR_H
+#define CSR_H
+
+#define RV64_SSTATUS_SIE        (1UL << 1UL)  /**< Supervisor Interrupt Enable */
+#define RV64_SSTATUS_FS_MASK    (3UL << 13UL) /**< Floating point state field. Off (zero) makes every FP instruction trap */
+#define RV64_SSTATUS_VS_SHIFT   9UL           /**< Shift of the Vector extension state field */
+#define RV64_SSTATUS_VS_MASK    (3UL << 9UL)  /**< Vector extension state field */
+#define RV64_SSTATUS_VS_INITIAL (1UL << 9UL)  /**< Vector state is enabled and in its initial state */
+#define RV64_SSTATUS_VS_DIRTY   (3UL << 9UL)  /**< Vector state is enabled and has been modified */
+
+#define RV64_SIE_SSIE (1UL << 1UL) /**< Supervisor software interrupt enable */
+#define RV64_SIE_STIE (1UL << 5UL) /**< Supervisor timer interrupt enable */
+#define RV64_SIE_SEIE (1UL << 9UL) /**< Supervisor external interrupt enable */
+#define RV64_SIP_SSIP (1UL << 1UL) /**< Supervisor software interrupt pending */
+
+#define RV64_STVEC_MODE_VECTORED 1UL /**< Interrupts go to stvec.BASE + 4 * cause, exceptions to stvec.BASE */
+
+#define RV64_SATP_MODE_SV39 (8UL << 60UL) /**< satp.MODE for Sv39 translation */
+#define RV64_SATP_PPN_SHIFT 12UL          /**< satp.PPN holds the root table's address shifted down by this much */
+
+#endif
@@ -9,8 +9,78 @@
 
 #include "sbicall.h"
 
+/**
+ * @brief How console output reaches the firmware
+ */
+typedef enum
+{
+    DEBUG_CONSOLE_UNPROBED = 0, /**< Not worked out yet */
+    DEBUG_CONSOLE_DBCN,         /**< SBI Debug Console extension, a whole buffer per call */
+    DEBUG_CONSOLE_LEGACY        /**< Legacy putchar, one character per call */
+} debug_console_t;
+
+static debug_console_t debug_console = DEBUG_CONSOLE_UNPROBED;
+
+/**
+ * @brief Work out (once) which console interface the firmware offers
+ *
+ * @details Probing is idempotent, so CPUs racing to do it first all agree on the answer
+ */
+static debug_console_t debug_Console(void)
+{
+    debug_console_t console = __atomic_load_n(&debug_console, __ATOMIC_RELAXED);
+
+    if (console == DEBUG_CONSOLE_UNPROBED)
+    {
+        console = sbicall_ProbeExtension(SBICALL_EID_DBCN) ? DEBUG_CONSOLE_DBCN : DEBUG_CONSOLE_LEGACY;
+        __atomic_store_n(&debug_console, console, __ATOMIC_RELAXED);
+    }
+
+    return console;
+}
+
 void srv_hal_WriteDebugChar(char c)
 {
+    if (debug_Console() == DEBUG_CONSOLE_DBCN)
+    {
+        const sbicall_ret_t ret = sbicall_Ecall(SBICALL_EID_DBCN, SBICALL_DBCN_CONSOLE_WRITE_BYTE, (uint8_t)c, 0U, 0U, 0U, 0U, 0U);
+        if (ret.error == SBICALL_SUCCESS)
+        {
+            return;
+        }
+    }
+
     /* Print the character to the console */
     (void)sbicall_LegacyEcall1((uintptr_t)c, SBICALL_LEGACY_CONSOLE_PUTCHAR);
 }
+
+void srv_hal_WriteDebugString(const char* str, size_t length)
+{
+    if (debug_Console() == DEBUG_CONSOLE_DBCN)
+    {
+        while (length != 0U)
+        {
+            /*
+             * DBCN takes a physical address. The Kernel runs identity mapped, so the
+             * virtual address of the buffer is also its physical address.
+             */
+            const uintptr_t     address = (uintptr_t)str;
+            const sbicall_ret_t ret     = sbicall_Ecall(SBICALL_EID_DBCN, SBICALL_DBCN_CONSOLE_WRITE, length, address, 0U, 0U, 0U, 0U);
+
+            /* The firmware may write less than asked for, so keep going until it's all out */
+            if ((ret.error != SBICALL_SUCCESS) || (ret.value <= 0))
+            {
+                break;
+            }
+
+            str    += ret.value;
+            length -= (size_t)ret.value;
+        }
+    }
+
+    /* Legacy console (or whatever DBCN couldn't write), one character per call */
+    for (size_t i = 0U; i < length; i++)
+    {
+        (void)sbicall_LegacyEcall1((uintptr_t)str[i], SBICALL_LEGACY_CONSOLE_PUTCHAR);
+    }
+}
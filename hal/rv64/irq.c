@@ -7,14 +7,46 @@
 
 #include <hal.h>
 
+#include "csr.h"
+
 void srv_hal_EnableInterrupts(void)
 {
     /* Set SSTATUS.SIE to 1 */
-    __asm__ volatile("csrrsi zero, sstatus, 1");
+    __asm__ volatile("csrrsi zero, sstatus, 2");
 }
 
 void srv_hal_DisableInterrupts(void)
 {
     /* Clear SSTATUS.SIE */
-    __asm__ volatile("csrrci zero, sstatus, 1");
+    __asm__ volatile("csrrci zero, sstatus, 2");
+}
+
+srv_irq_state_t srv_hal_SaveAndDisableInterrupts(void)
+{
+    srv_irq_state_t sstatus;
+
+    /* Clear SSTATUS.SIE, and get the old value back in the same instruction */
+    __asm__ volatile("csrrci %0, sstatus, 2"
+                     : "=r"(sstatus)
+                     :
+                     : "memory");
+
+    return sstatus & RV64_SSTATUS_SIE;
+}
+
+void srv_hal_RestoreInterrupts(srv_irq_state_t state)
+{
+    /* Only SIE is ever saved, so setting the saved bits back is enough */
+    __asm__ volatile("csrs sstatus, %0"
+                     :
+                     : "r"(state & RV64_SSTATUS_SIE)
+                     : "memory");
+}
+
+void srv_hal_WaitForInterrupt(void)
+{
+    __asm__ volatile("wfi"
+                     :
+                     :
+                     : "memory");
 }
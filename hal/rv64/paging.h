@@ -2,6 +2,10 @@
  * @file    paging.h
  * @brief   RV64 Paging types
  *
+ * @details Page table entries are built and inspected with the inline
+ *          helpers here, so constructing an entry compiles down to a shift
+ *          and an OR rather than a call per permission bit
+ *
  * @copyright SPDX-License-Identifier: GPL-3.0-or-later
  ****************************************************************/
 
@@ -10,9 +14,89 @@
 
 #include <stdint.h>
 
-#define SRV_PAGING_PTE_PER_TABLE 512UL /**< Number of Page Table Entries in a Page Table */
+#define SRV_PAGING_PTE_PER_TABLE   512UL                  /**< Number of Page Table Entries in a Page Table */
+#define SRV_PAGING_LEVELS          3U                     /**< Number of page table levels (Sv39) */
+#define SRV_PAGING_PAGE_SHIFT      12ULL                  /**< log2 of the base page size */
+#define SRV_PAGING_VA_BITS         39ULL                  /**< Significant bits of a virtual address. The rest copy the top one */
+#define SRV_PAGING_DIRECT_MAP_BASE 0xFFFFFFC000000000ULL /**< Where all of physical memory is mapped, the bottom of the upper half */
+#define SRV_PAGING_DIRECT_MAP_SIZE (256ULL << 30ULL)      /**< Size of the direct map window (the whole upper half) */
+
+#define SRV_PTE_VALID      (1ULL << 0ULL)                                      /**< Entry is valid */
+#define SRV_PTE_READ       (1ULL << 1ULL)                                      /**< Leaf can be read */
+#define SRV_PTE_WRITE      (1ULL << 2ULL)                                      /**< Leaf can be written. Requires @ref SRV_PTE_READ */
+#define SRV_PTE_EXECUTE    (1ULL << 3ULL)                                      /**< Leaf can be executed */
+#define SRV_PTE_USER       (1ULL << 4ULL)                                      /**< Leaf is accessible from U-mode */
+#define SRV_PTE_GLOBAL     (1ULL << 5ULL)                                      /**< Mapping exists in every address space */
+#define SRV_PTE_ACCESSED   (1ULL << 6ULL)                                      /**< Leaf has been accessed */
+#define SRV_PTE_DIRTY      (1ULL << 7ULL)                                      /**< Leaf has been written */
+#define SRV_PTE_LEAF_MASK  (SRV_PTE_READ | SRV_PTE_WRITE | SRV_PTE_EXECUTE)    /**< An entry with any of these set is a leaf, otherwise it points at a table */
+#define SRV_PTE_PROT_MASK  (SRV_PTE_LEAF_MASK | SRV_PTE_USER | SRV_PTE_GLOBAL) /**< Bits replaced by @ref srv_hal_ProtectPTERange */
+#define SRV_PTE_FLAGS_MASK 0x3FFULL                                            /**< Everything below the PPN */
+#define SRV_PTE_PPN_SHIFT  10ULL                                               /**< Shift of the PPN within an entry */
 
 typedef uint64_t           page_table_entry_t;                     /** Page Table Entry typedef */
 typedef page_table_entry_t page_table_t[SRV_PAGING_PTE_PER_TABLE]; /** Page Table Typedef */
 
+/**
+ * @brief Build a valid Page Table Entry
+ *
+ * @param[in] pa    Physical address of the page, or of the next level table. Must be page aligned
+ * @param[in] flags Combination of the @c SRV_PTE_ bits. 0 makes an entry that points at a table
+ *
+ * @return The entry
+ */
+static inline page_table_entry_t srv_hal_MakePTE(uintptr_t pa, page_table_entry_t flags)
+{
+    return ((pa >> SRV_PAGING_PAGE_SHIFT) << SRV_PTE_PPN_SHIFT) | flags | SRV_PTE_VALID;
+}
+
+/**
+ * @brief Get the physical address a Page Table Entry points at
+ *
+ * @param[in] pte The Page Table Entry
+ *
+ * @return Address of the page, or of the next level table
+ */
+static inline uintptr_t srv_hal_GetPTEAddress(page_table_entry_t pte)
+{
+    return (pte >> SRV_PTE_PPN_SHIFT) << SRV_PAGING_PAGE_SHIFT;
+}
+
+/**
+ * @brief Gets the Valid status of a Page Table Entry
+ *
+ * @param[in] pte The Page Table Entry
+ *
+ * @return @c true if the entry maps something
+ */
+static inline bool srv_hal_IsPTEValid(page_table_entry_t pte)
+{
+    return (pte & SRV_PTE_VALID) != 0ULL;
+}
+
+/**
+ * @brief Does a Page Table Entry map a page, rather than point at a table?
+ *
+ * @param[in] pte The Page Table Entry
+ *
+ * @return @c true if the entry is a leaf
+ */
+static inline bool srv_hal_IsPTELeaf(page_table_entry_t pte)
+{
+    return (pte & SRV_PTE_LEAF_MASK) != 0ULL;
+}
+
+/**
+ * @brief Gets the Dirty status of a Page Table Entry
+ *
+ * @param[in] pte The Page Table Entry
+ *
+ * @return @c true  if the PTE's "dirty" flag is set
+ * @return @c false if the PTE's "dirty" flag is unset
+ */
+static inline bool srv_hal_IsPTEDirty(page_table_entry_t pte)
+{
+    return (pte & SRV_PTE_DIRTY) != 0ULL;
+}
+
 #endif
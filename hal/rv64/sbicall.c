@@ -9,16 +9,88 @@
 
 long sbicall_LegacyEcall1(uintptr_t arg0, rv64_sbicall_legacy_eid_t eid)
 {
-    uint32_t a0 = arg0;
-    uint32_t a7 = (uint32_t)eid;
-
-    __asm__ volatile(
-    "mv a0, %0\n"
-    "mv a7, %2\n"
-    "ecall\n"
-    : "+r"(a0)
-    : "r"(a0), "r"(a7)
-    : "cc", "memory");
-
-    return a0;
+    register uintptr_t a0 __asm__("a0") = arg0;
+    register uintptr_t a7 __asm__("a7") = (uintptr_t)eid;
+
+    __asm__ volatile("ecall"
+                     : "+r"(a0)
+                     : "r"(a7)
+                     : "memory");
+
+    return (long)a0;
+}
+
+sbicall_ret_t sbicall_Ecall(rv64_sbicall_eid_t eid, uint32_t fid, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2,
+                            uintptr_t arg3, uintptr_t arg4, uintptr_t arg5)
+{
+    register uintptr_t a0 __asm__("a0") = arg0;
+    register uintptr_t a1 __asm__("a1") = arg1;
+    register uintptr_t a2 __asm__("a2") = arg2;
+    register uintptr_t a3 __asm__("a3") = arg3;
+    register uintptr_t a4 __asm__("a4") = arg4;
+    register uintptr_t a5 __asm__("a5") = arg5;
+    register uintptr_t a6 __asm__("a6") = (uintptr_t)fid;
+    register uintptr_t a7 __asm__("a7") = (uintptr_t)eid;
+
+    /* The firmware may read memory we point it at (and write it, for console reads) */
+    __asm__ volatile("ecall"
+                     : "+r"(a0), "+r"(a1)
+                     : "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(a6), "r"(a7)
+                     : "memory");
+
+    return (sbicall_ret_t){.error = (long)a0, .value = (long)a1};
+}
+
+void sbicall_SetTimer(uint64_t stime_value)
+{
+    /* Probed once, since this is on the path of every timer interrupt. Every hart sees the same firmware */
+    static int32_t has_time_extension = -1;
+
+    if (has_time_extension < 0)
+    {
+        has_time_extension = sbicall_ProbeExtension(SBICALL_EID_TIME) ? 1 : 0;
+    }
+
+    if (has_time_extension != 0)
+    {
+        (void)sbicall_Ecall(SBICALL_EID_TIME, SBICALL_TIME_SET_TIMER, stime_value, 0U, 0U, 0U, 0U, 0U);
+    }
+    else
+    {
+        (void)sbicall_LegacyEcall1(stime_value, SBICALL_LEGACY_SET_TIMER);
+    }
+}
+
+bool sbicall_SendIPI(uint64_t hart_mask, uint32_t hart_mask_base)
+{
+    /* Probed once, the same as the TIME extension */
+    static int32_t has_ipi_extension = -1;
+
+    if (has_ipi_extension < 0)
+    {
+        has_ipi_extension = sbicall_ProbeExtension(SBICALL_EID_IPI) ? 1 : 0;
+    }
+
+    if (has_ipi_extension != 0)
+    {
+        return sbicall_Ecall(SBICALL_EID_IPI, SBICALL_IPI_SEND_IPI, hart_mask, hart_mask_base, 0U, 0U, 0U, 0U).error == SBICALL_SUCCESS;
+    }
+
+    /* The legacy call takes a pointer to a mask that always starts at hart 0 */
+    if ((hart_mask_base >= 64U) || ((hart_mask << hart_mask_base) >> hart_mask_base) != hart_mask)
+    {
+        return false;
+    }
+
+    const uint64_t legacy_mask = hart_mask << hart_mask_base;
+
+    return sbicall_LegacyEcall1((uintptr_t)&legacy_mask, SBICALL_LEGACY_SEND_IPI) == SBICALL_SUCCESS;
+}
+
+bool sbicall_ProbeExtension(rv64_sbicall_eid_t eid)
+{
+    const sbicall_ret_t ret = sbicall_Ecall(SBICALL_EID_BASE, SBICALL_BASE_PROBE_EXTENSION, (uintptr_t)eid, 0U, 0U, 0U, 0U, 0U);
+
+    /* A non-zero value means present, with an extension specific meaning we don't need */
+    return (ret.error == SBICALL_SUCCESS) && (ret.value != 0);
 }
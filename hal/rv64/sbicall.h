@@ -8,6 +8,7 @@
 #ifndef SBICALL_H
 #define SBICALL_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /**
@@ -15,9 +16,95 @@
  */
 typedef enum
 {
-    SBICALL_LEGACY_CONSOLE_PUTCHAR = 0x01U /**< Console Putchar extension ID */
+    SBICALL_LEGACY_SET_TIMER       = 0x00U, /**< Set Timer extension ID */
+    SBICALL_LEGACY_CONSOLE_PUTCHAR = 0x01U, /**< Console Putchar extension ID */
+    SBICALL_LEGACY_SEND_IPI        = 0x04U  /**< Send IPI extension ID */
 } rv64_sbicall_legacy_eid_t;
 
+/**
+ * @brief SBI extension IDs, passed in @c a7
+ */
+typedef enum
+{
+    SBICALL_EID_BASE = 0x10U,       /**< Base extension, always present from SBI v0.2 */
+    SBICALL_EID_TIME = 0x54494D45U, /**< Timer extension ("TIME") */
+    SBICALL_EID_IPI  = 0x735049U,   /**< IPI extension ("sPI") */
+    SBICALL_EID_HSM  = 0x48534DU,   /**< Hart State Management extension ("HSM") */
+    SBICALL_EID_DBCN = 0x4442434EU  /**< Debug Console extension ("DBCN") */
+} rv64_sbicall_eid_t;
+
+/**
+ * @brief Base extension function IDs, passed in @c a6
+ */
+typedef enum
+{
+    SBICALL_BASE_GET_SPEC_VERSION = 0x00U, /**< Get the implemented SBI specification version */
+    SBICALL_BASE_GET_IMPL_ID      = 0x01U, /**< Get the SBI implementation ID */
+    SBICALL_BASE_GET_IMPL_VERSION = 0x02U, /**< Get the SBI implementation version */
+    SBICALL_BASE_PROBE_EXTENSION  = 0x03U  /**< Check whether an extension is available */
+} rv64_sbicall_base_fid_t;
+
+/**
+ * @brief Timer extension function IDs, passed in @c a6
+ */
+typedef enum
+{
+    SBICALL_TIME_SET_TIMER = 0x00U /**< Program the calling hart's timer, and clear its pending timer interrupt */
+} rv64_sbicall_time_fid_t;
+
+/**
+ * @brief IPI extension function IDs, passed in @c a6
+ */
+typedef enum
+{
+    SBICALL_IPI_SEND_IPI = 0x00U /**< Raise a supervisor software interrupt on a set of harts */
+} rv64_sbicall_ipi_fid_t;
+
+/**
+ * @brief Hart State Management extension function IDs, passed in @c a6
+ */
+typedef enum
+{
+    SBICALL_HSM_HART_START      = 0x00U, /**< Start a stopped hart at an address, in S-mode with translation off */
+    SBICALL_HSM_HART_STOP       = 0x01U, /**< Stop the calling hart */
+    SBICALL_HSM_HART_GET_STATUS = 0x02U  /**< Get the state of a hart */
+} rv64_sbicall_hsm_fid_t;
+
+/**
+ * @brief Debug Console extension function IDs, passed in @c a6
+ */
+typedef enum
+{
+    SBICALL_DBCN_CONSOLE_WRITE      = 0x00U, /**< Write a buffer of bytes to the console */
+    SBICALL_DBCN_CONSOLE_READ       = 0x01U, /**< Read bytes from the console into a buffer */
+    SBICALL_DBCN_CONSOLE_WRITE_BYTE = 0x02U  /**< Write a single byte to the console */
+} rv64_sbicall_dbcn_fid_t;
+
+/**
+ * @brief Standard SBI error codes, returned in @c a0
+ */
+typedef enum
+{
+    SBICALL_SUCCESS               = 0,  /**< Completed successfully */
+    SBICALL_ERR_FAILED            = -1, /**< Failed */
+    SBICALL_ERR_NOT_SUPPORTED     = -2, /**< Not supported */
+    SBICALL_ERR_INVALID_PARAM     = -3, /**< Invalid parameter(s) */
+    SBICALL_ERR_DENIED            = -4, /**< Denied or not allowed */
+    SBICALL_ERR_INVALID_ADDRESS   = -5, /**< Invalid address(es) */
+    SBICALL_ERR_ALREADY_AVAILABLE = -6, /**< Already available */
+    SBICALL_ERR_ALREADY_STARTED   = -7, /**< Already started */
+    SBICALL_ERR_ALREADY_STOPPED   = -8  /**< Already stopped */
+} rv64_sbicall_error_t;
+
+/**
+ * @brief The @c sbiret pair every non-legacy SBI call returns
+ */
+typedef struct
+{
+    long error; /**< One of @ref rv64_sbicall_error_t, from @c a0 */
+    long value; /**< Call specific return value, from @c a1 */
+} sbicall_ret_t;
+
 /**
  * @brief Perform a legacy SBI ECALL with 1 argument
  *
@@ -28,4 +115,57 @@ typedef enum
  */
 long sbicall_LegacyEcall1(uintptr_t arg0, rv64_sbicall_legacy_eid_t eid);
 
+/**
+ * @brief Perform an SBI ECALL using the v0.2+ calling convention
+ *
+ * @param[in] eid  Extension ID, placed in @c a7
+ * @param[in] fid  Function ID, placed in @c a6
+ * @param[in] arg0 Argument placed in @c a0
+ * @param[in] arg1 Argument placed in @c a1
+ * @param[in] arg2 Argument placed in @c a2
+ * @param[in] arg3 Argument placed in @c a3
+ * @param[in] arg4 Argument placed in @c a4
+ * @param[in] arg5 Argument placed in @c a5
+ *
+ * @return The error/value pair from @c a0 and @c a1
+ */
+sbicall_ret_t sbicall_Ecall(rv64_sbicall_eid_t eid, uint32_t fid, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2,
+                            uintptr_t arg3, uintptr_t arg4, uintptr_t arg5);
+
+/**
+ * @brief Program the calling hart's timer
+ *
+ * @details Uses the TIME extension, or the legacy Set Timer call on firmware
+ *          that predates it. Either way the hart's pending timer interrupt is
+ *          cleared.
+ *
+ * @param[in] stime_value Value of the @c time CSR to interrupt at. @c UINT64_MAX never interrupts
+ */
+void sbicall_SetTimer(uint64_t stime_value);
+
+/**
+ * @brief Raise a supervisor software interrupt on a set of harts
+ *
+ * @details Uses the IPI extension, or the legacy Send IPI call on firmware
+ *          that predates it, which can only reach harts 0 to 63
+ *
+ * @param[in] hart_mask      Bit @c n set sends to hart <tt>hart_mask_base + n</tt>
+ * @param[in] hart_mask_base Hart ID bit 0 of @c hart_mask stands for
+ *
+ * @return @c true if the firmware accepted the request
+ */
+bool sbicall_SendIPI(uint64_t hart_mask, uint32_t hart_mask_base);
+
+/**
+ * @brief Check whether the SBI implementation provides an extension
+ *
+ * @details Firmware that predates SBI v0.2 has no Base extension, in which case
+ *          the probe itself fails and every extension is reported as missing
+ *
+ * @param[in] eid The extension to look for
+ *
+ * @return @c true if the extension is available
+ */
+bool sbicall_ProbeExtension(rv64_sbicall_eid_t eid);
+
 #endif
@@ -7,33 +7,106 @@
 
 #include <hal.h>
 
-#define RV64_PTE_VALID   (1ULL << 0ULL) /**< Sv39 PTE Valid bit */
-#define RV64_PTE_READ    (1ULL << 1ULL) /**< Sv39 PTE Read bit */
-#define RV64_PTE_WRITE   (1ULL << 2ULL) /**< Sv39 PTE Write bit */
-#define RV64_PTE_EXECUTE (1ULL << 3ULL) /**< Sv39 PTE Execute bit */
-#define RV64_PTE_DIRTY   (1ULL << 7ULL) /**< Sv39 PTE Dirty flag */
+#include "csr.h"
 
-void srv_hal_MarkPTEValid(page_table_entry_t* pte)
+#define RV64_TLB_FLUSH_MAX_PAGES 32ULL /**< Largest range flushed a page at a time. Past this, flushing everything is cheaper */
+
+/**
+ * @brief Atomically clear some bits of every valid leaf in a run
+ *
+ * @details The CPU may set Accessed and Dirty behind our back, so each entry
+ *          is updated with an atomic read-modify-write rather than a plain store
+ *
+ * @return Number of valid leaves that had any of @c bits set
+ */
+static size_t sv39_ClearPTEBits(page_table_entry_t* ptes, size_t count, page_table_entry_t bits)
+{
+    size_t was_set = 0ULL;
+
+    for (size_t index = 0ULL; index < count; index++)
+    {
+        const page_table_entry_t pte = __atomic_load_n(&ptes[index], __ATOMIC_RELAXED);
+
+        if (!srv_hal_IsPTEValid(pte) || !srv_hal_IsPTELeaf(pte) || ((pte & bits) == 0ULL))
+        {
+            continue;
+        }
+
+        if ((__atomic_fetch_and(&ptes[index], ~bits, __ATOMIC_RELAXED) & bits) != 0ULL)
+        {
+            was_set++;
+        }
+    }
+
+    return was_set;
+}
+
+void srv_hal_ProtectPTERange(page_table_entry_t* ptes, size_t count, page_table_entry_t flags)
 {
-    *pte |= RV64_PTE_VALID;
+    for (size_t index = 0ULL; index < count; index++)
+    {
+        page_table_entry_t pte = __atomic_load_n(&ptes[index], __ATOMIC_RELAXED);
+        page_table_entry_t updated;
+
+        do
+        {
+            if (!srv_hal_IsPTEValid(pte) || !srv_hal_IsPTELeaf(pte))
+            {
+                break;
+            }
+
+            updated = (pte & ~SRV_PTE_PROT_MASK) | flags;
+        } while ((updated != pte) && !__atomic_compare_exchange_n(&ptes[index], &pte, updated, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
 }
 
-void srv_hal_MarkPTEReadable(page_table_entry_t* pte)
+size_t srv_hal_ClearPTEDirtyRange(page_table_entry_t* ptes, size_t count)
 {
-    *pte |= RV64_PTE_WRITE;
+    return sv39_ClearPTEBits(ptes, count, SRV_PTE_DIRTY);
 }
 
-void srv_hal_MarkPTEWritable(page_table_entry_t* pte)
+size_t srv_hal_ClearPTEAccessedRange(page_table_entry_t* ptes, size_t count)
 {
-    *pte |= RV64_PTE_WRITE;
+    return sv39_ClearPTEBits(ptes, count, SRV_PTE_ACCESSED);
 }
 
-void srv_hal_MarkPTEExecutable(page_table_entry_t* pte)
+void srv_hal_SetPageTableRoot(srv_physical_address_t root)
 {
-    *pte |= RV64_PTE_EXECUTE;
+    const uintptr_t satp = (root != 0ULL) ? (RV64_SATP_MODE_SV39 | (root >> RV64_SATP_PPN_SHIFT)) : 0ULL;
+
+    /* Anything cached under the old root (or the lack of one) is stale */
+    __asm__ volatile("csrw satp, %0\n"
+                     "sfence.vma zero, zero"
+                     :
+                     : "r"(satp)
+                     : "memory");
 }
 
-bool srv_hal_IsPTEDirty(page_table_entry_t* pte)
+void srv_hal_FlushTLB(void)
 {
-    return (*pte & RV64_PTE_DIRTY) != 0ULL;
+    /* Order the page table writes before the flush, and the flush before anything that follows */
+    __asm__ volatile("sfence.vma zero, zero"
+                     :
+                     :
+                     : "memory");
+}
+
+void srv_hal_FlushTLBRange(srv_virtual_address_t va, size_t size)
+{
+    const srv_virtual_address_t first = va & ~((1ULL << SRV_PAGING_PAGE_SHIFT) - 1ULL);
+    const size_t                pages = ((va + size - first) + (1ULL << SRV_PAGING_PAGE_SHIFT) - 1ULL) >> SRV_PAGING_PAGE_SHIFT;
+
+    if (pages > RV64_TLB_FLUSH_MAX_PAGES)
+    {
+        srv_hal_FlushTLB();
+        return;
+    }
+
+    for (size_t page = 0ULL; page < pages; page++)
+    {
+        __asm__ volatile("sfence.vma %0, zero"
+                         :
+                         : "r"(first + (page << SRV_PAGING_PAGE_SHIFT))
+                         : "memory");
+    }
 }
@@ -0,0 +1,43 @@
+/****************************************************************
+ * @file    timer.c
+ * @brief   RV64 platform timer HAL functions
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <hal.h>
+
+#include "sbicall.h"
+
+static bool rv64_timer_sstc = false; /**< stimecmp can be written directly, without going through the firmware */
+
+void srv_hal_InitTimer(bool has_compare_register)
+{
+    rv64_timer_sstc = has_compare_register;
+}
+
+uint64_t srv_hal_GetTime(void)
+{
+    uint64_t time;
+
+    __asm__ volatile("rdtime %0"
+                     : "=r"(time));
+
+    return time;
+}
+
+void srv_hal_SetTimer(uint64_t deadline)
+{
+    if (rv64_timer_sstc)
+    {
+        /* stimecmp. Written by number, since the rest of the Kernel isn't built with Sstc */
+        __asm__ volatile("csrw 0x14D, %0"
+                         :
+                         : "r"(deadline)
+                         : "memory");
+        return;
+    }
+
+    /* An ecall each time, which is why Sstc is worth finding */
+    sbicall_SetTimer(deadline);
+}
@@ -0,0 +1,68 @@
+/****************************************************************
+ * @file    trap.c
+ * @brief   RV64 trap HAL functions
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <hal.h>
+
+#include "csr.h"
+
+extern void rv64_trap_Vectors(void); /**< The vector table, in trap.s */
+
+/**
+ * @brief Called by trap.s for every exception, and any interrupt it has no path for
+ */
+void rv64_trap_HandleException(void);
+
+void srv_hal_InitTraps(void)
+{
+    /* Vectored mode is optional. If it doesn't stick, the first entry sorts interrupts out itself */
+    __asm__ volatile("csrw stvec, %0"
+                     :
+                     : "r"((uintptr_t)rv64_trap_Vectors | RV64_STVEC_MODE_VECTORED)
+                     : "memory");
+
+    /* The Kernel does no floating point, so any that creeps in traps instead of going unnoticed */
+    __asm__ volatile("csrc sstatus, %0"
+                     :
+                     : "r"(RV64_SSTATUS_FS_MASK)
+                     : "memory");
+
+    __asm__ volatile("csrs sie, %0"
+                     :
+                     : "r"(RV64_SIE_SSIE | RV64_SIE_STIE)
+                     : "memory");
+}
+
+void srv_hal_EnableExternalInterrupts(void)
+{
+    __asm__ volatile("csrs sie, %0"
+                     :
+                     : "r"(RV64_SIE_SEIE)
+                     : "memory");
+}
+
+void srv_hal_RaiseSoftwareInterrupt(void)
+{
+    __asm__ volatile("csrs sip, %0"
+                     :
+                     : "r"(RV64_SIP_SSIP)
+                     : "memory");
+}
+
+void rv64_trap_HandleException(void)
+{
+    uintptr_t cause;
+    uintptr_t pc;
+    uintptr_t value;
+
+    /* Nothing can trap between entry and here, so these still describe this exception */
+    __asm__ volatile("csrr %0, scause\n"
+                     "csrr %1, sepc\n"
+                     "csrr %2, stval"
+                     : "=r"(cause), "=r"(pc), "=r"(value));
+
+    srv_trap_HandleException(cause, pc, value);
+}
@@ -0,0 +1,244 @@
+#
+# Trap entry
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+# stvec points at a table with one jump per interrupt cause, so the timer,
+# software and external interrupts each go straight to their own handler
+# without decoding scause. The handlers are C functions, which preserve the
+# callee-saved registers themselves, so the entry path only saves the
+# caller-saved ones.
+#
+# The FP registers are only saved when sstatus.FS says the interrupted code
+# has dirtied them. Either way the handler runs with FS Off, so the hardware
+# makes sure it can't touch them. The Kernel keeps FS Off everywhere else
+# too, so today the save never happens. Vector state is never live here,
+# since vector sections mask interrupts.
+#
+# The frame is laid out with each integer register at 8 times its number,
+# and doesn't change size, so nothing has to work out where anything is.
+#
+
+.section .text
+
+.equ TRAP_FRAME_SIZE, 544    # x0-x31 slots, sepc, sstatus, f0-f31, fcsr and a pad to keep sp 16 byte aligned
+.equ TRAP_SEPC, 256
+.equ TRAP_SSTATUS, 264
+.equ TRAP_FCSR, 528
+.equ SSTATUS_FS_MASK, 0x6000 # Dirty is both bits set
+.equ SIP_SSIP, 2
+
+#
+# The vector table. stvec.BASE has to be 4 byte aligned, but some harts want
+# more, so it gets a whole cache line's worth
+#
+# Every entry is exactly one instruction. If the hart doesn't do vectored
+# mode, every trap lands on entry 0, which sorts interrupts out itself.
+#
+.balign 256
+.type rv64_trap_Vectors, @function
+.global rv64_trap_Vectors
+rv64_trap_Vectors:
+.option push
+.option norvc
+    j rv64_trap_Exception # 0 - Exceptions
+    j rv64_trap_Software  # 1 - Supervisor software interrupt
+    j rv64_trap_Exception # 2 - Reserved
+    j rv64_trap_Exception # 3 - Machine software interrupt, never delegated
+    j rv64_trap_Exception # 4 - Reserved
+    j rv64_trap_Timer     # 5 - Supervisor timer interrupt
+    j rv64_trap_Exception # 6 - Reserved
+    j rv64_trap_Exception # 7 - Machine timer interrupt, never delegated
+    j rv64_trap_Exception # 8 - Reserved
+    j rv64_trap_External  # 9 - Supervisor external interrupt
+.option pop
+
+#
+# Each path stashes a0 so it can hand rv64_trap_Interrupt the handler to call
+#
+rv64_trap_Software:
+    addi sp, sp, -TRAP_FRAME_SIZE
+    sd a0, 80(sp)
+.Lsoftware:
+    # Acknowledged before the handler runs, so one raised while it does isn't lost
+    csrci sip, SIP_SSIP
+    la a0, srv_trap_HandleSoftware
+    j rv64_trap_Interrupt
+
+rv64_trap_Timer:
+    addi sp, sp, -TRAP_FRAME_SIZE
+    sd a0, 80(sp)
+.Ltimer:
+    # The handler acknowledges it by programming the next deadline
+    la a0, srv_trap_HandleTimer
+    j rv64_trap_Interrupt
+
+rv64_trap_External:
+    addi sp, sp, -TRAP_FRAME_SIZE
+    sd a0, 80(sp)
+.Lexternal:
+    la a0, srv_trap_HandleExternal
+    j rv64_trap_Interrupt
+
+rv64_trap_Exception:
+    addi sp, sp, -TRAP_FRAME_SIZE
+    sd a0, 80(sp)
+    csrr a0, scause
+    bltz a0, .Ldirect
+
+.Lexception:
+    # Exceptions are rare, so they share the interrupt path and rv64_trap_HandleException() reads the details
+    la a0, rv64_trap_HandleException
+    j rv64_trap_Interrupt
+
+.Ldirect:
+    # An interrupt through entry 0, because stvec is in direct mode. Pick the path the vector would have
+    slli a0, a0, 1
+    srli a0, a0, 1
+    addi a0, a0, -1
+    beqz a0, .Lsoftware
+    addi a0, a0, -4
+    beqz a0, .Ltimer
+    addi a0, a0, -4
+    beqz a0, .Lexternal
+    j .Lexception
+
+#
+# Shared by every path
+#
+# a0 - Handler to call. The interrupted a0 is already in the frame
+#
+rv64_trap_Interrupt:
+    sd ra, 8(sp)
+    sd t0, 40(sp)
+    sd t1, 48(sp)
+    sd t2, 56(sp)
+    sd a1, 88(sp)
+    sd a2, 96(sp)
+    sd a3, 104(sp)
+    sd a4, 112(sp)
+    sd a5, 120(sp)
+    sd a6, 128(sp)
+    sd a7, 136(sp)
+    sd t3, 224(sp)
+    sd t4, 232(sp)
+    sd t5, 240(sp)
+    sd t6, 248(sp)
+    csrr t0, sepc
+    csrr t1, sstatus
+    sd t0, TRAP_SEPC(sp)
+    sd t1, TRAP_SSTATUS(sp)
+
+    # sstatus.SD sums up the dirty bits, so the usual case costs a single branch
+    bltz t1, .Lsave_fp
+.Lfp_saved:
+    li t0, SSTATUS_FS_MASK
+    csrc sstatus, t0
+    jalr a0
+
+    # Back in whichever thread was interrupted, since the handler may have switched away and back
+    ld t0, TRAP_SEPC(sp)
+    ld t1, TRAP_SSTATUS(sp)
+    csrw sepc, t0
+    csrw sstatus, t1
+    bltz t1, .Lrestore_fp
+.Lfp_restored:
+    ld ra, 8(sp)
+    ld t0, 40(sp)
+    ld t1, 48(sp)
+    ld t2, 56(sp)
+    ld a0, 80(sp)
+    ld a1, 88(sp)
+    ld a2, 96(sp)
+    ld a3, 104(sp)
+    ld a4, 112(sp)
+    ld a5, 120(sp)
+    ld a6, 128(sp)
+    ld a7, 136(sp)
+    ld t3, 224(sp)
+    ld t4, 232(sp)
+    ld t5, 240(sp)
+    ld t6, 248(sp)
+    addi sp, sp, TRAP_FRAME_SIZE
+    sret
+
+.Lsave_fp:
+    li t0, SSTATUS_FS_MASK
+    and t2, t1, t0
+    bne t2, t0, .Lfp_saved
+    fsd f0, 272(sp)
+    fsd f1, 280(sp)
+    fsd f2, 288(sp)
+    fsd f3, 296(sp)
+    fsd f4, 304(sp)
+    fsd f5, 312(sp)
+    fsd f6, 320(sp)
+    fsd f7, 328(sp)
+    fsd f8, 336(sp)
+    fsd f9, 344(sp)
+    fsd f10, 352(sp)
+    fsd f11, 360(sp)
+    fsd f12, 368(sp)
+    fsd f13, 376(sp)
+    fsd f14, 384(sp)
+    fsd f15, 392(sp)
+    fsd f16, 400(sp)
+    fsd f17, 408(sp)
+    fsd f18, 416(sp)
+    fsd f19, 424(sp)
+    fsd f20, 432(sp)
+    fsd f21, 440(sp)
+    fsd f22, 448(sp)
+    fsd f23, 456(sp)
+    fsd f24, 464(sp)
+    fsd f25, 472(sp)
+    fsd f26, 480(sp)
+    fsd f27, 488(sp)
+    fsd f28, 496(sp)
+    fsd f29, 504(sp)
+    fsd f30, 512(sp)
+    fsd f31, 520(sp)
+    frcsr t2
+    sd t2, TRAP_FCSR(sp)
+    j .Lfp_saved
+
+.Lrestore_fp:
+    # sstatus is back as it was, so FS is Dirty again and these are allowed
+    li t0, SSTATUS_FS_MASK
+    and t2, t1, t0
+    bne t2, t0, .Lfp_restored
+    fld f0, 272(sp)
+    fld f1, 280(sp)
+    fld f2, 288(sp)
+    fld f3, 296(sp)
+    fld f4, 304(sp)
+    fld f5, 312(sp)
+    fld f6, 320(sp)
+    fld f7, 328(sp)
+    fld f8, 336(sp)
+    fld f9, 344(sp)
+    fld f10, 352(sp)
+    fld f11, 360(sp)
+    fld f12, 368(sp)
+    fld f13, 376(sp)
+    fld f14, 384(sp)
+    fld f15, 392(sp)
+    fld f16, 400(sp)
+    fld f17, 408(sp)
+    fld f18, 416(sp)
+    fld f19, 424(sp)
+    fld f20, 432(sp)
+    fld f21, 440(sp)
+    fld f22, 448(sp)
+    fld f23, 456(sp)
+    fld f24, 464(sp)
+    fld f25, 472(sp)
+    fld f26, 480(sp)
+    fld f27, 488(sp)
+    fld f28, 496(sp)
+    fld f29, 504(sp)
+    fld f30, 512(sp)
+    fld f31, 520(sp)
+    ld t2, TRAP_FCSR(sp)
+    fscsr t2
+    j .Lfp_restored
@@ -12,6 +12,7 @@ typedef enum
 {
     SRV_ARCH_INIT_SUCCESS,             /**< The Arch init routine ran successfully */
     SRC_ARCH_INIT_DEVICE_TREE_INVALID, /**< The arch init routine failed due to a Device Tree parsing error */
+    SRV_ARCH_INIT_PAGING_FAILED,       /**< The arch init routine couldn't build the Kernel address space */
 } srv_arch_init_result_t;
 
 typedef struct
@@ -19,6 +20,7 @@ typedef struct
     srv_physical_address_t kernel_physical_address; /**< Physical Load address of the Kernel */
     size_t                 kernel_load_offset;      /**< Offset of the Kernel from the start of physical memory */
     void*                  fdt_ptr;                 /**< Pointer to the Flattened Device Tree structure. May be NULL on some platforms */
+    uintptr_t              boot_cpu_hardware_id;    /**< Hardware ID of the CPU that booted the Kernel */
 } srv_boot_info_t;
 
 /**
@@ -8,9 +8,263 @@
 #include <arch/arch.h>
 
 #include <drivers/fdt/fdt.h>
+#include <drivers/irq/plic.h>
+#include <drivers/uart/ns16550.h>
+#include <mm/kalloc.h>
+#include <mm/phys/kpalloc.h>
+#include <mm/vm.h>
+#include <sched/sched.h>
+#include <smp/smp.h>
+#include <stdio.h>
+#include <time/timer.h>
+
+_Static_assert(SRV_KPALLOC_MAX_REGIONS >= SRV_FDT_MAX_MEMORY_RANGES, "the page allocator has to take every bank the memory map can hold");
+
+/**
+ * @brief Drop the RAM the direct map can't reach
+ *
+ * @details Every page the page allocator hands out has to be reachable
+ *          through the direct map, so the allocator and the Kernel address
+ *          space both get the clipped map
+ *
+ * @param[in,out] map The memory map
+ */
+static void arch_ClipMemoryMap(srv_fdt_memory_map_t* map)
+{
+    size_t kept = 0U;
+
+    for (size_t bank = 0U; bank < map->usable_count; bank++)
+    {
+        srv_physical_range_t range = map->usable[bank];
+
+        if (range.base >= SRV_PAGING_DIRECT_MAP_SIZE)
+        {
+            kprintf("mm: RAM at 0x%lx is past the direct map, leaving it out\n", range.base);
+            continue;
+        }
+
+        if (range.size > (SRV_PAGING_DIRECT_MAP_SIZE - range.base))
+        {
+            kprintf("mm: RAM from 0x%lx is past the direct map, leaving it out\n", (uint64_t)SRV_PAGING_DIRECT_MAP_SIZE);
+            range.size = SRV_PAGING_DIRECT_MAP_SIZE - range.base;
+        }
+
+        map->usable[kept] = range;
+        kept++;
+    }
+
+    map->usable_count = kept;
+}
+
+/**
+ * @brief Reserve whatever sits below the Kernel in the bank it was loaded into
+ *
+ * @details SBI firmware loads the Kernel just above itself. Newer firmware
+ *          describes its own memory in @c /reserved-memory, but older
+ *          firmware doesn't, so this is reserved no matter what.
+ *
+ * @param[in]     boot_info Boot Information structure
+ * @param[in,out] map       The memory map to add the reservation to
+ *
+ * @return @c false if there was no room left in the map
+ */
+static bool arch_ReserveFirmware(const srv_boot_info_t* boot_info, srv_fdt_memory_map_t* map)
+{
+    const srv_physical_address_t kernel_base = boot_info->kernel_physical_address;
+
+    for (size_t bank = 0U; bank < map->usable_count; bank++)
+    {
+        const srv_physical_range_t* range = &map->usable[bank];
+
+        if ((kernel_base > range->base) && (kernel_base < (range->base + range->size)))
+        {
+            if (map->reserved_count == SRV_FDT_MAX_MEMORY_RANGES)
+            {
+                return false;
+            }
+
+            /* Ranges don't need to stay sorted for the page allocator */
+            map->reserved[map->reserved_count] = (srv_physical_range_t){.base = range->base, .size = kernel_base - range->base};
+            map->reserved_count++;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Identity map the pages of a device window that aren't mapped yet
+ *
+ * @details Small devices can share a page with the one before, so any page
+ *          may already be mapped. Each run of unmapped pages is mapped in
+ *          one go, so it can still get large pages.
+ *
+ * @param[in] space The address space
+ * @param[in] start Page aligned start of the window
+ * @param[in] end   Page aligned end of the window
+ *
+ * @return @c false if there wasn't enough memory for the page tables
+ */
+static bool arch_MapDeviceWindow(srv_vm_space_t* space, srv_physical_address_t start, srv_physical_address_t end)
+{
+    srv_physical_address_t run = start;
+
+    for (srv_physical_address_t page = start; page < end; page += SRV_PAGE_SIZE)
+    {
+        srv_physical_address_t pa = 0U;
+
+        if (!srv_vm_Translate(space, page, &pa, NULL))
+        {
+            continue;
+        }
+
+        if ((page != run) && !srv_vm_Map(space, run, run, page - run, SRV_VM_READ | SRV_VM_WRITE | SRV_VM_GLOBAL))
+        {
+            return false;
+        }
+
+        run = page + SRV_PAGE_SIZE;
+    }
+
+    return (run == end) || srv_vm_Map(space, run, run, end - run, SRV_VM_READ | SRV_VM_WRITE | SRV_VM_GLOBAL);
+}
+
+/**
+ * @brief Map the registers of every on-chip device where they are
+ *
+ * @details Drivers find their registers in the DTB and use the physical
+ *          address, so they keep working once translation is on. Only the
+ *          devices under @c /soc are mapped, which is everything on the
+ *          platforms we boot on.
+ *
+ * @param[in] fdt Pointer to the DTB
+ *
+ * @return @c false if there wasn't enough memory for the page tables
+ */
+static bool arch_MapDevices(const void* fdt)
+{
+    srv_vm_space_t* space         = srv_vm_GetKernelSpace();
+    const int32_t   soc           = srv_fdt_PathOffset(fdt, "/soc");
+    uint32_t        address_cells = 0U;
+    uint32_t        size_cells    = 0U;
+
+    if (soc < 0)
+    {
+        return true;
+    }
+
+    srv_fdt_GetCells(fdt, soc, &address_cells, &size_cells);
+
+    const size_t stride = (size_t)(address_cells + size_cells) * sizeof(uint32_t);
+    if ((stride == 0U) || (address_cells > 2U) || (size_cells > 2U))
+    {
+        return true;
+    }
+
+    for (int32_t device = srv_fdt_FirstSubnode(fdt, soc); device >= 0; device = srv_fdt_NextSubnode(fdt, device))
+    {
+        uint32_t       length = 0U;
+        const uint8_t* reg    = (const uint8_t*)srv_fdt_GetProp(fdt, device, "reg", &length);
+
+        for (size_t entry = 0U; (reg != NULL) && ((entry + stride) <= length); entry += stride)
+        {
+            const srv_physical_address_t base = (srv_physical_address_t)srv_fdt_ReadCells(&reg[entry], address_cells);
+            const size_t                 size = (size_t)srv_fdt_ReadCells(&reg[entry + (address_cells * sizeof(uint32_t))], size_cells);
+
+            const srv_physical_address_t start = base & ~(SRV_PAGE_SIZE - 1ULL);
+            const srv_physical_address_t end   = (base + size + SRV_PAGE_SIZE - 1ULL) & ~(SRV_PAGE_SIZE - 1ULL);
+
+            if ((size != 0U) && !arch_MapDeviceWindow(space, start, end))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief PLIC handler for the UART
+ *
+ * @param[in] argument Unused
+ */
+static void arch_UARTInterrupt(void* argument)
+{
+    (void)argument;
+    srv_ns16550_HandleInterrupt();
+}
 
 srv_arch_init_result_t srv_arch_Init(srv_boot_info_t* boot_info)
 {
-    (void)boot_info;
+    const void* fdt = boot_info->fdt_ptr;
+
+    srv_smp_InitBootCPU((uint32_t)boot_info->boot_cpu_hardware_id);
+
+    /* Straight away, so anything that goes wrong from here on panics instead of jumping to nowhere */
+    srv_hal_InitTraps();
+
+    if (!srv_fdt_CheckHeader(fdt))
+    {
+        return SRC_ARCH_INIT_DEVICE_TREE_INVALID;
+    }
+
+    /* Runs before any allocator exists, so the map comes straight out of the blob (which it reserves) */
+    static srv_fdt_memory_map_t memory_map;
+    if (!srv_fdt_GetMemoryMap(fdt, &memory_map) || !arch_ReserveFirmware(boot_info, &memory_map))
+    {
+        return SRC_ARCH_INIT_DEVICE_TREE_INVALID;
+    }
+
+    arch_ClipMemoryMap(&memory_map);
+
+    srv_kpalloc_InitPageAllocator(memory_map.usable, memory_map.usable_count, memory_map.reserved, memory_map.reserved_count);
+    srv_kmalloc_Init();
+
+    if (!srv_fdt_Init(boot_info->fdt_ptr))
+    {
+        return SRC_ARCH_INIT_DEVICE_TREE_INVALID;
+    }
+
+    srv_timer_Init(fdt);
+    srv_sched_Init();
+
+    if (!srv_vm_InitKernelSpace(memory_map.usable, memory_map.usable_count) || !arch_MapDevices(fdt))
+    {
+        return SRV_ARCH_INIT_PAGING_FAILED;
+    }
+
+    /* The blob is normally in RAM, but doesn't have to be */
+    srv_physical_address_t fdt_pa = 0U;
+    if (!srv_vm_Translate(srv_vm_GetKernelSpace(), (srv_virtual_address_t)fdt & ~(SRV_PAGE_SIZE - 1ULL), &fdt_pa, NULL))
+    {
+        const srv_physical_address_t start = (srv_physical_address_t)fdt & ~(SRV_PAGE_SIZE - 1ULL);
+        const srv_physical_address_t end   = ((srv_physical_address_t)fdt + srv_fdt_GetTotalSize(fdt) + SRV_PAGE_SIZE - 1ULL) & ~(SRV_PAGE_SIZE - 1ULL);
+
+        if (!srv_vm_Map(srv_vm_GetKernelSpace(), start, start, end - start, SRV_VM_READ | SRV_VM_GLOBAL))
+        {
+            return SRV_ARCH_INIT_PAGING_FAILED;
+        }
+    }
+
+    srv_vm_Activate(srv_vm_GetKernelSpace());
+
+    /* Not every platform has one. Without it, output stays on the firmware console */
+    const bool uart = srv_ns16550_Init();
+
+    /* From here on the UART is fed from its interrupt, which starts arriving once kmain unmasks interrupts */
+    if (srv_plic_Init())
+    {
+        srv_plic_InitCPU();
+
+        if (uart && (srv_ns16550_GetInterrupt() != 0U) && srv_plic_Register(srv_ns16550_GetInterrupt(), arch_UARTInterrupt, NULL))
+        {
+            srv_ns16550_EnableInterrupts();
+        }
+    }
+
+    /* Everything the other CPUs need is in place, so bring them in */
+    (void)srv_smp_StartCPUs(fdt);
+
     return SRV_ARCH_INIT_SUCCESS;
 }
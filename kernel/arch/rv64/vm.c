@@ -0,0 +1,682 @@
+/****************************************************************
+ * @file    vm.c
+ * @brief   Sv39 implementation of @ref vm.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <mm/vm.h>
+
+#include <mm/phys/kpalloc.h>
+#include <smp/smp.h>
+#include <stdio.h>
+#include <string.h>
+
+#define VM_INDEX_BITS 9ULL  /**< Virtual address bits used to index each level */
+#define VM_VA_BITS    39ULL /**< Number of significant virtual address bits */
+
+extern uint8_t __KERNEL_PHYSICAL_START[]; /**< Start of the Kernel image, from the linker script */
+extern uint8_t __kernel_text_end[];       /**< End of the Kernel's code, from the linker script */
+extern uint8_t __kernel_rodata_end[];     /**< End of the Kernel's read-only data, from the linker script */
+
+/**
+ * @brief A contiguous run of identically mapped pages, collected by @ref srv_vm_Dump
+ */
+typedef struct
+{
+    srv_virtual_address_t  va;    /**< Start of the run */
+    srv_physical_address_t pa;    /**< Physical address the run starts at */
+    size_t                 size;  /**< Size of the run, in bytes, or 0 if there isn't one yet */
+    page_table_entry_t     flags; /**< Permission bits shared by every page in the run */
+    uint32_t               level; /**< Level of the pages in the run */
+    size_t                 pages; /**< Number of pages in the run */
+} vm_dump_run_t;
+
+/**
+ * @brief Totals collected by @ref srv_vm_Dump
+ */
+typedef struct
+{
+    vm_dump_run_t run;                       /**< The run being collected */
+    size_t        leaves[SRV_PAGING_LEVELS]; /**< Number of pages of each size */
+    size_t        tables;                    /**< Number of page table pages */
+} vm_dump_t;
+
+static srv_vm_space_t  vm_kernel_space = {.lock = SRV_SPINLOCK_INIT("vm-kernel")};
+static srv_vm_space_t* vm_active_space = NULL; /**< Address space the executing CPU is using */
+
+/**
+ * @brief Get the size of the memory a single entry at a level maps
+ */
+static inline size_t vm_LevelSize(uint32_t level)
+{
+    return 1ULL << (SRV_PAGING_PAGE_SHIFT + (VM_INDEX_BITS * level));
+}
+
+/**
+ * @brief Get the index of the entry that maps a virtual address at a level
+ */
+static inline size_t vm_LevelIndex(srv_virtual_address_t va, uint32_t level)
+{
+    return (va >> (SRV_PAGING_PAGE_SHIFT + (VM_INDEX_BITS * level))) & (SRV_PAGING_PTE_PER_TABLE - 1ULL);
+}
+
+static inline page_table_entry_t* vm_EntryTable(page_table_entry_t pte)
+{
+    return (page_table_entry_t*)srv_hal_GetPTEAddress(pte);
+}
+
+/**
+ * @brief Is a virtual address one that Sv39 can translate?
+ *
+ * @details Bits 63 to 39 must all be copies of bit 38
+ */
+static inline bool vm_IsCanonical(srv_virtual_address_t va)
+{
+    const int64_t signed_va = (int64_t)va;
+
+    return (signed_va >> (VM_VA_BITS - 1ULL)) == 0LL || (signed_va >> (VM_VA_BITS - 1ULL)) == -1LL;
+}
+
+/**
+ * @brief Turn @c SRV_VM_ flags into leaf entry bits
+ *
+ * @details Accessed and Dirty are set up front, since the Kernel has no use
+ *          for them and some CPUs fault rather than set them in hardware
+ *
+ * @return The bits, or 0 if the flags don't allow any access
+ */
+static page_table_entry_t vm_ProtToFlags(uint32_t prot)
+{
+    page_table_entry_t flags = SRV_PTE_ACCESSED | SRV_PTE_DIRTY;
+
+    /* Write-only is a reserved encoding */
+    if ((prot & (SRV_VM_READ | SRV_VM_WRITE)) != 0U)
+    {
+        flags |= SRV_PTE_READ;
+    }
+
+    flags |= ((prot & SRV_VM_WRITE) != 0U) ? SRV_PTE_WRITE : 0ULL;
+    flags |= ((prot & SRV_VM_EXECUTE) != 0U) ? SRV_PTE_EXECUTE : 0ULL;
+    flags |= ((prot & SRV_VM_USER) != 0U) ? SRV_PTE_USER : 0ULL;
+    flags |= ((prot & SRV_VM_GLOBAL) != 0U) ? SRV_PTE_GLOBAL : 0ULL;
+
+    return ((flags & SRV_PTE_LEAF_MASK) != 0ULL) ? flags : 0ULL;
+}
+
+static uint32_t vm_FlagsToProt(page_table_entry_t flags)
+{
+    uint32_t prot = 0U;
+
+    prot |= ((flags & SRV_PTE_READ) != 0ULL) ? SRV_VM_READ : 0U;
+    prot |= ((flags & SRV_PTE_WRITE) != 0ULL) ? SRV_VM_WRITE : 0U;
+    prot |= ((flags & SRV_PTE_EXECUTE) != 0ULL) ? SRV_VM_EXECUTE : 0U;
+    prot |= ((flags & SRV_PTE_USER) != 0ULL) ? SRV_VM_USER : 0U;
+    prot |= ((flags & SRV_PTE_GLOBAL) != 0ULL) ? SRV_VM_GLOBAL : 0U;
+
+    return prot;
+}
+
+/**
+ * @brief Make sure a range is page aligned and doesn't wrap or cross the hole in the middle of the address space
+ */
+static bool vm_IsValidRange(srv_virtual_address_t va, size_t size)
+{
+    if ((size == 0ULL) || (((va | size) & (SRV_PAGE_SIZE - 1ULL)) != 0ULL) || ((va + size) <= va))
+    {
+        return false;
+    }
+
+    return vm_IsCanonical(va) && vm_IsCanonical(va + size - 1ULL) && ((int64_t)va < 0) == ((int64_t)(va + size - 1ULL) < 0);
+}
+
+/**
+ * @brief Get the end of the chunk an entry at a level covers, clipped to the end of a range
+ *
+ * @param[in] va    An address within the chunk
+ * @param[in] end   End of the range
+ * @param[in] level The level
+ *
+ * @return The end of the chunk, or @c end if that comes first
+ */
+static inline srv_virtual_address_t vm_ChunkEnd(srv_virtual_address_t va, srv_virtual_address_t end, uint32_t level)
+{
+    const srv_virtual_address_t next = (va | (vm_LevelSize(level) - 1ULL)) + 1ULL;
+
+    /* The last chunk of the address space wraps around to 0 */
+    return ((next == 0ULL) || (next > end)) ? end : next;
+}
+
+/**
+ * @brief Allocate an empty page table
+ *
+ * @return The table, or @c NULL if there is no memory left
+ */
+static page_table_entry_t* vm_NewTable(void)
+{
+    page_table_entry_t* table = (page_table_entry_t*)srv_kpalloc_AllocPage();
+
+    if (table != NULL)
+    {
+        (void)memset(table, 0, SRV_PAGE_SIZE);
+    }
+
+    return table;
+}
+
+static bool vm_IsTableEmpty(const page_table_entry_t* table)
+{
+    for (size_t index = 0ULL; index < SRV_PAGING_PTE_PER_TABLE; index++)
+    {
+        if (srv_hal_IsPTEValid(table[index]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Replace a large page with a table of pages one level down, with the same permissions
+ *
+ * @param[in,out] entry The large page's entry
+ * @param[in]     level Level of @c entry
+ *
+ * @return @c false if there was no memory for the table
+ */
+static bool vm_Split(page_table_entry_t* entry, uint32_t level)
+{
+    page_table_entry_t* table = vm_NewTable();
+    if (table == NULL)
+    {
+        return false;
+    }
+
+    const srv_physical_address_t pa    = srv_hal_GetPTEAddress(*entry);
+    const page_table_entry_t     flags = *entry & SRV_PTE_FLAGS_MASK;
+
+    for (size_t index = 0ULL; index < SRV_PAGING_PTE_PER_TABLE; index++)
+    {
+        table[index] = srv_hal_MakePTE(pa + (index * vm_LevelSize(level - 1U)), flags);
+    }
+
+    *entry = srv_hal_MakePTE((srv_physical_address_t)table, 0ULL);
+
+    return true;
+}
+
+/**
+ * @brief Map part of a range into a table
+ *
+ * @param[in]  table      The table
+ * @param[in]  level      Level of the table
+ * @param[in]  va         Start of the part of the range that falls in this table
+ * @param[in]  end        End of the part of the range that falls in this table
+ * @param[in]  pa         Physical address to map at @c va
+ * @param[in]  flags      Leaf entry bits
+ * @param[out] mapped_end End of what has been mapped so far, so a failure can be undone
+ *
+ * @return @c false if something was already mapped, or there was no memory for a table
+ */
+static bool vm_MapLevel(page_table_entry_t* table, uint32_t level, srv_virtual_address_t va, srv_virtual_address_t end, srv_physical_address_t pa, page_table_entry_t flags, srv_virtual_address_t* mapped_end)
+{
+    const size_t size = vm_LevelSize(level);
+
+    while (va < end)
+    {
+        const srv_virtual_address_t next  = vm_ChunkEnd(va, end, level);
+        page_table_entry_t*         entry = &table[vm_LevelIndex(va, level)];
+
+        /* Use a page this size if the range covers it completely and the physical address lines up */
+        if (((next - va) == size) && ((pa & (size - 1ULL)) == 0ULL))
+        {
+            if (srv_hal_IsPTEValid(*entry))
+            {
+                return false;
+            }
+
+            *entry      = srv_hal_MakePTE(pa, flags);
+            *mapped_end = next;
+        }
+        else
+        {
+            if (!srv_hal_IsPTEValid(*entry))
+            {
+                page_table_entry_t* child = vm_NewTable();
+                if (child == NULL)
+                {
+                    return false;
+                }
+
+                *entry = srv_hal_MakePTE((srv_physical_address_t)child, 0ULL);
+            }
+            else if (srv_hal_IsPTELeaf(*entry))
+            {
+                return false;
+            }
+
+            page_table_entry_t* child = vm_EntryTable(*entry);
+            if (!vm_MapLevel(child, level - 1U, va, next, pa, flags, mapped_end))
+            {
+                /* Don't leave a table behind that nothing was mapped into */
+                if (vm_IsTableEmpty(child))
+                {
+                    *entry = 0ULL;
+                    srv_kpalloc_FreePage(child);
+                }
+
+                return false;
+            }
+        }
+
+        pa += next - va;
+        va  = next;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Unmap part of a range from a table, freeing any tables it empties
+ *
+ * @param[in]  table        The table
+ * @param[in]  level        Level of the table
+ * @param[in]  va           Start of the part of the range that falls in this table
+ * @param[in]  end          End of the part of the range that falls in this table
+ * @param[out] tables_freed Set if a table was freed, which a ranged TLB flush doesn't cover
+ *
+ * @return @c false if a large page couldn't be split
+ */
+static bool vm_UnmapLevel(page_table_entry_t* table, uint32_t level, srv_virtual_address_t va, srv_virtual_address_t end, bool* tables_freed)
+{
+    const size_t size = vm_LevelSize(level);
+
+    while (va < end)
+    {
+        const srv_virtual_address_t next  = vm_ChunkEnd(va, end, level);
+        page_table_entry_t*         entry = &table[vm_LevelIndex(va, level)];
+
+        if (srv_hal_IsPTEValid(*entry))
+        {
+            if (srv_hal_IsPTELeaf(*entry) && ((next - va) == size))
+            {
+                *entry = 0ULL;
+            }
+            else
+            {
+                if (srv_hal_IsPTELeaf(*entry) && !vm_Split(entry, level))
+                {
+                    return false;
+                }
+
+                page_table_entry_t* child = vm_EntryTable(*entry);
+                if (!vm_UnmapLevel(child, level - 1U, va, next, tables_freed))
+                {
+                    return false;
+                }
+
+                if (vm_IsTableEmpty(child))
+                {
+                    *entry        = 0ULL;
+                    *tables_freed = true;
+                    srv_kpalloc_FreePage(child);
+                }
+            }
+        }
+
+        va = next;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Change the permissions of part of a range in a table
+ *
+ * @param[in] table The table
+ * @param[in] level Level of the table
+ * @param[in] va    Start of the part of the range that falls in this table
+ * @param[in] end   End of the part of the range that falls in this table
+ * @param[in] flags New leaf entry bits
+ *
+ * @return @c false if part of the range isn't mapped, or a large page couldn't be split
+ */
+static bool vm_ProtectLevel(page_table_entry_t* table, uint32_t level, srv_virtual_address_t va, srv_virtual_address_t end, page_table_entry_t flags)
+{
+    const size_t size = vm_LevelSize(level);
+
+    while (va < end)
+    {
+        const srv_virtual_address_t next  = vm_ChunkEnd(va, end, level);
+        page_table_entry_t*         entry = &table[vm_LevelIndex(va, level)];
+
+        if (!srv_hal_IsPTEValid(*entry))
+        {
+            return false;
+        }
+
+        if (srv_hal_IsPTELeaf(*entry))
+        {
+            const bool same = ((*entry & SRV_PTE_FLAGS_MASK) == (flags | SRV_PTE_VALID));
+
+            if (((next - va) == size) || same)
+            {
+                /* Gather the whole leaves that follow, so the run is updated in one go */
+                size_t                count   = 1ULL;
+                srv_virtual_address_t run_end = next;
+
+                while ((run_end < end) && (count < (SRV_PAGING_PTE_PER_TABLE - vm_LevelIndex(va, level))))
+                {
+                    const srv_virtual_address_t after = vm_ChunkEnd(run_end, end, level);
+
+                    if (((after - run_end) != size) || !srv_hal_IsPTEValid(entry[count]) || !srv_hal_IsPTELeaf(entry[count]))
+                    {
+                        break;
+                    }
+
+                    count++;
+                    run_end = after;
+                }
+
+                srv_hal_ProtectPTERange(entry, count, flags);
+                va = run_end;
+                continue;
+            }
+
+            if (!vm_Split(entry, level))
+            {
+                return false;
+            }
+        }
+
+        if (!vm_ProtectLevel(vm_EntryTable(*entry), level - 1U, va, next, flags))
+        {
+            return false;
+        }
+
+        va = next;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Make changes to a range of an address space visible to every CPU
+ *
+ * @param[in] space        The address space
+ * @param[in] va           Start of the range that changed
+ * @param[in] size         Size of the range that changed
+ * @param[in] tables_freed Whether any page tables were freed, in which case everything is flushed
+ */
+static inline void vm_Flush(const srv_vm_space_t* space, srv_virtual_address_t va, size_t size, bool tables_freed)
+{
+    if (space != vm_active_space)
+    {
+        return;
+    }
+
+    /* Every CPU runs in the active space, so they all flush. A ranged flush doesn't reach freed tables */
+    srv_smp_FlushTLBRange(SRV_SMP_ALL_CPUS, va, tables_freed ? SIZE_MAX : size);
+}
+
+srv_vm_space_t* srv_vm_GetKernelSpace(void)
+{
+    return &vm_kernel_space;
+}
+
+bool srv_vm_Map(srv_vm_space_t* space, srv_virtual_address_t va, srv_physical_address_t pa, size_t size, uint32_t prot)
+{
+    const page_table_entry_t flags = vm_ProtToFlags(prot);
+
+    if ((flags == 0ULL) || !vm_IsValidRange(va, size) || ((pa & (SRV_PAGE_SIZE - 1ULL)) != 0ULL))
+    {
+        return false;
+    }
+
+    srv_virtual_address_t mapped_end = va;
+    const srv_irq_state_t irq_state  = srv_spinlock_LockIRQSave(&space->lock);
+    const bool            mapped     = vm_MapLevel(space->root, SRV_PAGING_LEVELS - 1U, va, va + size, pa, flags, &mapped_end);
+
+    /* Take back whatever did get mapped, which frees the tables made for it */
+    if (!mapped && (mapped_end > va))
+    {
+        (void)vm_UnmapLevel(space->root, SRV_PAGING_LEVELS - 1U, va, mapped_end, &(bool){false});
+    }
+
+    srv_spinlock_UnlockIRQRestore(&space->lock, irq_state);
+
+    /* Some CPUs cache invalid entries too, so even a brand new mapping needs a flush */
+    vm_Flush(space, va, size, !mapped);
+
+    return mapped;
+}
+
+bool srv_vm_Unmap(srv_vm_space_t* space, srv_virtual_address_t va, size_t size)
+{
+    if (!vm_IsValidRange(va, size))
+    {
+        return false;
+    }
+
+    bool                  tables_freed = false;
+    const srv_irq_state_t irq_state    = srv_spinlock_LockIRQSave(&space->lock);
+    const bool            unmapped     = vm_UnmapLevel(space->root, SRV_PAGING_LEVELS - 1U, va, va + size, &tables_freed);
+
+    srv_spinlock_UnlockIRQRestore(&space->lock, irq_state);
+    vm_Flush(space, va, size, tables_freed);
+
+    return unmapped;
+}
+
+bool srv_vm_Protect(srv_vm_space_t* space, srv_virtual_address_t va, size_t size, uint32_t prot)
+{
+    const page_table_entry_t flags = vm_ProtToFlags(prot);
+
+    if ((flags == 0ULL) || !vm_IsValidRange(va, size))
+    {
+        return false;
+    }
+
+    const srv_irq_state_t irq_state = srv_spinlock_LockIRQSave(&space->lock);
+    const bool            protected = vm_ProtectLevel(space->root, SRV_PAGING_LEVELS - 1U, va, va + size, flags);
+
+    srv_spinlock_UnlockIRQRestore(&space->lock, irq_state);
+    vm_Flush(space, va, size, false);
+
+    return protected;
+}
+
+/**
+ * @brief Look up a virtual address, with the address space's lock held
+ */
+static bool vm_Translate(const srv_vm_space_t* space, srv_virtual_address_t va, srv_physical_address_t* pa, uint32_t* prot)
+{
+    const page_table_entry_t* table = space->root;
+
+    if (!vm_IsCanonical(va))
+    {
+        return false;
+    }
+
+    for (uint32_t level = SRV_PAGING_LEVELS; level-- > 0U;)
+    {
+        const page_table_entry_t entry = table[vm_LevelIndex(va, level)];
+
+        if (!srv_hal_IsPTEValid(entry))
+        {
+            return false;
+        }
+
+        if (srv_hal_IsPTELeaf(entry))
+        {
+            *pa = srv_hal_GetPTEAddress(entry) + (va & (vm_LevelSize(level) - 1ULL));
+
+            if (prot != NULL)
+            {
+                *prot = vm_FlagsToProt(entry);
+            }
+
+            return true;
+        }
+
+        table = vm_EntryTable(entry);
+    }
+
+    /* A non-leaf entry in the last level is malformed */
+    return false;
+}
+
+bool srv_vm_Translate(srv_vm_space_t* space, srv_virtual_address_t va, srv_physical_address_t* pa, uint32_t* prot)
+{
+    /* An Unmap on another CPU could free a table out from under the walk */
+    const srv_irq_state_t irq_state  = srv_spinlock_LockIRQSave(&space->lock);
+    const bool            translated = vm_Translate(space, va, pa, prot);
+
+    srv_spinlock_UnlockIRQRestore(&space->lock, irq_state);
+
+    return translated;
+}
+
+void srv_vm_Activate(srv_vm_space_t* space)
+{
+    vm_active_space = space;
+
+    srv_hal_SetPageTableRoot((srv_physical_address_t)space->root);
+}
+
+bool srv_vm_InitKernelSpace(const srv_physical_range_t* ram, size_t ram_count)
+{
+    vm_kernel_space.root = vm_NewTable();
+    if (vm_kernel_space.root == NULL)
+    {
+        return false;
+    }
+
+    for (size_t bank = 0ULL; bank < ram_count; bank++)
+    {
+        /* Only whole pages can be mapped */
+        const srv_physical_address_t start = (ram[bank].base + SRV_PAGE_SIZE - 1ULL) & ~(SRV_PAGE_SIZE - 1ULL);
+        srv_physical_address_t       end   = (ram[bank].base + ram[bank].size) & ~(SRV_PAGE_SIZE - 1ULL);
+
+        /* Whatever is past the direct map can't be reached, so only the part below it is mapped */
+        if (end > SRV_PAGING_DIRECT_MAP_SIZE)
+        {
+            end = SRV_PAGING_DIRECT_MAP_SIZE;
+        }
+
+        if (end <= start)
+        {
+            continue;
+        }
+
+        if (!srv_vm_Map(&vm_kernel_space, start, start, end - start, SRV_VM_READ | SRV_VM_WRITE | SRV_VM_GLOBAL) ||
+            !srv_vm_Map(&vm_kernel_space, (srv_virtual_address_t)srv_vm_PhysicalToDirect(start), start, end - start, SRV_VM_READ | SRV_VM_WRITE | SRV_VM_GLOBAL))
+        {
+            return false;
+        }
+    }
+
+    /* Splits the large pages the Kernel image sits in, but only those */
+    const srv_virtual_address_t text_start = (srv_virtual_address_t)__KERNEL_PHYSICAL_START;
+    const srv_virtual_address_t text_end   = (srv_virtual_address_t)__kernel_text_end;
+    const srv_virtual_address_t rodata_end = (srv_virtual_address_t)__kernel_rodata_end;
+
+    return srv_vm_Protect(&vm_kernel_space, text_start, text_end - text_start, SRV_VM_READ | SRV_VM_EXECUTE | SRV_VM_GLOBAL) &&
+           srv_vm_Protect(&vm_kernel_space, text_end, rodata_end - text_end, SRV_VM_READ | SRV_VM_GLOBAL);
+}
+
+/**
+ * @brief Print a run of pages, if there is one
+ */
+static void vm_dump_Flush(vm_dump_run_t* run)
+{
+    static const char* const page_sizes[SRV_PAGING_LEVELS] = {"4K", "2M", "1G"};
+
+    if (run->size == 0ULL)
+    {
+        return;
+    }
+
+    kprintf("  %lx-%lx -> %lx %c%c%c%c%c %s x %d\n",
+            (uint64_t)run->va,
+            (uint64_t)(run->va + run->size),
+            (uint64_t)run->pa,
+            ((run->flags & SRV_PTE_READ) != 0ULL) ? 'R' : '-',
+            ((run->flags & SRV_PTE_WRITE) != 0ULL) ? 'W' : '-',
+            ((run->flags & SRV_PTE_EXECUTE) != 0ULL) ? 'X' : '-',
+            ((run->flags & SRV_PTE_USER) != 0ULL) ? 'U' : '-',
+            ((run->flags & SRV_PTE_GLOBAL) != 0ULL) ? 'G' : '-',
+            page_sizes[run->level],
+            (int)run->pages);
+
+    run->size = 0ULL;
+}
+
+/**
+ * @brief Add a leaf to the dump, extending the current run if it carries straight on from it
+ */
+static void vm_dump_Leaf(vm_dump_t* dump, srv_virtual_address_t va, page_table_entry_t entry, uint32_t level)
+{
+    vm_dump_run_t*               run   = &dump->run;
+    const srv_physical_address_t pa    = srv_hal_GetPTEAddress(entry);
+    const page_table_entry_t     flags = entry & SRV_PTE_FLAGS_MASK;
+
+    dump->leaves[level]++;
+
+    if ((run->size != 0ULL) && ((run->va + run->size) == va) && ((run->pa + run->size) == pa) && (run->flags == flags) && (run->level == level))
+    {
+        run->size += vm_LevelSize(level);
+        run->pages++;
+        return;
+    }
+
+    vm_dump_Flush(run);
+
+    *run = (vm_dump_run_t){.va = va, .pa = pa, .size = vm_LevelSize(level), .flags = flags, .level = level, .pages = 1ULL};
+}
+
+static void vm_dump_Table(vm_dump_t* dump, const page_table_entry_t* table, uint32_t level, srv_virtual_address_t base)
+{
+    dump->tables++;
+
+    for (size_t index = 0ULL; index < SRV_PAGING_PTE_PER_TABLE; index++)
+    {
+        const page_table_entry_t entry = table[index];
+        srv_virtual_address_t    va    = base + (index * vm_LevelSize(level));
+
+        /* Sign extend the top level index into a canonical address */
+        if ((level == (SRV_PAGING_LEVELS - 1U)) && ((va >> (VM_VA_BITS - 1ULL)) != 0ULL))
+        {
+            va |= ~((1ULL << VM_VA_BITS) - 1ULL);
+        }
+
+        if (!srv_hal_IsPTEValid(entry))
+        {
+            continue;
+        }
+
+        if (srv_hal_IsPTELeaf(entry))
+        {
+            vm_dump_Leaf(dump, va, entry, level);
+        }
+        else if (level > 0U)
+        {
+            vm_dump_Table(dump, vm_EntryTable(entry), level - 1U, va);
+        }
+    }
+}
+
+void srv_vm_Dump(srv_vm_space_t* space)
+{
+    vm_dump_t dump = {0};
+
+    kprintf("Address space, root table at %lx\n", (uint64_t)(uintptr_t)space->root);
+
+    const srv_irq_state_t irq_state = srv_spinlock_LockIRQSave(&space->lock);
+    vm_dump_Table(&dump, space->root, SRV_PAGING_LEVELS - 1U, 0ULL);
+    vm_dump_Flush(&dump.run);
+    srv_spinlock_UnlockIRQRestore(&space->lock, irq_state);
+
+    kprintf("  %d x 1G, %d x 2M, %d x 4K pages in %d tables\n", (int)dump.leaves[2], (int)dump.leaves[1], (int)dump.leaves[0], (int)dump.tables);
+}
@@ -0,0 +1,292 @@
+/****************************************************************
+ * @file    bench.c
+ * @brief   Implementation of @ref bench.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <bench/bench.h>
+
+#include <hal.h>
+#include <sched/sched.h>
+#include <smp/smp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_BUFFER_SIZE 16384U /**< Size of each benchmark buffer */
+#define BENCH_ITERATIONS  64U    /**< Number of times each operation is timed */
+#define BENCH_YIELDS      2048U  /**< Number of times each scheduler benchmark thread yields */
+#define BENCH_TRAPS       1024U  /**< Number of traps timed */
+#define BENCH_CALLS       256U   /**< Number of cross-CPU calls timed */
+
+static uint8_t bench_src[BENCH_BUFFER_SIZE + 8U];
+static uint8_t bench_dst[BENCH_BUFFER_SIZE + 8U];
+
+static const size_t bench_sizes[] = {64U, 512U, 4096U, BENCH_BUFFER_SIZE};
+
+static uint32_t bench_threads_done = 0U; /**< Scheduler benchmark threads that have finished */
+
+/**
+ * @brief The byte-at-a-time copy that kstdlib used to have, as a baseline
+ *
+ * @details @c volatile stops the compiler from widening or vectorizing it
+ */
+static void bench_ByteCopy(volatile uint8_t* dst, const volatile uint8_t* src, size_t n)
+{
+    for (size_t i = 0U; i < n; i++)
+    {
+        dst[i] = src[i];
+    }
+}
+
+/**
+ * @brief Byte-at-a-time fill baseline
+ */
+static void bench_ByteSet(volatile uint8_t* dst, int c, size_t n)
+{
+    for (size_t i = 0U; i < n; i++)
+    {
+        dst[i] = (uint8_t)c;
+    }
+}
+
+/**
+ * @brief Time the kstdlib memory routines against a byte loop
+ */
+static void bench_String(void)
+{
+    kprintf("bench: string (vector unit %s)\n", srv_hal_HasVectorUnit() ? "present" : "absent");
+
+    for (size_t size_index = 0U; size_index < (sizeof(bench_sizes) / sizeof(bench_sizes[0])); size_index++)
+    {
+        const size_t size = bench_sizes[size_index];
+
+        /* Aligned, then with the source one byte off so the shifting path is measured too */
+        for (size_t src_offset = 0U; src_offset < 2U; src_offset++)
+        {
+            uint64_t byte_cycles = 0U;
+            uint64_t copy_cycles = 0U;
+            uint64_t move_cycles = 0U;
+
+            for (uint32_t iteration = 0U; iteration < BENCH_ITERATIONS; iteration++)
+            {
+                uint64_t start = srv_hal_GetCycleCount();
+                bench_ByteCopy(bench_dst, &bench_src[src_offset], size);
+                byte_cycles += srv_hal_GetCycleCount() - start;
+
+                start = srv_hal_GetCycleCount();
+                (void)memcpy(bench_dst, &bench_src[src_offset], size);
+                copy_cycles += srv_hal_GetCycleCount() - start;
+
+                start = srv_hal_GetCycleCount();
+                (void)memmove(&bench_dst[8], &bench_dst[src_offset], size);
+                move_cycles += srv_hal_GetCycleCount() - start;
+            }
+
+            kprintf("  copy %d%s: byte %d, memcpy %d, memmove %d cycles\n",
+                    (int)size, (src_offset != 0U) ? " (misaligned)" : "",
+                    (int)(byte_cycles / BENCH_ITERATIONS),
+                    (int)(copy_cycles / BENCH_ITERATIONS),
+                    (int)(move_cycles / BENCH_ITERATIONS));
+        }
+
+        uint64_t byte_cycles = 0U;
+        uint64_t set_cycles  = 0U;
+        uint64_t cmp_cycles  = 0U;
+
+        for (uint32_t iteration = 0U; iteration < BENCH_ITERATIONS; iteration++)
+        {
+            uint64_t start = srv_hal_GetCycleCount();
+            bench_ByteSet(bench_dst, (int)iteration, size);
+            byte_cycles += srv_hal_GetCycleCount() - start;
+
+            start = srv_hal_GetCycleCount();
+            (void)memset(bench_dst, (int)iteration, size);
+            set_cycles += srv_hal_GetCycleCount() - start;
+
+            start = srv_hal_GetCycleCount();
+            (void)memcmp(bench_dst, bench_dst + 8U, size);
+            cmp_cycles += srv_hal_GetCycleCount() - start;
+        }
+
+        kprintf("  fill %d: byte %d, memset %d cycles, memcmp %d cycles\n",
+                (int)size,
+                (int)(byte_cycles / BENCH_ITERATIONS),
+                (int)(set_cycles / BENCH_ITERATIONS),
+                (int)(cmp_cycles / BENCH_ITERATIONS));
+    }
+}
+
+/**
+ * @brief Scheduler benchmark thread, which does nothing but yield
+ */
+static void bench_YieldThread(void* argument)
+{
+    (void)argument;
+
+    for (uint32_t iteration = 0U; iteration < BENCH_YIELDS; iteration++)
+    {
+        srv_sched_Yield();
+    }
+
+    __atomic_fetch_add(&bench_threads_done, 1U, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Add up a run queue counter over every online CPU
+ *
+ * @param[in] steals @c true for steals, @c false for context switches
+ */
+static uint64_t bench_SumRunQueues(bool steals)
+{
+    uint64_t total = 0U;
+
+    for (uint32_t id = 0U; id < SRV_HAL_MAX_CPUS; id++)
+    {
+        const srv_percpu_t* cpu = srv_smp_GetCPU(id);
+
+        if (cpu != NULL)
+        {
+            total += __atomic_load_n(steals ? &cpu->run_queue.steals : &cpu->run_queue.switches, __ATOMIC_RELAXED);
+        }
+    }
+
+    return total;
+}
+
+/**
+ * @brief Time context switches with more and more threads yielding at once
+ *
+ * @details The threads all start on this CPU, so the others only get any by
+ *          stealing them. The cost per switch is per CPU, so it stays flat if
+ *          switching scales with the number of CPUs.
+ */
+static void bench_Sched(void)
+{
+    const uint32_t cpus = srv_smp_GetCPUCount();
+
+    kprintf("bench: sched (%d CPUs)\n", (int)cpus);
+
+    for (uint32_t threads = 2U; threads <= (cpus * 4U); threads *= 2U)
+    {
+        __atomic_store_n(&bench_threads_done, 0U, __ATOMIC_RELAXED);
+
+        for (uint32_t thread = 0U; thread < threads; thread++)
+        {
+            if (srv_sched_CreateThread("bench", bench_YieldThread, NULL) == NULL)
+            {
+                kprintf("  out of memory for threads\n");
+                return;
+            }
+        }
+
+        const uint64_t switches = bench_SumRunQueues(false);
+        const uint64_t steals   = bench_SumRunQueues(true);
+        const uint64_t start    = srv_hal_GetCycleCount();
+
+        /* We are the idle thread, so this only comes back once there is nothing queued here */
+        while (__atomic_load_n(&bench_threads_done, __ATOMIC_ACQUIRE) != threads)
+        {
+            srv_sched_Yield();
+        }
+
+        const uint64_t cycles = srv_hal_GetCycleCount() - start;
+        const uint64_t made   = bench_SumRunQueues(false) - switches;
+
+        kprintf("  %d threads: %d switches, %d steals, %d cycles per switch per CPU\n",
+                (int)threads,
+                (int)made,
+                (int)(bench_SumRunQueues(true) - steals),
+                (int)((made == 0U) ? 0U : ((cycles * cpus) / made)));
+    }
+}
+
+/**
+ * @brief Time a trip through the interrupt path
+ *
+ * @details A software interrupt sent to ourselves is taken straight away, so
+ *          raising one times the whole entry, handler and exit
+ */
+static void bench_Trap(void)
+{
+    uint64_t best  = UINT64_MAX;
+    uint64_t total = 0U;
+
+    kprintf("bench: trap\n");
+
+    for (uint32_t iteration = 0U; iteration < BENCH_TRAPS; iteration++)
+    {
+        const uint64_t start = srv_hal_GetCycleCount();
+        srv_hal_RaiseSoftwareInterrupt();
+        const uint64_t cycles = srv_hal_GetCycleCount() - start;
+
+        total += cycles;
+        best   = (cycles < best) ? cycles : best;
+    }
+
+    kprintf("  software interrupt round trip: %d cycles average, %d best\n",
+            (int)(total / BENCH_TRAPS),
+            (int)best);
+}
+
+/**
+ * @brief Cross-CPU call that does nothing, so only the round trip is timed
+ */
+static void bench_EmptyCall(void* argument)
+{
+    (void)argument;
+}
+
+/**
+ * @brief Time cross-CPU calls and TLB shootdowns
+ *
+ * @details A call to one CPU is a full IPI round trip. A call to all of them
+ *          shows how well the IPIs are batched, and a shootdown adds the
+ *          flush on top.
+ */
+static void bench_Call(void)
+{
+    const uint32_t cpus = srv_smp_GetCPUCount();
+
+    kprintf("bench: cross-CPU calls (%d CPUs)\n", (int)cpus);
+
+    if (cpus < 2U)
+    {
+        kprintf("  needs another CPU\n");
+        return;
+    }
+
+    uint64_t one_cycles       = 0U;
+    uint64_t all_cycles       = 0U;
+    uint64_t shootdown_cycles = 0U;
+
+    for (uint32_t iteration = 0U; iteration < BENCH_CALLS; iteration++)
+    {
+        uint64_t start = srv_hal_GetCycleCount();
+        (void)srv_smp_CallFunction(1ULL << 1U, bench_EmptyCall, NULL, true);
+        one_cycles += srv_hal_GetCycleCount() - start;
+
+        start = srv_hal_GetCycleCount();
+        (void)srv_smp_CallFunction(SRV_SMP_ALL_CPUS, bench_EmptyCall, NULL, true);
+        all_cycles += srv_hal_GetCycleCount() - start;
+
+        /* The benchmark buffers are mapped, so flushing them is harmless */
+        start = srv_hal_GetCycleCount();
+        srv_smp_FlushTLBRange(SRV_SMP_ALL_CPUS, (srv_virtual_address_t)bench_dst, sizeof(bench_dst));
+        shootdown_cycles += srv_hal_GetCycleCount() - start;
+    }
+
+    kprintf("  call one CPU %d, call every CPU %d, shootdown %d cycles\n",
+            (int)(one_cycles / BENCH_CALLS),
+            (int)(all_cycles / BENCH_CALLS),
+            (int)(shootdown_cycles / BENCH_CALLS));
+}
+
+void srv_bench_Run(void)
+{
+    bench_String();
+    bench_Sched();
+    bench_Trap();
+    bench_Call();
+}
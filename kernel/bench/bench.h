@@ -0,0 +1,18 @@
+/****************************************************************
+ * @file    bench.h
+ * @brief   In-Kernel micro-benchmarks
+ *
+ * @details Only built when the @c SYSRV_BENCHMARKS CMake option is on
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * @brief Run every benchmark and print the results to the debug console
+ */
+void srv_bench_Run(void);
+
+#endif
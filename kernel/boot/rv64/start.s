@@ -12,17 +12,28 @@ boot_info:
     .quad 0 # rv64_boot_info_t::kernel_physical_address
     .quad 0 # rv64_boot_info_t::kernel_load_offset
     .quad 0 # rv64_boot_info_t::fdt_ptr
+    .quad 0 # rv64_boot_info_t::boot_cpu_hardware_id
+
+.section .data
+_boot_Lottery:
+    .word 0 # Set by the first hart to reach _start
 
 .type _start, @function
 .global _start
+.type _start_secondary, @function
+.global _start_secondary
 .section .init
 .extern __kernel_stack_top
 .extern srv_arch_Init
+.extern srv_smp_InitSecondaryCPU
+.extern srv_percpu_blocks
+.extern kmain
 
 #
 # Kernel entry point from OpenSBI
 #
 # a0 - Hart ID
+# a1 - Pointer to the Flattened Device Tree
 #
 _start:
     # Load the initial stack pointer
@@ -30,16 +41,20 @@ _start:
     mv sp, t0
 
     #
-    # Only perform init if the Hart ID is 0 and park
-    # any other Harts
+    # SBI HSM firmware only lets the boot hart in, but older firmware
+    # releases every hart here at once. The first one to arrive is the boot
+    # hart, and the rest park, since they can't be started again later.
     #
-    lui t0, 0
-    mv tp, a0 # Store the number of this CPU in the $tp register (which is unused by the Kernel)
-    bne a0, t0, _boot_ParkHart
+    la t0, _boot_Lottery
+    li t1, 1
+    amoswap.w.aq t1, t1, (t0)
+    bnez t1, _boot_ParkHart
 
-    # Set up the boot param structure
+    # The boot hart is logical CPU 0. $tp points at the executing CPU's srv_percpu_t (it is unused by the Kernel otherwise)
+    la tp, srv_percpu_blocks
 
     # Construct the boot info structure
+    mv t2, a0
     la a0, boot_info
     la t0, __KERNEL_PHYSICAL_START
     la t1, __PHYSICAL_MEMORY_START
@@ -47,6 +62,7 @@ _start:
     sd t0, 0(a0)
     sd t1, 8(a0)
     sd a1, 16(a0)
+    sd t2, 24(a0)
 
     # Save a0 on the stack so we can get it back later
     addi sp, sp, -8
@@ -58,5 +74,32 @@ _start:
     la t0, srv_arch_Init
     jalr t0
 
+    # Only start the Kernel proper if the platform came up (SRV_ARCH_INIT_SUCCESS is 0)
+    bnez a0, _boot_ParkHart
+    la t0, kmain
+    jalr t0
+    j _boot_ParkHart
+
+#
+# Entry point for every other hart, started by srv_smp_StartCPUs() through SBI HSM
+#
+# a0 - Hart ID
+# a1 - Pointer to this CPU's srv_percpu_t
+#
+_start_secondary:
+    # Translation is off, but the Kernel is identity mapped so the block is where it says it is
+    ld sp, 8(a1) # srv_percpu_t::stack_top
+    mv tp, a1
+
+    mv a0, a1
+    la t0, srv_smp_InitSecondaryCPU
+    jalr t0
+
+    # Returns false if the boot CPU gave up waiting for us
+    beqz a0, _boot_ParkHart
+    la t0, kmain
+    jalr t0
+
 _boot_ParkHart:
-    j .
+    wfi
+    j _boot_ParkHart
@@ -16,30 +16,44 @@
 #define FDT_NOP            0x00000004UL
 #define FDT_END            0x00000009UL
 
-#define FDT_MAX_CHILDREN   16UL /**< The max number of children a node can have. Clamped at 32 for now */
-#define FDT_MAX_PROPERTIES 16UL /**< The max number of children a node can have. Clamped at 32 for now */
+#define FDT_INVALID_INDEX  UINT32_MAX /**< Index value meaning "no node" or "no property" */
+#define FDT_MIN_ENTRY_SIZE 12UL       /**< Fewest bytes of structure block a node or property can take up */
+
+#define FDT_FNV_OFFSET_BASIS 0x811C9DC5UL /**< FNV-1a 32-bit starting value */
+#define FDT_FNV_PRIME        0x01000193UL /**< FNV-1a 32-bit multiplier */
+#define FDT_MIN_INDEX_SLOTS  16U          /**< Smallest hash table worth building */
+#define FDT_PHANDLE_SPREAD   4U           /**< Largest phandle, per node, that still gets a dense array */
 
 /**
  * @brief Per-node property structure
  *
+ * @details Everything is an offset or an index rather than a pointer, so a
+ *          property is 16 bytes and four of them share a cache line
  */
 typedef struct
 {
-    const char*    name;
-    const uint8_t* value;
-    uint32_t       length;
+    uint32_t name_offset;  /**< Offset of the name in the strings block */
+    uint32_t value_offset; /**< Offset of the value in the structure block */
+    uint32_t length;       /**< Length of the value, in bytes */
+    uint32_t next;         /**< Index of the node's next property */
 } fdt_node_property_t;
 
 /**
  * @brief Flattened Device Tree binary node in-memory structure
+ *
+ * @details Nodes are linked first-child/next-sibling by index into the node
+ *          array, so a node can have any number of children and properties
  */
-typedef struct fdt_node
+struct fdt_node
 {
-    struct fdt_node*       parent;                         /* The parent node of this node*/
-    const struct fdt_node* children[FDT_MAX_CHILDREN];     /**< The child nodes of this node*/
-    fdt_node_property_t*   properties[FDT_MAX_PROPERTIES]; /**< The properties for this node */
-    const char*            name;                           /**< The name of this node */
-} fdt_node_t;
+    uint32_t name_offset;  /**< Offset of the name in the structure block */
+    uint32_t parent;       /**< Index of the parent node */
+    uint32_t first_child;  /**< Index of the first child node */
+    uint32_t next_sibling; /**< Index of the next node with the same parent */
+    uint32_t first_prop;   /**< Index of the first property */
+};
+
+typedef srv_fdt_node_t fdt_node_t;
 
 /**
  * @brief Flattened Device Tree property structure
@@ -51,24 +65,91 @@ typedef struct
     uint32_t nameoff; /**< Offset into the strings table for this property */
 } fdt_prop_t;
 
+/**
+ * @brief The parsed tree
+ *
+ * @details Nodes and properties live in one arena, sized up front from the
+ *          structure block. Nodes are handed out from the front and properties
+ *          from the back, so neither needs its own worst case reserved.
+ */
+typedef struct
+{
+    fdt_node_t*          nodes;      /**< Node array, at the start of the arena */
+    fdt_node_property_t* properties; /**< End of the arena. Property @c i is at @c properties[-1 - i] */
+    uint32_t             node_count; /**< Number of nodes in the tree */
+    uint32_t             prop_count; /**< Number of properties in the tree */
+    size_t               arena_size; /**< Size of the arena, in bytes */
+    const uint8_t*       structs;    /**< Start of the DTB structure block */
+    const char*          strings;    /**< Start of the DTB strings block */
+} fdt_tree_t;
+
+/**
+ * @brief Path index hash table slot
+ */
+typedef struct
+{
+    uint32_t hash; /**< Hash of the node's full path */
+    uint32_t node; /**< Index of the node, or @ref FDT_INVALID_INDEX for an empty slot */
+} fdt_path_slot_t;
+
+/**
+ * @brief Compatible index hash table slot. A node gets one per compatible string
+ */
+typedef struct
+{
+    uint32_t hash;          /**< Hash of the compatible string */
+    uint32_t node;          /**< Index of the node, or @ref FDT_INVALID_INDEX for an empty slot */
+    uint32_t string_offset; /**< Offset of the compatible string in the structure block */
+} fdt_compatible_slot_t;
+
+/**
+ * @brief Lookup indices, built once after the tree is parsed
+ *
+ * @details Both hash tables use linear probing and are at most half full.
+ *          Nodes are inserted in document order, so of the slots holding the
+ *          same key, the first one probed is the first node in the tree.
+ */
+typedef struct
+{
+    uint32_t*              path_hashes;     /**< Hash of every node's path, by node index */
+    fdt_path_slot_t*       paths;           /**< Path hash table */
+    uint32_t               path_mask;       /**< Number of path slots, minus one */
+    fdt_compatible_slot_t* compatibles;     /**< Compatible string hash table */
+    uint32_t               compatible_mask; /**< Number of compatible slots, minus one */
+    uint32_t*              phandles;        /**< Node index by phandle, or @c NULL if the phandles are too sparse */
+    uint32_t               phandle_count;   /**< Number of entries in @ref phandles */
+} fdt_index_t;
+
 static struct fdt_header* fdt_info_block = NULL;
-static fdt_node_t*        root_node      = NULL;
+static fdt_tree_t         fdt_tree       = {0};
+static fdt_index_t        fdt_index      = {0};
 
 /**
  * @brief Parse the device tree
+ *
+ * @return true  The tree was parsed
+ * @return false The tree is malformed
+ */
+static bool fdt_ParseTree(void);
+
+/**
+ * @brief Build the path, compatible and phandle indices over the parsed tree
+ *
+ * @return true  The indices were built
+ * @return false The tree is empty
  */
-static void fdt_ParseTree(void);
+static bool fdt_BuildIndices(void);
 
 /**
- * @brief Find a node by name given a root node
+ * @brief Find a property of a node by name
  *
- * @param[in] root The root node to search
- * @param[in] node_name The name of the node
+ * @param[in] node The node to search
+ * @param[in] name The name of the property
  *
- * @return Pointer to an @ref fdt_node_t
- * @return @c NULL if the node cannot be found
+ * @return Pointer to the property
+ * @return @c NULL if the node doesn't have the property
  */
-static const fdt_node_t* fdt_FindNodeByName(const fdt_node_t* root, const char* node_name);
+static const fdt_node_property_t* fdt_FindProperty(const fdt_node_t* node, const char* name);
 
 /**
  * @brief Align a value to the next Device Tree word address
@@ -101,130 +182,207 @@ static inline uint32_t fdt_Read32(const uint8_t* ptr)
 }
 
 /**
- * @brief Inserts a child node into a node's children list
+ * @brief Does a list of NUL terminated strings (e.g. "compatible") contain a string?
  *
- * @param[in] node  The node to insert the child into
- * @param[in] child The child node to insert
+ * @param[in] list       The first string in the list
+ * @param[in] length     Length of the whole list, in bytes
+ * @param[in] string     The string to look for
  *
- * @return true   The child has been inserted
- * @return false  Child insertion failed due to many children (as specified by @ref FDT_MAX_CHILDREN)
+ * @return @c true if it does
  */
-static inline bool fdt_InsertChild(fdt_node_t* const node, const fdt_node_t* const child)
+static bool fdt_StringListContains(const char* list, size_t length, const char* string)
 {
-    size_t child_index = 0ULL;
+    const char* end = list + length;
 
-    /* Walk the child array until we find a free slot*/
-    while (child_index < FDT_MAX_CHILDREN)
+    while (list < end)
     {
-        if (node->children[child_index] == NULL)
+        if (strcmp(list, string) == 0)
         {
-            node->children[child_index] = child;
             return true;
         }
 
-        child_index++;
+        list += strlen(list) + 1U;
     }
 
-    /* If we get here, the insertion failed, so return false */
     return false;
 }
 
 /**
- * @brief Insert a property into a node
+ * @brief Turn a node index into a node
  *
- * @param[in] node          The node to insert the property into
- * @param[in] property_ptr  Pointer to the property's data
+ * @param[in] index Index into the node array
  *
- * @return true
- * @return false
+ * @return The node, or @c NULL for @ref FDT_INVALID_INDEX
  */
-static inline bool fdt_InsertProperty(fdt_node_t* const node, const uint32_t nameoff, const uint32_t prop_len, const void* property_ptr)
+static inline const fdt_node_t* fdt_Node(uint32_t index)
 {
-    size_t prop_index = 0ULL;
+    return (index != FDT_INVALID_INDEX) ? &fdt_tree.nodes[index] : NULL;
+}
 
-    const uint8_t* fdt_info_as_u8 = (const uint8_t*)fdt_info_block;
+/**
+ * @brief Turn a property index into a property
+ *
+ * @param[in] index Index into the property array
+ *
+ * @return The property, or @c NULL for @ref FDT_INVALID_INDEX
+ */
+static inline const fdt_node_property_t* fdt_Property(uint32_t index)
+{
+    return (index != FDT_INVALID_INDEX) ? &fdt_tree.properties[-1 - (ptrdiff_t)index] : NULL;
+}
 
-    /* Walk the child array until we find a free slot*/
-    while (prop_index < FDT_MAX_PROPERTIES)
-    {
-        if (node->properties[prop_index] == NULL)
-        {
-            /* Allocate a new property */
-            fdt_node_property_t* property = (fdt_node_property_t*)srv_kalloc_EternalAlloc(sizeof(fdt_node_property_t));
+static inline const char* fdt_NodeName(const fdt_node_t* node)
+{
+    return (const char*)&fdt_tree.structs[node->name_offset];
+}
 
-            /* Fill the property */
-            /* FIXME: We can do this ahead of time instead of on each loop */
-            const uint32_t string_table_offset = fdt_Read32((const uint8_t*)&fdt_info_block->off_dt_strings);
+static inline const char* fdt_PropertyName(const fdt_node_property_t* prop)
+{
+    return &fdt_tree.strings[prop->name_offset];
+}
 
-            property->name   = (const char*)(&fdt_info_as_u8[string_table_offset + nameoff]);
-            property->length = prop_len;
-            property->value  = property_ptr;
+static inline const uint8_t* fdt_PropertyValue(const fdt_node_property_t* prop)
+{
+    return &fdt_tree.structs[prop->value_offset];
+}
 
-            node->properties[prop_index] = property;
+/**
+ * @brief Take a new node from the front of the arena
+ *
+ * @return Index of the node, or @ref FDT_INVALID_INDEX if the arena is full
+ */
+static inline uint32_t fdt_NewNode(void)
+{
+    const size_t used = ((size_t)(fdt_tree.node_count + 1U) * sizeof(fdt_node_t)) + ((size_t)fdt_tree.prop_count * sizeof(fdt_node_property_t));
+    if (used > fdt_tree.arena_size)
+    {
+        return FDT_INVALID_INDEX;
+    }
 
-            return true;
-        }
+    return fdt_tree.node_count++;
+}
 
-        prop_index++;
+/**
+ * @brief Take a new property from the back of the arena
+ *
+ * @return Index of the property, or @ref FDT_INVALID_INDEX if the arena is full
+ */
+static inline uint32_t fdt_NewProperty(void)
+{
+    const size_t used = ((size_t)fdt_tree.node_count * sizeof(fdt_node_t)) + ((size_t)(fdt_tree.prop_count + 1U) * sizeof(fdt_node_property_t));
+    if (used > fdt_tree.arena_size)
+    {
+        return FDT_INVALID_INDEX;
     }
 
-    /* If we get here, the insertion failed, so return false */
-    return false;
+    return fdt_tree.prop_count++;
 }
 
-static void fdt_ParseTree(void)
+static bool fdt_ParseTree(void)
 {
-#ifdef SRV_SYSTEM_BIG_ENDIAN
-    const uint8_t* dt_start_ptr = (uint8_t*)fdt_info_block + fdt_info_block->off_dt_struct;
-#else
-    const uint8_t* dt_start_ptr = (uint8_t*)fdt_info_block + __builtin_bswap32(fdt_info_block->off_dt_struct);
-#endif
-    size_t      curr_offset = 0ULL;
-    fdt_node_t* curr_node   = NULL;
+    const size_t   struct_size  = fdt_Read32((const uint8_t*)&fdt_info_block->size_dt_struct);
+    const uint8_t* dt_start_ptr = fdt_tree.structs;
+    size_t         curr_offset  = 0ULL;
+    uint32_t       curr_node    = FDT_INVALID_INDEX;
+
+    /* The last child and property of the current node, so appending doesn't need a walk */
+    uint32_t last_child = FDT_INVALID_INDEX;
+    uint32_t last_prop  = FDT_INVALID_INDEX;
 
-    while (curr_offset < fdt_info_block->size_dt_struct)
+    while (curr_offset < struct_size)
     {
         const uint32_t token  = fdt_Read32(&dt_start_ptr[curr_offset]);
         curr_offset          += sizeof(uint32_t);
 
         if (token == FDT_BEGIN_NODE)
         {
-            /* Get the length of the node's name */
-            const char*  node_name      = (const char*)&dt_start_ptr[curr_offset];
-            const size_t node_name_len  = strlen(node_name);
-            curr_offset                += fdt_AlignToNextWord(node_name_len);
+            /* Get the length of the node's name, including its NUL terminator */
+            const size_t name_offset    = curr_offset;
+            const size_t node_name_len  = strlen((const char*)&dt_start_ptr[name_offset]);
+            curr_offset                += fdt_AlignToNextWord(node_name_len + 1ULL);
 
-            fdt_node_t* new_node = (fdt_node_t*)srv_kalloc_EternalAlloc(sizeof(fdt_node_t));
-            new_node->name       = node_name;
-
-            /* This is the root node */
-            if (node_name_len == 0ULL)
+            const uint32_t new_index = fdt_NewNode();
+            if (new_index == FDT_INVALID_INDEX)
             {
-                root_node         = (fdt_node_t*)new_node;
-                root_node->parent = NULL;
-                curr_node         = root_node;
+                return false;
             }
-            else
+
+            fdt_tree.nodes[new_index] = (fdt_node_t){
+                .name_offset  = (uint32_t)name_offset,
+                .parent       = curr_node,
+                .first_child  = FDT_INVALID_INDEX,
+                .next_sibling = FDT_INVALID_INDEX,
+                .first_prop   = FDT_INVALID_INDEX,
+            };
+
+            /* Append to the parent's children. The root (index 0) has no parent */
+            if (curr_node != FDT_INVALID_INDEX)
             {
-                new_node->parent = curr_node;
+                fdt_node_t* parent = &fdt_tree.nodes[curr_node];
+
+                /* Siblings are always parsed one after the other, so the previous sibling is the parent's newest child */
+                if (parent->first_child == FDT_INVALID_INDEX)
+                {
+                    parent->first_child = new_index;
+                }
+                else
+                {
+                    fdt_tree.nodes[last_child].next_sibling = new_index;
+                }
             }
 
-            /* Set a pointer to the node name and insert the child */
-            fdt_InsertChild(curr_node, new_node);
-            curr_node = new_node;
+            curr_node  = new_index;
+            last_child = FDT_INVALID_INDEX;
+            last_prop  = FDT_INVALID_INDEX;
         }
         else if (token == FDT_END_NODE)
         {
-            curr_node = curr_node->parent;
+            if (curr_node == FDT_INVALID_INDEX)
+            {
+                return false;
+            }
+
+            /* The node we're leaving is now the newest child of its parent */
+            last_child = curr_node;
+            curr_node  = fdt_tree.nodes[curr_node].parent;
+
+            /* Properties always come before children, so the parent won't get any more */
+            last_prop = FDT_INVALID_INDEX;
         }
         else if (token == FDT_PROP)
         {
-            fdt_prop_t* prop = (fdt_prop_t*)&dt_start_ptr[curr_offset];
+            if (curr_node == FDT_INVALID_INDEX)
+            {
+                return false;
+            }
+
+            const fdt_prop_t* prop = (const fdt_prop_t*)&dt_start_ptr[curr_offset];
 
             const uint32_t prop_len   = fdt_Read32((const uint8_t*)&prop->len);
             const uint32_t str_offset = fdt_Read32((const uint8_t*)&prop->nameoff);
 
-            fdt_InsertProperty(curr_node, str_offset, prop_len, (const uint8_t*)prop + sizeof(fdt_prop_t));
+            const uint32_t new_index = fdt_NewProperty();
+            if (new_index == FDT_INVALID_INDEX)
+            {
+                return false;
+            }
+
+            *(fdt_node_property_t*)fdt_Property(new_index) = (fdt_node_property_t){
+                .name_offset  = str_offset,
+                .value_offset = (uint32_t)(curr_offset + sizeof(fdt_prop_t)),
+                .length       = prop_len,
+                .next         = FDT_INVALID_INDEX,
+            };
+
+            if (last_prop == FDT_INVALID_INDEX)
+            {
+                fdt_tree.nodes[curr_node].first_prop = new_index;
+            }
+            else
+            {
+                ((fdt_node_property_t*)fdt_Property(last_prop))->next = new_index;
+            }
+            last_prop = new_index;
 
             curr_offset += sizeof(fdt_prop_t) + fdt_AlignToNextWord(prop_len); /* Take into account the second word of the prop being the name offset */
         }
@@ -236,22 +394,249 @@ static void fdt_ParseTree(void)
             /* Nothing left to do, get out of here! */
             break;
         }
+        else
+        {
+            /* Unknown token, so we can't know how far to skip */
+            return false;
+        }
+    }
+
+    return fdt_tree.node_count != 0U;
+}
+
+/**
+ * @brief Continue an FNV-1a hash over some more bytes
+ *
+ * @details Paths are hashed a component at a time from the parent's hash, so
+ *          the full path of a node never has to be put together in memory
+ *
+ * @param[in] hash   Hash of everything before @c bytes
+ * @param[in] bytes  The bytes to add
+ * @param[in] length Number of bytes to add
+ *
+ * @return The new hash
+ */
+static inline uint32_t fdt_Hash(uint32_t hash, const char* bytes, size_t length)
+{
+    for (size_t i = 0U; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)bytes[i]) * FDT_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Get the number of slots for a hash table, keeping it at most half full
+ *
+ * @param[in] entries Number of entries that will go in
+ *
+ * @return Number of slots, always a power of two
+ */
+static inline uint32_t fdt_TableSize(uint32_t entries)
+{
+    uint32_t slots = FDT_MIN_INDEX_SLOTS;
+
+    while (slots < (entries * 2U))
+    {
+        slots <<= 1U;
     }
+
+    return slots;
+}
+
+/**
+ * @brief Get the phandle of a node, if it has one
+ *
+ * @param[in]  node    The node
+ * @param[out] phandle The node's phandle
+ *
+ * @return @c true if the node has a phandle
+ */
+static bool fdt_NodePhandle(const fdt_node_t* node, uint32_t* phandle)
+{
+    /* Older trees use "linux,phandle" */
+    return (srv_fdt_GetPropertyU32(node, "phandle", phandle) || srv_fdt_GetPropertyU32(node, "linux,phandle", phandle)) && (*phandle != 0U);
 }
 
-static const fdt_node_t* fdt_FindNodeByName(const fdt_node_t* root, const char* node_name)
+/**
+ * @brief Is a path the full path of a node?
+ *
+ * @details Walks up from the node, matching names against the path from its end
+ *
+ * @param[in] index  Index of the node
+ * @param[in] path   The path, with any trailing '/' already dropped
+ * @param[in] length Length of the path
+ *
+ * @return @c true if it is
+ */
+static bool fdt_PathMatches(uint32_t index, const char* path, size_t length)
 {
-    /* Search the children for the node */
-    for (size_t child_index = 0ULL; child_index < FDT_MAX_CHILDREN; child_index++)
+    while (index != 0U)
     {
-        const fdt_node_t* node = root->children[child_index];
-        if (strcmp(node->name, node_name) == 0)
+        const fdt_node_t* node        = &fdt_tree.nodes[index];
+        const char*       name        = fdt_NodeName(node);
+        const size_t      name_length = strlen(name);
+
+        if ((length <= name_length) || (path[length - name_length - 1U] != '/') || (memcmp(&path[length - name_length], name, name_length) != 0))
         {
-            return node;
+            return false;
         }
+
+        length -= name_length + 1U;
+        index   = node->parent;
     }
 
-    return NULL;
+    return length == 0U;
+}
+
+/**
+ * @brief Find the parsed node for a structure block offset from the in-place API
+ *
+ * @details Nodes are parsed in document order, so their name offsets are sorted
+ *
+ * @param[in] offset Offset of the node's begin token
+ *
+ * @return The node, or @c NULL if no node begins there
+ */
+static const fdt_node_t* fdt_NodeAtOffset(uint32_t offset)
+{
+    const uint32_t name_offset = offset + sizeof(uint32_t);
+    uint32_t       low         = 0U;
+    uint32_t       high        = fdt_tree.node_count;
+
+    while (low < high)
+    {
+        const uint32_t middle = low + ((high - low) / 2U);
+
+        if (fdt_tree.nodes[middle].name_offset < name_offset)
+        {
+            low = middle + 1U;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return ((low < fdt_tree.node_count) && (fdt_tree.nodes[low].name_offset == name_offset)) ? &fdt_tree.nodes[low] : NULL;
+}
+
+static bool fdt_BuildIndices(void)
+{
+    const uint32_t node_count       = fdt_tree.node_count;
+    uint32_t       compatible_count = 0U;
+    uint32_t       max_phandle      = 0U;
+
+    if (node_count == 0U)
+    {
+        return false;
+    }
+
+    /* Count the compatible strings and find the largest phandle, so everything is sized up front */
+    for (uint32_t index = 0U; index < node_count; index++)
+    {
+        const fdt_node_t*          node = &fdt_tree.nodes[index];
+        const fdt_node_property_t* prop = fdt_FindProperty(node, "compatible");
+        uint32_t                   phandle;
+
+        if (prop != NULL)
+        {
+            const char* string = (const char*)fdt_PropertyValue(prop);
+            const char* end    = string + prop->length;
+
+            for (; string < end; string += strlen(string) + 1U)
+            {
+                compatible_count++;
+            }
+        }
+
+        if (fdt_NodePhandle(node, &phandle) && (phandle > max_phandle))
+        {
+            max_phandle = phandle;
+        }
+    }
+
+    const uint32_t path_slots       = fdt_TableSize(node_count);
+    const uint32_t compatible_slots = fdt_TableSize(compatible_count);
+
+    fdt_index = (fdt_index_t){
+        .path_hashes     = (uint32_t*)srv_kalloc_EternalAllocAligned(node_count * sizeof(uint32_t), _Alignof(uint32_t)),
+        .paths           = (fdt_path_slot_t*)srv_kalloc_EternalAllocAligned(path_slots * sizeof(fdt_path_slot_t), _Alignof(fdt_path_slot_t)),
+        .path_mask       = path_slots - 1U,
+        .compatibles     = (fdt_compatible_slot_t*)srv_kalloc_EternalAllocAligned(compatible_slots * sizeof(fdt_compatible_slot_t), _Alignof(fdt_compatible_slot_t)),
+        .compatible_mask = compatible_slots - 1U,
+        .phandles        = NULL,
+        .phandle_count   = 0U,
+    };
+
+    /* All ones marks every slot empty, since the node is FDT_INVALID_INDEX */
+    (void)memset(fdt_index.paths, 0xFF, path_slots * sizeof(fdt_path_slot_t));
+    (void)memset(fdt_index.compatibles, 0xFF, compatible_slots * sizeof(fdt_compatible_slot_t));
+
+    /* A handful of huge phandles would make a dense array mostly holes, so those trees get a scan instead */
+    if ((max_phandle != 0U) && (max_phandle <= (node_count * FDT_PHANDLE_SPREAD)))
+    {
+        fdt_index.phandle_count = max_phandle + 1U;
+        fdt_index.phandles      = (uint32_t*)srv_kalloc_EternalAllocAligned(fdt_index.phandle_count * sizeof(uint32_t), _Alignof(uint32_t));
+        (void)memset(fdt_index.phandles, 0xFF, fdt_index.phandle_count * sizeof(uint32_t));
+    }
+
+    for (uint32_t index = 0U; index < node_count; index++)
+    {
+        const fdt_node_t* node = &fdt_tree.nodes[index];
+        const char*       name = fdt_NodeName(node);
+
+        /* The root is the empty prefix every other path starts from. Parents always come before their children */
+        uint32_t hash = FDT_FNV_OFFSET_BASIS;
+        if (node->parent != FDT_INVALID_INDEX)
+        {
+            hash = fdt_Hash(fdt_index.path_hashes[node->parent], "/", 1U);
+            hash = fdt_Hash(hash, name, strlen(name));
+        }
+        fdt_index.path_hashes[index] = hash;
+
+        uint32_t slot = hash & fdt_index.path_mask;
+        while (fdt_index.paths[slot].node != FDT_INVALID_INDEX)
+        {
+            slot = (slot + 1U) & fdt_index.path_mask;
+        }
+        fdt_index.paths[slot] = (fdt_path_slot_t){.hash = hash, .node = index};
+
+        const fdt_node_property_t* prop = fdt_FindProperty(node, "compatible");
+        if (prop != NULL)
+        {
+            const char* string = (const char*)fdt_PropertyValue(prop);
+            const char* end    = string + prop->length;
+
+            while (string < end)
+            {
+                const size_t   length          = strlen(string);
+                const uint32_t compatible_hash = fdt_Hash(FDT_FNV_OFFSET_BASIS, string, length);
+
+                slot = compatible_hash & fdt_index.compatible_mask;
+                while (fdt_index.compatibles[slot].node != FDT_INVALID_INDEX)
+                {
+                    slot = (slot + 1U) & fdt_index.compatible_mask;
+                }
+                fdt_index.compatibles[slot] = (fdt_compatible_slot_t){
+                    .hash          = compatible_hash,
+                    .node          = index,
+                    .string_offset = (uint32_t)((const uint8_t*)string - fdt_tree.structs),
+                };
+
+                string += length + 1U;
+            }
+        }
+
+        uint32_t phandle;
+        if ((fdt_index.phandles != NULL) && fdt_NodePhandle(node, &phandle))
+        {
+            fdt_index.phandles[phandle] = index;
+        }
+    }
+
+    return true;
 }
 
 bool srv_fdt_Init(void* fdt_ptr)
@@ -259,7 +644,7 @@ bool srv_fdt_Init(void* fdt_ptr)
     struct fdt_header* header = (struct fdt_header*)fdt_ptr;
 
     /* Make sure this is actually a real DTB */
-    if (fdt_Read32((uint8_t*)&header->magic) != FDT_MAGIC)
+    if (!srv_fdt_CheckHeader(fdt_ptr))
     {
         return false;
     }
@@ -267,34 +652,710 @@ bool srv_fdt_Init(void* fdt_ptr)
     /* Cache a pointer to the FDT header */
     fdt_info_block = fdt_ptr;
 
-    /* Parse the tree */
-    fdt_ParseTree();
+    /*
+     * Every node and property takes at least 12 bytes of the structure block
+     * (a node is a begin token, a name and an end token, a property is a token,
+     * a length and a name offset), which bounds how many there can be without
+     * having to count them first.
+     */
+    const size_t struct_size = fdt_Read32((const uint8_t*)&header->size_dt_struct);
+    const size_t max_entries = (struct_size / FDT_MIN_ENTRY_SIZE) + 1ULL;
+    const size_t arena_size  = max_entries * sizeof(fdt_node_t);
 
-    return true;
+    uint8_t* arena = (uint8_t*)srv_kalloc_EternalAllocAligned(arena_size, _Alignof(fdt_node_t));
+
+    fdt_tree = (fdt_tree_t){
+        .nodes      = (fdt_node_t*)arena,
+        .properties = (fdt_node_property_t*)&arena[arena_size],
+        .node_count = 0U,
+        .prop_count = 0U,
+        .arena_size = arena_size,
+        .structs    = (const uint8_t*)fdt_ptr + fdt_Read32((const uint8_t*)&header->off_dt_struct),
+        .strings    = (const char*)fdt_ptr + fdt_Read32((const uint8_t*)&header->off_dt_strings),
+    };
+
+    /* Parse the tree, then index it so drivers never have to walk it */
+    return fdt_ParseTree() && fdt_BuildIndices();
 }
 
-size_t srv_fdt_GetMemorySize(void)
+static const fdt_node_property_t* fdt_FindProperty(const fdt_node_t* node, const char* name)
 {
-    /* FIXME: This should _really_ be better than this, but I just want this to work for now */
-    const fdt_node_t* memory_node = fdt_FindNodeByName(root_node, "memory@80000000");
-    if (memory_node == NULL)
+    for (const fdt_node_property_t* prop = fdt_Property(node->first_prop); prop != NULL; prop = fdt_Property(prop->next))
     {
-        return 0ULL;
+        if (strcmp(fdt_PropertyName(prop), name) == 0)
+        {
+            return prop;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Find the first node at or after an index that is compatible with a string
+ *
+ * @param[in] first      Index of the first node to consider
+ * @param[in] compatible The compatible string
+ *
+ * @return The node, or @c NULL if there isn't one
+ */
+static const fdt_node_t* fdt_FindCompatibleFrom(uint32_t first, const char* compatible)
+{
+    if (fdt_index.compatibles == NULL)
+    {
+        return NULL;
+    }
+
+    const uint32_t hash = fdt_Hash(FDT_FNV_OFFSET_BASIS, compatible, strlen(compatible));
+
+    for (uint32_t slot = hash & fdt_index.compatible_mask; fdt_index.compatibles[slot].node != FDT_INVALID_INDEX; slot = (slot + 1U) & fdt_index.compatible_mask)
+    {
+        const fdt_compatible_slot_t* entry = &fdt_index.compatibles[slot];
+
+        if ((entry->hash == hash) && (entry->node >= first) && (strcmp((const char*)&fdt_tree.structs[entry->string_offset], compatible) == 0))
+        {
+            return &fdt_tree.nodes[entry->node];
+        }
+    }
+
+    return NULL;
+}
+
+const srv_fdt_node_t* srv_fdt_FindCompatibleNode(const char* compatible)
+{
+    return fdt_FindCompatibleFrom(0U, compatible);
+}
+
+const srv_fdt_node_t* srv_fdt_FindNextCompatibleNode(const srv_fdt_node_t* previous, const char* compatible)
+{
+    return fdt_FindCompatibleFrom((uint32_t)(previous - fdt_tree.nodes) + 1U, compatible);
+}
+
+const srv_fdt_node_t* srv_fdt_FindNodeByPath(const char* path)
+{
+    if ((fdt_index.paths == NULL) || (path[0] != '/'))
+    {
+        return NULL;
+    }
+
+    /* "/" hashes as the empty prefix, the same as the root did when it was indexed */
+    size_t length = strlen(path);
+    while ((length > 0U) && (path[length - 1U] == '/'))
+    {
+        length--;
+    }
+
+    const uint32_t hash = fdt_Hash(FDT_FNV_OFFSET_BASIS, path, length);
+
+    for (uint32_t slot = hash & fdt_index.path_mask; fdt_index.paths[slot].node != FDT_INVALID_INDEX; slot = (slot + 1U) & fdt_index.path_mask)
+    {
+        const fdt_path_slot_t* entry = &fdt_index.paths[slot];
+
+        if ((entry->hash == hash) && fdt_PathMatches(entry->node, path, length))
+        {
+            return &fdt_tree.nodes[entry->node];
+        }
+    }
+
+    /* Not an exact path, but unit addresses may have been left off, which only a walk can resolve */
+    const int32_t offset = srv_fdt_PathOffset(fdt_info_block, path);
+
+    return (offset >= 0) ? fdt_NodeAtOffset((uint32_t)offset) : NULL;
+}
+
+const srv_fdt_node_t* srv_fdt_FindNodeByPhandle(uint32_t phandle)
+{
+    if (fdt_index.phandles != NULL)
+    {
+        return (phandle < fdt_index.phandle_count) ? fdt_Node(fdt_index.phandles[phandle]) : NULL;
+    }
+
+    /* The phandles were too sparse to index (or there aren't any) */
+    uint32_t node_phandle;
+    for (uint32_t index = 0U; index < fdt_tree.node_count; index++)
+    {
+        if (fdt_NodePhandle(&fdt_tree.nodes[index], &node_phandle) && (node_phandle == phandle))
+        {
+            return &fdt_tree.nodes[index];
+        }
     }
 
-    /* Search for the "reg" property */
-    for (size_t prop_index = 0ULL; prop_index < FDT_MAX_PROPERTIES; prop_index++)
+    return NULL;
+}
+
+bool srv_fdt_GetReg(const srv_fdt_node_t* node, size_t index, srv_physical_address_t* base, size_t* size)
+{
+    /* The parent's cell counts describe how the child's "reg" is laid out. These are the spec defaults */
+    uint32_t address_cells = 2U;
+    uint32_t size_cells    = 1U;
+    uint32_t parent_cells  = 0U;
+
+    const fdt_node_t* parent = fdt_Node(node->parent);
+    if (parent != NULL)
     {
-        const fdt_node_property_t* prop = memory_node->properties[prop_index];
+        if (srv_fdt_GetPropertyU32(parent, "#address-cells", &parent_cells))
+        {
+            address_cells = parent_cells;
+        }
 
-        if (strcmp(prop->name, "reg") == 0)
+        if (srv_fdt_GetPropertyU32(parent, "#size-cells", &parent_cells))
         {
-            /* Just return the size in bytes. We don't bother with the upper word */
-            const uint32_t size_lo = fdt_Read32(&prop->value[12]);
+            size_cells = parent_cells;
+        }
+    }
 
-            return size_lo;
+    /* Anything wider than 64 bits can't be represented anyway */
+    if ((address_cells > 2U) || (size_cells > 2U))
+    {
+        return false;
+    }
+
+    const fdt_node_property_t* prop = fdt_FindProperty(node, "reg");
+    if (prop == NULL)
+    {
+        return false;
+    }
+
+    const size_t entry_size = (size_t)(address_cells + size_cells) * sizeof(uint32_t);
+    if ((entry_size == 0U) || (((index + 1U) * entry_size) > prop->length))
+    {
+        return false;
+    }
+
+    const uint8_t* entry = &fdt_PropertyValue(prop)[index * entry_size];
+
+    *base = (srv_physical_address_t)srv_fdt_ReadCells(entry, address_cells);
+    *size = (size_t)srv_fdt_ReadCells(&entry[address_cells * sizeof(uint32_t)], size_cells);
+
+    return true;
+}
+
+bool srv_fdt_GetPropertyU32(const srv_fdt_node_t* node, const char* name, uint32_t* value)
+{
+    const fdt_node_property_t* prop = fdt_FindProperty(node, name);
+    if ((prop == NULL) || (prop->length < sizeof(uint32_t)))
+    {
+        return false;
+    }
+
+    *value = fdt_Read32(fdt_PropertyValue(prop));
+
+    return true;
+}
+
+const void* srv_fdt_GetProperty(const srv_fdt_node_t* node, const char* name, uint32_t* length)
+{
+    const fdt_node_property_t* prop = fdt_FindProperty(node, name);
+    if (prop == NULL)
+    {
+        return NULL;
+    }
+
+    *length = prop->length;
+
+    return fdt_PropertyValue(prop);
+}
+
+const srv_fdt_node_t* srv_fdt_GetParent(const srv_fdt_node_t* node)
+{
+    return fdt_Node(node->parent);
+}
+
+uint64_t srv_fdt_ReadCells(const void* cells, uint32_t count)
+{
+    const uint8_t* cells_as_u8 = (const uint8_t*)cells;
+    uint64_t       number      = 0ULL;
+
+    for (uint32_t cell = 0U; cell < count; cell++)
+    {
+        number = (number << 32U) | fdt_Read32(&cells_as_u8[cell * sizeof(uint32_t)]);
+    }
+
+    return number;
+}
+
+/**
+ * @brief Get a field of a DTB header in CPU byte order
+ */
+#define FDT_HEADER_FIELD(fdt, field) fdt_Read32((const uint8_t*)&((const struct fdt_header*)(fdt))->field)
+
+/**
+ * @brief Get a pointer into a DTB's structure block
+ */
+static inline const uint8_t* fdt_blob_Struct(const void* fdt, uint32_t offset)
+{
+    return (const uint8_t*)fdt + FDT_HEADER_FIELD(fdt, off_dt_struct) + offset;
+}
+
+/**
+ * @brief Read the tag at an offset in the structure block, and find where the next one starts
+ *
+ * @param[in]  fdt         Pointer to the DTB
+ * @param[in]  offset      Offset of the tag
+ * @param[out] next_offset Offset of the tag after it
+ *
+ * @return The tag's token, or @ref FDT_END if @c offset is out of bounds or the tag runs off the end
+ */
+static uint32_t fdt_blob_NextTag(const void* fdt, uint32_t offset, uint32_t* next_offset)
+{
+    const uint32_t struct_size = FDT_HEADER_FIELD(fdt, size_dt_struct);
+
+    if ((offset + sizeof(uint32_t)) > struct_size)
+    {
+        return FDT_END;
+    }
+
+    const uint8_t* tag   = fdt_blob_Struct(fdt, offset);
+    const uint32_t token = fdt_Read32(tag);
+    size_t         next  = offset + sizeof(uint32_t);
+
+    if (token == FDT_BEGIN_NODE)
+    {
+        /* Skip the name, including its NUL terminator */
+        next += fdt_AlignToNextWord(strlen((const char*)&tag[sizeof(uint32_t)]) + 1ULL);
+    }
+    else if (token == FDT_PROP)
+    {
+        if ((next + sizeof(fdt_prop_t)) > struct_size)
+        {
+            return FDT_END;
+        }
+
+        next += sizeof(fdt_prop_t) + fdt_AlignToNextWord(fdt_Read32(&tag[sizeof(uint32_t)]));
+    }
+
+    if (next > struct_size)
+    {
+        return FDT_END;
+    }
+
+    *next_offset = (uint32_t)next;
+
+    return token;
+}
+
+bool srv_fdt_CheckHeader(const void* fdt)
+{
+    if ((fdt == NULL) || (FDT_HEADER_FIELD(fdt, magic) != FDT_MAGIC))
+    {
+        return false;
+    }
+
+    /* Version 16 introduced the layout we parse, and 17 is the current one */
+    if ((FDT_HEADER_FIELD(fdt, version) < 16U) || (FDT_HEADER_FIELD(fdt, last_comp_version) > 17U))
+    {
+        return false;
+    }
+
+    const uint32_t total_size = FDT_HEADER_FIELD(fdt, totalsize);
+
+    return ((uint64_t)FDT_HEADER_FIELD(fdt, off_dt_struct) + FDT_HEADER_FIELD(fdt, size_dt_struct) <= total_size) &&
+           ((uint64_t)FDT_HEADER_FIELD(fdt, off_dt_strings) + FDT_HEADER_FIELD(fdt, size_dt_strings) <= total_size);
+}
+
+size_t srv_fdt_GetTotalSize(const void* fdt)
+{
+    return FDT_HEADER_FIELD(fdt, totalsize);
+}
+
+int32_t srv_fdt_NextNode(const void* fdt, int32_t offset, int32_t* depth)
+{
+    uint32_t next = 0U;
+
+    if (offset < 0)
+    {
+        /* The root node is always first, but there may be NOPs before it */
+        offset = 0;
+        if (depth != NULL)
+        {
+            *depth = -1;
+        }
+    }
+    else if (fdt_blob_NextTag(fdt, (uint32_t)offset, &next) != FDT_BEGIN_NODE)
+    {
+        return SRV_FDT_ERR_BAD_STRUCTURE;
+    }
+    else
+    {
+        offset = (int32_t)next;
+    }
+
+    for (;;)
+    {
+        const uint32_t token = fdt_blob_NextTag(fdt, (uint32_t)offset, &next);
+
+        if (token == FDT_BEGIN_NODE)
+        {
+            if (depth != NULL)
+            {
+                (*depth)++;
+            }
+
+            return offset;
+        }
+        else if (token == FDT_END_NODE)
+        {
+            if ((depth != NULL) && (--(*depth) < 0))
+            {
+                return SRV_FDT_ERR_NOT_FOUND;
+            }
+        }
+        else if ((token != FDT_PROP) && (token != FDT_NOP))
+        {
+            /* FDT_END, or something we don't understand */
+            return SRV_FDT_ERR_NOT_FOUND;
+        }
+
+        offset = (int32_t)next;
+    }
+}
+
+int32_t srv_fdt_FirstSubnode(const void* fdt, int32_t offset)
+{
+    int32_t depth = 0;
+
+    offset = srv_fdt_NextNode(fdt, offset, &depth);
+
+    return ((offset >= 0) && (depth == 1)) ? offset : SRV_FDT_ERR_NOT_FOUND;
+}
+
+int32_t srv_fdt_NextSubnode(const void* fdt, int32_t offset)
+{
+    int32_t depth = 1;
+
+    /* Step over the whole subtree of the current node, until we're back at its level */
+    do
+    {
+        offset = srv_fdt_NextNode(fdt, offset, &depth);
+        if ((offset < 0) || (depth < 1))
+        {
+            return SRV_FDT_ERR_NOT_FOUND;
+        }
+    } while (depth > 1);
+
+    return offset;
+}
+
+const char* srv_fdt_GetName(const void* fdt, int32_t offset)
+{
+    uint32_t next = 0U;
+
+    if ((offset < 0) || (fdt_blob_NextTag(fdt, (uint32_t)offset, &next) != FDT_BEGIN_NODE))
+    {
+        return NULL;
+    }
+
+    return (const char*)fdt_blob_Struct(fdt, (uint32_t)offset + sizeof(uint32_t));
+}
+
+/**
+ * @brief Does a node name match one component of a path?
+ *
+ * @param[in] name      The node's name
+ * @param[in] component The path component
+ * @param[in] length    Length of the path component
+ *
+ * @return @c true if the component names the node
+ */
+static bool fdt_blob_NameMatches(const char* name, const char* component, size_t length)
+{
+    if (strncmp(name, component, length) != 0)
+    {
+        return false;
+    }
+
+    /* Either an exact match, or the component left the unit address off */
+    return (name[length] == '\0') || ((name[length] == '@') && (memchr(component, '@', length) == NULL));
+}
+
+int32_t srv_fdt_PathOffset(const void* fdt, const char* path)
+{
+    if (path[0] != '/')
+    {
+        return SRV_FDT_ERR_NOT_FOUND;
+    }
+
+    int32_t offset = srv_fdt_NextNode(fdt, -1, NULL);
+
+    while (offset >= 0)
+    {
+        while (*path == '/')
+        {
+            path++;
+        }
+
+        if (*path == '\0')
+        {
+            return offset;
+        }
+
+        const char*  slash  = strchr(path, '/');
+        const size_t length = (slash != NULL) ? (size_t)(slash - path) : strlen(path);
+
+        for (offset = srv_fdt_FirstSubnode(fdt, offset); offset >= 0; offset = srv_fdt_NextSubnode(fdt, offset))
+        {
+            if (fdt_blob_NameMatches(srv_fdt_GetName(fdt, offset), path, length))
+            {
+                break;
+            }
+        }
+
+        path += length;
+    }
+
+    return SRV_FDT_ERR_NOT_FOUND;
+}
+
+const void* srv_fdt_GetProp(const void* fdt, int32_t offset, const char* name, uint32_t* length)
+{
+    uint32_t next = 0U;
+
+    if ((offset < 0) || (fdt_blob_NextTag(fdt, (uint32_t)offset, &next) != FDT_BEGIN_NODE))
+    {
+        return NULL;
+    }
+
+    const char*    strings      = (const char*)fdt + FDT_HEADER_FIELD(fdt, off_dt_strings);
+    const uint32_t strings_size = FDT_HEADER_FIELD(fdt, size_dt_strings);
+
+    /* A node's properties all come before its first child */
+    for (;;)
+    {
+        const uint32_t prop_offset = next;
+        const uint32_t token       = fdt_blob_NextTag(fdt, prop_offset, &next);
+
+        if (token == FDT_NOP)
+        {
+            continue;
+        }
+
+        if (token != FDT_PROP)
+        {
+            return NULL;
+        }
+
+        const uint8_t* prop    = fdt_blob_Struct(fdt, prop_offset + sizeof(uint32_t));
+        const uint32_t nameoff = fdt_Read32(&prop[offsetof(fdt_prop_t, nameoff)]);
+
+        if ((nameoff < strings_size) && (strcmp(&strings[nameoff], name) == 0))
+        {
+            if (length != NULL)
+            {
+                *length = fdt_Read32(&prop[offsetof(fdt_prop_t, len)]);
+            }
+
+            return &prop[sizeof(fdt_prop_t)];
+        }
+    }
+}
+
+int32_t srv_fdt_NodeOffsetByCompatible(const void* fdt, int32_t start_offset, const char* compatible)
+{
+    for (int32_t offset = srv_fdt_NextNode(fdt, start_offset, NULL); offset >= 0; offset = srv_fdt_NextNode(fdt, offset, NULL))
+    {
+        uint32_t    length = 0U;
+        const char* list   = (const char*)srv_fdt_GetProp(fdt, offset, "compatible", &length);
+
+        if ((list != NULL) && fdt_StringListContains(list, length, compatible))
+        {
+            return offset;
+        }
+    }
+
+    return SRV_FDT_ERR_NOT_FOUND;
+}
+
+void srv_fdt_GetCells(const void* fdt, int32_t offset, uint32_t* address_cells, uint32_t* size_cells)
+{
+    const void* cells = srv_fdt_GetProp(fdt, offset, "#address-cells", NULL);
+    *address_cells    = (cells != NULL) ? fdt_Read32((const uint8_t*)cells) : 2U;
+
+    cells       = srv_fdt_GetProp(fdt, offset, "#size-cells", NULL);
+    *size_cells = (cells != NULL) ? fdt_Read32((const uint8_t*)cells) : 1U;
+}
+
+/**
+ * @brief Sort memory ranges by base address
+ *
+ * @details There are only ever a handful, so an insertion sort is plenty
+ *
+ * @param[in,out] ranges The ranges to sort
+ * @param[in]     count  Number of ranges
+ */
+static void fdt_SortRanges(srv_physical_range_t* ranges, size_t count)
+{
+    for (size_t i = 1U; i < count; i++)
+    {
+        const srv_physical_range_t range = ranges[i];
+        size_t                     j     = i;
+
+        while ((j > 0U) && (ranges[j - 1U].base > range.base))
+        {
+            ranges[j] = ranges[j - 1U];
+            j--;
+        }
+
+        ranges[j] = range;
+    }
+}
+
+/**
+ * @brief Add a range to a list, unless it is empty
+ *
+ * @param[in,out] ranges The list
+ * @param[in,out] count  Number of ranges in the list
+ * @param[in]     base   Base address of the range
+ * @param[in]     size   Size of the range, in bytes
+ *
+ * @return @c false if the list is full
+ */
+static bool fdt_AddRange(srv_physical_range_t* ranges, size_t* count, uint64_t base, uint64_t size)
+{
+    if (size == 0U)
+    {
+        return true;
+    }
+
+    if (*count == SRV_FDT_MAX_MEMORY_RANGES)
+    {
+        return false;
+    }
+
+    ranges[*count] = (srv_physical_range_t){.base = (srv_physical_address_t)base, .size = (size_t)size};
+    (*count)++;
+
+    return true;
+}
+
+/**
+ * @brief Add every entry of a node's "reg" property to a list
+ *
+ * @param[in]     fdt           Pointer to the DTB
+ * @param[in]     offset        Offset of the node
+ * @param[in]     address_cells The parent's @c #address-cells
+ * @param[in]     size_cells    The parent's @c #size-cells
+ * @param[in,out] ranges        The list
+ * @param[in,out] count         Number of ranges in the list
+ *
+ * @return @c false if the list filled up
+ */
+static bool fdt_AddRegRanges(const void* fdt, int32_t offset, uint32_t address_cells, uint32_t size_cells, srv_physical_range_t* ranges, size_t* count)
+{
+    uint32_t       length = 0U;
+    const uint8_t* reg    = (const uint8_t*)srv_fdt_GetProp(fdt, offset, "reg", &length);
+    const size_t   stride = (size_t)(address_cells + size_cells) * sizeof(uint32_t);
+
+    if ((reg == NULL) || (stride == 0U) || (address_cells > 2U) || (size_cells > 2U))
+    {
+        return true;
+    }
+
+    for (size_t entry = 0U; (entry + stride) <= length; entry += stride)
+    {
+        const uint64_t base = srv_fdt_ReadCells(&reg[entry], address_cells);
+        const uint64_t size = srv_fdt_ReadCells(&reg[entry + (address_cells * sizeof(uint32_t))], size_cells);
+
+        if (!fdt_AddRange(ranges, count, base, size))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool srv_fdt_IsEnabled(const void* fdt, int32_t offset)
+{
+    const char* status = (const char*)srv_fdt_GetProp(fdt, offset, "status", NULL);
+
+    return (status == NULL) || (strcmp(status, "okay") == 0) || (strcmp(status, "ok") == 0);
+}
+
+bool srv_fdt_GetMemoryMap(const void* fdt, srv_fdt_memory_map_t* map)
+{
+    uint32_t address_cells = 0U;
+    uint32_t size_cells    = 0U;
+
+    map->usable_count   = 0U;
+    map->reserved_count = 0U;
+
+    /* Memory nodes hang off the root, so they all share its cell sizes */
+    srv_fdt_GetCells(fdt, 0, &address_cells, &size_cells);
+
+    int32_t depth = 0;
+    for (int32_t offset = srv_fdt_NextNode(fdt, 0, &depth); (offset >= 0) && (depth > 0); offset = srv_fdt_NextNode(fdt, offset, &depth))
+    {
+        const char* device_type = (const char*)srv_fdt_GetProp(fdt, offset, "device_type", NULL);
+
+        if ((depth == 1) && (device_type != NULL) && (strcmp(device_type, "memory") == 0) && srv_fdt_IsEnabled(fdt, offset))
+        {
+            /* Losing a bank only costs us some RAM, so a full list isn't an error */
+            (void)fdt_AddRegRanges(fdt, offset, address_cells, size_cells, map->usable, &map->usable_count);
+        }
+    }
+
+    /* The memory reservation block is a list of 64-bit address and size pairs, ending with an empty one */
+    const uint8_t* rsvmap = (const uint8_t*)fdt + FDT_HEADER_FIELD(fdt, off_mem_rsvmap);
+    for (;; rsvmap += 2U * sizeof(uint64_t))
+    {
+        const uint64_t base = srv_fdt_ReadCells(rsvmap, 2U);
+        const uint64_t size = srv_fdt_ReadCells(&rsvmap[sizeof(uint64_t)], 2U);
+
+        if ((base == 0U) && (size == 0U))
+        {
+            break;
+        }
+
+        if (!fdt_AddRange(map->reserved, &map->reserved_count, base, size))
+        {
+            return false;
+        }
+    }
+
+    /* Firmware (e.g. OpenSBI) describes the memory it keeps for itself here */
+    const int32_t reserved_memory = srv_fdt_PathOffset(fdt, "/reserved-memory");
+    if (reserved_memory >= 0)
+    {
+        srv_fdt_GetCells(fdt, reserved_memory, &address_cells, &size_cells);
+
+        for (int32_t offset = srv_fdt_FirstSubnode(fdt, reserved_memory); offset >= 0; offset = srv_fdt_NextSubnode(fdt, offset))
+        {
+            if (srv_fdt_IsEnabled(fdt, offset) && !fdt_AddRegRanges(fdt, offset, address_cells, size_cells, map->reserved, &map->reserved_count))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (!fdt_AddRange(map->reserved, &map->reserved_count, (uintptr_t)fdt, srv_fdt_GetTotalSize(fdt)))
+    {
+        return false;
+    }
+
+    fdt_SortRanges(map->usable, map->usable_count);
+    fdt_SortRanges(map->reserved, map->reserved_count);
+
+    /* Merge banks that touch or overlap, so the page allocator sees as few regions as possible */
+    size_t merged = 0U;
+    for (size_t range = 0U; range < map->usable_count; range++)
+    {
+        const srv_physical_range_t bank = map->usable[range];
+        srv_physical_range_t*      last = (merged != 0U) ? &map->usable[merged - 1U] : NULL;
+
+        if ((last != NULL) && (bank.base <= (last->base + last->size)))
+        {
+            if ((bank.base + bank.size) > (last->base + last->size))
+            {
+                last->size = (bank.base + bank.size) - last->base;
+            }
+        }
+        else
+        {
+            map->usable[merged] = bank;
+            merged++;
         }
     }
+    map->usable_count = merged;
 
-    return 0ULL;
+    return map->usable_count != 0U;
 }
@@ -5,10 +5,31 @@
  * @copyright SPDX-License-Identifier: GPL-3.0-or-later
  ****************************************************************/
 
+#ifndef FDT_H
+#define FDT_H
+
 #include <hal.h>
 #include <stdint.h>
 #include <stddef.h>
 
+#define SRV_FDT_ERR_NOT_FOUND     (-1) /**< The node or property doesn't exist */
+#define SRV_FDT_ERR_BAD_STRUCTURE (-2) /**< The structure block is malformed */
+
+#define SRV_FDT_MAX_MEMORY_RANGES 16U /**< Most usable or reserved ranges a memory map can hold */
+
+typedef struct fdt_node srv_fdt_node_t; /**< Opaque handle to a node of the parsed tree */
+
+/**
+ * @brief Physical memory layout described by a DTB
+ */
+typedef struct
+{
+    srv_physical_range_t usable[SRV_FDT_MAX_MEMORY_RANGES];   /**< RAM banks, sorted by base, with touching banks merged */
+    size_t               usable_count;                        /**< Number of entries in @ref usable */
+    srv_physical_range_t reserved[SRV_FDT_MAX_MEMORY_RANGES]; /**< Ranges that must not be allocated, sorted by base. These may overlap */
+    size_t               reserved_count;                      /**< Number of entries in @ref reserved */
+} srv_fdt_memory_map_t;
+
 /**
  * @brief FDT Header
  *
@@ -34,6 +55,8 @@ struct fdt_header
  * @param[in] fdt_ptr Pointer to the FDT
  *
  * @warning This function MUST be called before the Virtual Memory subsystem has been configured!
+ * @note    The parsed tree lives in a single arena on the eternal heap, so
+ *          no other allocator needs to be up yet
  *
  * @return true     The FDT driver was initialized successfully
  * @return false    An error occurred during initialization, or the FDT provided is invalid
@@ -41,8 +64,250 @@ struct fdt_header
 bool srv_fdt_Init(void* fdt_ptr);
 
 /**
- * @brief Get the amount of memory installed in the system
+ * @brief Find the first node whose "compatible" list contains a string
+ *
+ * @details Resolved through a hash table built by @ref srv_fdt_Init
+ *
+ * @param[in] compatible The compatible string, e.g. @c "ns16550a"
+ *
+ * @return Handle to the node
+ * @return @c NULL if there isn't a compatible node
+ */
+const srv_fdt_node_t* srv_fdt_FindCompatibleNode(const char* compatible);
+
+/**
+ * @brief Find the next node, in document order, whose "compatible" list contains a string
+ *
+ * @param[in] previous   A node returned by the last lookup for @c compatible
+ * @param[in] compatible The compatible string
+ *
+ * @return Handle to the node
+ * @return @c NULL if there are no more compatible nodes
+ */
+const srv_fdt_node_t* srv_fdt_FindNextCompatibleNode(const srv_fdt_node_t* previous, const char* compatible);
+
+/**
+ * @brief Find a node by its full path
+ *
+ * @param[in] path The path, e.g. @c "/soc/serial@10000000". Unit addresses may
+ *                 be left off, at the cost of a walk of the blob
+ *
+ * @return Handle to the node
+ * @return @c NULL if there is no such node
+ */
+const srv_fdt_node_t* srv_fdt_FindNodeByPath(const char* path);
+
+/**
+ * @brief Find the node a phandle (e.g. from "interrupt-parent") refers to
+ *
+ * @param[in] phandle The phandle
+ *
+ * @return Handle to the node
+ * @return @c NULL if no node has that phandle
+ */
+const srv_fdt_node_t* srv_fdt_FindNodeByPhandle(uint32_t phandle);
+
+/**
+ * @brief Get one entry of a node's "reg" property
+ *
+ * @details The entry is decoded using the @c #address-cells and @c #size-cells
+ *          of the node's parent
+ *
+ * @param[in]  node  The node
+ * @param[in]  index The entry to get
+ * @param[out] base  Base address of the region
+ * @param[out] size  Size of the region, in bytes
+ *
+ * @return true  @c base and @c size have been filled
+ * @return false The node has no such entry
+ */
+bool srv_fdt_GetReg(const srv_fdt_node_t* node, size_t index, srv_physical_address_t* base, size_t* size);
+
+/**
+ * @brief Get the first cell of a property as a number
+ *
+ * @param[in]  node  The node
+ * @param[in]  name  Name of the property, e.g. @c "clock-frequency"
+ * @param[out] value The value of the property
+ *
+ * @return true  @c value has been filled
+ * @return false The node has no such property
+ */
+bool srv_fdt_GetPropertyU32(const srv_fdt_node_t* node, const char* name, uint32_t* value);
+
+/**
+ * @brief Get a property's raw value
+ *
+ * @param[in]  node   The node
+ * @param[in]  name   Name of the property, e.g. @c "interrupts-extended"
+ * @param[out] length Length of the value, in bytes
+ *
+ * @return Pointer to the value, whose cells are big-endian (see @ref srv_fdt_ReadCells)
+ * @return @c NULL if the node has no such property
+ */
+const void* srv_fdt_GetProperty(const srv_fdt_node_t* node, const char* name, uint32_t* length);
+
+/**
+ * @brief Get a node's parent
+ *
+ * @param[in] node The node
+ *
+ * @return Handle to the parent
+ * @return @c NULL for the root node
+ */
+const srv_fdt_node_t* srv_fdt_GetParent(const srv_fdt_node_t* node);
+
+/*
+ * In-place query API
+ *
+ * These walk the DTB blob directly and never allocate, so they can be used
+ * from srv_arch_Init() before any allocator (or the parsed tree) exists.
+ * Nodes are named by their offset into the structure block, the root node
+ * being at offset 0. Negative offsets are one of the SRV_FDT_ERR_ codes.
+ */
+
+/**
+ * @brief Sanity check a DTB header
+ *
+ * @param[in] fdt Pointer to the DTB
+ *
+ * @return @c true if the magic and version are ones we understand
+ */
+bool srv_fdt_CheckHeader(const void* fdt);
+
+/**
+ * @brief Get the size of the whole DTB blob
  *
- * @return The amount of memory in the system, in bytes
+ * @param[in] fdt Pointer to the DTB
+ *
+ * @return Size of the blob, in bytes
+ */
+size_t srv_fdt_GetTotalSize(const void* fdt);
+
+/**
+ * @brief Get the next node in document order
+ *
+ * @param[in]     fdt    Pointer to the DTB
+ * @param[in]     offset Offset of the current node, or a negative value to get the root node
+ * @param[in,out] depth  Depth tracker, which is incremented for each level descended and
+ *                       decremented for each level climbed. May be @c NULL
+ *
+ * @return Offset of the next node
+ * @return @ref SRV_FDT_ERR_NOT_FOUND at the end of the tree, or once @c depth drops below 0
+ */
+int32_t srv_fdt_NextNode(const void* fdt, int32_t offset, int32_t* depth);
+
+/**
+ * @brief Get the first child of a node
+ *
+ * @param[in] fdt    Pointer to the DTB
+ * @param[in] offset Offset of the parent node
+ *
+ * @return Offset of the child, or @ref SRV_FDT_ERR_NOT_FOUND if it has none
+ */
+int32_t srv_fdt_FirstSubnode(const void* fdt, int32_t offset);
+
+/**
+ * @brief Get the next sibling of a node
+ *
+ * @param[in] fdt    Pointer to the DTB
+ * @param[in] offset Offset of the current node
+ *
+ * @return Offset of the sibling, or @ref SRV_FDT_ERR_NOT_FOUND if it's the last one
+ */
+int32_t srv_fdt_NextSubnode(const void* fdt, int32_t offset);
+
+/**
+ * @brief Find a node by its full path, e.g. @c "/soc/serial@10000000"
+ *
+ * @details As with libfdt, a path component without a unit address matches a
+ *          node that has one, so @c "/memory" finds @c memory@80000000
+ *
+ * @param[in] fdt  Pointer to the DTB
+ * @param[in] path The absolute path of the node
+ *
+ * @return Offset of the node, or @ref SRV_FDT_ERR_NOT_FOUND
+ */
+int32_t srv_fdt_PathOffset(const void* fdt, const char* path);
+
+/**
+ * @brief Find the next node whose "compatible" list contains a string
+ *
+ * @param[in] fdt          Pointer to the DTB
+ * @param[in] start_offset Node to search after, or a negative value to search the whole tree
+ * @param[in] compatible   The compatible string to look for
+ *
+ * @return Offset of the node, or @ref SRV_FDT_ERR_NOT_FOUND
+ */
+int32_t srv_fdt_NodeOffsetByCompatible(const void* fdt, int32_t start_offset, const char* compatible);
+
+/**
+ * @brief Get the name of a node
+ *
+ * @param[in] fdt    Pointer to the DTB
+ * @param[in] offset Offset of the node
+ *
+ * @return The node's name (empty for the root), or @c NULL if @c offset isn't a node
+ */
+const char* srv_fdt_GetName(const void* fdt, int32_t offset);
+
+/**
+ * @brief Get the value of one of a node's properties
+ *
+ * @param[in]  fdt    Pointer to the DTB
+ * @param[in]  offset Offset of the node
+ * @param[in]  name   Name of the property
+ * @param[out] length Length of the value, in bytes. May be @c NULL
+ *
+ * @return Pointer to the value inside the DTB, or @c NULL if the node doesn't have the property
  */
-size_t srv_fdt_GetMemorySize(void);
+const void* srv_fdt_GetProp(const void* fdt, int32_t offset, const char* name, uint32_t* length);
+
+/**
+ * @brief Is a node switched on?
+ *
+ * @param[in] fdt    Pointer to the DTB
+ * @param[in] offset Offset of the node
+ *
+ * @return @c true if it has no "status", or its status is "okay" (or the older "ok")
+ */
+bool srv_fdt_IsEnabled(const void* fdt, int32_t offset);
+
+/**
+ * @brief Get the @c #address-cells and @c #size-cells a node gives its children
+ *
+ * @param[in]  fdt           Pointer to the DTB
+ * @param[in]  offset        Offset of the parent node
+ * @param[out] address_cells Number of cells in a child's address (2 if unspecified)
+ * @param[out] size_cells    Number of cells in a child's size (1 if unspecified)
+ */
+void srv_fdt_GetCells(const void* fdt, int32_t offset, uint32_t* address_cells, uint32_t* size_cells);
+
+/**
+ * @brief Read a big endian number made of 32-bit cells
+ *
+ * @param[in] cells Pointer to the first cell
+ * @param[in] count Number of cells (at most 2)
+ *
+ * @return The number
+ */
+uint64_t srv_fdt_ReadCells(const void* cells, uint32_t count);
+
+/**
+ * @brief Discover every bank of RAM, and everything in it that is already spoken for
+ *
+ * @details RAM comes from each enabled node with a @c device_type of "memory".
+ *          The reserved ranges are the memory reservation block, every
+ *          statically placed child of @c /reserved-memory, and the DTB blob
+ *          itself. Dynamically placed reservations (a "size" but no "reg") are
+ *          left to whoever wants them.
+ *
+ * @param[in]  fdt Pointer to the DTB
+ * @param[out] map The memory map to fill
+ *
+ * @return true  @c map has been filled. Banks past @ref SRV_FDT_MAX_MEMORY_RANGES are left out
+ * @return false There is no usable RAM, or too many reservations to record them all
+ */
+bool srv_fdt_GetMemoryMap(const void* fdt, srv_fdt_memory_map_t* map);
+
+#endif
@@ -0,0 +1,346 @@
+/****************************************************************
+ * @file    plic.c
+ * @brief   Implementation of @ref plic.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <drivers/irq/plic.h>
+
+#include <drivers/fdt/fdt.h>
+#include <mm/kalloc.h>
+#include <smp/percpu.h>
+#include <sync/spinlock.h>
+
+#define PLIC_PRIORITY_BASE  0x000000U  /**< Source priorities, one word per source */
+#define PLIC_ENABLE_BASE    0x002000U  /**< Enable bits, a block per context */
+#define PLIC_ENABLE_STRIDE  0x80U      /**< Size of a context's enable block */
+#define PLIC_CONTEXT_BASE   0x200000U  /**< Threshold and claim registers, a block per context */
+#define PLIC_CONTEXT_STRIDE 0x1000U    /**< Size of a context's threshold and claim block */
+#define PLIC_CONTEXT_CLAIM  4U         /**< Offset of the claim/complete register in a context's block */
+#define PLIC_MAX_SOURCES    1023U      /**< Highest source number the PLIC can have */
+#define PLIC_SUPERVISOR_IRQ 9U         /**< Cause of a supervisor external interrupt, as the hart's interrupt controller numbers it */
+#define PLIC_NO_CONTEXT     UINT32_MAX /**< A hart or CPU without a supervisor context */
+#define PLIC_NO_CPU         UINT32_MAX /**< A source routed nowhere */
+
+/**
+ * @brief A source's handler and where it is routed
+ */
+typedef struct
+{
+    srv_plic_handler_t handler;  /**< Run when the source interrupts, or @c NULL if it was never registered */
+    void*              argument; /**< Passed to @ref handler */
+    uint64_t           count;    /**< Times the source has interrupted. Bumped atomically, since it can be claimed on two CPUs while it moves */
+    uint32_t           cpu;      /**< Logical number of the CPU it is routed to, or @ref PLIC_NO_CPU */
+} plic_source_t;
+
+/**
+ * @brief A hart's supervisor context, as the Device Tree describes it
+ */
+typedef struct
+{
+    uint32_t hart_id; /**< Hardware ID of the hart */
+    uint32_t context; /**< PLIC context that interrupts it in supervisor mode */
+} plic_hart_t;
+
+/**
+ * @brief State of the (single) PLIC
+ */
+typedef struct
+{
+    volatile uint8_t*  base;                          /**< MMIO base of the register block */
+    uint32_t           source_count;                  /**< Highest source number */
+    plic_source_t*     sources;                       /**< Indexed by source number. Entry 0 is unused, since source 0 means none */
+    uint32_t           hart_count;                    /**< Valid entries in @ref harts */
+    plic_hart_t        harts[SRV_HAL_MAX_CPUS];       /**< Every hart's supervisor context */
+    volatile uint32_t* claim[SRV_HAL_MAX_CPUS];       /**< Each CPU's claim register, or @c NULL until it calls @ref srv_plic_InitCPU */
+    uint32_t           cpu_context[SRV_HAL_MAX_CPUS]; /**< Each CPU's context, or @ref PLIC_NO_CONTEXT */
+    bool               present;                       /**< @ref srv_plic_Init succeeded */
+    srv_spinlock_t     lock;                          /**< Serialises changes to the enable bits and routing */
+} plic_t;
+
+static plic_t plic = {.lock = SRV_SPINLOCK_INIT("plic")};
+
+static inline volatile uint32_t* plic_Register(uint32_t offset)
+{
+    return (volatile uint32_t*)(plic.base + offset);
+}
+
+static inline volatile uint32_t* plic_EnableWord(uint32_t context, uint32_t source)
+{
+    return plic_Register(PLIC_ENABLE_BASE + (context * PLIC_ENABLE_STRIDE) + ((source / 32U) * sizeof(uint32_t)));
+}
+
+static inline volatile uint32_t* plic_ContextRegister(uint32_t context, uint32_t offset)
+{
+    return plic_Register(PLIC_CONTEXT_BASE + (context * PLIC_CONTEXT_STRIDE) + offset);
+}
+
+/**
+ * @brief Turn a source's enable bit on or off in one context
+ *
+ * @note Must be called with the lock held, since the word is shared with 31 other sources
+ */
+static inline void plic_SetEnabledLocked(uint32_t context, uint32_t source, bool enabled)
+{
+    volatile uint32_t* word = plic_EnableWord(context, source);
+    const uint32_t     bit  = 1U << (source % 32U);
+
+    *word = enabled ? (*word | bit) : (*word & ~bit);
+}
+
+/**
+ * @brief Find the hart a context in "interrupts-extended" belongs to
+ *
+ * @param[in]  controller The hart's interrupt controller node
+ * @param[out] hart_id    Hardware ID of the hart
+ *
+ * @return @c false if the controller isn't inside a CPU node
+ */
+static bool plic_HartOfController(const srv_fdt_node_t* controller, uint32_t* hart_id)
+{
+    const srv_fdt_node_t*  cpu  = srv_fdt_GetParent(controller);
+    srv_physical_address_t id   = 0U;
+    size_t                 size = 0U;
+
+    if ((cpu == NULL) || !srv_fdt_GetReg(cpu, 0U, &id, &size))
+    {
+        return false;
+    }
+
+    *hart_id = (uint32_t)id;
+
+    return true;
+}
+
+/**
+ * @brief Record which context interrupts each hart in supervisor mode
+ *
+ * @details "interrupts-extended" lists a (controller, interrupt) pair per
+ *          context, in context order. Pairs for machine mode, or for no mode
+ *          at all, are skipped.
+ *
+ * @param[in] node The PLIC node
+ */
+static void plic_FindContexts(const srv_fdt_node_t* node)
+{
+    uint32_t       length = 0U;
+    const uint8_t* cells  = (const uint8_t*)srv_fdt_GetProperty(node, "interrupts-extended", &length);
+    uint32_t       offset = 0U;
+
+    for (uint32_t context = 0U; (cells != NULL) && ((offset + (2U * sizeof(uint32_t))) <= length); context++)
+    {
+        const srv_fdt_node_t* controller      = srv_fdt_FindNodeByPhandle((uint32_t)srv_fdt_ReadCells(&cells[offset], 1U));
+        uint32_t              interrupt_cells = 1U;
+
+        if (controller == NULL)
+        {
+            return;
+        }
+
+        (void)srv_fdt_GetPropertyU32(controller, "#interrupt-cells", &interrupt_cells);
+
+        const uint32_t irq     = (uint32_t)srv_fdt_ReadCells(&cells[offset + sizeof(uint32_t)], 1U);
+        uint32_t       hart_id = 0U;
+
+        if ((irq == PLIC_SUPERVISOR_IRQ) && (plic.hart_count < SRV_HAL_MAX_CPUS) && plic_HartOfController(controller, &hart_id))
+        {
+            plic.harts[plic.hart_count] = (plic_hart_t){.hart_id = hart_id, .context = context};
+            plic.hart_count++;
+        }
+
+        offset += (1U + interrupt_cells) * sizeof(uint32_t);
+    }
+}
+
+/**
+ * @brief Get a CPU's context
+ *
+ * @return The context, or @ref PLIC_NO_CONTEXT if the CPU hasn't called @ref srv_plic_InitCPU
+ */
+static inline uint32_t plic_ContextOf(uint32_t cpu)
+{
+    return (cpu < SRV_HAL_MAX_CPUS) ? plic.cpu_context[cpu] : PLIC_NO_CONTEXT;
+}
+
+/**
+ * @brief Move a source's enable bit to another CPU's context
+ *
+ * @note Must be called with the lock held
+ */
+static void plic_RouteLocked(uint32_t source, uint32_t cpu)
+{
+    plic_source_t* entry = &plic.sources[source];
+
+    if (entry->cpu != PLIC_NO_CPU)
+    {
+        plic_SetEnabledLocked(plic.cpu_context[entry->cpu], source, false);
+    }
+
+    plic_SetEnabledLocked(plic.cpu_context[cpu], source, true);
+    entry->cpu = cpu;
+}
+
+bool srv_plic_Init(void)
+{
+    const srv_fdt_node_t* node = srv_fdt_FindCompatibleNode("riscv,plic0");
+    if (node == NULL)
+    {
+        node = srv_fdt_FindCompatibleNode("sifive,plic-1.0.0");
+    }
+
+    srv_physical_address_t base         = 0U;
+    size_t                 size         = 0U;
+    uint32_t               source_count = 0U;
+    if ((node == NULL) || !srv_fdt_GetReg(node, 0U, &base, &size) || !srv_fdt_GetPropertyU32(node, "riscv,ndev", &source_count))
+    {
+        return false;
+    }
+
+    if ((source_count == 0U) || (source_count > PLIC_MAX_SOURCES))
+    {
+        return false;
+    }
+
+    plic.sources = (plic_source_t*)srv_kmalloc((source_count + 1U) * sizeof(plic_source_t), 0U);
+    if (plic.sources == NULL)
+    {
+        return false;
+    }
+
+    /* The Kernel runs identity mapped, so the register block is at its physical address */
+    plic.base         = (volatile uint8_t*)base;
+    plic.source_count = source_count;
+
+    plic_FindContexts(node);
+
+    for (uint32_t cpu = 0U; cpu < SRV_HAL_MAX_CPUS; cpu++)
+    {
+        plic.cpu_context[cpu] = PLIC_NO_CONTEXT;
+    }
+
+    /* Whatever the firmware left behind, nothing interrupts until a driver asks for it */
+    for (uint32_t source = 0U; source <= source_count; source++)
+    {
+        plic.sources[source] = (plic_source_t){.cpu = PLIC_NO_CPU};
+        *plic_Register(PLIC_PRIORITY_BASE + (source * sizeof(uint32_t))) = 0U;
+    }
+
+    for (uint32_t hart = 0U; hart < plic.hart_count; hart++)
+    {
+        for (uint32_t source = 0U; source <= source_count; source += 32U)
+        {
+            *plic_EnableWord(plic.harts[hart].context, source) = 0U;
+        }
+    }
+
+    plic.present = true;
+
+    return true;
+}
+
+void srv_plic_InitCPU(void)
+{
+    if (!plic.present)
+    {
+        return;
+    }
+
+    const uint32_t cpu         = srv_hal_GetExecutingCPU();
+    const uint32_t hardware_id = SRV_PERCPU(hardware_id);
+
+    for (uint32_t hart = 0U; hart < plic.hart_count; hart++)
+    {
+        if (plic.harts[hart].hart_id == hardware_id)
+        {
+            const uint32_t context = plic.harts[hart].context;
+
+            /* Let every priority through. Masking is done per source */
+            *plic_ContextRegister(context, 0U) = 0U;
+
+            plic.claim[cpu] = plic_ContextRegister(context, PLIC_CONTEXT_CLAIM);
+            __atomic_store_n(&plic.cpu_context[cpu], context, __ATOMIC_RELEASE);
+
+            srv_hal_EnableExternalInterrupts();
+            return;
+        }
+    }
+}
+
+bool srv_plic_Register(uint32_t source, srv_plic_handler_t handler, void* argument)
+{
+    const uint32_t cpu = srv_hal_GetExecutingCPU();
+
+    if (!plic.present || (source == 0U) || (source > plic.source_count) || (plic_ContextOf(cpu) == PLIC_NO_CONTEXT))
+    {
+        return false;
+    }
+
+    srv_spinlock_Lock(&plic.lock);
+
+    plic.sources[source].handler  = handler;
+    plic.sources[source].argument = argument;
+    plic_RouteLocked(source, cpu);
+
+    srv_spinlock_Unlock(&plic.lock);
+
+    return srv_plic_SetPriority(source, SRV_PLIC_DEFAULT_PRIORITY);
+}
+
+bool srv_plic_SetPriority(uint32_t source, uint32_t priority)
+{
+    if (!plic.present || (source == 0U) || (source > plic.source_count))
+    {
+        return false;
+    }
+
+    /* A register of its own, so there's nothing to lock */
+    *plic_Register(PLIC_PRIORITY_BASE + (source * sizeof(uint32_t))) = priority;
+
+    return true;
+}
+
+bool srv_plic_SetAffinity(uint32_t source, uint32_t cpu)
+{
+    if (!plic.present || (source == 0U) || (source > plic.source_count) || (plic_ContextOf(cpu) == PLIC_NO_CONTEXT))
+    {
+        return false;
+    }
+
+    srv_spinlock_Lock(&plic.lock);
+    plic_RouteLocked(source, cpu);
+    srv_spinlock_Unlock(&plic.lock);
+
+    return true;
+}
+
+uint64_t srv_plic_GetCount(uint32_t source)
+{
+    if (!plic.present || (source == 0U) || (source > plic.source_count))
+    {
+        return 0U;
+    }
+
+    return __atomic_load_n(&plic.sources[source].count, __ATOMIC_RELAXED);
+}
+
+void srv_plic_HandleInterrupt(void)
+{
+    volatile uint32_t* claim = plic.claim[srv_hal_GetExecutingCPU()];
+
+    /* Claiming again as soon as one is done picks up anything that came in meanwhile, without another trap */
+    for (uint32_t source = *claim; source != 0U; source = *claim)
+    {
+        plic_source_t* entry = &plic.sources[source];
+
+        /* Usually only this CPU counts the source, but after srv_plic_SetAffinity the old one may still be finishing a claim */
+        __atomic_fetch_add(&entry->count, 1U, __ATOMIC_RELAXED);
+
+        if (entry->handler != NULL)
+        {
+            entry->handler(entry->argument);
+        }
+
+        *claim = source;
+    }
+}
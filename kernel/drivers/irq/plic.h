@@ -0,0 +1,105 @@
+/****************************************************************
+ * @file    plic.h
+ * @brief   RISC-V Platform-Level Interrupt Controller driver
+ *
+ * @details Every interrupt source is routed to exactly one CPU, so its
+ *          handler only ever runs there and the source's state stays in
+ *          that CPU's cache. Each source counts how often it fires. Those
+ *          counts show which sources are worth moving to another CPU with
+ *          @ref srv_plic_SetAffinity.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef PLIC_H
+#define PLIC_H
+
+#include <hal.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SRV_PLIC_DEFAULT_PRIORITY 1U /**< Priority a source gets when its handler is registered. 0 would mask it */
+
+/**
+ * @brief Function run when a source interrupts
+ *
+ * @details Runs on the CPU the source is routed to, with interrupts masked
+ *
+ * @param[in] argument The value given to @ref srv_plic_Register
+ */
+typedef void (*srv_plic_handler_t)(void* argument);
+
+/**
+ * @brief Find the PLIC in the Device Tree and mask every source
+ *
+ * @details Looks for the first node compatible with @c "riscv,plic0" or
+ *          @c "sifive,plic-1.0.0". Which context belongs to which hart comes
+ *          from its @c interrupts-extended property.
+ *
+ * @warning The FDT driver and the Kernel heap must be initialized first
+ *
+ * @return true  The PLIC was found and initialized
+ * @return false There is no usable PLIC in the Device Tree
+ */
+bool srv_plic_Init(void);
+
+/**
+ * @brief Let the PLIC interrupt the executing CPU
+ *
+ * @details Called once by every CPU. Does nothing if there is no PLIC.
+ */
+void srv_plic_InitCPU(void);
+
+/**
+ * @brief Give a source its handler and unmask it, routed to the executing CPU
+ *
+ * @param[in] source   The source number, from a device's "interrupts" property
+ * @param[in] handler  Run when the source interrupts
+ * @param[in] argument Passed to @c handler
+ *
+ * @return @c false if there is no such source, or the executing CPU can't take PLIC interrupts
+ */
+bool srv_plic_Register(uint32_t source, srv_plic_handler_t handler, void* argument);
+
+/**
+ * @brief Set a source's priority
+ *
+ * @details When several sources are pending on a CPU, the highest priority
+ *          is handled first
+ *
+ * @param[in] source   The source number
+ * @param[in] priority The priority. 0 masks the source
+ *
+ * @return @c false if there is no such source
+ */
+bool srv_plic_SetPriority(uint32_t source, uint32_t priority);
+
+/**
+ * @brief Route a source to a different CPU
+ *
+ * @param[in] source The source number
+ * @param[in] cpu    Logical number of the online CPU to handle it from now on
+ *
+ * @return @c false if there is no such source, or the CPU can't take PLIC interrupts
+ */
+bool srv_plic_SetAffinity(uint32_t source, uint32_t cpu);
+
+/**
+ * @brief Get how many times a source has interrupted
+ *
+ * @param[in] source The source number
+ *
+ * @return The count, or 0 if there is no such source
+ */
+uint64_t srv_plic_GetCount(uint32_t source);
+
+/**
+ * @brief Handle every source pending on the executing CPU
+ *
+ * @details Called from the external interrupt. Sources are claimed and
+ *          completed one after the other until none are left, so a burst
+ *          costs one trap rather than one each.
+ */
+void srv_plic_HandleInterrupt(void);
+
+#endif
@@ -0,0 +1,303 @@
+/****************************************************************
+ * @file    ns16550.c
+ * @brief   Implementation of @ref ns16550.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <drivers/uart/ns16550.h>
+
+#include <drivers/fdt/fdt.h>
+#include <stdio.h>
+#include <sync/spinlock.h>
+
+#define NS16550_REG_THR 0U /**< Transmit Holding Register (write) */
+#define NS16550_REG_DLL 0U /**< Divisor Latch low byte (when LCR.DLAB is set) */
+#define NS16550_REG_IER 1U /**< Interrupt Enable Register */
+#define NS16550_REG_DLM 1U /**< Divisor Latch high byte (when LCR.DLAB is set) */
+#define NS16550_REG_IIR 2U /**< Interrupt Identification Register (read) */
+#define NS16550_REG_FCR 2U /**< FIFO Control Register (write) */
+#define NS16550_REG_LCR 3U /**< Line Control Register */
+#define NS16550_REG_MCR 4U /**< Modem Control Register */
+#define NS16550_REG_LSR 5U /**< Line Status Register */
+
+#define NS16550_IER_ETBEI      0x02U /**< Enable the THR Empty interrupt */
+#define NS16550_IIR_NO_PENDING 0x01U /**< No interrupt is pending */
+#define NS16550_IIR_ID_MASK    0x0EU /**< Interrupt identification bits */
+#define NS16550_IIR_ID_THRE    0x02U /**< THR Empty interrupt */
+#define NS16550_FCR_ENABLE     0x01U /**< Enable the FIFOs */
+#define NS16550_FCR_CLEAR_RX   0x02U /**< Clear the RX FIFO */
+#define NS16550_FCR_CLEAR_TX   0x04U /**< Clear the TX FIFO */
+#define NS16550_LCR_8N1        0x03U /**< 8 data bits, no parity, 1 stop bit */
+#define NS16550_LCR_DLAB       0x80U /**< Divisor Latch Access Bit */
+#define NS16550_MCR_DTR_RTS    0x03U /**< Assert DTR and RTS */
+#define NS16550_MCR_OUT2       0x08U /**< OUT2, which gates the interrupt line on PC style UARTs */
+#define NS16550_LSR_THRE       0x20U /**< THR (and so the TX FIFO) is empty */
+#define NS16550_LSR_TEMT       0x40U /**< THR and the shift register are both empty */
+
+#define NS16550_FIFO_SIZE    16U      /**< Depth of the TX FIFO */
+#define NS16550_BAUD_RATE    115200U  /**< Line speed we program */
+#define NS16550_DEFAULT_CLK  1843200U /**< Classic 16550 input clock, if the tree doesn't say */
+#define NS16550_RING_SIZE    4096U    /**< Size of the TX ring buffer. Must be a power of 2 */
+
+/**
+ * @brief State of the (single) UART
+ */
+typedef struct
+{
+    volatile uint8_t* base;                    /**< MMIO base of the register block */
+    uint32_t          reg_shift;               /**< Registers are @c 1 << reg_shift bytes apart */
+    uint32_t          reg_io_width;            /**< Access width of each register, 1 or 4 bytes */
+    uint32_t          interrupt;               /**< Interrupt number from the Device Tree */
+    bool              present;                 /**< @ref srv_ns16550_Init succeeded */
+    bool              interrupts;              /**< TX is driven from the THRE interrupt */
+    srv_spinlock_t    lock;                    /**< Protects the ring and the TX FIFO */
+    size_t            head;                    /**< Ring index of the next character to send */
+    size_t            tail;                    /**< Ring index the next queued character goes to */
+    char              ring[NS16550_RING_SIZE]; /**< Characters waiting to be sent */
+} ns16550_t;
+
+static ns16550_t uart = {.lock = SRV_SPINLOCK_INIT("ns16550")};
+
+static const srv_console_t ns16550_console = {
+    .write = srv_ns16550_Write,
+    .sync  = srv_ns16550_Sync,
+};
+
+static inline uint8_t ns16550_Read(uint32_t reg)
+{
+    volatile uint8_t* address = uart.base + (reg << uart.reg_shift);
+
+    if (uart.reg_io_width == sizeof(uint32_t))
+    {
+        return (uint8_t)*(volatile uint32_t*)address;
+    }
+
+    return *address;
+}
+
+static inline void ns16550_Write(uint32_t reg, uint8_t value)
+{
+    volatile uint8_t* address = uart.base + (reg << uart.reg_shift);
+
+    if (uart.reg_io_width == sizeof(uint32_t))
+    {
+        *(volatile uint32_t*)address = value;
+    }
+    else
+    {
+        *address = value;
+    }
+}
+
+/**
+ * @brief Take the UART lock with interrupts masked, so the handler can't deadlock against us
+ */
+static inline srv_irq_state_t ns16550_Lock(void)
+{
+    return srv_spinlock_LockIRQSave(&uart.lock);
+}
+
+static inline void ns16550_Unlock(srv_irq_state_t state)
+{
+    srv_spinlock_UnlockIRQRestore(&uart.lock, state);
+}
+
+/**
+ * @brief Move as much of the ring as fits into the TX FIFO, if the FIFO is empty
+ *
+ * @note Must be called with the lock held
+ *
+ * @return @c true if the FIFO was refilled
+ */
+static bool ns16550_FillFifoLocked(void)
+{
+    if ((ns16550_Read(NS16550_REG_LSR) & NS16550_LSR_THRE) == 0U)
+    {
+        return false;
+    }
+
+    /* THRE means the whole FIFO is free, so it can take a full load without checking again */
+    for (uint32_t count = 0U; (count < NS16550_FIFO_SIZE) && (uart.head != uart.tail); count++)
+    {
+        ns16550_Write(NS16550_REG_THR, (uint8_t)uart.ring[uart.head]);
+        uart.head = (uart.head + 1U) & (NS16550_RING_SIZE - 1U);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Turn the THRE interrupt on if there is anything left to send, otherwise off
+ *
+ * @note Must be called with the lock held
+ */
+static inline void ns16550_UpdateTxInterruptLocked(void)
+{
+    ns16550_Write(NS16550_REG_IER, (uart.head != uart.tail) ? NS16550_IER_ETBEI : 0U);
+}
+
+bool srv_ns16550_Init(void)
+{
+    const srv_fdt_node_t* node = srv_fdt_FindCompatibleNode("ns16550a");
+    if (node == NULL)
+    {
+        node = srv_fdt_FindCompatibleNode("ns16550");
+    }
+
+    srv_physical_address_t base = 0U;
+    size_t                 size = 0U;
+    if ((node == NULL) || !srv_fdt_GetReg(node, 0U, &base, &size))
+    {
+        return false;
+    }
+
+    uint32_t clock_frequency = NS16550_DEFAULT_CLK;
+    (void)srv_fdt_GetPropertyU32(node, "clock-frequency", &clock_frequency);
+
+    uart.reg_shift    = 0U;
+    uart.reg_io_width = 1U;
+    (void)srv_fdt_GetPropertyU32(node, "reg-shift", &uart.reg_shift);
+    (void)srv_fdt_GetPropertyU32(node, "reg-io-width", &uart.reg_io_width);
+    (void)srv_fdt_GetPropertyU32(node, "interrupts", &uart.interrupt);
+
+    if ((uart.reg_io_width != 1U) && (uart.reg_io_width != sizeof(uint32_t)))
+    {
+        return false;
+    }
+
+    /* The Kernel runs identity mapped, so the register block is at its physical address */
+    uart.base = (volatile uint8_t*)base;
+
+    /* Quiet the UART while we program it */
+    ns16550_Write(NS16550_REG_IER, 0U);
+
+    /* A clock of 0 means the firmware already set the baud rate up, so leave the divisor alone */
+    const uint32_t divisor = (clock_frequency != 0U) ? (clock_frequency / (16U * NS16550_BAUD_RATE)) : 0U;
+    if (divisor != 0U)
+    {
+        ns16550_Write(NS16550_REG_LCR, NS16550_LCR_DLAB);
+        ns16550_Write(NS16550_REG_DLL, (uint8_t)(divisor & 0xFFU));
+        ns16550_Write(NS16550_REG_DLM, (uint8_t)((divisor >> 8U) & 0xFFU));
+    }
+
+    ns16550_Write(NS16550_REG_LCR, NS16550_LCR_8N1);
+    ns16550_Write(NS16550_REG_FCR, NS16550_FCR_ENABLE | NS16550_FCR_CLEAR_RX | NS16550_FCR_CLEAR_TX);
+    ns16550_Write(NS16550_REG_MCR, NS16550_MCR_DTR_RTS | NS16550_MCR_OUT2);
+
+    uart.head    = 0U;
+    uart.tail    = 0U;
+    uart.present = true;
+
+    /* From here on, Kernel output skips the firmware and comes straight to us */
+    srv_stdio_SetConsole(&ns16550_console);
+
+    return true;
+}
+
+void srv_ns16550_Write(const char* str, size_t length)
+{
+    if (!uart.present)
+    {
+        return;
+    }
+
+    const srv_irq_state_t state = ns16550_Lock();
+
+    for (size_t i = 0U; i < length; i++)
+    {
+        size_t next = (uart.tail + 1U) & (NS16550_RING_SIZE - 1U);
+
+        /* Ring full, so make room by pushing the oldest characters out ourselves */
+        while (next == uart.head)
+        {
+            (void)ns16550_FillFifoLocked();
+        }
+
+        uart.ring[uart.tail] = str[i];
+        uart.tail            = next;
+
+        /* Polled mode sends the FIFO's worth as soon as it empties, rather than queueing the lot */
+        if (!uart.interrupts)
+        {
+            (void)ns16550_FillFifoLocked();
+        }
+    }
+
+    if (uart.interrupts)
+    {
+        /* Get things moving if the FIFO is idle. The THRE interrupt takes it from there */
+        (void)ns16550_FillFifoLocked();
+        ns16550_UpdateTxInterruptLocked();
+    }
+    else
+    {
+        while (uart.head != uart.tail)
+        {
+            (void)ns16550_FillFifoLocked();
+        }
+    }
+
+    ns16550_Unlock(state);
+}
+
+void srv_ns16550_Sync(void)
+{
+    if (!uart.present)
+    {
+        return;
+    }
+
+    const srv_irq_state_t state = ns16550_Lock();
+
+    while (uart.head != uart.tail)
+    {
+        (void)ns16550_FillFifoLocked();
+    }
+
+    while ((ns16550_Read(NS16550_REG_LSR) & NS16550_LSR_TEMT) == 0U)
+    {
+    }
+
+    if (uart.interrupts)
+    {
+        ns16550_UpdateTxInterruptLocked();
+    }
+
+    ns16550_Unlock(state);
+}
+
+uint32_t srv_ns16550_GetInterrupt(void)
+{
+    return uart.interrupt;
+}
+
+void srv_ns16550_EnableInterrupts(void)
+{
+    if (!uart.present)
+    {
+        return;
+    }
+
+    const srv_irq_state_t state = ns16550_Lock();
+
+    uart.interrupts = true;
+    ns16550_UpdateTxInterruptLocked();
+
+    ns16550_Unlock(state);
+}
+
+void srv_ns16550_HandleInterrupt(void)
+{
+    const srv_irq_state_t state = ns16550_Lock();
+
+    /* Reading IIR also acknowledges a pending THRE interrupt */
+    const uint8_t iir = ns16550_Read(NS16550_REG_IIR);
+    if (((iir & NS16550_IIR_NO_PENDING) == 0U) && ((iir & NS16550_IIR_ID_MASK) == NS16550_IIR_ID_THRE))
+    {
+        (void)ns16550_FillFifoLocked();
+        ns16550_UpdateTxInterruptLocked();
+    }
+
+    ns16550_Unlock(state);
+}
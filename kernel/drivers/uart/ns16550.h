@@ -0,0 +1,75 @@
+/****************************************************************
+ * @file    ns16550.h
+ * @brief   NS16550A UART driver
+ *
+ * @details Writes straight to the UART's registers instead of going
+ *          through the firmware. Output is polled into the 16 byte TX FIFO
+ *          until @ref srv_ns16550_EnableInterrupts is called, after which it
+ *          is queued in a ring buffer and drained from the THRE interrupt.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef NS16550_H
+#define NS16550_H
+
+#include <hal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Find the UART in the Device Tree and initialize it
+ *
+ * @details Looks for the first node compatible with @c "ns16550a", which is the
+ *          @c serial@... node on QEMU's @c virt machine. The UART is
+ *          programmed for 115200 8N1 with its FIFOs enabled, and becomes
+ *          the Kernel console.
+ *
+ * @warning The FDT driver must be initialized first
+ *
+ * @return true  The UART was found and initialized
+ * @return false There is no usable UART in the Device Tree
+ */
+bool srv_ns16550_Init(void);
+
+/**
+ * @brief Write characters to the UART
+ *
+ * @details Before interrupts are enabled this polls, filling the whole TX FIFO
+ *          each time it empties. Afterwards, characters are queued in the ring
+ *          buffer and this only blocks if the ring is full.
+ *
+ * @param[in] str    The characters to write
+ * @param[in] length Number of characters to write
+ */
+void srv_ns16550_Write(const char* str, size_t length);
+
+/**
+ * @brief Block until every queued character has left the UART
+ *
+ * @note Safe to call with interrupts masked, e.g. from the panic path
+ */
+void srv_ns16550_Sync(void);
+
+/**
+ * @brief Get the interrupt number the UART raises, from its "interrupts" property
+ *
+ * @return The interrupt number, or 0 if the UART doesn't have one
+ */
+uint32_t srv_ns16550_GetInterrupt(void);
+
+/**
+ * @brief Switch transmission over to the THRE interrupt
+ *
+ * @warning Only call this once the interrupt controller delivers the UART's
+ *          interrupt to @ref srv_ns16550_HandleInterrupt
+ */
+void srv_ns16550_EnableInterrupts(void);
+
+/**
+ * @brief UART interrupt handler. Refills the TX FIFO from the ring buffer
+ */
+void srv_ns16550_HandleInterrupt(void);
+
+#endif
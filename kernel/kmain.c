@@ -6,17 +6,62 @@
  ****************************************************************/
 
 #include <stdio.h>
+#include <trace.h>
 
 #include <mm/phys/kpalloc.h>
 #include <drivers/fdt/fdt.h>
 #include <panic.h>
+#include <sched/sched.h>
+#include <smp/smp.h>
+#include <sync/lock_stats.h>
+#include <time/timer.h>
+
+#if defined(SRV_CONFIG_BENCHMARKS)
+#include <bench/bench.h>
+#endif
 
 int kmain(void)
 {
-    kprintf("Hello, World!\n");
+    const uint32_t cpu = srv_hal_GetExecutingCPU();
+
+    /* From here on, this is the CPU's idle thread. It is never moved, so cpu stays right */
+    srv_sched_InitCPU();
+
+    /* Programs the CPU's timer, after which other CPUs arming timers here know to send an IPI */
+    srv_timer_Run();
+
+    /* Timers and the scheduler are ready for interrupts, so take them */
+    srv_hal_EnableInterrupts();
+
+    if (cpu == 0U)
+    {
+        kprintf("Hello, World!\n");
+    }
+
+    /* Every CPU checks in before any of them carries on */
+    srv_smp_Barrier();
+
+    if (cpu == 0U)
+    {
+        kprintf("%d CPUs online\n", (int)srv_smp_GetCPUCount());
+
+#if defined(SRV_CONFIG_BENCHMARKS)
+        srv_bench_Run();
+#endif
+
+        /* Does nothing unless the Kernel was built with lock statistics */
+        srv_lock_stats_Dump();
+    }
 
     for (;;)
     {
+        /* Nothing else to do, so turn any trace records into text whenever this CPU wakes up */
+        if (cpu == 0U)
+        {
+            srv_trace_Drain();
+        }
+
+        srv_sched_Idle();
     }
 
     return 0;
@@ -8,16 +8,135 @@
 #include <stdio.h>
 
 #include <hal.h>
+#include <stddef.h>
+#include <sync/ticketlock.h>
+
+#define STDIO_BUFFER_SIZE 256U /**< Size of each CPU's console output buffer */
+
+/**
+ * @brief Per-CPU console output buffer
+ *
+ * @details Output is collected here and handed to the HAL in one go, rather
+ *          than trapping to the firmware once per character
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]
+{
+    char   data[STDIO_BUFFER_SIZE]; /**< Characters waiting to be written */
+    size_t length;                  /**< Number of characters in @ref data */
+} stdio_buffer_t;
+
+/**
+ * @brief Where @ref printf_internal gets its arguments from
+ *
+ * @details Either a live @c va_list, or words captured ahead of time by the
+ *          trace log, which are cast back to whatever each conversion expects
+ */
+typedef struct
+{
+    __builtin_va_list* va;    /**< Arguments of a variadic call, or @c NULL if they come from @ref words */
+    const uint64_t*    words; /**< Arguments captured ahead of time, one word each */
+    size_t             count; /**< Number of @ref words left */
+} printf_args_t;
 
 static const char* digits = "0123456789ABCDEF";
 
-[[gnu::always_inline]] static inline int printf_internal_Number(int number)
+static stdio_buffer_t       stdio_buffers[SRV_HAL_MAX_CPUS];
+static srv_ticketlock_t     stdio_console_lock = SRV_TICKETLOCK_INIT("console"); /**< Stops lines from different CPUs interleaving. Fair, so a chatty CPU can't starve the rest */
+static const srv_console_t* stdio_console      = NULL;                           /**< Console device, or @c NULL for the HAL debug console */
+static bool                 stdio_panicking    = false;                          /**< A CPU has panicked, so output goes straight to the HAL debug console without the lock */
+
+/**
+ * @brief Send characters to the console device, or the HAL if there isn't one
+ *
+ * @param[in] str    The characters to write
+ * @param[in] length Number of characters to write
+ */
+static inline void stdio_Write(const char* str, size_t length)
+{
+    const srv_console_t* console = __atomic_load_n(&stdio_console, __ATOMIC_ACQUIRE);
+
+    /* The console device's driver may be what panicked, or be stuck behind a lock the panicking CPU holds */
+    if ((console != NULL) && !__atomic_load_n(&stdio_panicking, __ATOMIC_RELAXED))
+    {
+        console->write(str, length);
+    }
+    else
+    {
+        srv_hal_WriteDebugString(str, length);
+    }
+}
+
+/**
+ * @brief Get the executing CPU's output buffer
+ *
+ * @note Must be called with interrupts masked
+ *
+ * @return The buffer, or @c NULL if the CPU has no buffer and output must go straight to the console
+ */
+static inline stdio_buffer_t* stdio_buffer_Current(void)
+{
+    const uint32_t cpu = srv_hal_GetExecutingCPU();
+
+    return (cpu < SRV_HAL_MAX_CPUS) ? &stdio_buffers[cpu] : NULL;
+}
+
+/**
+ * @brief Write a buffer's contents to the console and empty it
+ *
+ * @param[in] buffer The buffer to flush
+ */
+static void stdio_buffer_Flush(stdio_buffer_t* buffer)
+{
+    if (buffer->length == 0U)
+    {
+        return;
+    }
+
+    /* The panicking CPU may already hold the lock. Lines may interleave, but the message gets out */
+    if (__atomic_load_n(&stdio_panicking, __ATOMIC_RELAXED))
+    {
+        stdio_Write(buffer->data, buffer->length);
+        buffer->length = 0U;
+        return;
+    }
+
+    srv_ticketlock_Lock(&stdio_console_lock);
+    stdio_Write(buffer->data, buffer->length);
+    srv_ticketlock_Unlock(&stdio_console_lock);
+
+    buffer->length = 0U;
+}
+
+/**
+ * @brief Add a character to a buffer, flushing on newline or when it fills up
+ *
+ * @param[in] buffer The buffer to add to, or @c NULL to write straight to the console
+ * @param[in] c      The character to add
+ */
+static void stdio_buffer_PutChar(stdio_buffer_t* buffer, char c)
+{
+    if (buffer == NULL)
+    {
+        stdio_Write(&c, 1U);
+        return;
+    }
+
+    buffer->data[buffer->length] = c;
+    buffer->length++;
+
+    if ((c == '\n') || (buffer->length == STDIO_BUFFER_SIZE))
+    {
+        stdio_buffer_Flush(buffer);
+    }
+}
+
+[[gnu::always_inline]] static inline int printf_internal_Number(stdio_buffer_t* buffer, int number)
 {
     int num = 0;
 
     if (number < 0)
     {
-        srv_hal_WriteDebugChar('-');
+        stdio_buffer_PutChar(buffer, '-');
 
         /* Modifying the param directly is bad practice, but let's do it for now */
         number -= number;
@@ -27,7 +146,7 @@ static const char* digits = "0123456789ABCDEF";
     {
         const char to_print  = digits[number % 10];
         number              /= 10;
-        srv_hal_WriteDebugChar(to_print);
+        stdio_buffer_PutChar(buffer, to_print);
 
         num++;
     } while (number != 0);
@@ -35,13 +154,13 @@ static const char* digits = "0123456789ABCDEF";
     return num;
 }
 
-[[gnu::always_inline]] static inline int printf_internal_Hex(int number)
+[[gnu::always_inline]] static inline int printf_internal_Hex(stdio_buffer_t* buffer, uint64_t number, int bits)
 {
     /* Stole this from kling, but it's pretty basic */
 
     int ret    = 0;
     int shifts = 0;
-    for (__SIZE_TYPE__ i = number; i > 0; i >>= 4)
+    for (uint64_t i = number; i > 0; i >>= 4)
     {
         shifts++;
     }
@@ -52,26 +171,48 @@ static const char* digits = "0123456789ABCDEF";
     }
 
     shifts *= 4;
-    for (int i = (32 - shifts) / 4; i > 0; i--)
+    for (int i = (bits - shifts) / 4; i > 0; i--)
     {
-        srv_hal_WriteDebugChar('0');
+        stdio_buffer_PutChar(buffer, '0');
+        ret++;
     }
 
     while (shifts > 0)
     {
         shifts -= 4;
-        srv_hal_WriteDebugChar(digits[(number >> shifts) & 0xFU]);
+        stdio_buffer_PutChar(buffer, digits[(number >> shifts) & 0xFU]);
+        ret++;
     }
 
     return ret;
 }
 
-[[gnu::always_inline]] static inline int printf_internal_String(const char* string)
+[[gnu::always_inline]] static inline int printf_internal_Unsigned(stdio_buffer_t* buffer, uint64_t number)
+{
+    char reversed[20];
+    int  num = 0;
+
+    do
+    {
+        reversed[num]  = digits[number % 10U];
+        number        /= 10U;
+        num++;
+    } while (number != 0U);
+
+    for (int i = num - 1; i >= 0; i--)
+    {
+        stdio_buffer_PutChar(buffer, reversed[i]);
+    }
+
+    return num;
+}
+
+[[gnu::always_inline]] static inline int printf_internal_String(stdio_buffer_t* buffer, const char* string)
 {
     __SIZE_TYPE__ curr_index = 0ULL;
     while (string[curr_index] != '\0')
     {
-        srv_hal_WriteDebugChar(string[curr_index]);
+        stdio_buffer_PutChar(buffer, string[curr_index]);
 
         curr_index++;
     }
@@ -79,7 +220,42 @@ static const char* digits = "0123456789ABCDEF";
     return curr_index;
 }
 
-int printf_internal(const char* format, __builtin_va_list* va)
+/**
+ * @brief Take the next captured word, or 0 if the format asks for more than were captured
+ */
+static inline uint64_t printf_args_NextWord(printf_args_t* args)
+{
+    if (args->count == 0U)
+    {
+        return 0ULL;
+    }
+
+    args->count--;
+
+    return *args->words++;
+}
+
+static inline int printf_args_Int(printf_args_t* args)
+{
+    return (args->va != NULL) ? __builtin_va_arg(*args->va, int) : (int)printf_args_NextWord(args);
+}
+
+static inline uint32_t printf_args_U32(printf_args_t* args)
+{
+    return (args->va != NULL) ? __builtin_va_arg(*args->va, uint32_t) : (uint32_t)printf_args_NextWord(args);
+}
+
+static inline uint64_t printf_args_U64(printf_args_t* args)
+{
+    return (args->va != NULL) ? __builtin_va_arg(*args->va, uint64_t) : printf_args_NextWord(args);
+}
+
+static inline const char* printf_args_String(printf_args_t* args)
+{
+    return (args->va != NULL) ? __builtin_va_arg(*args->va, const char*) : (const char*)(uintptr_t)printf_args_NextWord(args);
+}
+
+int printf_internal(stdio_buffer_t* buffer, const char* format, printf_args_t* args)
 {
     __SIZE_TYPE__ index       = 0ULL;
     int           num_written = 0;
@@ -96,16 +272,16 @@ int printf_internal(const char* format, __builtin_va_list* va)
             {
             case 'c':
             {
-                const char c_to_print = __builtin_va_arg(*va, int);
-                srv_hal_WriteDebugChar((char)c_to_print);
+                const char c_to_print = printf_args_Int(args);
+                stdio_buffer_PutChar(buffer, (char)c_to_print);
 
                 num_written++;
                 break;
             }
             case 'd':
             {
-                int val      = __builtin_va_arg(*va, int);
-                num_written += printf_internal_Number(val);
+                int val      = printf_args_Int(args);
+                num_written += printf_internal_Number(buffer, val);
 
                 if (val < 0)
                 {
@@ -115,21 +291,42 @@ int printf_internal(const char* format, __builtin_va_list* va)
             }
             case 'x':
             {
-                uint32_t val  = __builtin_va_arg(*va, uint32_t);
-                num_written  += printf_internal_Hex(val);
+                uint32_t val  = printf_args_U32(args);
+                num_written  += printf_internal_Hex(buffer, val, 32);
+
+                break;
+            }
+            case 'l':
+            {
+                /* %lx and %lu take a uint64_t. %llx and %llu are the same thing */
+                while (format[index + 1U] == 'l')
+                {
+                    index++;
+                }
+
+                if (format[index + 1U] == 'x')
+                {
+                    index++;
+                    num_written += printf_internal_Hex(buffer, printf_args_U64(args), 64);
+                }
+                else if (format[index + 1U] == 'u')
+                {
+                    index++;
+                    num_written += printf_internal_Unsigned(buffer, printf_args_U64(args));
+                }
 
                 break;
             }
             case 's':
             {
-                const char* s  = __builtin_va_arg(*va, const char*);
-                num_written   += printf_internal_String(s);
+                const char* s  = printf_args_String(args);
+                num_written   += printf_internal_String(buffer, (s != NULL) ? s : "(null)");
 
                 break;
             }
             case '%':
             {
-                srv_hal_WriteDebugChar('%');
+                stdio_buffer_PutChar(buffer, '%');
 
                 num_written++;
                 break;
@@ -143,7 +340,7 @@ int printf_internal(const char* format, __builtin_va_list* va)
         else
         {
             /* Just write the character out */
-            srv_hal_WriteDebugChar(format[index]);
+            stdio_buffer_PutChar(buffer, format[index]);
 
             num_written++;
             index++;
@@ -159,9 +356,62 @@ int kprintf(const char* format, ...)
 {
     __builtin_va_list arg_list;
 
+    /* Mask interrupts so a handler can't print into the middle of this CPU's buffer */
+    const srv_irq_state_t state  = srv_hal_SaveAndDisableInterrupts();
+    stdio_buffer_t*       buffer = stdio_buffer_Current();
+
     __builtin_va_start(arg_list, format);
-    const int ret = printf_internal(format, &arg_list);
+    printf_args_t args = {.va = &arg_list, .words = NULL, .count = 0U};
+    const int     ret  = printf_internal(buffer, format, &args);
     __builtin_va_end(arg_list);
 
+    srv_hal_RestoreInterrupts(state);
+
+    return ret;
+}
+
+int kprintf_args(const char* format, const uint64_t* words, size_t count)
+{
+    const srv_irq_state_t state  = srv_hal_SaveAndDisableInterrupts();
+    stdio_buffer_t*       buffer = stdio_buffer_Current();
+
+    printf_args_t args = {.va = NULL, .words = words, .count = count};
+    const int     ret  = printf_internal(buffer, format, &args);
+
+    srv_hal_RestoreInterrupts(state);
+
     return ret;
 }
+
+void kflush(void)
+{
+    const srv_irq_state_t state  = srv_hal_SaveAndDisableInterrupts();
+    stdio_buffer_t*       buffer = stdio_buffer_Current();
+
+    if (buffer != NULL)
+    {
+        stdio_buffer_Flush(buffer);
+    }
+
+    /* Output while panicking already went out synchronously, through the HAL */
+    const srv_console_t* console = __atomic_load_n(&stdio_console, __ATOMIC_ACQUIRE);
+    if ((console != NULL) && !__atomic_load_n(&stdio_panicking, __ATOMIC_RELAXED))
+    {
+        console->sync();
+    }
+
+    srv_hal_RestoreInterrupts(state);
+}
+
+void srv_stdio_SetConsole(const srv_console_t* console)
+{
+    /* Get everything written so far out of the old console before switching */
+    kflush();
+
+    __atomic_store_n(&stdio_console, console, __ATOMIC_RELEASE);
+}
+
+void srv_stdio_EnterPanic(void)
+{
+    __atomic_store_n(&stdio_panicking, true, __ATOMIC_RELAXED);
+}
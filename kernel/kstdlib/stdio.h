@@ -8,16 +8,73 @@
 #ifndef STDIO_H
 #define STDIO_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A console device that takes over Kernel output from the HAL debug console
+ */
+typedef struct
+{
+    void (*write)(const char* str, size_t length); /**< Output (or queue) a run of characters */
+    void (*sync)(void);                            /**< Block until everything written has been output */
+} srv_console_t;
+
 /**
  * @brief Kernel internal printf function
  *
+ * @details Understands @c %c, @c %d, @c %x (a @c uint32_t as 8 hex digits),
+ *          @c %s and @c %%, plus @c %lx (a @c uint64_t as 16 hex digits) and
+ *          @c %lu (a @c uint64_t in decimal)
+ *
  * @param[in] format The format string to write
  *
  * @note This function implicitly writes to the Kernel's debug console using the
  *       underlying Architecture HAL!
  *
+ * @note Output is buffered per CPU, and only written out on a newline, when the
+ *       buffer fills up or on @ref kflush
+ *
  * @return The number of bytes written
  */
 [[gnu::format(printf, 1, 2)]] int kprintf(const char* format, ...);
 
+/**
+ * @brief @ref kprintf, with arguments that were captured as words ahead of time
+ *
+ * @details Each word is cast back to the type its conversion expects, so this
+ *          formats records from the trace log exactly as @ref kprintf would have
+ *
+ * @param[in] format The format string to write
+ * @param[in] words  The arguments, one word each
+ * @param[in] count  Number of words. Conversions past the end print as 0
+ *
+ * @return The number of bytes written
+ */
+int kprintf_args(const char* format, const uint64_t* words, size_t count);
+
+/**
+ * @brief Write out anything the executing CPU has buffered but not yet written
+ *
+ * @details Also waits for the console to finish outputting it, so this is safe to
+ *          call right before hanging the CPU
+ */
+void kflush(void);
+
+/**
+ * @brief Send Kernel output to a console device instead of the HAL debug console
+ *
+ * @param[in] console The console to use, or @c NULL to go back to the HAL debug console
+ */
+void srv_stdio_SetConsole(const srv_console_t* console);
+
+/**
+ * @brief Stop taking locks and using the console device, for good
+ *
+ * @details From here on, output goes straight to the HAL debug console, so a
+ *          panic still gets its message out when the executing CPU holds the
+ *          console lock or the console device is what failed
+ */
+void srv_stdio_EnterPanic(void);
+
 #endif
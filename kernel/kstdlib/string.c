@@ -7,46 +7,610 @@
 
 #include <string.h>
 
+#include <hal.h>
 #include <stdint.h>
 
+#define STRING_WORD_SIZE        sizeof(string_word_t)   /**< Number of bytes in a machine word */
+#define STRING_WORD_MASK        (STRING_WORD_SIZE - 1U) /**< Mask of the misaligned bits of an address */
+#define STRING_UNROLL           8U                      /**< Number of words moved per unrolled loop iteration */
+#define STRING_BYTE_BROADCAST   0x0101010101010101ULL   /**< Multiplier that copies a byte into every byte of a word */
+#define STRING_VECTOR_THRESHOLD 256U                    /**< Smallest operation worth switching the vector unit on for */
+#define STRING_VECTOR_CHUNK     4096U                   /**< Most bytes handled per vector section, to bound interrupt latency */
+
+typedef uintptr_t string_word_t [[gnu::may_alias]]; /**< Machine word that may alias any other type */
+
+/*
+ * Word-at-a-time string scanning
+ *
+ * The string routines below only ever load naturally aligned words. An
+ * aligned word never straddles a page, so a load that touches a byte of
+ * the string (or its terminator) can never fault, even when the rest of
+ * the word lies beyond the end of the string.
+ */
+
+/*
+ * Vector (RVV) routines, implemented in string_rvv.s. These must only be
+ * called between srv_hal_VectorBegin() and srv_hal_VectorEnd().
+ */
+extern void string_rvv_Copy(void* s1, const void* s2, size_t n);
+extern void string_rvv_Set(void* s, int c, size_t n);
+extern long string_rvv_Compare(const void* s1, const void* s2, size_t n);
+
+static int string_vector_support = -1; /**< -1 until probed, then 1 if the vector unit is usable */
+
+/**
+ * @brief Find the zero bytes of a word
+ *
+ * @details Uses Zbb @c orc.b when the toolchain targets it, otherwise the
+ *          carry-free bit trick. Either way the result is exact, with no false
+ *          positives above a real zero byte, so it can be combined with other
+ *          masks and searched with @c ctz.
+ *
+ * @param[in] word The word to search
+ *
+ * @return A mask with bits set only in the bytes of @c word that are zero
+ */
+static inline string_word_t string_ZeroBytes(string_word_t word)
+{
+#if defined(__riscv_zbb)
+    string_word_t non_zero;
+    __asm__("orc.b %0, %1" : "=r"(non_zero) : "r"(word));
+
+    return ~non_zero;
+#else
+    const string_word_t low_bits = (string_word_t)0x7F7F7F7F7F7F7F7FULL;
+
+    return ~(((word & low_bits) + low_bits) | word | low_bits);
+#endif
+}
+
+/**
+ * @brief Get the index of the first (lowest addressed) flagged byte in a mask
+ *
+ * @param[in] mask A non-zero mask from @ref string_ZeroBytes or an XOR of two words
+ *
+ * @return Byte index into the word
+ */
+static inline size_t string_FirstByte(string_word_t mask)
+{
+    /* Little endian, so the lowest set bit is in the first flagged byte */
+    return (size_t)__builtin_ctzll(mask) / 8U;
+}
+
+/**
+ * @brief Should an operation of @c n bytes use the vector unit?
+ *
+ * @param[in] n Number of bytes in the operation
+ *
+ * @return @c true if the vector routines should be used
+ */
+static inline bool string_UseVector(size_t n)
+{
+    if (n < STRING_VECTOR_THRESHOLD)
+    {
+        return false;
+    }
+
+    int support = __atomic_load_n(&string_vector_support, __ATOMIC_RELAXED);
+    if (support < 0)
+    {
+        support = srv_hal_HasVectorUnit() ? 1 : 0;
+        __atomic_store_n(&string_vector_support, support, __ATOMIC_RELAXED);
+    }
+
+    return support != 0;
+}
+
+/**
+ * @brief Copy forwards, a word at a time wherever possible
+ *
+ * @details The destination is aligned with a byte head first. If the source
+ *          ends up aligned too, whole words are copied with an unrolled loop.
+ *          Otherwise, aligned source words are read and shifted together, so
+ *          there are never any misaligned accesses (which trap to M-mode on
+ *          many harts). Every load is done before the stores of an iteration,
+ *          so this is also safe for overlapping buffers where @c s1 < @c s2.
+ */
+static void string_CopyForward(uint8_t* s1, const uint8_t* s2, size_t n)
+{
+    /* Byte head, until the destination is aligned */
+    while ((n != 0U) && (((uintptr_t)s1 & STRING_WORD_MASK) != 0U))
+    {
+        *s1++ = *s2++;
+        n--;
+    }
+
+    string_word_t* dst        = (string_word_t*)s1;
+    const size_t   src_offset = (uintptr_t)s2 & STRING_WORD_MASK;
+
+    if (src_offset == 0U)
+    {
+        const string_word_t* src = (const string_word_t*)s2;
+
+        while (n >= (STRING_UNROLL * STRING_WORD_SIZE))
+        {
+            const string_word_t w0 = src[0];
+            const string_word_t w1 = src[1];
+            const string_word_t w2 = src[2];
+            const string_word_t w3 = src[3];
+            const string_word_t w4 = src[4];
+            const string_word_t w5 = src[5];
+            const string_word_t w6 = src[6];
+            const string_word_t w7 = src[7];
+
+            dst[0] = w0;
+            dst[1] = w1;
+            dst[2] = w2;
+            dst[3] = w3;
+            dst[4] = w4;
+            dst[5] = w5;
+            dst[6] = w6;
+            dst[7] = w7;
+
+            src += STRING_UNROLL;
+            dst += STRING_UNROLL;
+            n   -= STRING_UNROLL * STRING_WORD_SIZE;
+        }
+
+        while (n >= STRING_WORD_SIZE)
+        {
+            *dst++  = *src++;
+            n      -= STRING_WORD_SIZE;
+        }
+
+        s2 = (const uint8_t*)src;
+    }
+    else if (n >= STRING_WORD_SIZE)
+    {
+        /* Little endian, so the low bytes of each word come from the previous source word */
+        const unsigned       shift_lo = (unsigned)(src_offset * 8U);
+        const unsigned       shift_hi = (unsigned)(STRING_WORD_SIZE * 8U) - shift_lo;
+        const string_word_t* src      = (const string_word_t*)(s2 - src_offset);
+        string_word_t        lo       = *src++;
+
+        while (n >= STRING_WORD_SIZE)
+        {
+            const string_word_t hi = *src++;
+
+            *dst++  = (lo >> shift_lo) | (hi << shift_hi);
+            lo      = hi;
+            n      -= STRING_WORD_SIZE;
+            s2     += STRING_WORD_SIZE;
+        }
+    }
+
+    /* Byte tail */
+    s1 = (uint8_t*)dst;
+    while (n != 0U)
+    {
+        *s1++ = *s2++;
+        n--;
+    }
+}
+
+/**
+ * @brief Copy backwards, for overlapping buffers where @c s1 > @c s2
+ *
+ * @details Works from the end of both buffers. Whole words are only used when
+ *          both buffers share the same alignment, otherwise it falls back to
+ *          a byte loop.
+ */
+static void string_CopyBackward(uint8_t* s1, const uint8_t* s2, size_t n)
+{
+    uint8_t*       dst_end = s1 + n;
+    const uint8_t* src_end = s2 + n;
+
+    if ((((uintptr_t)dst_end ^ (uintptr_t)src_end) & STRING_WORD_MASK) == 0U)
+    {
+        while ((n != 0U) && (((uintptr_t)dst_end & STRING_WORD_MASK) != 0U))
+        {
+            *--dst_end = *--src_end;
+            n--;
+        }
+
+        while (n >= STRING_WORD_SIZE)
+        {
+            dst_end -= STRING_WORD_SIZE;
+            src_end -= STRING_WORD_SIZE;
+
+            *(string_word_t*)dst_end  = *(const string_word_t*)src_end;
+            n                        -= STRING_WORD_SIZE;
+        }
+    }
+
+    while (n != 0U)
+    {
+        *--dst_end = *--src_end;
+        n--;
+    }
+}
+
+/**
+ * @brief Copy with the vector unit, in chunks so interrupts aren't held off for too long
+ */
+static void string_VectorCopy(uint8_t* s1, const uint8_t* s2, size_t n)
+{
+    while (n != 0U)
+    {
+        const size_t chunk = (n < STRING_VECTOR_CHUNK) ? n : STRING_VECTOR_CHUNK;
+
+        const srv_irq_state_t state = srv_hal_VectorBegin();
+        string_rvv_Copy(s1, s2, chunk);
+        srv_hal_VectorEnd(state);
+
+        s1 += chunk;
+        s2 += chunk;
+        n  -= chunk;
+    }
+}
+
 void* memcpy(void* restrict s1, const void* restrict s2, size_t n)
 {
-    uint8_t*       s1_as_u8 = (uint8_t*)s1;
-    const uint8_t* s2_as_u8 = (const uint8_t*)s2;
+    if (string_UseVector(n))
+    {
+        string_VectorCopy((uint8_t*)s1, (const uint8_t*)s2, n);
+    }
+    else
+    {
+        string_CopyForward((uint8_t*)s1, (const uint8_t*)s2, n);
+    }
 
-    /* This is _really_ naive an unoptimized, but it doesn't really matter for now! */
-    for (size_t i = 0; i < n; i++)
+    return s1;
+}
+
+void* memmove(void* s1, const void* s2, size_t n)
+{
+    uint8_t*       dst = (uint8_t*)s1;
+    const uint8_t* src = (const uint8_t*)s2;
+
+    /* Copying forwards is only a problem if the destination starts inside the source */
+    if ((dst <= src) || (dst >= (src + n)))
     {
-        s1_as_u8[i] = s2_as_u8[i];
+        /* The vector copy works a whole register group at a time, so only use it when there's no overlap at all */
+        if ((((dst + n) <= src) || (dst >= (src + n))) && string_UseVector(n))
+        {
+            string_VectorCopy(dst, src, n);
+        }
+        else
+        {
+            string_CopyForward(dst, src, n);
+        }
+    }
+    else
+    {
+        string_CopyBackward(dst, src, n);
     }
 
     return s1;
 }
 
+void* memset(void* s, int c, size_t n)
+{
+    uint8_t*      dst  = (uint8_t*)s;
+    const uint8_t byte = (uint8_t)c;
+
+    if (string_UseVector(n))
+    {
+        while (n != 0U)
+        {
+            const size_t chunk = (n < STRING_VECTOR_CHUNK) ? n : STRING_VECTOR_CHUNK;
+
+            const srv_irq_state_t state = srv_hal_VectorBegin();
+            string_rvv_Set(dst, byte, chunk);
+            srv_hal_VectorEnd(state);
+
+            dst += chunk;
+            n   -= chunk;
+        }
+
+        return s;
+    }
+
+    /* Byte head, until the destination is aligned */
+    while ((n != 0U) && (((uintptr_t)dst & STRING_WORD_MASK) != 0U))
+    {
+        *dst++ = byte;
+        n--;
+    }
+
+    const string_word_t word  = (string_word_t)byte * (string_word_t)STRING_BYTE_BROADCAST;
+    string_word_t*      words = (string_word_t*)dst;
+
+    while (n >= (STRING_UNROLL * STRING_WORD_SIZE))
+    {
+        words[0] = word;
+        words[1] = word;
+        words[2] = word;
+        words[3] = word;
+        words[4] = word;
+        words[5] = word;
+        words[6] = word;
+        words[7] = word;
+
+        words += STRING_UNROLL;
+        n     -= STRING_UNROLL * STRING_WORD_SIZE;
+    }
+
+    while (n >= STRING_WORD_SIZE)
+    {
+        *words++  = word;
+        n        -= STRING_WORD_SIZE;
+    }
+
+    /* Byte tail */
+    dst = (uint8_t*)words;
+    while (n != 0U)
+    {
+        *dst++ = byte;
+        n--;
+    }
+
+    return s;
+}
+
+int memcmp(const void* s1, const void* s2, size_t n)
+{
+    const uint8_t* s1_as_u8 = (const uint8_t*)s1;
+    const uint8_t* s2_as_u8 = (const uint8_t*)s2;
+
+    if (string_UseVector(n))
+    {
+        while (n != 0U)
+        {
+            const size_t chunk = (n < STRING_VECTOR_CHUNK) ? n : STRING_VECTOR_CHUNK;
+
+            const srv_irq_state_t state = srv_hal_VectorBegin();
+            const long            index = string_rvv_Compare(s1_as_u8, s2_as_u8, chunk);
+            srv_hal_VectorEnd(state);
+
+            if (index >= 0)
+            {
+                return (int)s1_as_u8[index] - (int)s2_as_u8[index];
+            }
+
+            s1_as_u8 += chunk;
+            s2_as_u8 += chunk;
+            n        -= chunk;
+        }
+
+        return 0;
+    }
+
+    /* Words can only be compared if both buffers share an alignment */
+    if ((((uintptr_t)s1_as_u8 ^ (uintptr_t)s2_as_u8) & STRING_WORD_MASK) == 0U)
+    {
+        while ((n != 0U) && (((uintptr_t)s1_as_u8 & STRING_WORD_MASK) != 0U))
+        {
+            if (*s1_as_u8 != *s2_as_u8)
+            {
+                return (int)*s1_as_u8 - (int)*s2_as_u8;
+            }
+
+            s1_as_u8++;
+            s2_as_u8++;
+            n--;
+        }
+
+        while (n >= STRING_WORD_SIZE)
+        {
+            const string_word_t diff = *(const string_word_t*)s1_as_u8 ^ *(const string_word_t*)s2_as_u8;
+            if (diff != 0U)
+            {
+                const size_t index = string_FirstByte(diff);
+
+                return (int)s1_as_u8[index] - (int)s2_as_u8[index];
+            }
+
+            s1_as_u8 += STRING_WORD_SIZE;
+            s2_as_u8 += STRING_WORD_SIZE;
+            n        -= STRING_WORD_SIZE;
+        }
+    }
+
+    while (n != 0U)
+    {
+        if (*s1_as_u8 != *s2_as_u8)
+        {
+            return (int)*s1_as_u8 - (int)*s2_as_u8;
+        }
+
+        s1_as_u8++;
+        s2_as_u8++;
+        n--;
+    }
+
+    return 0;
+}
+
+void* memchr(const void* s, int c, size_t n)
+{
+    const uint8_t* s_as_u8 = (const uint8_t*)s;
+    const uint8_t  byte    = (uint8_t)c;
+
+    /* Byte head, until the pointer is aligned */
+    while ((n != 0U) && (((uintptr_t)s_as_u8 & STRING_WORD_MASK) != 0U))
+    {
+        if (*s_as_u8 == byte)
+        {
+            return (void*)s_as_u8;
+        }
+
+        s_as_u8++;
+        n--;
+    }
+
+    const string_word_t pattern = (string_word_t)byte * (string_word_t)STRING_BYTE_BROADCAST;
+
+    while (n >= STRING_WORD_SIZE)
+    {
+        const string_word_t match = string_ZeroBytes(*(const string_word_t*)s_as_u8 ^ pattern);
+        if (match != 0U)
+        {
+            return (void*)(s_as_u8 + string_FirstByte(match));
+        }
+
+        s_as_u8 += STRING_WORD_SIZE;
+        n       -= STRING_WORD_SIZE;
+    }
+
+    /* Byte tail */
+    while (n != 0U)
+    {
+        if (*s_as_u8 == byte)
+        {
+            return (void*)s_as_u8;
+        }
+
+        s_as_u8++;
+        n--;
+    }
+
+    return NULL;
+}
+
 size_t strlen(const char* str)
 {
-    size_t count = 0ULL;
+    const size_t         offset = (uintptr_t)str & STRING_WORD_MASK;
+    const string_word_t* words  = (const string_word_t*)(str - offset);
+
+    /* Force the bytes before the start of the string to non-zero so they can't match */
+    string_word_t word = *words | (((string_word_t)1U << (offset * 8U)) - 1U);
 
-    while (str[count] != '\0')
+    string_word_t zeroes;
+    while ((zeroes = string_ZeroBytes(word)) == 0U)
     {
-        count++;
+        word = *++words;
     }
 
-    return count;
+    return (size_t)((const char*)words - str) + string_FirstByte(zeroes);
 }
 
-int strcmp(const char* s1, const char* s2)
+char* strchr(const char* s, int c)
 {
-    size_t index = 0ULL;
+    const size_t         offset  = (uintptr_t)s & STRING_WORD_MASK;
+    const string_word_t* words   = (const string_word_t*)(s - offset);
+    const string_word_t  pattern = (string_word_t)(uint8_t)c * (string_word_t)STRING_BYTE_BROADCAST;
+    const string_word_t  head    = ((string_word_t)1U << (offset * 8U)) - 1U;
+
+    /* Search for the character and the terminator together, ignoring the bytes before the start */
+    string_word_t word  = *words;
+    string_word_t found = (string_ZeroBytes(word) | string_ZeroBytes(word ^ pattern)) & ~head;
+
+    while (found == 0U)
+    {
+        word  = *++words;
+        found = string_ZeroBytes(word) | string_ZeroBytes(word ^ pattern);
+    }
+
+    const char* match = (const char*)words + string_FirstByte(found);
+
+    /* Whichever came first wins; searching for '\0' itself finds the terminator */
+    return (*match == (char)c) ? (char*)match : NULL;
+}
+
+/**
+ * @brief Compare two strings a word at a time, for at most @c n bytes
+ *
+ * @details @c s1 is aligned with a byte head. If @c s2 is then aligned too,
+ *          whole words of each are compared directly. Otherwise aligned words
+ *          of @c s2 are shifted together, and the next word of @c s2 is only
+ *          loaded once the current one is known to hold no terminator, so no
+ *          load is ever made past the end of either string's final word.
+ *
+ * @param[in] s1 String s1
+ * @param[in] s2 String s2
+ * @param[in] n  Most bytes to compare (@c SIZE_MAX for @c strcmp)
+ *
+ * @return Difference of the first differing bytes, or 0 if equal
+ */
+static int string_Compare(const uint8_t* s1, const uint8_t* s2, size_t n)
+{
+    /* Byte head, until s1 is aligned */
+    while ((n != 0U) && (((uintptr_t)s1 & STRING_WORD_MASK) != 0U))
+    {
+        if ((*s1 != *s2) || (*s1 == 0U))
+        {
+            return (int)*s1 - (int)*s2;
+        }
 
-    char s1_char = s1[index];
-    char s2_char = s2[index];
-    while (s1_char != '\0' && (s1_char == s2_char))
+        s1++;
+        s2++;
+        n--;
+    }
+
+    const size_t src_offset = (uintptr_t)s2 & STRING_WORD_MASK;
+
+    if (src_offset == 0U)
+    {
+        while (n >= STRING_WORD_SIZE)
+        {
+            const string_word_t w1   = *(const string_word_t*)s1;
+            const string_word_t w2   = *(const string_word_t*)s2;
+            const string_word_t stop = (w1 ^ w2) | string_ZeroBytes(w1);
+
+            if (stop != 0U)
+            {
+                const size_t index = string_FirstByte(stop);
+
+                return (int)s1[index] - (int)s2[index];
+            }
+
+            s1 += STRING_WORD_SIZE;
+            s2 += STRING_WORD_SIZE;
+            n  -= STRING_WORD_SIZE;
+        }
+    }
+    else if (n >= STRING_WORD_SIZE)
     {
-        index++;
-        s1_char = s1[index];
-        s2_char = s2[index];
+        const unsigned       shift_lo = (unsigned)(src_offset * 8U);
+        const unsigned       shift_hi = (unsigned)(STRING_WORD_SIZE * 8U) - shift_lo;
+        const string_word_t* src      = (const string_word_t*)(s2 - src_offset);
+        string_word_t        lo       = *src++;
+
+        /* Stop before loading the next word of s2 if the rest of this one holds its terminator */
+        while ((n >= STRING_WORD_SIZE) && ((string_ZeroBytes(lo) >> shift_lo) == 0U))
+        {
+            const string_word_t hi   = *src++;
+            const string_word_t w1   = *(const string_word_t*)s1;
+            const string_word_t w2   = (lo >> shift_lo) | (hi << shift_hi);
+            const string_word_t stop = (w1 ^ w2) | string_ZeroBytes(w1);
+
+            if (stop != 0U)
+            {
+                const size_t index = string_FirstByte(stop);
+
+                return (int)s1[index] - (int)s2[index];
+            }
+
+            lo  = hi;
+            s1 += STRING_WORD_SIZE;
+            s2 += STRING_WORD_SIZE;
+            n  -= STRING_WORD_SIZE;
+        }
     }
 
-    return (int)s1_char - (int)s2_char;
+    /* Byte tail */
+    while (n != 0U)
+    {
+        if ((*s1 != *s2) || (*s1 == 0U))
+        {
+            return (int)*s1 - (int)*s2;
+        }
+
+        s1++;
+        s2++;
+        n--;
+    }
+
+    return 0;
+}
+
+int strcmp(const char* s1, const char* s2)
+{
+    return string_Compare((const uint8_t*)s1, (const uint8_t*)s2, SIZE_MAX);
+}
+
+int strncmp(const char* s1, const char* s2, size_t n)
+{
+    return string_Compare((const uint8_t*)s1, (const uint8_t*)s2, n);
 }
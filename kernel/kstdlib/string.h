@@ -21,6 +21,54 @@
  */
 [[gnu::access(write_only, 1), gnu::access(read_only, 2)]] void* memcpy(void* restrict s1, const void* restrict s2, size_t n);
 
+/**
+ * @brief Kernel Standard Library memmove implementation
+ *
+ * @param[in] s1 Pointer to the block to copy to
+ * @param[in] s2 Pointer to the block to copy from
+ * @param[in] n  Number of bytes to copy
+ *
+ * @note The two blocks may overlap
+ *
+ * @return Pointer to @c s1
+ */
+[[gnu::access(write_only, 1), gnu::access(read_only, 2)]] void* memmove(void* s1, const void* s2, size_t n);
+
+/**
+ * @brief Kernel Standard Library memset implementation
+ *
+ * @param[in] s Pointer to the block to fill
+ * @param[in] c The byte to fill the block with
+ * @param[in] n Number of bytes to fill
+ *
+ * @return Pointer to @c s
+ */
+[[gnu::access(write_only, 1)]] void* memset(void* s, int c, size_t n);
+
+/**
+ * @brief Kernel Standard Library memcmp implementation
+ *
+ * @param[in] s1 Pointer to the first block
+ * @param[in] s2 Pointer to the second block
+ * @param[in] n  Number of bytes to compare
+ *
+ * @return 0 if both blocks are equal
+ * @return > 0 if the first differing byte is greater in @c s1
+ * @return < 0 if the first differing byte is less in @c s1
+ */
+[[gnu::access(read_only, 1), gnu::access(read_only, 2)]] int memcmp(const void* s1, const void* s2, size_t n);
+
+/**
+ * @brief Kernel Standard Library memchr implementation
+ *
+ * @param[in] s Pointer to the block to search
+ * @param[in] c The byte to search for
+ * @param[in] n Number of bytes to search
+ *
+ * @return Pointer to the first occurrence of @c c in @c s, or @c NULL if not found
+ */
+[[gnu::access(read_only, 1)]] void* memchr(const void* s, int c, size_t n);
+
 /**
  * @brief Kernel Standard Library @c strlen implementation
  *
@@ -44,4 +92,27 @@ size_t strlen(const char* str);
  */
 int strcmp(const char* s1, const char* s2);
 
+/**
+ * @brief Compare at most @c n characters of two strings
+ *
+ * @param[in] s1 String s1
+ * @param[in] s2 String s2
+ * @param[in] n  Maximum number of characters to compare
+ *
+ * @return 0 if the first @c n characters of @c s1 and @c s2 are equal
+ * @return > 0 if @c s1 is greater than @c s2
+ * @return < 0 if @c s1 is less than @c s2
+ */
+int strncmp(const char* s1, const char* s2, size_t n);
+
+/**
+ * @brief Find the first occurrence of a character in a string
+ *
+ * @param[in] s String to search
+ * @param[in] c Character to search for. May be @c '\0' to find the terminator
+ *
+ * @return Pointer to the character in @c s, or @c NULL if not found
+ */
+char* strchr(const char* s, int c);
+
 #endif
@@ -0,0 +1,92 @@
+#
+# Vector (RVV 1.0) string routines
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+# These are only ever called from string.c, between srv_hal_VectorBegin()
+# and srv_hal_VectorEnd(), on harts that have a vector unit. The rest of
+# the Kernel is built without V, so it is only enabled for this file.
+#
+
+.option arch, +v
+
+.section .text
+
+#
+# void string_rvv_Copy(void* s1, const void* s2, size_t n)
+#
+# a0 - Destination
+# a1 - Source
+# a2 - Number of bytes
+#
+.type string_rvv_Copy, @function
+.global string_rvv_Copy
+string_rvv_Copy:
+    beqz a2, 2f
+1:
+    vsetvli t0, a2, e8, m8, ta, ma
+    vle8.v v8, (a1)
+    vse8.v v8, (a0)
+    add a1, a1, t0
+    add a0, a0, t0
+    sub a2, a2, t0
+    bnez a2, 1b
+2:
+    ret
+
+#
+# void string_rvv_Set(void* s, int c, size_t n)
+#
+# a0 - Destination
+# a1 - Byte to fill with
+# a2 - Number of bytes
+#
+.type string_rvv_Set, @function
+.global string_rvv_Set
+string_rvv_Set:
+    beqz a2, 2f
+    # Splat the byte across the whole register group once, then just store it
+    vsetvli t0, a2, e8, m8, ta, ma
+    vmv.v.x v8, a1
+1:
+    vsetvli t0, a2, e8, m8, ta, ma
+    vse8.v v8, (a0)
+    add a0, a0, t0
+    sub a2, a2, t0
+    bnez a2, 1b
+2:
+    ret
+
+#
+# long string_rvv_Compare(const void* s1, const void* s2, size_t n)
+#
+# a0 - First block
+# a1 - Second block
+# a2 - Number of bytes
+#
+# Returns the index of the first byte that differs, or -1 if the blocks match
+#
+.type string_rvv_Compare, @function
+.global string_rvv_Compare
+string_rvv_Compare:
+    mv t2, a0
+    beqz a2, 2f
+1:
+    vsetvli t0, a2, e8, m8, ta, ma
+    vle8.v v8, (a0)
+    vle8.v v16, (a1)
+    vmsne.vv v0, v8, v16
+    vfirst.m t1, v0
+    bgez t1, 3f
+    add a0, a0, t0
+    add a1, a1, t0
+    sub a2, a2, t0
+    bnez a2, 1b
+2:
+    li a0, -1
+    ret
+3:
+    # Index is the offset of this group from the start, plus the lane that differed
+    sub a0, a0, t2
+    add a0, a0, t1
+    ret
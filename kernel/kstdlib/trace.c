@@ -0,0 +1,124 @@
+/****************************************************************
+ * @file    trace.c
+ * @brief   Implementation of @ref trace.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <trace.h>
+
+#include <stdio.h>
+#include <sync/spinlock.h>
+
+srv_trace_ring_t srv_trace_rings[SRV_HAL_MAX_CPUS];
+
+static srv_spinlock_t trace_drain_lock = SRV_SPINLOCK_INIT("trace"); /**< Only one CPU drains at a time */
+
+void srv_trace_Record(const char* format, uint32_t count, const uint64_t* args)
+{
+    const uint32_t cpu = srv_hal_GetExecutingCPU();
+    if (cpu >= SRV_HAL_MAX_CPUS)
+    {
+        return;
+    }
+
+    srv_trace_ring_t* ring = &srv_trace_rings[cpu];
+
+    /*
+     * Only this CPU ever writes to its ring, but an interrupt handler on this
+     * CPU might log in the middle of us. The AMO hands us and the handler
+     * different slots without having to mask interrupts.
+     */
+    const uint64_t      position = __atomic_fetch_add(&ring->head, 1ULL, __ATOMIC_RELAXED);
+    srv_trace_record_t* record   = &ring->records[position & (SRV_TRACE_RING_RECORDS - 1U)];
+
+    if (count > SRV_TRACE_MAX_ARGS)
+    {
+        count = SRV_TRACE_MAX_ARGS;
+    }
+
+    /*
+     * The slot may still hold a record a reader is copying. Invalidate it
+     * before touching anything, so the reader's second look at the sequence
+     * catches us. Our position is a value no reader of this slot looks for.
+     */
+    __atomic_store_n(&record->sequence, (uint32_t)position, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->format    = format;
+    record->timestamp = srv_hal_GetCycleCount();
+    record->count     = count;
+
+    for (uint32_t arg = 0U; arg < count; arg++)
+    {
+        record->args[arg] = args[arg];
+    }
+
+    /* Publish last, so a reader that sees this sequence number sees the whole record */
+    __atomic_store_n(&record->sequence, (uint32_t)(position + 1ULL), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Format the records waiting in one ring
+ *
+ * @param[in] cpu  Number of the CPU that owns the ring
+ * @param[in] ring The ring
+ */
+static void trace_DrainRing(uint32_t cpu, srv_trace_ring_t* ring)
+{
+    const uint64_t head    = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint64_t       drained = ring->drained;
+
+    /* The writer never waits for us, so anything more than a ring behind is gone */
+    if ((head - drained) > SRV_TRACE_RING_RECORDS)
+    {
+        ring->lost += (head - drained) - SRV_TRACE_RING_RECORDS;
+        drained     = head - SRV_TRACE_RING_RECORDS;
+    }
+
+    while (drained != head)
+    {
+        const srv_trace_record_t* record = &ring->records[drained & (SRV_TRACE_RING_RECORDS - 1U)];
+
+        /* Reserved but not written yet (or already overwritten). Come back for it next time */
+        if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != (uint32_t)(drained + 1ULL))
+        {
+            break;
+        }
+
+        /* Take a copy, since the writer may lap us while we format it */
+        const srv_trace_record_t copy = *record;
+
+        /* The copy has to be done before the sequence is looked at again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&record->sequence, __ATOMIC_RELAXED) != (uint32_t)(drained + 1ULL))
+        {
+            ring->lost++;
+            drained++;
+            continue;
+        }
+
+        kprintf("[cpu%d %lx] ", (int)cpu, copy.timestamp);
+        (void)kprintf_args(copy.format, copy.args, copy.count);
+
+        drained++;
+    }
+
+    ring->drained = drained;
+}
+
+void srv_trace_Drain(void)
+{
+    /* Someone else is already on it */
+    if (!srv_spinlock_TryLock(&trace_drain_lock))
+    {
+        return;
+    }
+
+    for (uint32_t cpu = 0U; cpu < SRV_HAL_MAX_CPUS; cpu++)
+    {
+        trace_DrainRing(cpu, &srv_trace_rings[cpu]);
+    }
+
+    srv_spinlock_Unlock(&trace_drain_lock);
+}
@@ -0,0 +1,114 @@
+/****************************************************************
+ * @file    trace.h
+ * @brief   Deferred binary trace log
+ *
+ * @details @ref ktrace records the format string pointer, a cycle count and
+ *          the raw arguments into a per-CPU ring, without formatting anything.
+ *          Records are turned into text later, either by @ref srv_trace_Drain
+ *          or offline by @c meta/tools/trace_decode.py, which reads a dump of
+ *          @ref srv_trace_rings and resolves the format strings from the
+ *          Kernel ELF.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <hal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SRV_TRACE_MAX_ARGS     5U   /**< Most arguments a single record can hold */
+#define SRV_TRACE_RING_RECORDS 256U /**< Records per CPU ring. Must be a power of 2 */
+
+/**
+ * @brief One trace record
+ *
+ * @note The host decoder depends on this layout
+ */
+typedef struct
+{
+    const char* format;                   /**< Format string, as passed to @ref ktrace */
+    uint64_t    timestamp;                /**< @ref srv_hal_GetCycleCount when the record was made */
+    uint32_t    sequence;                 /**< Low bits of (ring position + 1), written last to publish the record. Low bits of the position while it is being written */
+    uint32_t    count;                    /**< Number of arguments in @ref args */
+    uint64_t    args[SRV_TRACE_MAX_ARGS]; /**< Arguments, each cast to a word */
+} srv_trace_record_t;
+
+/**
+ * @brief A CPU's trace ring
+ *
+ * @note The host decoder depends on this layout
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]
+{
+    uint64_t           head;                            /**< Number of records ever reserved */
+    uint64_t           drained;                         /**< Number of records @ref srv_trace_Drain has consumed */
+    uint64_t           lost;                            /**< Records overwritten before they were drained */
+    srv_trace_record_t records[SRV_TRACE_RING_RECORDS] [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]; /**< The ring */
+} srv_trace_ring_t;
+
+extern srv_trace_ring_t srv_trace_rings[SRV_HAL_MAX_CPUS]; /**< Every CPU's ring, exported for the host decoder */
+
+/**
+ * @brief Append a record to the executing CPU's ring
+ *
+ * @note Use @ref ktrace rather than calling this directly
+ *
+ * @param[in] format The format string
+ * @param[in] count  Number of words in @c args
+ * @param[in] args   The arguments, each cast to a word
+ */
+void srv_trace_Record(const char* format, uint32_t count, const uint64_t* args);
+
+/**
+ * @brief Format every record waiting in every CPU's ring through @ref kprintf_args
+ *
+ * @details Meant to be called when there's nothing better to do, e.g. from the idle loop
+ */
+void srv_trace_Drain(void);
+
+/**
+ * @brief Never called. Gives @ref ktrace the same format checking as @ref kprintf
+ */
+[[gnu::format(printf, 1, 2)]] static inline void srv_trace_CheckFormat([[maybe_unused]] const char* format, ...)
+{
+}
+
+#define SRV_TRACE_WORD(x)        ((uint64_t)(uintptr_t)(x))
+#define SRV_TRACE_WORDS_0()
+#define SRV_TRACE_WORDS_1(a)             SRV_TRACE_WORD(a)
+#define SRV_TRACE_WORDS_2(a, b)          SRV_TRACE_WORDS_1(a), SRV_TRACE_WORD(b)
+#define SRV_TRACE_WORDS_3(a, b, c)       SRV_TRACE_WORDS_2(a, b), SRV_TRACE_WORD(c)
+#define SRV_TRACE_WORDS_4(a, b, c, d)    SRV_TRACE_WORDS_3(a, b, c), SRV_TRACE_WORD(d)
+#define SRV_TRACE_WORDS_5(a, b, c, d, e) SRV_TRACE_WORDS_4(a, b, c, d), SRV_TRACE_WORD(e)
+#define SRV_TRACE_COUNT_(_1, _2, _3, _4, _5, n, ...) n
+#define SRV_TRACE_COUNT(...)     SRV_TRACE_COUNT_(__VA_ARGS__ __VA_OPT__(, ) 5, 4, 3, 2, 1, 0)
+#define SRV_TRACE_CAT_(a, b)     a##b
+#define SRV_TRACE_CAT(a, b)      SRV_TRACE_CAT_(a, b)
+
+/**
+ * @brief Log a message to the trace ring instead of the console
+ *
+ * @details Takes the same format strings as @ref kprintf, with up to
+ *          @ref SRV_TRACE_MAX_ARGS arguments. Nothing is formatted here, so a
+ *          call costs a handful of stores. String (@c %s) arguments are only
+ *          dereferenced when the record is formatted, so they must still be
+ *          alive then; string literals always are.
+ *
+ * @param[in] format The format string
+ */
+#define ktrace(format, ...)                                                                                                \
+    do                                                                                                                     \
+    {                                                                                                                      \
+        if (false)                                                                                                         \
+        {                                                                                                                  \
+            srv_trace_CheckFormat(format __VA_OPT__(, ) __VA_ARGS__);                                                      \
+        }                                                                                                                  \
+        srv_trace_Record(format, SRV_TRACE_COUNT(__VA_ARGS__),                                                             \
+                         (const uint64_t[SRV_TRACE_MAX_ARGS]){                                                     \
+                             SRV_TRACE_CAT(SRV_TRACE_WORDS_, SRV_TRACE_COUNT(__VA_ARGS__))(__VA_ARGS__)});                 \
+    } while (false)
+
+#endif
@@ -8,27 +8,64 @@
  */
 
 #include <mm/kalloc.h>
+#include <mm/kmem.h>
+#include <mm/phys/kpalloc.h>
 #include <hal.h>
 #include <panic.h>
+#include <sync/spinlock.h>
+
+#define KMALLOC_LARGE_TAG 1ULL /**< Page owner tag bit marking the first page of a large allocation */
 
 extern uintptr_t __kalloc_eternal_start;
 extern uintptr_t __kalloc_eternal_end;
-static uintptr_t curr_kalloc_eternal_address = (uintptr_t)&__kalloc_eternal_start;
+static uintptr_t      curr_kalloc_eternal_address = (uintptr_t)&__kalloc_eternal_start;
+static srv_spinlock_t kalloc_eternal_lock         = SRV_SPINLOCK_INIT("kalloc-eternal"); /**< Protects @ref curr_kalloc_eternal_address */
 
-void* srv_kalloc_EternalAlloc(size_t size)
+/**
+ * @brief Names of the size class caches
+ */
+static const char* const kmalloc_class_names[SRV_KMALLOC_CLASS_COUNT] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-24", "kmalloc-32",
+    "kmalloc-48", "kmalloc-64", "kmalloc-96", "kmalloc-128",
+    "kmalloc-192", "kmalloc-256", "kmalloc-384", "kmalloc-512",
+    "kmalloc-768", "kmalloc-1024", "kmalloc-1536", "kmalloc-2048"};
+
+static srv_kmem_cache_t* kmalloc_caches[SRV_KMALLOC_CLASS_COUNT] = {NULL};
+
+static size_t kmalloc_large_allocs = 0ULL; /**< Number of large allocations */
+static size_t kmalloc_large_frees  = 0ULL; /**< Number of large frees */
+static size_t kmalloc_large_pages  = 0ULL; /**< Pages currently held by large allocations */
+
+/**
+ * @brief Bump the eternal heap pointer
+ *
+ * @param[in] size      Number of bytes to allocate
+ * @param[in] alignment Alignment of the allocation. Must be a power of 2
+ *
+ * @return The allocation
+ */
+static void* kalloc_EternalBump(size_t size, size_t alignment)
 {
     void* alloc_ptr = NULL;
 
+    srv_spinlock_Lock(&kalloc_eternal_lock);
+
+    /* Round the current allocation pointer up to the next aligned address */
+    const uintptr_t address = (curr_kalloc_eternal_address + alignment - 1ULL) & ~(alignment - 1ULL);
+
     /* Make sure we aren't don't spill over */
-    if ((curr_kalloc_eternal_address + size) < (uintptr_t)&__kalloc_eternal_end)
+    if ((address + size) <= (uintptr_t)&__kalloc_eternal_end)
     {
         /* Allocate it! */
-        alloc_ptr = (void*)curr_kalloc_eternal_address;
+        alloc_ptr = (void*)address;
 
         /* Bump it! */
-        curr_kalloc_eternal_address += size;
+        curr_kalloc_eternal_address = address + size;
     }
-    else
+
+    srv_spinlock_Unlock(&kalloc_eternal_lock);
+
+    if (alloc_ptr == NULL)
     {
         srv_KernelPanic("Eternal Heap Exhausted!");
     }
@@ -36,10 +73,199 @@ void* srv_kalloc_EternalAlloc(size_t size)
     return alloc_ptr;
 }
 
+void* srv_kalloc_EternalAlloc(size_t size)
+{
+    return kalloc_EternalBump(size, 1ULL);
+}
+
 [[gnu::malloc]] void* srv_kalloc_EternalAllocAligned(size_t size, size_t alignment)
 {
-    /* Align the current allocation pointer */
-    curr_kalloc_eternal_address = curr_kalloc_eternal_address + (curr_kalloc_eternal_address & (alignment - 1ULL));
+    return kalloc_EternalBump(size, alignment);
+}
+
+/**
+ * @brief Get the size of a size class
+ *
+ * @details Classes go 8, 16, then a power of two and the point three quarters
+ *          of the way to it for every power from 32 upwards (24, 32, 48, 64...)
+ *
+ * @param[in] size_class The size class index
+ *
+ * @return The size of objects in that class
+ */
+static inline size_t kmalloc_ClassSize(uint32_t size_class)
+{
+    if (size_class < 2U)
+    {
+        return 8ULL << size_class;
+    }
+
+    const uint32_t power = ((size_class - 2U) / 2U) + 5U;
+
+    return ((size_class & 1U) != 0U) ? (1ULL << power) : (3ULL << (power - 2U));
+}
+
+/**
+ * @brief Get the smallest size class that fits a size
+ *
+ * @param[in] size Number of bytes, at most @ref SRV_KMALLOC_MAX_CLASS_SIZE
+ *
+ * @return The size class index
+ */
+static inline uint32_t kmalloc_SizeToClass(size_t size)
+{
+    if (size <= 16ULL)
+    {
+        return (size <= 8ULL) ? 0U : 1U;
+    }
+
+    /* Round up to the next power of two, then see if the three quarter class is enough */
+    const uint32_t power      = 64U - (uint32_t)__builtin_clzll(size - 1ULL);
+    const uint32_t size_class = ((power - 5U) * 2U) + 2U;
+
+    return (size <= (3ULL << (power - 2U))) ? size_class : (size_class + 1U);
+}
+
+/**
+ * @brief The natural alignment of a size class, which is the largest power of two dividing its size
+ */
+static inline size_t kmalloc_ClassAlign(uint32_t size_class)
+{
+    const size_t size = kmalloc_ClassSize(size_class);
+
+    return size & (~size + 1ULL);
+}
+
+/**
+ * @brief Allocate directly from the page allocator
+ */
+static void* kmalloc_LargeAlloc(size_t size, size_t align)
+{
+    if (align > size)
+    {
+        size = align;
+    }
+
+    /* Buddy blocks are aligned to their own size, which covers any alignment up to the block size */
+    uint32_t order = 0U;
+    while ((SRV_PAGE_SIZE << order) < size)
+    {
+        order++;
+
+        if (order > SRV_KPALLOC_MAX_ORDER)
+        {
+            return NULL;
+        }
+    }
+
+    void* block = srv_kpalloc_AllocPages(order);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    srv_kpalloc_SetPageOwner(block, ((uintptr_t)order << 1ULL) | KMALLOC_LARGE_TAG);
+
+    __atomic_fetch_add(&kmalloc_large_allocs, 1ULL, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&kmalloc_large_pages, 1ULL << order, __ATOMIC_RELAXED);
+
+    return block;
+}
+
+void srv_kmalloc_Init(void)
+{
+    for (uint32_t size_class = 0U; size_class < SRV_KMALLOC_CLASS_COUNT; size_class++)
+    {
+        kmalloc_caches[size_class] = srv_kmem_CacheCreate(kmalloc_class_names[size_class], kmalloc_ClassSize(size_class), kmalloc_ClassAlign(size_class), NULL);
+        if (kmalloc_caches[size_class] == NULL)
+        {
+            srv_KernelPanic("kmalloc: failed to create the size class caches");
+        }
+    }
+}
+
+void* srv_kmalloc(size_t size, size_t align)
+{
+    if (size == 0ULL)
+    {
+        return NULL;
+    }
+
+    if ((align & (align - 1ULL)) != 0ULL)
+    {
+        srv_KernelPanic("kmalloc: alignment is not a power of 2");
+    }
+
+    if ((size > SRV_KMALLOC_MAX_CLASS_SIZE) || (align > SRV_KMALLOC_MAX_CLASS_SIZE))
+    {
+        return kmalloc_LargeAlloc(size, align);
+    }
+
+    /* Step up until we hit a class that is naturally aligned enough. The power of two classes always are */
+    uint32_t size_class = kmalloc_SizeToClass((size < align) ? align : size);
+    while (kmalloc_ClassAlign(size_class) < align)
+    {
+        size_class++;
+    }
+
+    return srv_kmem_CacheAlloc(kmalloc_caches[size_class]);
+}
+
+void srv_kfree(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    const uintptr_t owner = srv_kpalloc_GetPageOwner(ptr);
+
+    if ((owner & KMALLOC_LARGE_TAG) != 0ULL)
+    {
+        const uint32_t order = (uint32_t)(owner >> 1ULL);
+
+        if (((uintptr_t)ptr & (SRV_PAGE_SIZE - 1ULL)) != 0ULL)
+        {
+            srv_KernelPanic("kfree: pointer is not the start of a large allocation");
+        }
+
+        srv_kpalloc_SetPageOwner(ptr, 0ULL);
+        srv_kpalloc_FreePages(ptr, order);
+
+        __atomic_fetch_add(&kmalloc_large_frees, 1ULL, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&kmalloc_large_pages, 1ULL << order, __ATOMIC_RELAXED);
+
+        return;
+    }
+
+    /* Otherwise it has to have come out of one of our slab caches */
+    srv_kmem_cache_t* cache = srv_kmem_CacheOf(ptr);
+    for (uint32_t size_class = 0U; size_class < SRV_KMALLOC_CLASS_COUNT; size_class++)
+    {
+        if (kmalloc_caches[size_class] == cache)
+        {
+            srv_kmem_CacheFree(cache, ptr);
+            return;
+        }
+    }
+
+    srv_KernelPanic("kfree: pointer was not allocated by kmalloc");
+}
+
+void srv_kmalloc_GetStats(srv_kmalloc_stats_t* stats)
+{
+    for (uint32_t size_class = 0U; size_class < SRV_KMALLOC_CLASS_COUNT; size_class++)
+    {
+        srv_kmem_stats_t cache_stats;
+        srv_kmem_CacheGetStats(kmalloc_caches[size_class], &cache_stats);
+
+        stats->classes[size_class].size   = cache_stats.object_size;
+        stats->classes[size_class].allocs = cache_stats.allocs;
+        stats->classes[size_class].frees  = cache_stats.frees;
+        stats->classes[size_class].slabs  = cache_stats.slabs;
+    }
 
-    return srv_kalloc_EternalAlloc(size);
+    stats->large_allocs = __atomic_load_n(&kmalloc_large_allocs, __ATOMIC_RELAXED);
+    stats->large_frees  = __atomic_load_n(&kmalloc_large_frees, __ATOMIC_RELAXED);
+    stats->large_pages  = __atomic_load_n(&kmalloc_large_pages, __ATOMIC_RELAXED);
 }
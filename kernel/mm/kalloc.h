@@ -11,6 +11,32 @@
 #define KALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#define SRV_KMALLOC_CLASS_COUNT    16U     /**< Number of @ref srv_kmalloc size classes */
+#define SRV_KMALLOC_MAX_CLASS_SIZE 2048ULL /**< Largest size class. Anything bigger goes straight to the page allocator */
+
+/**
+ * @brief Per size class @ref srv_kmalloc statistics
+ */
+typedef struct
+{
+    size_t size;   /**< Size of objects in this class */
+    size_t allocs; /**< Number of allocations from this class */
+    size_t frees;  /**< Number of frees to this class */
+    size_t slabs;  /**< Number of slabs currently backing this class */
+} srv_kmalloc_class_stats_t;
+
+/**
+ * @brief @ref srv_kmalloc statistics
+ */
+typedef struct
+{
+    srv_kmalloc_class_stats_t classes[SRV_KMALLOC_CLASS_COUNT]; /**< Statistics for each size class */
+    size_t                    large_allocs;                     /**< Number of allocations served by the page allocator */
+    size_t                    large_frees;                      /**< Number of large allocations freed */
+    size_t                    large_pages;                      /**< Number of pages currently held by large allocations */
+} srv_kmalloc_stats_t;
 
 /**
  * @brief   Allocates data on the eternal kernel heap
@@ -29,4 +55,39 @@
  */
 [[gnu::malloc]] void* srv_kalloc_EternalAllocAligned(size_t size, size_t alignment);
 
+/**
+ * @brief Initialize the general purpose kernel heap
+ *
+ * @warning The physical page allocator must be initialized before calling this
+ */
+void srv_kmalloc_Init(void);
+
+/**
+ * @brief   Allocate memory from the general purpose kernel heap
+ * @details Requests up to @ref SRV_KMALLOC_MAX_CLASS_SIZE are rounded up to a
+ *          size class and served from that class's slab cache. Anything larger
+ *          is served directly by the page allocator.
+ *
+ * @param[in] size  Number of bytes to allocate
+ * @param[in] align Required alignment. Must be a power of 2, or 0 for the natural alignment of the size class
+ *
+ * @return Pointer to the allocated memory
+ * @return @c NULL if @c size is 0 or the system is out of memory
+ */
+[[gnu::malloc, gnu::alloc_size(1)]] void* srv_kmalloc(size_t size, size_t align);
+
+/**
+ * @brief Free memory allocated by @ref srv_kmalloc
+ *
+ * @param[in] ptr Pointer to free. @c NULL is ignored
+ */
+void srv_kfree(void* ptr);
+
+/**
+ * @brief Get a snapshot of the kernel heap's statistics
+ *
+ * @param[out] stats Structure to fill
+ */
+void srv_kmalloc_GetStats(srv_kmalloc_stats_t* stats);
+
 #endif
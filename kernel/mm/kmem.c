@@ -0,0 +1,569 @@
+/**
+ * @file    kmem.c
+ * @brief   Implementation of @ref kmem.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * Copyright (C) 2025 Jesse Buhagiar
+ */
+
+#include <mm/kmem.h>
+#include <mm/phys/kpalloc.h>
+#include <panic.h>
+#include <sync/spinlock.h>
+
+#define KMEM_CPU_CACHE_SIZE  16ULL                    /**< Number of objects each CPU can keep cached per cache */
+#define KMEM_CPU_CACHE_BATCH 8ULL                     /**< Number of objects moved between a CPU cache and the slabs at once */
+#define KMEM_MIN_ALIGN       sizeof(void*)            /**< Smallest alignment handed out */
+#define KMEM_MIN_OBJECTS     8ULL                     /**< Slabs are grown until they hold at least this many objects */
+#define KMEM_MAX_SLAB_ORDER  3U                       /**< Largest slab, as a page allocator order */
+#define KMEM_MAX_EMPTY_SLABS 1ULL                     /**< Empty slabs kept around before handing them back to the page allocator */
+#define KMEM_FREE_LIST_END   UINT16_MAX               /**< Terminates a slab's free list */
+#define KMEM_MAX_OBJECTS     (KMEM_FREE_LIST_END - 1) /**< Max objects per slab, limited by the free list index type */
+
+/**
+ * @brief Slab header
+ *
+ * @details Lives at the start of every slab. Slabs are allocated with
+ *          @ref srv_kpalloc_AllocPages so they are naturally aligned to their
+ *          size, which means the slab an object belongs to can be found by
+ *          masking the object's address. The free list is a separate array of
+ *          indices, so free objects are never written to and stay constructed.
+ */
+typedef struct kmem_slab
+{
+    struct kmem_slab* next;        /**< Next slab in the list this slab is on */
+    struct kmem_slab* prev;        /**< Previous slab in the list this slab is on */
+    srv_kmem_cache_t* cache;       /**< The cache that owns this slab */
+    uint8_t*          objects;     /**< The first object, after the color offset */
+    uint16_t          in_use;      /**< Number of objects allocated out of this slab */
+    uint16_t          free_head;   /**< Index of the first free object */
+    uint16_t          free_next[]; /**< Index of the next free object, per object */
+} kmem_slab_t;
+
+/**
+ * @brief Per-CPU object cache
+ *
+ * @details A LIFO stack of free objects that only the owning CPU touches, so
+ *          the common alloc/free path takes no lock. Cache-line aligned so CPUs
+ *          don't falsely share each other's stacks.
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]
+{
+    void*  objects[KMEM_CPU_CACHE_SIZE]; /**< Cached objects. @c objects[count - 1] is the hottest */
+    size_t count;                        /**< Number of cached objects */
+    size_t allocs;                       /**< Number of allocations served on this CPU */
+    size_t frees;                        /**< Number of frees served on this CPU */
+} kmem_cpu_cache_t;
+
+struct srv_kmem_cache
+{
+    kmem_cpu_cache_t cpu_caches[SRV_HAL_MAX_CPUS]; /**< Per-CPU object stacks */
+    const char*      name;                         /**< Name of the cache */
+    srv_kmem_ctor_t  ctor;                         /**< Object constructor, may be @c NULL */
+    size_t           object_size;                  /**< Size of each object, rounded up to its alignment */
+    size_t           objects_per_slab;             /**< Number of objects in each slab */
+    size_t           objects_offset;               /**< Offset of the first object from the slab, without color */
+    size_t           color_step;                   /**< Distance between two colors, in bytes */
+    size_t           color_max;                    /**< Highest color a slab can have */
+    size_t           color_next;                   /**< Color to give the next slab */
+    uint32_t         slab_order;                   /**< Page allocator order of each slab */
+    srv_spinlock_t   lock;                         /**< Protects everything below */
+    kmem_slab_t*     partial_slabs;                /**< Slabs with some objects allocated */
+    kmem_slab_t*     empty_slabs;                  /**< Slabs with no objects allocated */
+    size_t           empty_slab_count;             /**< Number of slabs in @ref empty_slabs */
+    size_t           slab_count;                   /**< Number of slabs owned by the cache */
+    size_t           allocs;                       /**< Allocations not served by a CPU cache */
+    size_t           frees;                        /**< Frees not served by a CPU cache */
+};
+
+static struct srv_kmem_cache kmem_cache_cache  = {0};   /**< The cache that cache descriptors are allocated from */
+static bool                  kmem_bootstrapped = false; /**< Has @ref kmem_cache_cache been set up */
+
+static inline size_t kmem_AlignUp(size_t value, size_t align)
+{
+    return (value + align - 1ULL) & ~(align - 1ULL);
+}
+
+static inline void kmem_Lock(srv_kmem_cache_t* cache)
+{
+    srv_spinlock_Lock(&cache->lock);
+}
+
+static inline void kmem_Unlock(srv_kmem_cache_t* cache)
+{
+    srv_spinlock_Unlock(&cache->lock);
+}
+
+/**
+ * @brief Work out the slab geometry of a cache
+ *
+ * @param[in] cache The cache, with @c object_size already set
+ * @param[in] align The alignment of each object
+ */
+static void kmem_cache_Layout(srv_kmem_cache_t* cache, size_t align)
+{
+    size_t slab_bytes = 0ULL;
+    size_t objects    = 0ULL;
+
+    for (uint32_t order = 0U; order <= KMEM_MAX_SLAB_ORDER; order++)
+    {
+        slab_bytes = SRV_PAGE_SIZE << order;
+
+        /* Start from an estimate that ignores alignment padding, then back off until it fits */
+        objects = (slab_bytes - sizeof(kmem_slab_t)) / (cache->object_size + sizeof(uint16_t));
+        while ((objects > 0ULL) && ((kmem_AlignUp(sizeof(kmem_slab_t) + (objects * sizeof(uint16_t)), align) + (objects * cache->object_size)) > slab_bytes))
+        {
+            objects--;
+        }
+
+        cache->slab_order = order;
+        if (objects >= KMEM_MIN_OBJECTS)
+        {
+            break;
+        }
+    }
+
+    if (objects == 0ULL)
+    {
+        srv_KernelPanic("kmem: object too large for a slab");
+    }
+
+    if (objects > KMEM_MAX_OBJECTS)
+    {
+        objects = KMEM_MAX_OBJECTS;
+    }
+
+    cache->objects_per_slab = objects;
+    cache->objects_offset   = kmem_AlignUp(sizeof(kmem_slab_t) + (objects * sizeof(uint16_t)), align);
+
+    /* Spread whatever is left over across slabs so their objects start on different cache lines */
+    cache->color_step = (align > SRV_HAL_CACHE_LINE_SIZE) ? align : SRV_HAL_CACHE_LINE_SIZE;
+    cache->color_max  = (slab_bytes - cache->objects_offset - (objects * cache->object_size)) / cache->color_step;
+    cache->color_next = 0ULL;
+}
+
+/**
+ * @brief Fill in a cache descriptor
+ */
+static void kmem_cache_Setup(srv_kmem_cache_t* cache, const char* name, size_t size, size_t align, srv_kmem_ctor_t ctor)
+{
+    if (align < KMEM_MIN_ALIGN)
+    {
+        align = KMEM_MIN_ALIGN;
+    }
+
+    if ((size == 0ULL) || ((align & (align - 1ULL)) != 0ULL))
+    {
+        srv_KernelPanic("kmem: invalid object size or alignment");
+    }
+
+    for (uint32_t cpu = 0U; cpu < SRV_HAL_MAX_CPUS; cpu++)
+    {
+        cache->cpu_caches[cpu].count  = 0ULL;
+        cache->cpu_caches[cpu].allocs = 0ULL;
+        cache->cpu_caches[cpu].frees  = 0ULL;
+    }
+
+    cache->name             = name;
+    srv_spinlock_Init(&cache->lock, name);
+    cache->ctor             = ctor;
+    cache->object_size      = kmem_AlignUp(size, align);
+    cache->partial_slabs    = NULL;
+    cache->empty_slabs      = NULL;
+    cache->empty_slab_count = 0ULL;
+    cache->slab_count       = 0ULL;
+    cache->allocs           = 0ULL;
+    cache->frees            = 0ULL;
+
+    kmem_cache_Layout(cache, align);
+}
+
+/**
+ * @brief Get the list a slab belongs on, given how many of its objects are in use
+ *
+ * @return The list, or @c NULL if the slab is full and belongs on no list
+ */
+static inline kmem_slab_t** kmem_slab_ListFor(srv_kmem_cache_t* cache, const kmem_slab_t* slab)
+{
+    if (slab->in_use == 0U)
+    {
+        return &cache->empty_slabs;
+    }
+
+    if (slab->in_use == cache->objects_per_slab)
+    {
+        return NULL;
+    }
+
+    return &cache->partial_slabs;
+}
+
+static inline void kmem_slab_ListPush(kmem_slab_t** list, kmem_slab_t* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+
+    if (*list != NULL)
+    {
+        (*list)->prev = slab;
+    }
+
+    *list = slab;
+}
+
+static inline void kmem_slab_ListRemove(kmem_slab_t** list, kmem_slab_t* slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/**
+ * @brief Move a slab to the right list after its use count changed
+ *
+ * @param[in] cache     The owning cache
+ * @param[in] slab      The slab
+ * @param[in] prev_list The list the slab was on before the change
+ */
+static void kmem_slab_Relist(srv_kmem_cache_t* cache, kmem_slab_t* slab, kmem_slab_t** prev_list)
+{
+    kmem_slab_t** new_list = kmem_slab_ListFor(cache, slab);
+    if (new_list == prev_list)
+    {
+        return;
+    }
+
+    if (prev_list != NULL)
+    {
+        kmem_slab_ListRemove(prev_list, slab);
+    }
+
+    if (prev_list == &cache->empty_slabs)
+    {
+        cache->empty_slab_count--;
+    }
+
+    if (new_list != NULL)
+    {
+        kmem_slab_ListPush(new_list, slab);
+    }
+
+    if (new_list == &cache->empty_slabs)
+    {
+        cache->empty_slab_count++;
+    }
+}
+
+/**
+ * @brief Create a new slab for a cache and construct all of its objects
+ *
+ * @note Called without the cache lock held, since the constructors may take a while
+ *
+ * @return The new slab, or @c NULL if there are no pages left
+ */
+static kmem_slab_t* kmem_slab_Create(srv_kmem_cache_t* cache, size_t color)
+{
+    kmem_slab_t* slab = srv_kpalloc_AllocPages(cache->slab_order);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+
+    /* Tag every page of the slab so that any object can be traced back to it */
+    for (size_t page = 0ULL; page < (1ULL << cache->slab_order); page++)
+    {
+        srv_kpalloc_SetPageOwner((const uint8_t*)slab + (page * SRV_PAGE_SIZE), (uintptr_t)slab);
+    }
+
+    slab->next      = NULL;
+    slab->prev      = NULL;
+    slab->cache     = cache;
+    slab->objects   = (uint8_t*)slab + cache->objects_offset + (color * cache->color_step);
+    slab->in_use    = 0U;
+    slab->free_head = 0U;
+
+    for (size_t index = 0ULL; index < cache->objects_per_slab; index++)
+    {
+        slab->free_next[index] = ((index + 1ULL) < cache->objects_per_slab) ? (uint16_t)(index + 1ULL) : KMEM_FREE_LIST_END;
+
+        if (cache->ctor != NULL)
+        {
+            cache->ctor(&slab->objects[index * cache->object_size]);
+        }
+    }
+
+    return slab;
+}
+
+/**
+ * @brief Find the slab an object lives in
+ */
+static inline kmem_slab_t* kmem_slab_FromObject(const srv_kmem_cache_t* cache, const void* object)
+{
+    return (kmem_slab_t*)((uintptr_t)object & ~((SRV_PAGE_SIZE << cache->slab_order) - 1ULL));
+}
+
+/**
+ * @brief Take up to @c count objects out of the cache's slabs, growing the cache if needed
+ *
+ * @param[in]  cache   The cache
+ * @param[out] objects Array to put the objects into
+ * @param[in]  count   Number of objects wanted
+ *
+ * @return Number of objects actually taken
+ */
+static size_t kmem_cache_TakeObjects(srv_kmem_cache_t* cache, void** objects, size_t count)
+{
+    size_t taken = 0ULL;
+
+    kmem_Lock(cache);
+
+    while (taken < count)
+    {
+        /* Prefer partial slabs so empty ones can be given back */
+        kmem_slab_t* slab = (cache->partial_slabs != NULL) ? cache->partial_slabs : cache->empty_slabs;
+
+        if (slab == NULL)
+        {
+            const size_t color = cache->color_next;
+            cache->color_next  = (color == cache->color_max) ? 0ULL : (color + 1ULL);
+
+            kmem_Unlock(cache);
+            slab = kmem_slab_Create(cache, color);
+            kmem_Lock(cache);
+
+            if (slab == NULL)
+            {
+                break;
+            }
+
+            kmem_slab_ListPush(&cache->empty_slabs, slab);
+            cache->empty_slab_count++;
+            cache->slab_count++;
+        }
+
+        kmem_slab_t** prev_list = kmem_slab_ListFor(cache, slab);
+
+        /* Pull objects off this slab until it runs out or we have enough */
+        while ((taken < count) && (slab->free_head != KMEM_FREE_LIST_END))
+        {
+            const uint16_t index = slab->free_head;
+
+            slab->free_head = slab->free_next[index];
+            slab->in_use++;
+
+            objects[taken] = &slab->objects[index * cache->object_size];
+            taken++;
+        }
+
+        kmem_slab_Relist(cache, slab, prev_list);
+    }
+
+    kmem_Unlock(cache);
+
+    return taken;
+}
+
+/**
+ * @brief Put objects back into the slabs they came from
+ *
+ * @param[in] cache   The cache
+ * @param[in] objects The objects to put back
+ * @param[in] count   Number of objects
+ */
+static void kmem_cache_ReturnObjects(srv_kmem_cache_t* cache, void* const* objects, size_t count)
+{
+    kmem_slab_t* release = NULL;
+
+    kmem_Lock(cache);
+
+    for (size_t object = 0ULL; object < count; object++)
+    {
+        kmem_slab_t*   slab  = kmem_slab_FromObject(cache, objects[object]);
+        const size_t   delta = (size_t)((uint8_t*)objects[object] - slab->objects);
+        const uint16_t index = (uint16_t)(delta / cache->object_size);
+
+        if ((slab->cache != cache) || ((delta % cache->object_size) != 0ULL) || (index >= cache->objects_per_slab))
+        {
+            srv_KernelPanic("kmem: freeing an object to the wrong cache");
+        }
+
+        kmem_slab_t** prev_list = kmem_slab_ListFor(cache, slab);
+
+        slab->free_next[index] = slab->free_head;
+        slab->free_head        = index;
+        slab->in_use--;
+
+        kmem_slab_Relist(cache, slab, prev_list);
+
+        /* Too many empty slabs hanging around, give one back */
+        if ((slab->in_use == 0U) && (cache->empty_slab_count > KMEM_MAX_EMPTY_SLABS))
+        {
+            kmem_slab_ListRemove(&cache->empty_slabs, slab);
+            cache->empty_slab_count--;
+            cache->slab_count--;
+
+            slab->next = release;
+            release    = slab;
+        }
+    }
+
+    kmem_Unlock(cache);
+
+    while (release != NULL)
+    {
+        kmem_slab_t* next = release->next;
+
+        for (size_t page = 0ULL; page < (1ULL << cache->slab_order); page++)
+        {
+            srv_kpalloc_SetPageOwner((const uint8_t*)release + (page * SRV_PAGE_SIZE), 0ULL);
+        }
+
+        srv_kpalloc_FreePages(release, cache->slab_order);
+        release = next;
+    }
+}
+
+/**
+ * @brief Get the executing CPU's object stack for a cache
+ *
+ * @return The CPU cache, or @c NULL if this CPU has none
+ */
+static inline kmem_cpu_cache_t* kmem_cache_CurrentCpu(srv_kmem_cache_t* cache)
+{
+    const uint32_t cpu = srv_hal_GetExecutingCPU();
+
+    return (cpu < SRV_HAL_MAX_CPUS) ? &cache->cpu_caches[cpu] : NULL;
+}
+
+srv_kmem_cache_t* srv_kmem_CacheCreate(const char* name, size_t size, size_t align, srv_kmem_ctor_t ctor)
+{
+    /* Cache descriptors come from a cache too, which has to be set up by hand the first time around */
+    if (!kmem_bootstrapped)
+    {
+        kmem_cache_Setup(&kmem_cache_cache, "kmem_cache", sizeof(struct srv_kmem_cache), _Alignof(struct srv_kmem_cache), NULL);
+        kmem_bootstrapped = true;
+    }
+
+    srv_kmem_cache_t* cache = srv_kmem_CacheAlloc(&kmem_cache_cache);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    kmem_cache_Setup(cache, name, size, align, ctor);
+
+    return cache;
+}
+
+void* srv_kmem_CacheAlloc(srv_kmem_cache_t* cache)
+{
+    void* object = NULL;
+
+    /* The CPU cache belongs to this CPU, so all we need to do is keep interrupts off it */
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    kmem_cpu_cache_t*     cpu_cache = kmem_cache_CurrentCpu(cache);
+
+    if (cpu_cache != NULL)
+    {
+        if (cpu_cache->count == 0ULL)
+        {
+            cpu_cache->count = kmem_cache_TakeObjects(cache, cpu_cache->objects, KMEM_CPU_CACHE_BATCH);
+        }
+
+        if (cpu_cache->count != 0ULL)
+        {
+            cpu_cache->count--;
+            object = cpu_cache->objects[cpu_cache->count];
+            cpu_cache->allocs++;
+        }
+    }
+    else if (kmem_cache_TakeObjects(cache, &object, 1ULL) != 0ULL)
+    {
+        __atomic_fetch_add(&cache->allocs, 1ULL, __ATOMIC_RELAXED);
+    }
+
+    srv_hal_RestoreInterrupts(irq_state);
+
+    return object;
+}
+
+void srv_kmem_CacheFree(srv_kmem_cache_t* cache, void* object)
+{
+    if (object == NULL)
+    {
+        return;
+    }
+
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    kmem_cpu_cache_t*     cpu_cache = kmem_cache_CurrentCpu(cache);
+
+    if (cpu_cache != NULL)
+    {
+        if (cpu_cache->count == KMEM_CPU_CACHE_SIZE)
+        {
+            /* Give back the coldest batch, and slide the hot end down */
+            kmem_cache_ReturnObjects(cache, cpu_cache->objects, KMEM_CPU_CACHE_BATCH);
+
+            for (size_t index = KMEM_CPU_CACHE_BATCH; index < cpu_cache->count; index++)
+            {
+                cpu_cache->objects[index - KMEM_CPU_CACHE_BATCH] = cpu_cache->objects[index];
+            }
+
+            cpu_cache->count -= KMEM_CPU_CACHE_BATCH;
+        }
+
+        cpu_cache->objects[cpu_cache->count] = object;
+        cpu_cache->count++;
+        cpu_cache->frees++;
+    }
+    else
+    {
+        kmem_cache_ReturnObjects(cache, &object, 1ULL);
+        __atomic_fetch_add(&cache->frees, 1ULL, __ATOMIC_RELAXED);
+    }
+
+    srv_hal_RestoreInterrupts(irq_state);
+}
+
+void srv_kmem_CacheGetStats(srv_kmem_cache_t* cache, srv_kmem_stats_t* stats)
+{
+    stats->name        = cache->name;
+    stats->object_size = cache->object_size;
+    stats->allocs      = __atomic_load_n(&cache->allocs, __ATOMIC_RELAXED);
+    stats->frees       = __atomic_load_n(&cache->frees, __ATOMIC_RELAXED);
+    stats->slab_pages  = 1ULL << cache->slab_order;
+    stats->objects     = cache->objects_per_slab;
+
+    for (uint32_t cpu = 0U; cpu < SRV_HAL_MAX_CPUS; cpu++)
+    {
+        stats->allocs += __atomic_load_n(&cache->cpu_caches[cpu].allocs, __ATOMIC_RELAXED);
+        stats->frees  += __atomic_load_n(&cache->cpu_caches[cpu].frees, __ATOMIC_RELAXED);
+    }
+
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    kmem_Lock(cache);
+
+    stats->slabs = cache->slab_count;
+
+    kmem_Unlock(cache);
+    srv_hal_RestoreInterrupts(irq_state);
+}
+
+srv_kmem_cache_t* srv_kmem_CacheOf(const void* object)
+{
+    const kmem_slab_t* slab = (const kmem_slab_t*)srv_kpalloc_GetPageOwner(object);
+
+    return (slab != NULL) ? slab->cache : NULL;
+}
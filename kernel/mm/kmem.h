@@ -0,0 +1,95 @@
+/**
+ * @file    kmem.h
+ * @brief   Kernel slab (object cache) allocator
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * Copyright (C) 2025 Jesse Buhagiar
+ */
+
+#ifndef KMEM_H
+#define KMEM_H
+
+#include <hal.h>
+#include <stddef.h>
+
+typedef struct srv_kmem_cache srv_kmem_cache_t; /**< Opaque object cache handle */
+
+/**
+ * @brief Object constructor
+ *
+ * @details Called once for each object when the slab it lives in is created,
+ *          <b>not</b> on every allocation. Objects must be handed back to
+ *          @ref srv_kmem_CacheFree in their constructed state.
+ *
+ * @param[in] object The object to construct
+ */
+typedef void (*srv_kmem_ctor_t)(void* object);
+
+/**
+ * @brief Object cache statistics
+ */
+typedef struct
+{
+    const char* name;        /**< Name of the cache */
+    size_t      object_size; /**< Size of each object, including alignment padding */
+    size_t      allocs;      /**< Number of objects allocated */
+    size_t      frees;       /**< Number of objects freed */
+    size_t      slabs;       /**< Number of slabs currently owned by the cache */
+    size_t      slab_pages;  /**< Number of pages in each slab */
+    size_t      objects;     /**< Number of objects per slab */
+} srv_kmem_stats_t;
+
+/**
+ * @brief Create a named object cache
+ *
+ * @param[in] name  Name of the cache, for debugging. Must outlive the cache
+ * @param[in] size  Size of each object, in bytes
+ * @param[in] align Alignment of each object. Must be a power of 2, or 0 for the default
+ * @param[in] ctor  Optional object constructor, may be @c NULL
+ *
+ * @warning The physical page allocator must be initialized before calling this
+ *
+ * @return The new cache
+ */
+srv_kmem_cache_t* srv_kmem_CacheCreate(const char* name, size_t size, size_t align, srv_kmem_ctor_t ctor);
+
+/**
+ * @brief Allocate an object from a cache
+ *
+ * @param[in] cache The cache to allocate from
+ *
+ * @return Pointer to a constructed object
+ * @return @c NULL if the system is out of memory
+ */
+[[gnu::malloc]] void* srv_kmem_CacheAlloc(srv_kmem_cache_t* cache);
+
+/**
+ * @brief Return an object to the cache it was allocated from
+ *
+ * @param[in] cache  The cache the object came from
+ * @param[in] object The object to free
+ */
+void srv_kmem_CacheFree(srv_kmem_cache_t* cache, void* object);
+
+/**
+ * @brief Find the cache an object was allocated from
+ *
+ * @param[in] object Pointer to the object
+ *
+ * @warning Only meaningful for pointers that came from @ref srv_kmem_CacheAlloc.
+ *          Pages owned by other allocators may carry their own owner tags.
+ *
+ * @return The owning cache, or @c NULL if the page isn't owned by a slab
+ */
+srv_kmem_cache_t* srv_kmem_CacheOf(const void* object);
+
+/**
+ * @brief Get a snapshot of a cache's statistics
+ *
+ * @param[in]  cache The cache
+ * @param[out] stats Structure to fill
+ */
+void srv_kmem_CacheGetStats(srv_kmem_cache_t* cache, srv_kmem_stats_t* stats);
+
+#endif
@@ -1,6 +1,6 @@
 /**
  * @file    kpalloc.c
- * @brief   Implementation of @ref physalloc.h
+ * @brief   Implementation of @ref kpalloc.h
  *
  * @copyright SPDX-License-Identifier: GPL-3.0-or-later
  *
@@ -8,155 +8,1064 @@
  */
 
 #include <mm/phys/kpalloc.h>
-#include <mm/kalloc.h>
+#include <panic.h>
+#include <smp/percpu.h>
+#include <stdio.h>
+#include <sync/mcslock.h>
 
 typedef uint64_t physalloc_bmap_entry_t;
 
 #define PHYSALLOC_BITS_PER_ENTRY  (sizeof(physalloc_bmap_entry_t) * 8ULL) /**< Number of bits in a bitmap array entry */
 #define PHYSALLOC_PAGES_PER_ENTRY PHYSALLOC_BITS_PER_ENTRY                /**< Number of pages in a single bitmap array entry  */
-#define PHYSALLOC_NO_FREE_PAGES   UINT64_MAX                              /**< Marker indicating that there are no free pages in this entry */
+#define PHYSALLOC_NO_FREE_PAGES   0ULL                                    /**< Marker indicating that there are no free pages in this entry */
 #define PHYSALLOC_BYTES_PER_ENTRY sizeof(physalloc_bmap_entry_t)          /**< Number of bytes in a bitmap array entry */
+#define PHYSALLOC_MAX_LEVELS      5ULL                                    /**< Max summary depth. 64^5 pages is 4 TiB of RAM, which is plenty */
+#define PHYSALLOC_INVALID_INDEX   SIZE_MAX                                /**< Returned by a bitmap search that found nothing */
+
+#define KPALLOC_MAGAZINE_BATCH 16ULL /**< Number of pages moved between a magazine and the buddy allocator at once */
+
+#define KPALLOC_ORDER_COUNT    (SRV_KPALLOC_MAX_ORDER + 1U)               /**< Number of buddy orders */
+#define KPALLOC_MAX_BLOCK_SIZE (SRV_PAGE_SIZE << SRV_KPALLOC_MAX_ORDER) /**< Size of the largest block, in bytes */
+
+extern uint8_t __KERNEL_PHYSICAL_START[]; /**< Start of the Kernel image, from the linker script */
+extern uint8_t __kernel_end[];            /**< End of the Kernel image, stack and eternal heap, from the linker script */
+
+/**
+ * @brief Hierarchical (summary) bitmap
+ *
+ * @details Level 0 holds one bit per block, where a set bit means the block is
+ *          <b>free</b>. Every level above it holds one bit per entry of the level
+ *          below, set if that entry has at least one free block in it. The top
+ *          level always fits in a single entry, so finding a free block is a
+ *          @c ctz descent that touches one entry per level, no matter how much
+ *          RAM is installed.
+ */
+typedef struct
+{
+    physalloc_bmap_entry_t* levels[PHYSALLOC_MAX_LEVELS];        /**< Bitmap levels. @c levels[0] is the per-block bitmap */
+    size_t                  level_entries[PHYSALLOC_MAX_LEVELS]; /**< Number of entries in each level */
+    size_t                  level_count;                         /**< Number of levels in use */
+    size_t                  bit_count;                           /**< Number of valid bits in level 0 */
+    size_t                  rover;                               /**< Next-fit search position */
+} physalloc_hbitmap_t;
+
+/**
+ * @brief A contiguous bank of RAM managed by the buddy allocator
+ *
+ * @details Each order has its own hierarchical bitmap with one bit per naturally
+ *          aligned block of @c 2^order pages. A bit is set when that block is
+ *          free <b>and</b> has not been merged with its buddy into a block of the
+ *          order above, so every free page is described by exactly one bit across
+ *          all of the orders. Nothing is ever written into the free pages themselves.
+ *
+ *          Page indices count from @ref origin, the region's base rounded down to
+ *          the largest block size, so blocks are naturally aligned in physical
+ *          memory and not just within the region. Pages below @ref first_page
+ *          are never free, so nothing ever merges with them.
+ *
+ *          The bitmaps and page owner tags live in the region's own memory.
+ */
+typedef struct
+{
+    uintptr_t           origin;                           /**< Physical address of page index 0 */
+    size_t              first_page;                       /**< Index of the first page in the region */
+    size_t              end_page;                         /**< Index one past the last page in the region */
+    physalloc_hbitmap_t free_maps[KPALLOC_ORDER_COUNT];   /**< Free block bitmaps, one per order */
+    size_t              free_blocks[KPALLOC_ORDER_COUNT]; /**< Number of free blocks in each order */
+    uintptr_t*          page_owners;                      /**< Owner tags, indexed from @ref first_page. See @ref srv_kpalloc_SetPageOwner */
+    srv_physical_range_t metadata;                        /**< Where the bitmaps and owner tags are */
+} kpalloc_region_t;
 
 /**
- * @brief The number of addressable bytes in a single bitmap entry
+ * @brief Buddy allocator state
  */
-#define PHYSALLOC_ALLOC_PER_ENTRY (PHYSALLOC_BITS_PER_ENTRY * PHYSALLOC_PAGE_SIZE)
+typedef struct
+{
+    kpalloc_region_t regions[SRV_KPALLOC_MAX_REGIONS];   /**< Banks of RAM, sorted by address */
+    size_t           region_count;                       /**< Number of regions in use */
+    size_t           free_blocks[KPALLOC_ORDER_COUNT];   /**< Number of free blocks in each order, across all regions */
+    size_t           allocs[KPALLOC_ORDER_COUNT];        /**< Number of successful allocations of each order */
+    size_t           failures[KPALLOC_ORDER_COUNT];      /**< Number of failed allocations of each order */
+    size_t           splits;                             /**< Number of times a block was split in two */
+    size_t           merges;                             /**< Number of times two buddies were merged */
+} kpalloc_buddy_t;
 
-static physalloc_bmap_entry_t* page_bitmap = NULL;
+static kpalloc_buddy_t buddy = {0};
 
-static uintptr_t free_pages         = 0ULL; /**< Number of memory pages in the system */
-static uintptr_t phys_base_address  = 0ULL; /**< Base address of physical memory */
-static size_t    bitmap_entry_count = 0ULL;
+/* Every CPU comes here when its magazine runs dry, so waiters queue up rather than all spinning on one line */
+static srv_mcslock_t buddy_lock  = SRV_MCSLOCK_INIT("kpalloc"); /**< Protects @ref buddy and @ref free_pages */
+static uintptr_t     free_pages  = 0ULL;                        /**< Number of free memory pages in the buddy allocator */
+static uintptr_t     total_pages = 0ULL;                        /**< Number of pages managed by the allocator */
 
 /**
- * @brief Round a value up to a page size
+ * @brief Take the buddy allocator lock
  *
- * @param[in] value The value to round
+ * @param[in] node The caller's place in the queue, which must live until @ref kpalloc_Unlock
+ */
+static inline void kpalloc_Lock(srv_mcs_node_t* node)
+{
+    srv_mcslock_Lock(&buddy_lock, node);
+}
+
+/**
+ * @brief Release the buddy allocator lock
  *
- * @return The value rounded to the size of a page
+ * @param[in] node The node passed to @ref kpalloc_Lock
  */
-static inline size_t kpalloc_bitmap_RoundToPage(size_t value)
+static inline void kpalloc_Unlock(srv_mcs_node_t* node)
 {
-    return ((value + SRV_PAGE_SIZE - 1) / SRV_PAGE_SIZE) * SRV_PAGE_SIZE;
+    srv_mcslock_Unlock(&buddy_lock, node);
 }
 
-static inline size_t kpalloc_bitmap_AddressToBitIndex(uintptr_t address)
+static inline size_t kpalloc_region_AddressToPageIndex(const kpalloc_region_t* region, uintptr_t address)
 {
-    return (address - phys_base_address) / SRV_PAGE_SIZE;
+    return (address - region->origin) / SRV_PAGE_SIZE;
 }
 
-static inline void* kpalloc_bitmap_BitIndexToPageAddress(size_t bit_index)
+static inline void* kpalloc_region_PageIndexToAddress(const kpalloc_region_t* region, size_t page_index)
 {
-    return (void*)(phys_base_address + (bit_index * SRV_PAGE_SIZE));
+    return (void*)(region->origin + (page_index * SRV_PAGE_SIZE));
 }
 
 /**
- * @brief Set a bit in the page bitmap
+ * @brief Find the region a physical address is in
  *
- * @param[in] bit The bit to set
+ * @param[in] address The address
+ *
+ * @return The region, or @c NULL if the address isn't in memory we manage
  */
-static inline void kpalloc_bitmap_SetBit(size_t bit)
+static kpalloc_region_t* kpalloc_FindRegion(uintptr_t address)
 {
-    page_bitmap[bit / PHYSALLOC_BITS_PER_ENTRY] |= (1ULL << (bit % PHYSALLOC_BITS_PER_ENTRY));
+    for (size_t index = 0ULL; index < buddy.region_count; index++)
+    {
+        kpalloc_region_t* region = &buddy.regions[index];
+
+        if ((address >= region->origin) && (kpalloc_region_AddressToPageIndex(region, address) >= region->first_page) &&
+            (kpalloc_region_AddressToPageIndex(region, address) < region->end_page))
+        {
+            return region;
+        }
+    }
+
+    return NULL;
 }
 
-static inline void kpalloc_bitmap_UnsetBit(size_t bit)
+/**
+ * @brief Number of bitmap entries needed to hold a number of bits
+ *
+ * @param[in] bits The number of bits
+ *
+ * @return The number of entries, rounded up
+ */
+static inline size_t kpalloc_bitmap_EntriesForBits(size_t bits)
 {
-    page_bitmap[bit / PHYSALLOC_BITS_PER_ENTRY] &= ~(1ULL << (bit % PHYSALLOC_BITS_PER_ENTRY));
+    return (bits + PHYSALLOC_BITS_PER_ENTRY - 1ULL) / PHYSALLOC_BITS_PER_ENTRY;
 }
 
-static inline bool kpalloc_bitmap_IsBitSet(size_t bit)
+/**
+ * @brief Number of bytes a hierarchical bitmap needs, summary levels included
+ *
+ * @param[in] bits Number of bits in level 0
+ *
+ * @return The size of the bitmap, in bytes
+ */
+static size_t kpalloc_bitmap_Bytes(size_t bits)
+{
+    size_t bytes      = 0ULL;
+    size_t level_bits = bits;
+
+    do
+    {
+        const size_t entries  = kpalloc_bitmap_EntriesForBits(level_bits);
+        bytes                += entries * PHYSALLOC_BYTES_PER_ENTRY;
+        level_bits            = entries;
+    } while (level_bits > 1ULL);
+
+    return bytes;
+}
+
+/**
+ * @brief Set up a hierarchical bitmap with every bit clear
+ *
+ * @param[out]    bitmap The bitmap to initialize
+ * @param[in]     bits   Number of bits in level 0
+ * @param[in,out] memory Where to put the levels. Moved past them on return
+ */
+static void kpalloc_bitmap_Init(physalloc_hbitmap_t* bitmap, size_t bits, uint8_t** memory)
+{
+    size_t level_bits = bits;
+
+    bitmap->bit_count   = bits;
+    bitmap->level_count = 0ULL;
+    bitmap->rover       = 0ULL;
+
+    do
+    {
+        if (bitmap->level_count == PHYSALLOC_MAX_LEVELS)
+        {
+            srv_KernelPanic("kpalloc: too much physical memory for the page bitmap");
+        }
+
+        const size_t entries = kpalloc_bitmap_EntriesForBits(level_bits);
+
+        physalloc_bmap_entry_t* level = (physalloc_bmap_entry_t*)*memory;
+        *memory                      += entries * PHYSALLOC_BYTES_PER_ENTRY;
+
+        for (size_t entry = 0ULL; entry < entries; entry++)
+        {
+            level[entry] = PHYSALLOC_NO_FREE_PAGES;
+        }
+
+        bitmap->levels[bitmap->level_count]        = level;
+        bitmap->level_entries[bitmap->level_count] = entries;
+        bitmap->level_count++;
+
+        level_bits = entries;
+    } while (level_bits > 1ULL);
+}
+
+/**
+ * @brief Set a bit in the bitmap, and propagate it up the summary levels
+ *
+ * @param[in] bitmap The bitmap to modify
+ * @param[in] bit    The bit to set
+ */
+static inline void kpalloc_bitmap_SetBit(physalloc_hbitmap_t* bitmap, size_t bit)
+{
+    for (size_t level = 0ULL; level < bitmap->level_count; level++)
+    {
+        physalloc_bmap_entry_t* entry     = &bitmap->levels[level][bit / PHYSALLOC_BITS_PER_ENTRY];
+        const bool              was_empty = (*entry == PHYSALLOC_NO_FREE_PAGES);
+
+        *entry |= (1ULL << (bit % PHYSALLOC_BITS_PER_ENTRY));
+
+        /* The level above already knows this entry has something in it */
+        if (!was_empty)
+        {
+            break;
+        }
+
+        bit /= PHYSALLOC_BITS_PER_ENTRY;
+    }
+}
+
+/**
+ * @brief Clear a bit in the bitmap, and propagate it up the summary levels
+ *
+ * @param[in] bitmap The bitmap to modify
+ * @param[in] bit    The bit to clear
+ */
+static inline void kpalloc_bitmap_UnsetBit(physalloc_hbitmap_t* bitmap, size_t bit)
+{
+    for (size_t level = 0ULL; level < bitmap->level_count; level++)
+    {
+        physalloc_bmap_entry_t* entry = &bitmap->levels[level][bit / PHYSALLOC_BITS_PER_ENTRY];
+
+        *entry &= ~(1ULL << (bit % PHYSALLOC_BITS_PER_ENTRY));
+
+        /* Only tell the level above if this entry just became empty */
+        if (*entry != PHYSALLOC_NO_FREE_PAGES)
+        {
+            break;
+        }
+
+        bit /= PHYSALLOC_BITS_PER_ENTRY;
+    }
+}
+
+static inline bool kpalloc_bitmap_IsBitSet(const physalloc_hbitmap_t* bitmap, size_t bit)
 {
     const uint64_t mask  = 1ULL << (bit % PHYSALLOC_BITS_PER_ENTRY);
-    const uint64_t entry = page_bitmap[bit / PHYSALLOC_BITS_PER_ENTRY];
+    const uint64_t entry = bitmap->levels[0][bit / PHYSALLOC_BITS_PER_ENTRY];
 
     return ((mask & entry) != 0ULL);
 }
 
-void kpalloc_Init(uintptr_t base_address, size_t memory_size)
+/**
+ * @brief Find the first set bit at or after @c start
+ *
+ * @details Climbs the summary levels until an entry with a set bit after
+ *          @c start is found, then descends back down with @c ctz. This reads
+ *          at most two entries per level.
+ *
+ * @param[in] bitmap The bitmap to search
+ * @param[in] start  The bit index to start searching from
+ *
+ * @return The index of the set bit
+ * @return @ref PHYSALLOC_INVALID_INDEX if there are no set bits after @c start
+ */
+static size_t kpalloc_bitmap_FindNextSet(const physalloc_hbitmap_t* bitmap, size_t start)
 {
-    phys_base_address = base_address; /* Set the physical base address of all RAM */
-    free_pages        = (memory_size / SRV_PAGE_SIZE);
+    size_t index = start;
+    size_t level = 0ULL;
+
+    /* Climb until we find an entry with something set after our position */
+    while (level < bitmap->level_count)
+    {
+        const size_t entry_index = index / PHYSALLOC_BITS_PER_ENTRY;
+        if (entry_index >= bitmap->level_entries[level])
+        {
+            return PHYSALLOC_INVALID_INDEX;
+        }
+
+        const physalloc_bmap_entry_t entry = bitmap->levels[level][entry_index] & (~0ULL << (index % PHYSALLOC_BITS_PER_ENTRY));
+        if (entry != PHYSALLOC_NO_FREE_PAGES)
+        {
+            index = (entry_index * PHYSALLOC_BITS_PER_ENTRY) + (size_t)__builtin_ctzll(entry);
+            break;
+        }
+
+        /* Nothing left in this entry, so look from the next entry onwards one level up */
+        index = entry_index + 1ULL;
+        level++;
+    }
+
+    if (level == bitmap->level_count)
+    {
+        return PHYSALLOC_INVALID_INDEX;
+    }
+
+    /* Descend, taking the lowest set bit at each level */
+    while (level > 0ULL)
+    {
+        level--;
+        index = (index * PHYSALLOC_BITS_PER_ENTRY) + (size_t)__builtin_ctzll(bitmap->levels[level][index]);
+    }
 
-    /* Work out how many uint64_t's there are in our bitmap */
-    bitmap_entry_count = (free_pages / PHYSALLOC_PAGES_PER_ENTRY);
-    page_bitmap        = srv_kalloc_EternalAlloc(bitmap_entry_count * sizeof(uint64_t));
+    return index;
 }
 
-void* kpalloc_AllocPage(void)
+/**
+ * @brief Find a free block of an order in a region
+ *
+ * @details Order 0 is searched next-fit from the bitmap's rover so that
+ *          consecutive single page allocations don't keep rescanning the same
+ *          spot. Larger orders are searched lowest address first, which keeps
+ *          the big blocks at the top of memory intact for longer.
+ *
+ * @param[in] region The region to search
+ * @param[in] order  The order to search
+ *
+ * @return The block index within the order
+ * @return @ref PHYSALLOC_INVALID_INDEX if the order has no free blocks
+ */
+static size_t kpalloc_buddy_FindFree(kpalloc_region_t* region, uint32_t order)
+{
+    physalloc_hbitmap_t* map = &region->free_maps[order];
+
+    if (region->free_blocks[order] == 0ULL)
+    {
+        return PHYSALLOC_INVALID_INDEX;
+    }
+
+    size_t block = PHYSALLOC_INVALID_INDEX;
+    if (order == 0U)
+    {
+        block = kpalloc_bitmap_FindNextSet(map, map->rover);
+    }
+
+    if (block == PHYSALLOC_INVALID_INDEX)
+    {
+        block = kpalloc_bitmap_FindNextSet(map, 0ULL);
+    }
+
+    if ((order == 0U) && (block != PHYSALLOC_INVALID_INDEX))
+    {
+        map->rover = ((block + 1ULL) < map->bit_count) ? (block + 1ULL) : 0ULL;
+    }
+
+    return block;
+}
+
+/**
+ * @brief Put a free block into an order's free map
+ *
+ * @param[in] region The region the block is in
+ * @param[in] order  The order of the block
+ * @param[in] block  The block index within the order
+ */
+static inline void kpalloc_buddy_Insert(kpalloc_region_t* region, uint32_t order, size_t block)
+{
+    kpalloc_bitmap_SetBit(&region->free_maps[order], block);
+    region->free_blocks[order]++;
+    buddy.free_blocks[order]++;
+}
+
+/**
+ * @brief Take a free block out of an order's free map
+ *
+ * @param[in] region The region the block is in
+ * @param[in] order  The order of the block
+ * @param[in] block  The block index within the order
+ */
+static inline void kpalloc_buddy_Remove(kpalloc_region_t* region, uint32_t order, size_t block)
+{
+    kpalloc_bitmap_UnsetBit(&region->free_maps[order], block);
+    region->free_blocks[order]--;
+    buddy.free_blocks[order]--;
+}
+
+/**
+ * @brief Find the free block that contains a page, if there is one
+ *
+ * @param[in]  region     The region the page is in
+ * @param[in]  page_index Index of the page within the region
+ * @param[out] order_out  The order of the free block containing the page
+ *
+ * @return @c true if the page is free
+ */
+static bool kpalloc_buddy_FindContainingBlock(const kpalloc_region_t* region, size_t page_index, uint32_t* order_out)
+{
+    for (uint32_t order = 0U; order < KPALLOC_ORDER_COUNT; order++)
+    {
+        const size_t block = page_index >> order;
+        if (block >= region->free_maps[order].bit_count)
+        {
+            break;
+        }
+
+        if (kpalloc_bitmap_IsBitSet(&region->free_maps[order], block))
+        {
+            *order_out = order;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check whether any page of a block is already free
+ *
+ * @details A free block that overlaps it either contains its first page, or
+ *          is a smaller block somewhere inside it. The second kind is found
+ *          with one bitmap search per smaller order.
+ *
+ * @param[in] region     The region the block is in
+ * @param[in] page_index Index of the first page of the block
+ * @param[in] order      The order of the block
+ *
+ * @return @c true if some of the block is free
+ */
+static bool kpalloc_buddy_OverlapsFree(const kpalloc_region_t* region, size_t page_index, uint32_t order)
 {
-    void*  page_ptr  = NULL;
-    size_t bit_index = 0ULL;
+    uint32_t containing_order = 0U;
+    if (kpalloc_buddy_FindContainingBlock(region, page_index, &containing_order))
+    {
+        return true;
+    }
 
-    for (size_t bitmap_index = 0ULL; bitmap_index < bitmap_entry_count; bitmap_index++)
+    for (uint32_t smaller = 0U; smaller < order; smaller++)
     {
-        const physalloc_bmap_entry_t bitmap_entry = page_bitmap[bitmap_index];
+        const size_t first = page_index >> smaller;
+        const size_t limit = (page_index + (1ULL << order)) >> smaller;
+        const size_t found = kpalloc_bitmap_FindNextSet(&region->free_maps[smaller], first);
 
-        /* If there are no free pages in this entry then go to the next one */
-        if (bitmap_entry == PHYSALLOC_NO_FREE_PAGES)
+        if ((found != PHYSALLOC_INVALID_INDEX) && (found < limit))
         {
-            bit_index += PHYSALLOC_BITS_PER_ENTRY;
-            continue;
+            return true;
         }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Allocate a block of @c 2^order pages from the buddy allocator
+ *
+ * @note The buddy lock must be held
+ *
+ * @param[in] order The order to allocate
+ *
+ * @return Physical address of the first page of the block, or @c NULL
+ */
+static page_t kpalloc_buddy_AllocLocked(uint32_t order)
+{
+    kpalloc_region_t* region      = NULL;
+    uint32_t          block_order = order;
+    size_t            block       = PHYSALLOC_INVALID_INDEX;
 
-        /* This entry is completely free! Take bit0 */
-        if (bitmap_entry == 0ULL)
+    /* Find the smallest order that has something free, in whichever region has it first */
+    while (block_order < KPALLOC_ORDER_COUNT)
+    {
+        for (size_t index = 0ULL; (index < buddy.region_count) && (block == PHYSALLOC_INVALID_INDEX); index++)
         {
-            kpalloc_bitmap_SetBit(0ULL);
+            region = &buddy.regions[index];
+            block  = kpalloc_buddy_FindFree(region, block_order);
+        }
+
+        if (block != PHYSALLOC_INVALID_INDEX)
+        {
+            break;
+        }
+
+        block_order++;
+    }
+
+    if (block == PHYSALLOC_INVALID_INDEX)
+    {
+        buddy.failures[order]++;
+        return NULL;
+    }
+
+    kpalloc_buddy_Remove(region, block_order, block);
+
+    /* Split it down to size, handing the upper half of each split back */
+    while (block_order > order)
+    {
+        block_order--;
+        block <<= 1ULL;
+
+        kpalloc_buddy_Insert(region, block_order, block + 1ULL);
+        buddy.splits++;
+    }
+
+    free_pages -= (1ULL << order);
+    buddy.allocs[order]++;
+
+    return kpalloc_region_PageIndexToAddress(region, block << order);
+}
+
+/**
+ * @brief Return a block of @c 2^order pages to the buddy allocator, merging it with its buddies
+ *
+ * @note The buddy lock must be held
+ *
+ * @param[in] region     The region the block is in
+ * @param[in] page_index Index of the first page of the block
+ * @param[in] order      The order of the block
+ */
+static void kpalloc_buddy_FreeLocked(kpalloc_region_t* region, size_t page_index, uint32_t order)
+{
+    if (kpalloc_buddy_OverlapsFree(region, page_index, order))
+    {
+        srv_KernelPanic("kpalloc: double free of a page");
+    }
+
+    free_pages += (1ULL << order);
 
-            /* Construct the page address to return */
-            page_ptr = kpalloc_bitmap_BitIndexToPageAddress(bit_index);
-            free_pages--;
+    size_t block = page_index >> order;
+    while (order < SRV_KPALLOC_MAX_ORDER)
+    {
+        const size_t buddy_block = block ^ 1ULL;
 
+        if ((buddy_block >= region->free_maps[order].bit_count) || !kpalloc_bitmap_IsBitSet(&region->free_maps[order], buddy_block))
+        {
             break;
         }
+
+        /* Our buddy is free too, so the two of us become one block an order up */
+        kpalloc_buddy_Remove(region, order, buddy_block);
+        block >>= 1ULL;
+        order++;
+        buddy.merges++;
+    }
+
+    kpalloc_buddy_Insert(region, order, block);
+}
+
+/**
+ * @brief Take a single page out of whatever free block it is sitting in
+ *
+ * @note The buddy lock must be held
+ *
+ * @param[in] region     The region the page is in
+ * @param[in] page_index Index of the page to carve out
+ */
+static void kpalloc_buddy_CarvePageLocked(kpalloc_region_t* region, size_t page_index)
+{
+    uint32_t order = 0U;
+    if (!kpalloc_buddy_FindContainingBlock(region, page_index, &order))
+    {
+        /* Already in use */
+        return;
+    }
+
+    size_t block = page_index >> order;
+    kpalloc_buddy_Remove(region, order, block);
+
+    /* Split down towards the page, freeing the half we aren't standing in each time */
+    while (order > 0U)
+    {
+        order--;
+        block <<= 1ULL;
+
+        if (((page_index >> order) & 1ULL) != 0ULL)
+        {
+            kpalloc_buddy_Insert(region, order, block);
+            block++;
+        }
         else
         {
-            /* Find the first bit that's free */
-            const size_t first_bit_free = __builtin_ctzl(~bitmap_entry);
-            const size_t page_bit_index = bit_index + first_bit_free;
-            kpalloc_bitmap_SetBit(page_bit_index);
+            kpalloc_buddy_Insert(region, order, block + 1ULL);
+        }
+    }
+
+    free_pages--;
+}
+
+/**
+ * @brief Carve every page a physical range touches out of the free blocks
+ *
+ * @note The buddy lock must be held
+ *
+ * @param[in] base_address The base address of the range
+ * @param[in] length       The length of the range
+ */
+static void kpalloc_CarveRangeLocked(srv_physical_address_t base_address, size_t length)
+{
+    /* Cover every page the range touches, even partially */
+    const srv_physical_address_t range_start = base_address & ~(SRV_PAGE_SIZE - 1ULL);
+    const srv_physical_address_t range_end   = base_address + length;
+
+    for (size_t index = 0ULL; index < buddy.region_count; index++)
+    {
+        kpalloc_region_t* region = &buddy.regions[index];
+
+        const srv_physical_address_t region_start = (srv_physical_address_t)kpalloc_region_PageIndexToAddress(region, region->first_page);
+        const srv_physical_address_t region_end   = (srv_physical_address_t)kpalloc_region_PageIndexToAddress(region, region->end_page);
+
+        /* Only the part of the range that falls inside this region */
+        const srv_physical_address_t start = (range_start > region_start) ? range_start : region_start;
+        const srv_physical_address_t end   = (range_end < region_end) ? range_end : region_end;
+
+        for (srv_physical_address_t page = start; page < end; page += SRV_PAGE_SIZE)
+        {
+            kpalloc_buddy_CarvePageLocked(region, kpalloc_region_AddressToPageIndex(region, page));
+        }
+    }
+}
+
+/**
+ * @brief Find a range that overlaps a window of memory
+ *
+ * @param[in] base   Base address of the window
+ * @param[in] size   Size of the window, in bytes
+ * @param[in] ranges The ranges to check
+ * @param[in] count  Number of ranges
+ *
+ * @return The first overlapping range, or @c NULL if there isn't one
+ */
+static const srv_physical_range_t* kpalloc_FindOverlap(srv_physical_address_t base, size_t size, const srv_physical_range_t* ranges, size_t count)
+{
+    for (size_t range = 0ULL; range < count; range++)
+    {
+        if ((ranges[range].base < (base + size)) && (base < (ranges[range].base + ranges[range].size)))
+        {
+            return &ranges[range];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Find room at the top of a region for its own bitmaps and owner tags
+ *
+ * @details Starts at the top of the region, and each time the window lands on
+ *          something reserved, moves it down to just below that reservation
+ *
+ * @param[in] start          First usable address in the region
+ * @param[in] end            End of the region
+ * @param[in] size           Bytes needed, a whole number of pages
+ * @param[in] reserved       Ranges that are already spoken for
+ * @param[in] reserved_count Number of entries in @c reserved
+ *
+ * @return Base of the window, or 0 if it doesn't fit anywhere
+ */
+static srv_physical_address_t kpalloc_PlaceMetadata(srv_physical_address_t start, srv_physical_address_t end, size_t size, const srv_physical_range_t* reserved, size_t reserved_count)
+{
+    const srv_physical_range_t kernel_image = {
+        .base = (srv_physical_address_t)__KERNEL_PHYSICAL_START,
+        .size = (size_t)(__kernel_end - __KERNEL_PHYSICAL_START),
+    };
+
+    srv_physical_address_t top = end;
+
+    while ((top > start) && ((top - start) >= size))
+    {
+        const srv_physical_address_t base  = top - size;
+        const srv_physical_range_t*  clash = kpalloc_FindOverlap(base, size, reserved, reserved_count);
+
+        if (clash == NULL)
+        {
+            clash = kpalloc_FindOverlap(base, size, &kernel_image, 1ULL);
+        }
+
+        if (clash == NULL)
+        {
+            return base;
+        }
+
+        top = clash->base & ~(SRV_PAGE_SIZE - 1ULL);
+    }
+
+    return 0ULL;
+}
+
+/**
+ * @brief Start managing a bank of RAM
+ *
+ * @param[in] range          The bank
+ * @param[in] reserved       Ranges that are already spoken for
+ * @param[in] reserved_count Number of entries in @c reserved
+ */
+static void kpalloc_AddRegion(const srv_physical_range_t* range, const srv_physical_range_t* reserved, size_t reserved_count)
+{
+    /* Only whole pages are any use */
+    const srv_physical_address_t start = (range->base + SRV_PAGE_SIZE - 1ULL) & ~(SRV_PAGE_SIZE - 1ULL);
+    const srv_physical_address_t end   = (range->base + range->size) & ~(SRV_PAGE_SIZE - 1ULL);
+
+    if (end <= start)
+    {
+        return;
+    }
+
+    if (buddy.region_count == SRV_KPALLOC_MAX_REGIONS)
+    {
+        kprintf("kpalloc: too many banks of RAM, leaving out 0x%lx-0x%lx\n", (uint64_t)start, (uint64_t)end);
+        return;
+    }
+
+    kpalloc_region_t* region = &buddy.regions[buddy.region_count];
+
+    region->origin     = start & ~(KPALLOC_MAX_BLOCK_SIZE - 1ULL);
+    region->first_page = (start - region->origin) / SRV_PAGE_SIZE;
+    region->end_page   = (end - region->origin) / SRV_PAGE_SIZE;
+
+    /* Only whole blocks are tracked at each order */
+    const size_t pages = region->end_page - region->first_page;
+    size_t       bytes = pages * sizeof(uintptr_t);
+    for (uint32_t order = 0U; order < KPALLOC_ORDER_COUNT; order++)
+    {
+        bytes += kpalloc_bitmap_Bytes(region->end_page >> order);
+    }
+    bytes = (bytes + SRV_PAGE_SIZE - 1ULL) & ~(SRV_PAGE_SIZE - 1ULL);
+
+    const srv_physical_address_t metadata = kpalloc_PlaceMetadata(start, end, bytes, reserved, reserved_count);
+    if (metadata == 0ULL)
+    {
+        /* Nowhere to keep track of it, so leave the bank alone */
+        kprintf("kpalloc: no room for the bitmaps of 0x%lx-0x%lx, leaving it out\n", (uint64_t)start, (uint64_t)end);
+        return;
+    }
+
+    region->metadata    = (srv_physical_range_t){.base = metadata, .size = bytes};
+    region->page_owners = (uintptr_t*)metadata;
+
+    for (size_t page = 0ULL; page < pages; page++)
+    {
+        region->page_owners[page] = 0ULL;
+    }
+
+    uint8_t* memory = (uint8_t*)&region->page_owners[pages];
+    for (uint32_t order = 0U; order < KPALLOC_ORDER_COUNT; order++)
+    {
+        kpalloc_bitmap_Init(&region->free_maps[order], region->end_page >> order, &memory);
+        region->free_blocks[order] = 0ULL;
+    }
+
+    buddy.region_count++;
+    total_pages += pages;
+    free_pages  += pages;
+
+    /* Hand out memory as the largest naturally aligned blocks that fit */
+    size_t page_index = region->first_page;
+    while (page_index < region->end_page)
+    {
+        uint32_t order = (page_index == 0ULL) ? SRV_KPALLOC_MAX_ORDER : (uint32_t)__builtin_ctzll(page_index);
+        if (order > SRV_KPALLOC_MAX_ORDER)
+        {
+            order = SRV_KPALLOC_MAX_ORDER;
+        }
+
+        while ((page_index + (1ULL << order)) > region->end_page)
+        {
+            order--;
+        }
+
+        kpalloc_buddy_Insert(region, order, page_index >> order);
+        page_index += (1ULL << order);
+    }
+}
+
+void srv_kpalloc_InitPageAllocator(const srv_physical_range_t* usable, size_t usable_count, const srv_physical_range_t* reserved, size_t reserved_count)
+{
+    for (size_t range = 0ULL; range < usable_count; range++)
+    {
+        kpalloc_AddRegion(&usable[range], reserved, reserved_count);
+    }
+
+    if (buddy.region_count == 0ULL)
+    {
+        srv_KernelPanic("kpalloc: no usable memory");
+    }
+
+    srv_mcs_node_t node;
+    kpalloc_Lock(&node);
+
+    for (size_t range = 0ULL; range < reserved_count; range++)
+    {
+        kpalloc_CarveRangeLocked(reserved[range].base, reserved[range].size);
+    }
 
-            page_ptr = kpalloc_bitmap_BitIndexToPageAddress(page_bit_index);
-            free_pages--;
+    /* The Kernel image, its stack and the eternal heap */
+    kpalloc_CarveRangeLocked((srv_physical_address_t)__KERNEL_PHYSICAL_START, (size_t)(__kernel_end - __KERNEL_PHYSICAL_START));
 
+    for (size_t index = 0ULL; index < buddy.region_count; index++)
+    {
+        kpalloc_CarveRangeLocked(buddy.regions[index].metadata.base, buddy.regions[index].metadata.size);
+    }
+
+    /* A page at physical address 0 would look like a failed allocation */
+    kpalloc_CarveRangeLocked(0ULL, 1ULL);
+
+    kpalloc_Unlock(&node);
+}
+
+/**
+ * @brief Make sure a block being freed is a block we could have handed out
+ *
+ * @param[in] page_addr Physical address of the block
+ * @param[in] order     The order of the block
+ *
+ * @return The region the block is in
+ */
+static inline kpalloc_region_t* kpalloc_ValidateBlock(srv_physical_address_t page_addr, uint32_t order)
+{
+    if (order > SRV_KPALLOC_MAX_ORDER)
+    {
+        srv_KernelPanic("kpalloc: invalid block order");
+    }
+
+    /* Blocks are always naturally aligned to their size */
+    if ((page_addr & ((SRV_PAGE_SIZE << order) - 1ULL)) != 0ULL)
+    {
+        srv_KernelPanic("kpalloc: freeing an unaligned block");
+    }
+
+    kpalloc_region_t* region = kpalloc_FindRegion(page_addr);
+    if ((region == NULL) || ((kpalloc_region_AddressToPageIndex(region, page_addr) + (1ULL << order)) > region->end_page))
+    {
+        srv_KernelPanic("kpalloc: freeing a block outside of physical memory");
+    }
+
+    return region;
+}
+
+/**
+ * @brief Get the magazine of the executing CPU
+ *
+ * @note Must be called with interrupts masked
+ *
+ * @return The magazine, which lives in the CPU's local data block
+ */
+static inline srv_kpalloc_magazine_t* kpalloc_magazine_Current(void)
+{
+    return &SRV_PERCPU(page_cache);
+}
+
+/**
+ * @brief Refill an empty magazine with a batch of pages from the buddy allocator
+ *
+ * @param[in] magazine The magazine to refill
+ */
+static void kpalloc_magazine_Refill(srv_kpalloc_magazine_t* magazine)
+{
+    srv_mcs_node_t node;
+    kpalloc_Lock(&node);
+
+    while (magazine->count < KPALLOC_MAGAZINE_BATCH)
+    {
+        const page_t page = kpalloc_buddy_AllocLocked(0U);
+        if (page == NULL)
+        {
             break;
         }
+
+        magazine->rounds[magazine->count] = page;
+        magazine->count++;
+    }
+
+    kpalloc_Unlock(&node);
+}
+
+/**
+ * @brief Drain a batch of the coldest pages from a full magazine into the buddy allocator
+ *
+ * @param[in] magazine The magazine to drain
+ */
+static void kpalloc_magazine_Drain(srv_kpalloc_magazine_t* magazine)
+{
+    srv_mcs_node_t node;
+    kpalloc_Lock(&node);
+
+    for (size_t round = 0ULL; round < KPALLOC_MAGAZINE_BATCH; round++)
+    {
+        const uintptr_t   page_addr = (uintptr_t)magazine->rounds[round];
+        kpalloc_region_t* region    = kpalloc_FindRegion(page_addr);
+
+        kpalloc_buddy_FreeLocked(region, kpalloc_region_AddressToPageIndex(region, page_addr), 0U);
+    }
+
+    kpalloc_Unlock(&node);
+
+    /* Slide the hot end of the stack down to the bottom */
+    for (size_t round = KPALLOC_MAGAZINE_BATCH; round < magazine->count; round++)
+    {
+        magazine->rounds[round - KPALLOC_MAGAZINE_BATCH] = magazine->rounds[round];
+    }
+
+    magazine->count -= KPALLOC_MAGAZINE_BATCH;
+}
+
+page_t srv_kpalloc_AllocPage(void)
+{
+    page_t page = NULL;
+
+    /* The magazine belongs to this CPU, so all we need to do is keep interrupts off it */
+    const srv_irq_state_t   irq_state = srv_hal_SaveAndDisableInterrupts();
+    srv_kpalloc_magazine_t* magazine  = kpalloc_magazine_Current();
+
+    if (magazine->count == 0ULL)
+    {
+        kpalloc_magazine_Refill(magazine);
+    }
+
+    if (magazine->count != 0ULL)
+    {
+        magazine->count--;
+        page = magazine->rounds[magazine->count];
     }
 
-    return page_ptr;
+    srv_hal_RestoreInterrupts(irq_state);
+
+    return page;
 }
 
-void kpalloc_FreePage(void* page_ptr)
+void srv_kpalloc_FreePage(void* page_ptr)
 {
     /* Convert the page pointer to a physical address */
     const srv_physical_address_t page_addr = (srv_physical_address_t)page_ptr;
 
-    /* Make sure the address is actually aligned a page boundary */
-    if ((page_addr & (SRV_PAGE_SIZE - 1ULL)) != 0ULL)
+    (void)kpalloc_ValidateBlock(page_addr, 0U);
+
+    const srv_irq_state_t   irq_state = srv_hal_SaveAndDisableInterrupts();
+    srv_kpalloc_magazine_t* magazine  = kpalloc_magazine_Current();
+
+    if (magazine->count == SRV_KPALLOC_MAGAZINE_SIZE)
     {
-        /* TODO: We need to kpanic() here */
-        return;
+        kpalloc_magazine_Drain(magazine);
+    }
+
+    magazine->rounds[magazine->count] = page_ptr;
+    magazine->count++;
+
+    srv_hal_RestoreInterrupts(irq_state);
+}
+
+page_t srv_kpalloc_AllocPages(uint32_t order)
+{
+    if (order > SRV_KPALLOC_MAX_ORDER)
+    {
+        return NULL;
+    }
+
+    srv_mcs_node_t        node;
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    kpalloc_Lock(&node);
+
+    const page_t page = kpalloc_buddy_AllocLocked(order);
+
+    kpalloc_Unlock(&node);
+    srv_hal_RestoreInterrupts(irq_state);
+
+    return page;
+}
+
+void srv_kpalloc_FreePages(void* page_ptr, uint32_t order)
+{
+    const srv_physical_address_t page_addr = (srv_physical_address_t)page_ptr;
+
+    kpalloc_region_t* region = kpalloc_ValidateBlock(page_addr, order);
+
+    srv_mcs_node_t        node;
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    kpalloc_Lock(&node);
+
+    kpalloc_buddy_FreeLocked(region, kpalloc_region_AddressToPageIndex(region, page_addr), order);
+
+    kpalloc_Unlock(&node);
+    srv_hal_RestoreInterrupts(irq_state);
+}
+
+void srv_kpalloc_GetStats(srv_kpalloc_stats_t* stats)
+{
+    srv_mcs_node_t        node;
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    kpalloc_Lock(&node);
+
+    stats->total_pages = total_pages;
+    stats->free_pages  = free_pages;
+    stats->splits      = buddy.splits;
+    stats->merges      = buddy.merges;
+
+    /*
+     * Walk down from the top order, keeping a running total of the free pages
+     * that sit in blocks big enough to satisfy each order. Whatever is left
+     * over is free memory that is too fragmented to be used at that order.
+     */
+    size_t usable_pages = 0ULL;
+    for (uint32_t order = SRV_KPALLOC_MAX_ORDER + 1U; order-- > 0U;)
+    {
+        srv_kpalloc_order_stats_t* order_stats = &stats->orders[order];
+
+        usable_pages += buddy.free_blocks[order] << order;
+
+        order_stats->free_blocks = buddy.free_blocks[order];
+        order_stats->allocs      = buddy.allocs[order];
+        order_stats->failures    = buddy.failures[order];
+        order_stats->unusable    = (free_pages == 0ULL) ? 0U : (uint32_t)(((free_pages - usable_pages) * 1000ULL) / free_pages);
     }
 
-    const size_t bit_index = kpalloc_bitmap_AddressToBitIndex(page_addr);
-    kpalloc_bitmap_UnsetBit(bit_index);
+    kpalloc_Unlock(&node);
+    srv_hal_RestoreInterrupts(irq_state);
+}
+
+void srv_kpalloc_MarkRegionUnusable(srv_physical_address_t base_address, size_t length)
+{
+    srv_mcs_node_t        node;
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    kpalloc_Lock(&node);
+
+    kpalloc_CarveRangeLocked(base_address, length);
 
-    free_pages++;
+    kpalloc_Unlock(&node);
+    srv_hal_RestoreInterrupts(irq_state);
 }
 
-void kpalloc_MarkRegionUnusable(srv_physical_address_t base_address, size_t length)
+void srv_kpalloc_SetPageOwner(const void* page_ptr, uintptr_t owner)
 {
-    const size_t pages = length / SRV_PAGE_SIZE;
+    const srv_physical_address_t page_addr = (srv_physical_address_t)page_ptr;
+    kpalloc_region_t*            region    = kpalloc_FindRegion(page_addr);
 
-    /* Walk the bitmap and mark each consecutive bit as used */
-    size_t curr_bit_index = kpalloc_bitmap_AddressToBitIndex(base_address);
-    for (size_t page = 0UL; page < pages; page++)
+    if (region == NULL)
     {
-        /* Yeah, this could probably have been a while loop, but I like bounded loops a bit better */
-        (void)page;
+        srv_KernelPanic("kpalloc: setting the owner of a page outside of physical memory");
+    }
 
-        kpalloc_bitmap_SetBit(curr_bit_index);
-        curr_bit_index++;
+    region->page_owners[kpalloc_region_AddressToPageIndex(region, page_addr) - region->first_page] = owner;
+}
+
+uintptr_t srv_kpalloc_GetPageOwner(const void* page_ptr)
+{
+    const srv_physical_address_t page_addr = (srv_physical_address_t)page_ptr;
+    const kpalloc_region_t*      region    = kpalloc_FindRegion(page_addr);
+
+    if (region == NULL)
+    {
+        return 0ULL;
     }
+
+    return region->page_owners[kpalloc_region_AddressToPageIndex(region, page_addr) - region->first_page];
 }
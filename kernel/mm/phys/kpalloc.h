@@ -13,22 +13,71 @@
 #include <hal.h>
 #include <stddef.h>
 
-#define SRV_PAGE_SIZE 4096ULL /**< The size of a single page */
+#define SRV_PAGE_SIZE             4096ULL /**< The size of a single page */
+#define SRV_KPALLOC_MAX_ORDER     18U     /**< Largest block order the allocator hands out (2^18 pages, a 1 GiB gigapage) */
+#define SRV_KPALLOC_MAX_REGIONS   16U     /**< Most separate banks of RAM the allocator manages. As many as a Device Tree memory map holds */
+#define SRV_KPALLOC_MAGAZINE_SIZE 32ULL   /**< Number of pages a per-CPU magazine can hold */
 
 typedef void* page_t; /**< Physical page typedef */
 
+/**
+ * @brief Per-CPU magazine of free pages
+ *
+ * @details A small LIFO stack of free pages owned by a single CPU. Allocations
+ *          and frees on that CPU are served from here without touching the
+ *          global bitmap or its lock, and the most recently freed (and therefore
+ *          most likely cache-hot) page is the first one handed back out.
+ *          Each CPU's magazine lives in its local data block, and is cache-line
+ *          aligned so that two CPUs never share a line.
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]
+{
+    page_t rounds[SRV_KPALLOC_MAGAZINE_SIZE]; /**< The cached pages. @c rounds[count - 1] is the hottest */
+    size_t count;                             /**< Number of pages in the magazine */
+} srv_kpalloc_magazine_t;
+
+/**
+ * @brief Per-order buddy allocator statistics
+ */
+typedef struct
+{
+    size_t   free_blocks; /**< Number of free blocks of exactly this order */
+    size_t   allocs;      /**< Number of successful allocations of this order */
+    size_t   failures;    /**< Number of allocations of this order that failed */
+    uint32_t unusable;    /**< Per mille of free memory too fragmented to satisfy an allocation of this order */
+} srv_kpalloc_order_stats_t;
+
+/**
+ * @brief Physical page allocator statistics
+ */
+typedef struct
+{
+    size_t                    total_pages;                           /**< Number of pages managed by the allocator */
+    size_t                    free_pages;                            /**< Number of free pages, not counting per-CPU caches */
+    size_t                    splits;                                /**< Number of block splits */
+    size_t                    merges;                                /**< Number of buddy merges */
+    srv_kpalloc_order_stats_t orders[SRV_KPALLOC_MAX_ORDER + 1U];    /**< Statistics for each order */
+} srv_kpalloc_stats_t;
+
 /**
  * @brief Initialize the physical page allocator
  *
- * @param[in] base_address Physical base address of the memory in the machine
- * @param[in] memory_size  The size of the physical memory installed in the machine (in KiB)
+ * @details Each bank of RAM gets its own bitmaps, kept in the bank itself.
+ *          The Kernel image (with its stack and eternal heap) is reserved
+ *          automatically, on top of @c reserved.
+ *
+ * @param[in] usable         Banks of RAM, sorted by address. Partial pages at either end are left out
+ * @param[in] usable_count   Number of entries in @c usable. Banks past @ref SRV_KPALLOC_MAX_REGIONS are left out, with a message
+ * @param[in] reserved       Ranges of RAM that must never be handed out, e.g. firmware and the DTB blob
+ * @param[in] reserved_count Number of entries in @c reserved
  */
-void srv_kpalloc_InitPageAllocator(srv_physical_address_t base_address, size_t memory_size);
+void srv_kpalloc_InitPageAllocator(const srv_physical_range_t* usable, size_t usable_count, const srv_physical_range_t* reserved, size_t reserved_count);
 
 /**
  * @brief Allocate a single physical page
  *
  * @return Pointer to the physical address allocated
+ * @return @c NULL if there are no free pages left
  */
 page_t srv_kpalloc_AllocPage(void);
 
@@ -39,6 +88,55 @@ page_t srv_kpalloc_AllocPage(void);
  */
 void srv_kpalloc_FreePage(void* page_ptr);
 
+/**
+ * @brief Allocate a physically contiguous block of @c 2^order pages
+ *
+ * @details The block is naturally aligned to its own size, so an order 9
+ *          allocation is suitable for a 2 MiB megapage
+ *
+ * @param[in] order The order of the block to allocate
+ *
+ * @return Pointer to the physical address of the first page in the block
+ * @return @c NULL if there is no free block large enough
+ */
+page_t srv_kpalloc_AllocPages(uint32_t order);
+
+/**
+ * @brief Free a block allocated by @ref srv_kpalloc_AllocPages
+ *
+ * @param[in] page_ptr Pointer to the physical address of the first page in the block
+ * @param[in] order    The order the block was allocated with
+ */
+void srv_kpalloc_FreePages(void* page_ptr, uint32_t order);
+
+/**
+ * @brief Get a snapshot of the physical page allocator's statistics
+ *
+ * @param[out] stats Structure to fill
+ */
+void srv_kpalloc_GetStats(srv_kpalloc_stats_t* stats);
+
+/**
+ * @brief Tag a page with an owner defined value
+ *
+ * @details Allocators built on top of this one use the tag to get from any
+ *          address back to their own bookkeeping in O(1). Nothing in here
+ *          interprets the value, and it is <b>not</b> cleared when the page is freed.
+ *
+ * @param[in] page_ptr Pointer to any byte in the page
+ * @param[in] owner    The value to store, or 0 to clear it
+ */
+void srv_kpalloc_SetPageOwner(const void* page_ptr, uintptr_t owner);
+
+/**
+ * @brief Get the owner tag of a page
+ *
+ * @param[in] page_ptr Pointer to any byte in the page
+ *
+ * @return The value last given to @ref srv_kpalloc_SetPageOwner, or 0 if there isn't one
+ */
+uintptr_t srv_kpalloc_GetPageOwner(const void* page_ptr);
+
 /**
  * @brief Marks a region of memory as unusable
  *
@@ -0,0 +1,155 @@
+/****************************************************************
+ * @file    vm.h
+ * @brief   Kernel virtual address space management
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef VM_H
+#define VM_H
+
+#include <hal.h>
+#include <stddef.h>
+#include <sync/spinlock.h>
+
+#define SRV_VM_READ    (1U << 0U) /**< Mapping can be read */
+#define SRV_VM_WRITE   (1U << 1U) /**< Mapping can be written. Implies @ref SRV_VM_READ */
+#define SRV_VM_EXECUTE (1U << 2U) /**< Mapping can be executed */
+#define SRV_VM_USER    (1U << 3U) /**< Mapping is accessible from user mode */
+#define SRV_VM_GLOBAL  (1U << 4U) /**< Mapping exists in every address space, so survives an address space switch in the TLB */
+
+/**
+ * @brief An address space
+ */
+typedef struct
+{
+    srv_spinlock_t      lock; /**< Held while the page tables are walked or changed, but not across the TLB shootdown that follows */
+    page_table_entry_t* root; /**< Root page table. Page tables are always reached through their physical address */
+} srv_vm_space_t;
+
+/**
+ * @brief Get the Kernel's address space
+ *
+ * @return The Kernel address space
+ */
+srv_vm_space_t* srv_vm_GetKernelSpace(void);
+
+/**
+ * @brief Build the Kernel address space
+ *
+ * @details Every bank of RAM is mapped twice, once where it is (so the Kernel
+ *          keeps running when translation is switched on) and once in the
+ *          direct map at @ref SRV_PAGING_DIRECT_MAP_BASE. Both use the largest
+ *          pages alignment allows. The Kernel's text is then made read-only
+ *          and executable, and its read-only data read-only. Nothing is
+ *          activated yet.
+ *
+ * @warning The physical page allocator must be initialized before calling this
+ *
+ * @param[in] ram       Banks of RAM
+ * @param[in] ram_count Number of entries in @c ram
+ *
+ * @return true  The address space was built
+ * @return false There wasn't enough memory for the page tables
+ */
+bool srv_vm_InitKernelSpace(const srv_physical_range_t* ram, size_t ram_count);
+
+/**
+ * @brief Switch the executing CPU to an address space
+ *
+ * @param[in] space The address space
+ */
+void srv_vm_Activate(srv_vm_space_t* space);
+
+/**
+ * @brief Map a range of physical memory
+ *
+ * @details The range is mapped with 1 GiB and 2 MiB pages wherever both the
+ *          virtual and physical address are aligned for them, and 4 KiB pages
+ *          everywhere else
+ *
+ * @warning Waits for every CPU to flush its TLB, with interrupts masked. The
+ *          caller mustn't hold a lock another CPU could be spinning on with
+ *          its interrupts masked, or neither gets any further.
+ *
+ * @param[in] space The address space
+ * @param[in] va    Virtual address to map at. Must be page aligned
+ * @param[in] pa    Physical address to map. Must be page aligned
+ * @param[in] size  Size of the range, in bytes. Must be a whole number of pages
+ * @param[in] prot  Combination of the @c SRV_VM_ flags
+ *
+ * @return true  The range was mapped
+ * @return false Some of the range was already mapped, the arguments are invalid, or
+ *               there wasn't enough memory for the page tables. Nothing is left mapped.
+ */
+bool srv_vm_Map(srv_vm_space_t* space, srv_virtual_address_t va, srv_physical_address_t pa, size_t size, uint32_t prot);
+
+/**
+ * @brief Unmap a range
+ *
+ * @details Large pages that are only partly covered are split. Page tables
+ *          left empty are freed. Gaps in the range are skipped.
+ *
+ * @warning Waits on other CPUs, so the same goes for locks as for @ref srv_vm_Map
+ *
+ * @param[in] space The address space
+ * @param[in] va    Start of the range. Must be page aligned
+ * @param[in] size  Size of the range, in bytes. Must be a whole number of pages
+ *
+ * @return true  The range is no longer mapped
+ * @return false The arguments are invalid, or a large page couldn't be split
+ */
+bool srv_vm_Unmap(srv_vm_space_t* space, srv_virtual_address_t va, size_t size);
+
+/**
+ * @brief Change the permissions of a mapped range
+ *
+ * @details Large pages that are only partly covered are split
+ *
+ * @warning Waits on other CPUs, so the same goes for locks as for @ref srv_vm_Map
+ *
+ * @param[in] space The address space
+ * @param[in] va    Start of the range. Must be page aligned
+ * @param[in] size  Size of the range, in bytes. Must be a whole number of pages
+ * @param[in] prot  Combination of the @c SRV_VM_ flags
+ *
+ * @return true  The permissions were changed
+ * @return false Some of the range isn't mapped, the arguments are invalid, or
+ *               a large page couldn't be split
+ */
+bool srv_vm_Protect(srv_vm_space_t* space, srv_virtual_address_t va, size_t size, uint32_t prot);
+
+/**
+ * @brief Look up the physical address a virtual address is mapped to
+ *
+ * @param[in]  space The address space
+ * @param[in]  va    The virtual address
+ * @param[out] pa    The physical address
+ * @param[out] prot  The mapping's @c SRV_VM_ flags. May be @c NULL
+ *
+ * @return @c true if @c va is mapped
+ */
+bool srv_vm_Translate(srv_vm_space_t* space, srv_virtual_address_t va, srv_physical_address_t* pa, uint32_t* prot);
+
+/**
+ * @brief Print the layout of an address space to the console
+ *
+ * @details Contiguous runs of pages with the same permissions are printed as one line
+ *
+ * @param[in] space The address space
+ */
+void srv_vm_Dump(srv_vm_space_t* space);
+
+/**
+ * @brief Get the direct map address of some physical memory
+ *
+ * @param[in] pa The physical address
+ *
+ * @return Where @c pa can be reached once the Kernel address space is active
+ */
+static inline void* srv_vm_PhysicalToDirect(srv_physical_address_t pa)
+{
+    return (void*)(SRV_PAGING_DIRECT_MAP_BASE + pa);
+}
+
+#endif
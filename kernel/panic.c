@@ -12,8 +12,14 @@
 
 [[noreturn]] void srv_KernelPanic(const char* cause)
 {
+    /* This CPU may have panicked holding the console lock, which kprintf would then wait on forever */
+    srv_stdio_EnterPanic();
+
     kprintf("panic[cpu%d]: %s\n", srv_hal_GetExecutingCPU(), cause);
 
+    /* Make sure nothing is left sitting in the buffer before we hang */
+    kflush();
+
     /* Spin forever */
     for (;;)
     {
@@ -0,0 +1,455 @@
+/****************************************************************
+ * @file    sched.c
+ * @brief   Implementation of @ref sched.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <sched/sched.h>
+
+#include <mm/kmem.h>
+#include <mm/phys/kpalloc.h>
+#include <panic.h>
+#include <smp/percpu.h>
+#include <smp/smp.h>
+
+static srv_kmem_cache_t* sched_thread_cache = NULL; /**< Where thread records come from */
+static uint64_t          sched_slice_ticks  = 0U;   /**< @ref SRV_SCHED_SLICE_US in timebase ticks */
+static uint64_t          sched_created      = 0U;   /**< Threads made so far, so an idle CPU can tell whether any turned up while it looked for work */
+
+/**
+ * @brief Add a thread to the back of a run queue
+ */
+static inline void sched_Enqueue(srv_sched_run_queue_t* rq, srv_thread_t* thread)
+{
+    thread->state = SRV_THREAD_RUNNABLE;
+    thread->next  = NULL;
+
+    if (rq->tail == NULL)
+    {
+        rq->head = thread;
+    }
+    else
+    {
+        rq->tail->next = thread;
+    }
+
+    rq->tail = thread;
+    __atomic_store_n(&rq->length, rq->length + 1U, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Take a thread out of a run queue
+ *
+ * @param[in] rq     The run queue
+ * @param[in] thread The thread
+ * @param[in] before The thread queued ahead of it, or @c NULL if it is at the head
+ */
+static inline void sched_Remove(srv_sched_run_queue_t* rq, srv_thread_t* thread, srv_thread_t* before)
+{
+    if (before == NULL)
+    {
+        rq->head = thread->next;
+    }
+    else
+    {
+        before->next = thread->next;
+    }
+
+    if (rq->tail == thread)
+    {
+        rq->tail = before;
+    }
+
+    thread->next = NULL;
+    __atomic_store_n(&rq->length, rq->length - 1U, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Check whether a queued thread probably still has its working set in its CPU's cache
+ *
+ * @details Counting switches rather than cycles keeps this to one CPU's
+ *          numbers, since cycle counters aren't synchronized between CPUs
+ */
+static inline bool sched_IsCacheHot(const srv_sched_run_queue_t* rq, const srv_thread_t* thread)
+{
+    return (rq->switches - thread->last_switch) < SRV_SCHED_HOT_SWITCHES;
+}
+
+/**
+ * @brief Take a thread from another CPU's queue
+ *
+ * @details Only the busiest queue is tried. The thread that has waited
+ *          longest without being cache-hot goes first. If they are all hot,
+ *          one is only taken when at least two are waiting, since the last one
+ *          would then wait longer than it takes to refill a cache. The victim
+ *          is only try-locked, so CPUs stealing from each other can't deadlock.
+ *
+ * @param[in] cpu Number of the executing CPU
+ *
+ * @return The thread, or @c NULL if there was nothing worth taking
+ */
+static srv_thread_t* sched_Steal(uint32_t cpu)
+{
+    srv_sched_run_queue_t* victim  = NULL;
+    uint32_t               busiest = 0U;
+
+    for (uint32_t offset = 1U; offset < SRV_HAL_MAX_CPUS; offset++)
+    {
+        srv_percpu_t* other = srv_smp_GetCPU((cpu + offset) % SRV_HAL_MAX_CPUS);
+        if (other == NULL)
+        {
+            continue;
+        }
+
+        /* Only a hint, but it keeps idle CPUs off the locks of CPUs with nothing to give */
+        const uint32_t length = __atomic_load_n(&other->run_queue.length, __ATOMIC_RELAXED);
+        if (length > busiest)
+        {
+            busiest = length;
+            victim  = &other->run_queue;
+        }
+    }
+
+    if ((victim == NULL) || !srv_spinlock_TryLock(&victim->lock))
+    {
+        return NULL;
+    }
+
+    srv_thread_t* chosen        = NULL;
+    srv_thread_t* chosen_before = NULL;
+    srv_thread_t* tail_before   = NULL;
+
+    for (srv_thread_t *thread = victim->head, *before = NULL; thread != NULL; before = thread, thread = thread->next)
+    {
+        if (!sched_IsCacheHot(victim, thread))
+        {
+            chosen        = thread;
+            chosen_before = before;
+            break;
+        }
+
+        tail_before = before;
+    }
+
+    /* Everything is hot, so take the one that would have waited longest */
+    if ((chosen == NULL) && (victim->length >= 2U))
+    {
+        chosen        = victim->tail;
+        chosen_before = tail_before;
+    }
+
+    if (chosen != NULL)
+    {
+        sched_Remove(victim, chosen, chosen_before);
+    }
+
+    srv_spinlock_Unlock(&victim->lock);
+
+    return chosen;
+}
+
+/**
+ * @brief Tidy up after a switch, on the thread switched to
+ *
+ * @details Lets go of the run queue lock the switch was made under, and frees
+ *          the thread switched away from if it had exited. The thread may
+ *          have been moved to another CPU while it was away, so the run
+ *          queue is looked up again rather than taken from before the switch.
+ */
+static void sched_FinishSwitch(void)
+{
+    srv_sched_run_queue_t* rq       = &SRV_PERCPU(run_queue);
+    srv_thread_t*          previous = rq->previous;
+
+    srv_spinlock_Unlock(&rq->lock);
+
+    /* Nothing runs on its stack any more, so it can go */
+    if (previous->state == SRV_THREAD_DEAD)
+    {
+        srv_kpalloc_FreePages(previous->stack, SRV_SCHED_STACK_ORDER);
+        srv_kmem_CacheFree(sched_thread_cache, previous);
+    }
+}
+
+/**
+ * @brief Switch to the next thread
+ *
+ * @details The next thread comes from the head of the queue, then from
+ *          another CPU, and failing both is the thread that was already
+ *          running (if it still can) or the idle thread. Called with
+ *          interrupts masked and the queue locked. The lock has been let go
+ *          by the time this returns.
+ *
+ * @param[in] rq The executing CPU's run queue
+ */
+static void sched_Switch(srv_sched_run_queue_t* rq)
+{
+    srv_thread_t*  previous = rq->current;
+    srv_thread_t*  next     = rq->head;
+    const uint32_t cpu      = srv_hal_GetExecutingCPU();
+
+    if (next != NULL)
+    {
+        sched_Remove(rq, next, NULL);
+    }
+    else
+    {
+        /* Anything still runnable was put back in the queue, so an empty one means we are idle or exiting */
+        next = sched_Steal(cpu);
+        if (next != NULL)
+        {
+            rq->steals++;
+        }
+        else
+        {
+            next = (previous->state == SRV_THREAD_RUNNING) ? previous : &rq->idle;
+        }
+    }
+
+    next->state      = SRV_THREAD_RUNNING;
+    next->cpu        = cpu;
+    rq->need_resched = false;
+
+    /* Once armed the timer keeps itself going until the CPU goes idle, so this is rare */
+    if ((next != &rq->idle) && !rq->slice_armed)
+    {
+        rq->slice_armed = true;
+        (void)srv_timer_Arm(&rq->slice_timer, srv_hal_GetTime() + sched_slice_ticks, cpu);
+    }
+
+    if (next == previous)
+    {
+        srv_spinlock_Unlock(&rq->lock);
+        return;
+    }
+
+    previous->last_switch = rq->switches;
+    rq->switches++;
+    rq->previous    = previous;
+    rq->current     = next;
+    rq->slice_start = srv_hal_GetTime();
+
+    srv_hal_SwitchContext(&previous->context, next->context);
+    sched_FinishSwitch();
+}
+
+/**
+ * @brief Slice timer callback
+ *
+ * @details Flags the running thread to make way if its slice is up and
+ *          something is waiting, then re-arms for the end of the slice of
+ *          whatever is running. On an idle CPU it stops.
+ *
+ * @param[in] argument The executing CPU's run queue
+ */
+static void sched_SliceExpired(void* argument)
+{
+    srv_sched_run_queue_t* rq  = (srv_sched_run_queue_t*)argument;
+    const uint64_t         now = srv_hal_GetTime();
+
+    rq->slice_armed = false;
+
+    if (rq->current == &rq->idle)
+    {
+        return;
+    }
+
+    const uint64_t slice_end = rq->slice_start + sched_slice_ticks;
+
+    if ((now >= slice_end) && (__atomic_load_n(&rq->length, __ATOMIC_RELAXED) != 0U))
+    {
+        rq->need_resched = true;
+    }
+
+    /* If nobody was waiting the thread gets another slice. If it was switched in since, it gets the rest of its own */
+    rq->slice_armed = true;
+    (void)srv_timer_Arm(&rq->slice_timer, (now >= slice_end) ? (now + sched_slice_ticks) : slice_end, rq->idle.cpu);
+}
+
+/**
+ * @brief Wake a sleeping CPU so it can steal a thread just queued here
+ *
+ * @details Pairs with @ref srv_sched_Idle. Either the sleeping CPU sees the
+ *          new thread before it sleeps, or we see it sleeping and send it an IPI.
+ */
+static void sched_WakeIdle(void)
+{
+    const uint32_t self = srv_hal_GetExecutingCPU();
+
+    __atomic_fetch_add(&sched_created, 1U, __ATOMIC_SEQ_CST);
+
+    for (uint32_t offset = 1U; offset < SRV_HAL_MAX_CPUS; offset++)
+    {
+        const uint32_t id    = (self + offset) % SRV_HAL_MAX_CPUS;
+        srv_percpu_t*  other = srv_smp_GetCPU(id);
+
+        /* One is enough, since there is only one thread to take */
+        if ((other != NULL) && __atomic_load_n(&other->run_queue.idling, __ATOMIC_SEQ_CST))
+        {
+            srv_smp_SendIPI(1ULL << id);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Where every new thread starts
+ *
+ * @param[in] argument The thread
+ */
+static void sched_ThreadStart(void* argument)
+{
+    const srv_thread_t* thread = (const srv_thread_t*)argument;
+
+    /* Nothing returns into here, so finish the switch that got us here the way sched_Switch would have */
+    sched_FinishSwitch();
+    srv_hal_EnableInterrupts();
+
+    thread->entry(thread->argument);
+    srv_sched_Exit();
+}
+
+void srv_sched_Init(void)
+{
+    sched_thread_cache = srv_kmem_CacheCreate("thread", sizeof(srv_thread_t), _Alignof(srv_thread_t), NULL);
+    if (sched_thread_cache == NULL)
+    {
+        srv_KernelPanic("sched: failed to create the thread cache");
+    }
+
+    sched_slice_ticks = srv_timer_FromMicroseconds(SRV_SCHED_SLICE_US);
+}
+
+void srv_sched_InitCPU(void)
+{
+    srv_sched_run_queue_t* rq = &SRV_PERCPU(run_queue);
+
+    srv_spinlock_Init(&rq->lock, "run-queue");
+    rq->idle = (srv_thread_t){
+        .state = SRV_THREAD_RUNNING,
+        .cpu   = srv_hal_GetExecutingCPU(),
+        .name  = "idle",
+    };
+    rq->current     = &rq->idle;
+    rq->slice_start = srv_hal_GetTime();
+    srv_timer_Setup(&rq->slice_timer, sched_SliceExpired, rq);
+}
+
+srv_thread_t* srv_sched_CreateThread(const char* name, void (*entry)(void*), void* argument)
+{
+    srv_thread_t* thread = (srv_thread_t*)srv_kmem_CacheAlloc(sched_thread_cache);
+    if (thread == NULL)
+    {
+        return NULL;
+    }
+
+    void* stack = srv_kpalloc_AllocPages(SRV_SCHED_STACK_ORDER);
+    if (stack == NULL)
+    {
+        srv_kmem_CacheFree(sched_thread_cache, thread);
+        return NULL;
+    }
+
+    *thread = (srv_thread_t){
+        .context  = srv_hal_InitContext((uintptr_t)stack + SRV_SCHED_STACK_SIZE, sched_ThreadStart, thread),
+        .entry    = entry,
+        .argument = argument,
+        .stack    = stack,
+        .name     = name,
+    };
+
+    const srv_irq_state_t  irq_state = srv_hal_SaveAndDisableInterrupts();
+    srv_sched_run_queue_t* rq        = &SRV_PERCPU(run_queue);
+
+    srv_spinlock_Lock(&rq->lock);
+
+    /* It has never run, so there is nothing of it in any cache to keep it here for */
+    thread->cpu         = srv_hal_GetExecutingCPU();
+    thread->last_switch = rq->switches - SRV_SCHED_HOT_SWITCHES;
+    sched_Enqueue(rq, thread);
+
+    srv_spinlock_Unlock(&rq->lock);
+    sched_WakeIdle();
+    srv_hal_RestoreInterrupts(irq_state);
+
+    return thread;
+}
+
+void srv_sched_Yield(void)
+{
+    /* Mask interrupts first, or we could be preempted and moved between finding the queue and locking it */
+    const srv_irq_state_t  irq_state = srv_hal_SaveAndDisableInterrupts();
+    srv_sched_run_queue_t* rq        = &SRV_PERCPU(run_queue);
+
+    srv_spinlock_Lock(&rq->lock);
+
+    /* The idle thread is never queued, it is just what runs when the queue is empty */
+    if (rq->current != &rq->idle)
+    {
+        sched_Enqueue(rq, rq->current);
+    }
+
+    sched_Switch(rq);
+    srv_hal_RestoreInterrupts(irq_state);
+}
+
+void srv_sched_Idle(void)
+{
+    /* Read before looking for work, so a thread made while we look keeps us awake */
+    const uint64_t created = __atomic_load_n(&sched_created, __ATOMIC_SEQ_CST);
+
+    srv_sched_Yield();
+
+    const srv_irq_state_t  irq_state = srv_hal_SaveAndDisableInterrupts();
+    srv_sched_run_queue_t* rq        = &SRV_PERCPU(run_queue);
+
+    /* Interrupts stay masked, so one arriving from here on is still pending when we get to the wfi */
+    __atomic_store_n(&rq->idling, true, __ATOMIC_SEQ_CST);
+
+    if ((__atomic_load_n(&rq->length, __ATOMIC_RELAXED) == 0U) && (__atomic_load_n(&sched_created, __ATOMIC_SEQ_CST) == created))
+    {
+        srv_hal_WaitForInterrupt();
+    }
+
+    __atomic_store_n(&rq->idling, false, __ATOMIC_RELAXED);
+
+    /* Takes whatever woke us */
+    srv_hal_RestoreInterrupts(irq_state);
+}
+
+void srv_sched_Exit(void)
+{
+    (void)srv_hal_SaveAndDisableInterrupts();
+    srv_sched_run_queue_t* rq = &SRV_PERCPU(run_queue);
+
+    srv_spinlock_Lock(&rq->lock);
+
+    if (rq->current == &rq->idle)
+    {
+        srv_KernelPanic("sched: the idle thread can't exit");
+    }
+
+    rq->current->state = SRV_THREAD_DEAD;
+    sched_Switch(rq);
+
+    srv_KernelPanic("sched: a dead thread was switched back to");
+}
+
+srv_thread_t* srv_sched_GetCurrent(void)
+{
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    srv_thread_t*         current   = SRV_PERCPU(run_queue).current;
+
+    srv_hal_RestoreInterrupts(irq_state);
+
+    return current;
+}
+
+void srv_sched_Preempt(void)
+{
+    if (SRV_PERCPU(run_queue).need_resched)
+    {
+        srv_sched_Yield();
+    }
+}
@@ -0,0 +1,144 @@
+/****************************************************************
+ * @file    sched.h
+ * @brief   Kernel threads and the scheduler
+ *
+ * @details Every CPU has its own run queue, and threads stay on the CPU they
+ *          last ran on so they keep finding their working set in its cache.
+ *          A CPU that runs out of work steals from the busiest queue,
+ *          preferring threads whose cache has gone cold. Each CPU's
+ *          @c kmain context becomes its idle thread, which only runs when
+ *          there is nothing else to.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <hal.h>
+#include <sync/spinlock.h>
+#include <time/timer.h>
+
+#define SRV_SCHED_STACK_ORDER  2U                                 /**< Order of the page block each thread gets as its stack */
+#define SRV_SCHED_STACK_SIZE   (4096ULL << SRV_SCHED_STACK_ORDER) /**< Size of a thread's stack, in bytes */
+#define SRV_SCHED_SLICE_US     4000U                              /**< How long a thread runs before it has to make way, in microseconds */
+#define SRV_SCHED_HOT_SWITCHES 4U                                 /**< A thread is cache-hot until this many others have run on its CPU since it did */
+
+/**
+ * @brief What a thread is doing
+ */
+typedef enum
+{
+    SRV_THREAD_RUNNABLE = 0, /**< Waiting in a run queue */
+    SRV_THREAD_RUNNING,      /**< On a CPU */
+    SRV_THREAD_DEAD          /**< Exited, and freed once its CPU has switched away from it */
+} srv_thread_state_t;
+
+/**
+ * @brief A Kernel thread
+ */
+typedef struct srv_thread
+{
+    srv_context_t      context;     /**< Saved registers while the thread is off CPU */
+    srv_thread_state_t state;       /**< One of @ref srv_thread_state_t */
+    uint32_t           cpu;         /**< CPU the thread last ran on */
+    uint64_t           last_switch; /**< Its CPU's switch count when the thread last came off it */
+    void (*entry)(void*);           /**< Function the thread started in */
+    void*              argument;    /**< Value passed to @ref entry */
+    void*              stack;       /**< Base of the stack, or @c NULL for an idle thread, which runs on its CPU's boot stack */
+    const char*        name;        /**< Name for debugging */
+    struct srv_thread* next;        /**< Next thread in the run queue */
+} srv_thread_t;
+
+/**
+ * @brief A CPU's run queue
+ *
+ * @details Everything is protected by @ref lock, which is held across a
+ *          context switch and let go by the thread switched to. A thread
+ *          put back on the queue can't be stolen until it is fully off the CPU.
+ */
+typedef struct
+{
+    srv_spinlock_t lock;         /**< Protects the queue and the switch in progress */
+    srv_thread_t*  head;         /**< Next thread to run */
+    srv_thread_t*  tail;         /**< Thread queued last */
+    uint32_t       length;       /**< Threads waiting. Read without the lock by CPUs looking for work */
+    bool           need_resched; /**< The running thread should make way as soon as it can */
+    srv_thread_t*  current;      /**< Thread on the CPU */
+    srv_thread_t*  previous;     /**< Thread the last switch came from, for the one switched to to tidy up after */
+    uint64_t       slice_start;  /**< Time @ref current was switched to */
+    srv_timer_t    slice_timer;  /**< Goes off when @ref current may have used up its slice */
+    bool           slice_armed;  /**< @ref slice_timer is armed. Only the CPU itself touches this */
+    bool           idling;       /**< The CPU is asleep in @ref srv_sched_Idle. Read without the lock by CPUs with work to hand out */
+    uint64_t       switches;     /**< Context switches made by the CPU */
+    uint64_t       steals;       /**< Threads the CPU took from other queues */
+    srv_thread_t   idle;         /**< The CPU's idle thread */
+} srv_sched_run_queue_t;
+
+/**
+ * @brief Get ready to create threads
+ *
+ * @warning Must be called once, after the Kernel heap and timers are up and before any other CPU starts
+ */
+void srv_sched_Init(void);
+
+/**
+ * @brief Turn what the executing CPU is running into its idle thread
+ *
+ * @details Called once by every CPU, before it creates or runs any other thread
+ */
+void srv_sched_InitCPU(void);
+
+/**
+ * @brief Create a thread and queue it on the executing CPU
+ *
+ * @details The thread starts with interrupts enabled. When @c entry returns
+ *          the thread exits.
+ *
+ * @param[in] name     Name for debugging. Must stay valid for the life of the thread
+ * @param[in] entry    Function the thread starts in
+ * @param[in] argument Value passed to @c entry
+ *
+ * @return The thread, or @c NULL if there wasn't enough memory
+ */
+srv_thread_t* srv_sched_CreateThread(const char* name, void (*entry)(void*), void* argument);
+
+/**
+ * @brief Let the next thread in the executing CPU's queue run
+ *
+ * @details If the queue is empty the caller keeps running, unless it is the
+ *          idle thread and work can be stolen from another CPU
+ */
+void srv_sched_Yield(void);
+
+/**
+ * @brief Run whatever there is to run, and sleep until an interrupt if there is nothing
+ *
+ * @details Only called by the idle thread. A CPU that makes a thread wakes
+ *          one sleeping CPU with an IPI, so it can come and steal the thread.
+ */
+void srv_sched_Idle(void);
+
+/**
+ * @brief End the calling thread
+ */
+[[noreturn]] void srv_sched_Exit(void);
+
+/**
+ * @brief Get the thread running on the executing CPU
+ *
+ * @return The thread
+ */
+srv_thread_t* srv_sched_GetCurrent(void);
+
+/**
+ * @brief Switch threads if the running thread has used up its slice and someone is waiting
+ *
+ * @details Called on the way out of an interrupt, which is what makes the
+ *          scheduler preemptive. Slices are timed with a timer that is only
+ *          armed while a thread other than the idle thread is running, so an
+ *          idle CPU takes no interrupts for it.
+ */
+void srv_sched_Preempt(void);
+
+#endif
@@ -0,0 +1,80 @@
+/****************************************************************
+ * @file    percpu.h
+ * @brief   Per-CPU data blocks
+ *
+ * @details Each CPU has one block, found through @ref srv_hal_GetCPULocal.
+ *          Blocks are cache-line aligned, so CPUs updating their own block
+ *          never contend for a line with one another.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <hal.h>
+#include <mm/phys/kpalloc.h>
+#include <sched/sched.h>
+
+/**
+ * @brief Get a field of the executing CPU's block
+ *
+ * @note Only meaningful while the caller can't be moved to another CPU
+ */
+#define SRV_PERCPU(field) (srv_percpu_Get()->field)
+
+/**
+ * @brief Where a CPU is in being brought up
+ */
+typedef enum
+{
+    SRV_SMP_CPU_ABSENT = 0, /**< The slot is unused */
+    SRV_SMP_CPU_STARTING,   /**< The firmware has been asked to start the CPU */
+    SRV_SMP_CPU_ONLINE,     /**< The CPU is running the Kernel */
+    SRV_SMP_CPU_ABANDONED   /**< The CPU didn't check in in time, and must never join */
+} srv_smp_cpu_state_t;
+
+typedef struct srv_smp_call srv_smp_call_t; /**< A cross-CPU function call, private to smp.c */
+
+/**
+ * @brief Where other CPUs leave work for a CPU
+ *
+ * @details Every other CPU writes here, so it gets a cache line of its own
+ *          instead of bouncing the one its owner's hot fields are in
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]
+{
+    srv_smp_call_t* calls;     /**< Calls waiting to run, newest first. Pushed to without a lock */
+    uint64_t        tlb_range; /**< Pages waiting to be flushed from the TLB, packed by smp.c. Merged into without a lock */
+} srv_smp_mailbox_t;
+
+/**
+ * @brief A CPU's local data
+ *
+ * @note The secondary CPU entry point and @ref srv_hal_GetExecutingCPU reach
+ *       into this from assembly, so @ref id and @ref stack_top must stay where they are
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]
+{
+    uint32_t               id;          /**< Logical CPU number, as returned by @ref srv_hal_GetExecutingCPU */
+    uint32_t               hardware_id; /**< Hardware ID of the CPU (hart ID on RV64) */
+    uintptr_t              stack_top;   /**< Stack pointer the CPU starts with */
+    srv_smp_cpu_state_t    state;       /**< One of @ref srv_smp_cpu_state_t. Accessed atomically */
+    srv_kpalloc_magazine_t page_cache;  /**< Free pages only this CPU allocates from */
+    srv_sched_run_queue_t  run_queue;   /**< Threads waiting for this CPU */
+    srv_smp_mailbox_t      mailbox;     /**< Requests from other CPUs */
+} srv_percpu_t;
+
+extern srv_percpu_t srv_percpu_blocks[SRV_HAL_MAX_CPUS]; /**< Every CPU's block, indexed by logical CPU number */
+
+/**
+ * @brief Get the executing CPU's block
+ *
+ * @return The block
+ */
+static inline srv_percpu_t* srv_percpu_Get(void)
+{
+    return (srv_percpu_t*)srv_hal_GetCPULocal();
+}
+
+#endif
@@ -0,0 +1,534 @@
+/****************************************************************
+ * @file    smp.c
+ * @brief   Implementation of @ref smp.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <smp/smp.h>
+
+#include <drivers/fdt/fdt.h>
+#include <drivers/irq/plic.h>
+#include <mm/kalloc.h>
+#include <mm/phys/kpalloc.h>
+#include <mm/vm.h>
+#include <panic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SMP_START_TIMEOUT_CYCLES (1ULL << 30ULL)          /**< How long a CPU gets to check in after being started */
+#define SMP_TLB_PAGE_MASK        0xFFFFFFFFULL                                          /**< Page numbers in a packed TLB range are 32 bits */
+#define SMP_TLB_ALL              (0xFFFFFFFFULL << 32ULL)                               /**< Packed TLB range meaning everything */
+#define SMP_TLB_VA_MASK          ((1ULL << SRV_PAGING_VA_BITS) - 1ULL)                  /**< Significant bits of a virtual address, which are all a packed range keeps */
+#define SMP_TLB_PAGES            (1ULL << (SRV_PAGING_VA_BITS - SRV_PAGING_PAGE_SHIFT)) /**< Page numbers a packed range can hold */
+#define SMP_TLB_UPPER_PAGE       (SMP_TLB_PAGES / 2ULL)                                 /**< First page number of the upper half */
+
+/**
+ * @brief A call waiting in a CPU's mailbox
+ */
+struct srv_smp_call
+{
+    srv_smp_call_t*    next;      /**< Next call in the mailbox */
+    srv_smp_function_t function;  /**< Function to run */
+    void*              argument;  /**< Passed to @ref function */
+    uint32_t*          remaining; /**< Count of targets the caller is waiting on, or @c NULL if nobody waits and the call frees itself */
+};
+
+extern void _start_secondary(void);   /**< Entry point for secondary CPUs, in start.s */
+extern char __kernel_stack_bottom[]; /**< Bottom of the boot CPU's stack, from linker.ld */
+extern char __kernel_stack_top[];    /**< Top of the boot CPU's stack, from linker.ld */
+
+_Static_assert(offsetof(srv_percpu_t, id) == 0U, "srv_hal_GetExecutingCPU() reads the CPU number from offset 0");
+_Static_assert(offsetof(srv_percpu_t, stack_top) == 8U, "start.s loads the stack pointer from offset 8");
+
+srv_percpu_t srv_percpu_blocks[SRV_HAL_MAX_CPUS];
+
+static uint32_t smp_cpu_count = 0U;    /**< CPUs online. Only the boot CPU changes this, and only before it sets @ref smp_started */
+static uint32_t smp_next_id   = 0U;    /**< Number the next CPU started gets. Numbers given to abandoned CPUs are never reused */
+static bool     smp_started   = false; /**< @ref srv_smp_StartCPUs has finished, so @ref smp_cpu_count won't change again */
+
+static uint32_t smp_barrier_arrived    = 0U; /**< CPUs waiting at the barrier */
+static uint32_t smp_barrier_generation = 0U; /**< Bumped by the last CPU to arrive, which releases the rest */
+
+/**
+ * @brief Check whether a @c /cpus child is a CPU that can be used
+ */
+static bool smp_IsUsableCPU(const void* fdt, int32_t node)
+{
+    const char* type = (const char*)srv_fdt_GetProp(fdt, node, "device_type", NULL);
+
+    /* Firmware disables harts it can't run us on, e.g. an M-mode only monitor core */
+    return (type != NULL) && (strcmp(type, "cpu") == 0) && srv_fdt_IsEnabled(fdt, node);
+}
+
+/**
+ * @brief Start one CPU and wait for it to check in
+ *
+ * @param[in] hardware_id Hardware ID of the CPU
+ *
+ * @return @c true if the CPU is now online
+ */
+static bool smp_StartCPU(uint32_t hardware_id)
+{
+    srv_percpu_t* cpu   = &srv_percpu_blocks[smp_next_id];
+    void*         stack = srv_kpalloc_AllocPages(SRV_SMP_STACK_ORDER);
+
+    if (stack == NULL)
+    {
+        return false;
+    }
+
+    cpu->stack_top   = (uintptr_t)stack + SRV_SMP_STACK_SIZE;
+    cpu->id          = smp_next_id;
+    cpu->hardware_id = hardware_id;
+    __atomic_store_n(&cpu->state, SRV_SMP_CPU_STARTING, __ATOMIC_RELEASE);
+
+    /* The Kernel is identity mapped, so these addresses are also physical ones */
+    if (!srv_hal_StartCPU(hardware_id, (srv_physical_address_t)_start_secondary, (uintptr_t)cpu))
+    {
+        cpu->state = SRV_SMP_CPU_ABSENT;
+        srv_kpalloc_FreePages(stack, SRV_SMP_STACK_ORDER);
+        return false;
+    }
+
+    const uint64_t start = srv_hal_GetCycleCount();
+
+    while (__atomic_load_n(&cpu->state, __ATOMIC_ACQUIRE) == SRV_SMP_CPU_STARTING)
+    {
+        if ((srv_hal_GetCycleCount() - start) < SMP_START_TIMEOUT_CYCLES)
+        {
+            continue;
+        }
+
+        /* Whoever moves the state on first wins. If it's us, the CPU parks when it does turn up */
+        srv_smp_cpu_state_t expected = SRV_SMP_CPU_STARTING;
+        if (__atomic_compare_exchange_n(&cpu->state, &expected, SRV_SMP_CPU_ABANDONED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            /* The record and stack stay allocated, since the CPU may yet turn up and use them */
+            smp_next_id++;
+            kprintf("smp: CPU %d didn't come online\n", hardware_id);
+            return false;
+        }
+    }
+
+    smp_next_id++;
+    smp_cpu_count++;
+
+    return true;
+}
+
+void srv_smp_InitBootCPU(uint32_t hardware_id)
+{
+    srv_percpu_t* cpu = &srv_percpu_blocks[0];
+
+    /* Its kmain becomes an idle thread that takes traps and runs anything other CPUs ask of it, just like theirs */
+    if ((uintptr_t)(__kernel_stack_top - __kernel_stack_bottom) < SRV_SMP_STACK_SIZE)
+    {
+        srv_KernelPanic("smp: the boot CPU's stack is smaller than the others'");
+    }
+
+    cpu->stack_top   = (uintptr_t)__kernel_stack_top;
+    cpu->id          = 0U;
+    cpu->hardware_id = hardware_id;
+    cpu->state       = SRV_SMP_CPU_ONLINE;
+    smp_cpu_count    = 1U;
+    smp_next_id      = 1U;
+}
+
+uint32_t srv_smp_StartCPUs(const void* fdt)
+{
+    const int32_t cpus = srv_fdt_PathOffset(fdt, "/cpus");
+    if (cpus < 0)
+    {
+        __atomic_store_n(&smp_started, true, __ATOMIC_RELEASE);
+        return smp_cpu_count;
+    }
+
+    uint32_t address_cells = 0U;
+    uint32_t size_cells    = 0U;
+    srv_fdt_GetCells(fdt, cpus, &address_cells, &size_cells);
+
+    for (int32_t node = srv_fdt_FirstSubnode(fdt, cpus); node >= 0; node = srv_fdt_NextSubnode(fdt, node))
+    {
+        uint32_t    length = 0U;
+        const void* reg    = srv_fdt_GetProp(fdt, node, "reg", &length);
+
+        if ((reg == NULL) || (address_cells == 0U) || (address_cells > 2U) || (length < (address_cells * sizeof(uint32_t))) || !smp_IsUsableCPU(fdt, node))
+        {
+            continue;
+        }
+
+        const uint32_t hardware_id = (uint32_t)srv_fdt_ReadCells(reg, address_cells);
+        if (hardware_id == srv_percpu_blocks[0].hardware_id)
+        {
+            continue;
+        }
+
+        if (smp_next_id == SRV_HAL_MAX_CPUS)
+        {
+            kprintf("smp: only %d CPUs are supported, leaving the rest stopped\n", SRV_HAL_MAX_CPUS);
+            break;
+        }
+
+        (void)smp_StartCPU(hardware_id);
+    }
+
+    /* Let CPUs already waiting at the barrier count themselves against the final number */
+    __atomic_store_n(&smp_started, true, __ATOMIC_RELEASE);
+
+    return smp_cpu_count;
+}
+
+bool srv_smp_InitSecondaryCPU(srv_percpu_t* cpu)
+{
+    srv_smp_cpu_state_t expected = SRV_SMP_CPU_STARTING;
+
+    srv_hal_InitTraps();
+
+    /* The boot CPU already switched the page tables, this CPU just has to load them */
+    srv_vm_Activate(srv_vm_GetKernelSpace());
+    srv_plic_InitCPU();
+
+    return __atomic_compare_exchange_n(&cpu->state, &expected, SRV_SMP_CPU_ONLINE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+srv_percpu_t* srv_smp_GetCPU(uint32_t id)
+{
+    if ((id >= SRV_HAL_MAX_CPUS) || (__atomic_load_n(&srv_percpu_blocks[id].state, __ATOMIC_ACQUIRE) != SRV_SMP_CPU_ONLINE))
+    {
+        return NULL;
+    }
+
+    return &srv_percpu_blocks[id];
+}
+
+uint32_t srv_smp_GetCPUCount(void)
+{
+    return __atomic_load_n(&smp_cpu_count, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Push a call onto a CPU's mailbox
+ *
+ * @return @c true if the mailbox was empty, so the CPU needs an IPI to look at it
+ */
+static bool smp_Push(srv_smp_mailbox_t* mailbox, srv_smp_call_t* call)
+{
+    srv_smp_call_t* head = __atomic_load_n(&mailbox->calls, __ATOMIC_RELAXED);
+
+    do
+    {
+        call->next = head;
+    } while (!__atomic_compare_exchange_n(&mailbox->calls, &head, call, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return head == NULL;
+}
+
+/**
+ * @brief Run every call in the executing CPU's mailbox
+ *
+ * @note Interrupts must be masked
+ */
+static void smp_RunCalls(void)
+{
+    srv_smp_call_t* call    = __atomic_exchange_n(&SRV_PERCPU(mailbox).calls, NULL, __ATOMIC_ACQUIRE);
+    srv_smp_call_t* ordered = NULL;
+
+    /* Pushed newest first, so turn the list round to run them in the order they were made */
+    while (call != NULL)
+    {
+        srv_smp_call_t* next = call->next;
+        call->next           = ordered;
+        ordered              = call;
+        call                 = next;
+    }
+
+    while (ordered != NULL)
+    {
+        /* A waited for call lives on its caller's stack, which can be gone as soon as the count drops */
+        const srv_smp_function_t function  = ordered->function;
+        void*                    argument  = ordered->argument;
+        uint32_t*                remaining = ordered->remaining;
+        srv_smp_call_t*          next      = ordered->next;
+
+        if (remaining == NULL)
+        {
+            srv_kfree(ordered);
+        }
+
+        function(argument);
+
+        if (remaining != NULL)
+        {
+            __atomic_sub_fetch(remaining, 1U, __ATOMIC_RELEASE);
+        }
+
+        ordered = next;
+    }
+}
+
+/**
+ * @brief Merge a range of pages into a packed TLB range
+ *
+ * @param[in] packed     The packed range. 0 is empty
+ * @param[in] start_page First page of the range to add
+ * @param[in] end_page   Page after the last one to add
+ *
+ * @return The packed union of the two
+ */
+static inline uint64_t smp_TLBMerge(uint64_t packed, uint64_t start_page, uint64_t end_page)
+{
+    if (packed != 0U)
+    {
+        const uint64_t packed_start = packed & SMP_TLB_PAGE_MASK;
+        const uint64_t packed_end   = packed >> 32U;
+
+        start_page = (packed_start < start_page) ? packed_start : start_page;
+        end_page   = (packed_end > end_page) ? packed_end : end_page;
+    }
+
+    return (end_page << 32U) | start_page;
+}
+
+/**
+ * @brief Flush whatever has been merged into the executing CPU's mailbox
+ *
+ * @param[in] argument Unused
+ */
+static void smp_FlushPendingTLB(void* argument)
+{
+    (void)argument;
+
+    const uint64_t packed = __atomic_exchange_n(&SRV_PERCPU(mailbox).tlb_range, 0U, __ATOMIC_ACQ_REL);
+
+    /* Nothing left means someone else's call got here first and flushed our range with theirs */
+    if (packed == 0U)
+    {
+        return;
+    }
+
+    if (packed == SMP_TLB_ALL)
+    {
+        srv_hal_FlushTLB();
+        return;
+    }
+
+    const uint64_t start_page = packed & SMP_TLB_PAGE_MASK;
+    const uint64_t end_page   = packed >> 32U;
+
+    /* Ranges from both halves were merged, and the hole between them can't be flushed page by page */
+    if ((start_page < SMP_TLB_UPPER_PAGE) && (end_page > SMP_TLB_UPPER_PAGE))
+    {
+        srv_hal_FlushTLB();
+        return;
+    }
+
+    /* Put back the top bits that packing dropped */
+    const srv_virtual_address_t start = (start_page * SRV_PAGE_SIZE) | ((start_page >= SMP_TLB_UPPER_PAGE) ? ~SMP_TLB_VA_MASK : 0ULL);
+
+    srv_hal_FlushTLBRange(start, (size_t)((end_page - start_page) * SRV_PAGE_SIZE));
+}
+
+void srv_smp_Barrier(void)
+{
+    /* A CPU started early gets here while the boot CPU is still starting others, and the count still has to grow */
+    while (!__atomic_load_n(&smp_started, __ATOMIC_ACQUIRE))
+    {
+    }
+
+    const uint32_t participants = __atomic_load_n(&smp_cpu_count, __ATOMIC_RELAXED);
+
+    /* Read the generation before arriving, or the last CPU could bump it under us */
+    const uint32_t generation = __atomic_load_n(&smp_barrier_generation, __ATOMIC_ACQUIRE);
+
+    if (__atomic_add_fetch(&smp_barrier_arrived, 1U, __ATOMIC_ACQ_REL) == participants)
+    {
+        /* Nobody touches the count again until they see the new generation */
+        __atomic_store_n(&smp_barrier_arrived, 0U, __ATOMIC_RELAXED);
+        __atomic_store_n(&smp_barrier_generation, generation + 1U, __ATOMIC_RELEASE);
+        return;
+    }
+
+    while (__atomic_load_n(&smp_barrier_generation, __ATOMIC_ACQUIRE) == generation)
+    {
+    }
+}
+
+void srv_smp_SendIPI(uint64_t cpus)
+{
+    const uint32_t self = srv_hal_GetExecutingCPU();
+    uint64_t       mask = 0U;
+    uint32_t       base = 0U;
+
+    for (uint32_t id = 0U; id < SRV_HAL_MAX_CPUS; id++)
+    {
+        const srv_percpu_t* cpu = ((cpus & (1ULL << id)) != 0U) ? srv_smp_GetCPU(id) : NULL;
+
+        if (cpu == NULL)
+        {
+            continue;
+        }
+
+        if (id == self)
+        {
+            srv_hal_RaiseSoftwareInterrupt();
+            continue;
+        }
+
+        /* Hart IDs are usually dense, so everything normally fits in one mask */
+        if ((mask != 0U) && ((cpu->hardware_id < base) || ((cpu->hardware_id - base) >= 64U)))
+        {
+            (void)srv_hal_SendIPI(mask, base);
+            mask = 0U;
+        }
+
+        if (mask == 0U)
+        {
+            base = cpu->hardware_id;
+        }
+
+        mask |= 1ULL << (cpu->hardware_id - base);
+    }
+
+    if (mask != 0U)
+    {
+        (void)srv_hal_SendIPI(mask, base);
+    }
+}
+
+bool srv_smp_CallFunction(uint64_t cpus, srv_smp_function_t function, void* argument, bool wait)
+{
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    const uint32_t        self      = srv_hal_GetExecutingCPU();
+    srv_smp_call_t        calls[SRV_HAL_MAX_CPUS];
+    uint32_t              remaining = 0U;
+    uint64_t              notify    = 0U;
+    bool                  sent      = true;
+
+    for (uint32_t id = 0U; id < SRV_HAL_MAX_CPUS; id++)
+    {
+        srv_percpu_t* cpu = (((cpus & (1ULL << id)) != 0U) && (id != self)) ? srv_smp_GetCPU(id) : NULL;
+
+        if (cpu == NULL)
+        {
+            continue;
+        }
+
+        /* Nobody waits for a call that isn't waited for, so it can't live on our stack */
+        srv_smp_call_t* call = wait ? &calls[id] : (srv_smp_call_t*)srv_kmalloc(sizeof(srv_smp_call_t), 0U);
+        if (call == NULL)
+        {
+            sent = false;
+            continue;
+        }
+
+        *call = (srv_smp_call_t){
+            .function  = function,
+            .argument  = argument,
+            .remaining = wait ? &remaining : NULL,
+        };
+
+        if (wait)
+        {
+            __atomic_add_fetch(&remaining, 1U, __ATOMIC_RELAXED);
+        }
+
+        if (smp_Push(&cpu->mailbox, call))
+        {
+            notify |= 1ULL << id;
+        }
+    }
+
+    srv_smp_SendIPI(notify);
+
+    if ((cpus & (1ULL << self)) != 0U)
+    {
+        function(argument);
+    }
+
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE) != 0U)
+    {
+        /* A target may be waiting on us the same way, with its interrupts masked too */
+        smp_RunCalls();
+    }
+
+    srv_hal_RestoreInterrupts(irq_state);
+
+    return sent;
+}
+
+void srv_smp_FlushTLBRange(uint64_t cpus, srv_virtual_address_t va, size_t size)
+{
+    /* Only the significant bits are packed, so the upper half, where the direct map is, packs too */
+    const uint64_t start_page = (va & SMP_TLB_VA_MASK) / SRV_PAGE_SIZE;
+    const uint64_t end_page   = (size == SIZE_MAX) ? SMP_TLB_PAGE_MASK : (((va & SMP_TLB_VA_MASK) + size + SRV_PAGE_SIZE - 1U) / SRV_PAGE_SIZE);
+
+    if (size == 0U)
+    {
+        return;
+    }
+
+    for (uint32_t id = 0U; id < SRV_HAL_MAX_CPUS; id++)
+    {
+        srv_percpu_t* cpu = ((cpus & (1ULL << id)) != 0U) ? srv_smp_GetCPU(id) : NULL;
+
+        if (cpu == NULL)
+        {
+            continue;
+        }
+
+        uint64_t packed = __atomic_load_n(&cpu->mailbox.tlb_range, __ATOMIC_RELAXED);
+        uint64_t merged = 0U;
+
+        do
+        {
+            /* Anything that doesn't pack, and anything merged with everything, is everything */
+            merged = ((end_page > SMP_TLB_PAGES) || (packed == SMP_TLB_ALL)) ? SMP_TLB_ALL : smp_TLBMerge(packed, start_page, end_page);
+        } while (!__atomic_compare_exchange_n(&cpu->mailbox.tlb_range, &packed, merged, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    /* Whichever call reaches a CPU first flushes everything merged in by then */
+    (void)srv_smp_CallFunction(cpus, smp_FlushPendingTLB, NULL, true);
+}
+
+void srv_smp_TLBBatchAdd(srv_smp_tlb_batch_t* batch, uint64_t cpus, srv_virtual_address_t va, size_t size)
+{
+    if (size == 0U)
+    {
+        return;
+    }
+
+    /* Kept as the whole address space, which srv_smp_TLBBatchFlush passes on as SIZE_MAX */
+    if (size == SIZE_MAX)
+    {
+        batch->start = 0U;
+        batch->end   = SIZE_MAX;
+    }
+    else if (batch->start == batch->end)
+    {
+        batch->start = va;
+        batch->end   = va + size;
+    }
+    else
+    {
+        batch->start = (va < batch->start) ? va : batch->start;
+        batch->end   = ((va + size) > batch->end) ? (va + size) : batch->end;
+    }
+
+    batch->cpus |= cpus;
+}
+
+void srv_smp_TLBBatchFlush(srv_smp_tlb_batch_t* batch)
+{
+    if (batch->start != batch->end)
+    {
+        srv_smp_FlushTLBRange(batch->cpus, batch->start, batch->end - batch->start);
+    }
+
+    *batch = (srv_smp_tlb_batch_t){0};
+}
+
+void srv_smp_HandleIPI(void)
+{
+    smp_RunCalls();
+}
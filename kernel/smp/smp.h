@@ -0,0 +1,171 @@
+/****************************************************************
+ * @file    smp.h
+ * @brief   Multiprocessor bring-up and rendezvous
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <hal.h>
+#include <smp/percpu.h>
+#include <stddef.h>
+
+#define SRV_SMP_STACK_ORDER 2U                               /**< Order of the page block each secondary CPU gets as its stack */
+#define SRV_SMP_STACK_SIZE  (4096ULL << SRV_SMP_STACK_ORDER) /**< Size of a secondary CPU's stack, in bytes. linker.ld gives the boot CPU the same */
+#define SRV_SMP_ALL_CPUS    UINT64_MAX                       /**< CPU mask with every CPU in it */
+
+/**
+ * @brief Function run on another CPU by @ref srv_smp_CallFunction
+ *
+ * @details Runs from that CPU's software interrupt, with interrupts masked
+ *
+ * @param[in] argument The value given to @ref srv_smp_CallFunction
+ */
+typedef void (*srv_smp_function_t)(void* argument);
+
+/**
+ * @brief TLB flushes gathered up to be sent to other CPUs in one go
+ *
+ * @details Zero initialise it, add to it with @ref srv_smp_TLBBatchAdd and
+ *          send it with @ref srv_smp_TLBBatchFlush
+ */
+typedef struct
+{
+    uint64_t              cpus;  /**< CPU mask of every CPU that has to flush */
+    srv_virtual_address_t start; /**< Start of the range that covers every page added */
+    srv_virtual_address_t end;   /**< End of that range, or the same as @ref start if nothing has been added */
+} srv_smp_tlb_batch_t;
+
+/**
+ * @brief Start every other CPU the platform describes, and wait for each of them to come online
+ *
+ * @details CPUs are started one at a time. A CPU that can't be started, or
+ *          that doesn't check in within a timeout, is left out. CPUs beyond
+ *          @ref SRV_HAL_MAX_CPUS are never started.
+ *
+ * @warning Must be called on the boot CPU once the Kernel address space is active
+ *
+ * @param[in] fdt Pointer to the DTB
+ *
+ * @return Number of CPUs now online, including the boot CPU
+ */
+uint32_t srv_smp_StartCPUs(const void* fdt);
+
+/**
+ * @brief Record the boot CPU as CPU 0
+ *
+ * @details @c tp already points at CPU 0's block, courtesy of start.s
+ *
+ * @param[in] hardware_id Hardware ID of the boot CPU
+ */
+void srv_smp_InitBootCPU(uint32_t hardware_id);
+
+/**
+ * @brief Finish bringing up a secondary CPU, on that CPU
+ *
+ * @details Called from the secondary CPU entry point, with translation still off
+ *
+ * @param[in] cpu The CPU's block, which is also its local data block by now
+ *
+ * @return @c true if the CPU has joined, @c false if it was given up on and must park
+ */
+bool srv_smp_InitSecondaryCPU(srv_percpu_t* cpu);
+
+/**
+ * @brief Get the block of an online CPU
+ *
+ * @param[in] id Logical number of the CPU
+ *
+ * @return The block, or @c NULL if there is no such CPU
+ */
+srv_percpu_t* srv_smp_GetCPU(uint32_t id);
+
+/**
+ * @brief Get the number of CPUs that are online
+ *
+ * @return Number of online CPUs, including the boot CPU
+ */
+uint32_t srv_smp_GetCPUCount(void);
+
+/**
+ * @brief Wait until every online CPU has reached this barrier
+ *
+ * @details Every CPU must call this the same number of times. The barrier
+ *          resets itself, so it can be used again straight away. CPUs that
+ *          get here before @ref srv_smp_StartCPUs has finished wait for it
+ *          first, so the barrier always counts every CPU that came online.
+ */
+void srv_smp_Barrier(void);
+
+/**
+ * @brief Interrupt a set of CPUs
+ *
+ * @details Each one ends up in @ref srv_smp_HandleIPI. CPUs are grouped by
+ *          hardware ID so that most platforms need a single firmware call.
+ *
+ * @param[in] cpus CPU mask, with bit @c n standing for logical CPU @c n. CPUs that aren't online are skipped
+ */
+void srv_smp_SendIPI(uint64_t cpus);
+
+/**
+ * @brief Run a function on a set of CPUs
+ *
+ * @details The call is pushed onto each target's queue without taking a
+ *          lock. Only a push onto an empty queue sends an IPI, so a burst
+ *          of calls to one CPU costs it one interrupt. If the executing CPU
+ *          is in @c cpus the function runs on it directly, once the others
+ *          have been sent theirs.
+ *
+ * @note While waiting, the caller runs calls other CPUs make to it, so two
+ *       CPUs calling each other don't deadlock. It still mustn't wait while
+ *       holding a lock a target could be spinning on with interrupts masked.
+ *
+ * @param[in] cpus     CPU mask. CPUs that aren't online are skipped
+ * @param[in] function Function to run
+ * @param[in] argument Passed to @c function
+ * @param[in] wait     Return only once every target has run the function
+ *
+ * @return @c false if some target couldn't be sent the call, for lack of memory
+ */
+bool srv_smp_CallFunction(uint64_t cpus, srv_smp_function_t function, void* argument, bool wait);
+
+/**
+ * @brief Flush a range of leaves from the TLB of a set of CPUs, and wait until they have
+ *
+ * @details Ranges waiting for the same CPU are merged into one, so however
+ *          many CPUs ask at once, each target flushes once. Like
+ *          @ref srv_hal_FlushTLBRange, a big enough range becomes a full flush.
+ *
+ * @param[in] cpus CPU mask. CPUs that aren't online are skipped
+ * @param[in] va   Start of the range
+ * @param[in] size Size of the range, in bytes. @c SIZE_MAX flushes everything, including non-leaf entries
+ */
+void srv_smp_FlushTLBRange(uint64_t cpus, srv_virtual_address_t va, size_t size);
+
+/**
+ * @brief Add a range to a TLB flush batch
+ *
+ * @param[in,out] batch The batch
+ * @param[in]     cpus  CPU mask of the CPUs that have to flush the range
+ * @param[in]     va    Start of the range
+ * @param[in]     size  Size of the range, in bytes. @c SIZE_MAX flushes everything, as it does for @ref srv_smp_FlushTLBRange
+ */
+void srv_smp_TLBBatchAdd(srv_smp_tlb_batch_t* batch, uint64_t cpus, srv_virtual_address_t va, size_t size);
+
+/**
+ * @brief Flush everything in a batch with @ref srv_smp_FlushTLBRange, as one range, and empty it
+ *
+ * @param[in,out] batch The batch
+ */
+void srv_smp_TLBBatchFlush(srv_smp_tlb_batch_t* batch);
+
+/**
+ * @brief Run the calls waiting for the executing CPU
+ *
+ * @details Called from the software interrupt
+ */
+void srv_smp_HandleIPI(void);
+
+#endif
@@ -0,0 +1,54 @@
+/****************************************************************
+ * @file    lock_stats.c
+ * @brief   Implementation of @ref lock_stats.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <sync/lock_stats.h>
+
+#include <stdio.h>
+
+#if defined(SRV_CONFIG_LOCK_STATS)
+
+static srv_lock_stats_t* lock_stats_list = NULL; /**< Every lock that has been taken, most recent first */
+
+void srv_lock_stats_Register(srv_lock_stats_t* stats)
+{
+    /* The caller holds the lock, so only the list itself can race */
+    stats->registered = true;
+    stats->next       = __atomic_load_n(&lock_stats_list, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&lock_stats_list, &stats->next, stats, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void srv_lock_stats_Dump(void)
+{
+    kprintf("lock: acquired, contended, spins, max hold (cycles)\n");
+
+    for (const srv_lock_stats_t* stats = __atomic_load_n(&lock_stats_list, __ATOMIC_ACQUIRE); stats != NULL; stats = stats->next)
+    {
+        /* A snapshot, since the numbers keep moving under us */
+        const uint64_t acquisitions    = __atomic_load_n(&stats->acquisitions, __ATOMIC_RELAXED);
+        const uint64_t contended       = __atomic_load_n(&stats->contended, __ATOMIC_RELAXED);
+        const uint64_t spins           = __atomic_load_n(&stats->spins, __ATOMIC_RELAXED);
+        const uint64_t max_hold_cycles = __atomic_load_n(&stats->max_hold_cycles, __ATOMIC_RELAXED);
+
+        kprintf("%s: %lu, %lu, %lu, %lu\n",
+                (stats->name != NULL) ? stats->name : "?",
+                acquisitions,
+                contended,
+                spins,
+                max_hold_cycles);
+    }
+}
+
+#else
+
+void srv_lock_stats_Dump(void)
+{
+}
+
+#endif
@@ -0,0 +1,112 @@
+/****************************************************************
+ * @file    lock_stats.h
+ * @brief   Optional lock contention statistics
+ *
+ * @details Built in when @c SRV_CONFIG_LOCK_STATS is defined (the
+ *          @c SYSRV_LOCK_STATS CMake option). Each lock then counts how often
+ *          it was taken, how often it had to wait and for how long, and the
+ *          longest it was held. Otherwise the hooks compile away to nothing.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+#include <hal.h>
+#include <stddef.h>
+
+#if defined(SRV_CONFIG_LOCK_STATS)
+
+/**
+ * @brief Contention statistics for one lock
+ *
+ * @details Apart from @ref next, everything is only written by the lock's
+ *          holder, so it needs no atomics of its own
+ */
+typedef struct srv_lock_stats
+{
+    const char*            name;            /**< Name the lock is reported under */
+    uint64_t               acquisitions;    /**< Number of times the lock was taken */
+    uint64_t               contended;       /**< Number of acquisitions that had to wait */
+    uint64_t               spins;           /**< Total number of wait loop iterations */
+    uint64_t               max_hold_cycles; /**< Longest the lock was held, in cycles */
+    uint64_t               acquired_at;     /**< Cycle count when the current holder took the lock */
+    bool                   registered;      /**< Has the lock been added to the list @ref srv_lock_stats_Dump prints */
+    struct srv_lock_stats* next;            /**< Next lock in that list */
+} srv_lock_stats_t;
+
+/**
+ * @brief Add a lock to the list @ref srv_lock_stats_Dump prints
+ *
+ * @details Locks add themselves the first time they are taken
+ *
+ * @param[in] stats The lock's statistics
+ */
+void srv_lock_stats_Register(srv_lock_stats_t* stats);
+
+/**
+ * @brief Account for an acquisition
+ *
+ * @param[in] stats The lock's statistics
+ * @param[in] spins Number of times the caller went round its wait loop
+ */
+static inline void srv_lock_stats_Acquired(srv_lock_stats_t* stats, uint64_t spins)
+{
+    if (!stats->registered)
+    {
+        srv_lock_stats_Register(stats);
+    }
+
+    stats->acquisitions++;
+    if (spins != 0ULL)
+    {
+        stats->contended++;
+        stats->spins += spins;
+    }
+
+    stats->acquired_at = srv_hal_GetCycleCount();
+}
+
+/**
+ * @brief Account for a release
+ *
+ * @param[in] stats The lock's statistics
+ */
+static inline void srv_lock_stats_Released(srv_lock_stats_t* stats)
+{
+    const uint64_t held = srv_hal_GetCycleCount() - stats->acquired_at;
+
+    if (held > stats->max_hold_cycles)
+    {
+        stats->max_hold_cycles = held;
+    }
+}
+
+/* The member every lock carries, and its static initializer */
+#define SRV_LOCK_STATS_FIELD           srv_lock_stats_t stats;
+#define SRV_LOCK_STATS_INIT(lock_name) , .stats = {.name = (lock_name)}
+
+#define SRV_LOCK_STATS_SET_NAME(lock, lock_name)  ((lock)->stats = (srv_lock_stats_t){.name = (lock_name)})
+#define SRV_LOCK_STATS_ACQUIRED(lock, spin_count) srv_lock_stats_Acquired(&(lock)->stats, (spin_count))
+#define SRV_LOCK_STATS_RELEASED(lock)             srv_lock_stats_Released(&(lock)->stats)
+
+#else
+
+#define SRV_LOCK_STATS_FIELD
+#define SRV_LOCK_STATS_INIT(lock_name)
+
+#define SRV_LOCK_STATS_SET_NAME(lock, lock_name)  ((void)(lock_name))
+#define SRV_LOCK_STATS_ACQUIRED(lock, spin_count) ((void)(spin_count))
+#define SRV_LOCK_STATS_RELEASED(lock)             ((void)(lock))
+
+#endif
+
+/**
+ * @brief Print the statistics of every lock that has been taken
+ *
+ * @details Does nothing unless lock statistics are built in
+ */
+void srv_lock_stats_Dump(void);
+
+#endif
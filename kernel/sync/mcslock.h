@@ -0,0 +1,117 @@
+/****************************************************************
+ * @file    mcslock.h
+ * @brief   MCS queue lock
+ *
+ * @details Waiters queue up behind one another, each spinning on a flag in
+ *          its own node, so a release only touches the line of the next CPU
+ *          in line rather than every waiter's. That keeps the cost of a
+ *          handover flat however many CPUs are waiting, at the price of a
+ *          node the caller supplies (normally on its stack) for the duration.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef MCSLOCK_H
+#define MCSLOCK_H
+
+#include <hal.h>
+#include <sync/lock_stats.h>
+
+/**
+ * @brief A CPU's place in the queue for an MCS lock
+ *
+ * @details Cache-line aligned, since it's what the CPU spins on
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]] srv_mcs_node
+{
+    struct srv_mcs_node* next;    /**< The CPU queued behind this one */
+    uint32_t             waiting; /**< Cleared by the previous holder to hand the lock over */
+} srv_mcs_node_t;
+
+/**
+ * @brief An MCS lock
+ */
+typedef struct
+{
+    srv_mcs_node_t* tail; /**< Last CPU in the queue, or @c NULL if the lock is free */
+    SRV_LOCK_STATS_FIELD
+} srv_mcslock_t;
+
+/**
+ * @brief Static initializer for an unlocked MCS lock
+ *
+ * @param[in] name Name the lock's statistics are reported under
+ */
+#define SRV_MCSLOCK_INIT(name) {.tail = NULL SRV_LOCK_STATS_INIT(name)}
+
+/**
+ * @brief Initialize an MCS lock as unlocked
+ *
+ * @param[out] lock The lock
+ * @param[in]  name Name the lock's statistics are reported under
+ */
+static inline void srv_mcslock_Init(srv_mcslock_t* lock, const char* name)
+{
+    lock->tail = NULL;
+    SRV_LOCK_STATS_SET_NAME(lock, name);
+}
+
+/**
+ * @brief Join the queue for an MCS lock, and wait until it is our turn
+ *
+ * @param[in] lock The lock
+ * @param[in] node This CPU's node. Must stay put until @ref srv_mcslock_Unlock
+ */
+static inline void srv_mcslock_Lock(srv_mcslock_t* lock, srv_mcs_node_t* node)
+{
+    uint64_t spins = 0ULL;
+
+    node->next    = NULL;
+    node->waiting = 1U;
+
+    /* One amoswap both joins the queue and tells us who is ahead of us */
+    srv_mcs_node_t* previous = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+
+    if (previous != NULL)
+    {
+        __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&node->waiting, __ATOMIC_ACQUIRE) != 0U)
+        {
+            spins++;
+        }
+    }
+
+    SRV_LOCK_STATS_ACQUIRED(lock, spins);
+}
+
+/**
+ * @brief Release an MCS lock, handing it to the next CPU in the queue
+ *
+ * @param[in] lock The lock
+ * @param[in] node The node passed to @ref srv_mcslock_Lock
+ */
+static inline void srv_mcslock_Unlock(srv_mcslock_t* lock, srv_mcs_node_t* node)
+{
+    SRV_LOCK_STATS_RELEASED(lock);
+
+    srv_mcs_node_t* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+    if (next == NULL)
+    {
+        /* Nobody behind us, unless someone is between their amoswap and linking themselves in */
+        srv_mcs_node_t* expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            return;
+        }
+
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+        {
+        }
+    }
+
+    __atomic_store_n(&next->waiting, 0U, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,130 @@
+/****************************************************************
+ * @file    spinlock.h
+ * @brief   Test-and-test-and-set spinlock
+ *
+ * @details The cheapest lock, for short critical sections with little
+ *          contention. Waiters spin on a plain load, so the line is only
+ *          written (with an @c amoswap) when it looks free. It makes no
+ *          promise about the order waiters get in; see @ref ticketlock.h
+ *          and @ref mcslock.h for that.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <hal.h>
+#include <sync/lock_stats.h>
+
+/**
+ * @brief A spinlock
+ */
+typedef struct
+{
+    uint32_t locked; /**< Non-zero while held */
+    SRV_LOCK_STATS_FIELD
+} srv_spinlock_t;
+
+/**
+ * @brief Static initializer for an unlocked spinlock
+ *
+ * @param[in] name Name the lock's statistics are reported under
+ */
+#define SRV_SPINLOCK_INIT(name) {.locked = 0U SRV_LOCK_STATS_INIT(name)}
+
+/**
+ * @brief Initialize a spinlock as unlocked
+ *
+ * @param[out] lock The lock
+ * @param[in]  name Name the lock's statistics are reported under
+ */
+static inline void srv_spinlock_Init(srv_spinlock_t* lock, const char* name)
+{
+    lock->locked = 0U;
+    SRV_LOCK_STATS_SET_NAME(lock, name);
+}
+
+/**
+ * @brief Take a spinlock, waiting for as long as it takes
+ *
+ * @param[in] lock The lock
+ */
+static inline void srv_spinlock_Lock(srv_spinlock_t* lock)
+{
+    uint64_t spins = 0ULL;
+
+    while (__atomic_exchange_n(&lock->locked, 1U, __ATOMIC_ACQUIRE) != 0U)
+    {
+        /* Spin on a plain load so we don't hammer the line with AMOs */
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0U)
+        {
+            spins++;
+        }
+    }
+
+    SRV_LOCK_STATS_ACQUIRED(lock, spins);
+}
+
+/**
+ * @brief Take a spinlock if it is free
+ *
+ * @param[in] lock The lock
+ *
+ * @return @c true if the lock was taken
+ */
+static inline bool srv_spinlock_TryLock(srv_spinlock_t* lock)
+{
+    if ((__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0U) || (__atomic_exchange_n(&lock->locked, 1U, __ATOMIC_ACQUIRE) != 0U))
+    {
+        return false;
+    }
+
+    SRV_LOCK_STATS_ACQUIRED(lock, 0ULL);
+
+    return true;
+}
+
+/**
+ * @brief Release a spinlock
+ *
+ * @param[in] lock The lock
+ */
+static inline void srv_spinlock_Unlock(srv_spinlock_t* lock)
+{
+    SRV_LOCK_STATS_RELEASED(lock);
+    __atomic_store_n(&lock->locked, 0U, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Mask interrupts and take a spinlock
+ *
+ * @details Use this for any lock an interrupt handler can also take, or the
+ *          handler could spin forever on a lock its own CPU holds
+ *
+ * @param[in] lock The lock
+ *
+ * @return The interrupt state to hand back to @ref srv_spinlock_UnlockIRQRestore
+ */
+static inline srv_irq_state_t srv_spinlock_LockIRQSave(srv_spinlock_t* lock)
+{
+    const srv_irq_state_t state = srv_hal_SaveAndDisableInterrupts();
+
+    srv_spinlock_Lock(lock);
+
+    return state;
+}
+
+/**
+ * @brief Release a spinlock taken by @ref srv_spinlock_LockIRQSave
+ *
+ * @param[in] lock  The lock
+ * @param[in] state The value returned by @ref srv_spinlock_LockIRQSave
+ */
+static inline void srv_spinlock_UnlockIRQRestore(srv_spinlock_t* lock, srv_irq_state_t state)
+{
+    srv_spinlock_Unlock(lock);
+    srv_hal_RestoreInterrupts(state);
+}
+
+#endif
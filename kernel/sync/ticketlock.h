@@ -0,0 +1,106 @@
+/****************************************************************
+ * @file    ticketlock.h
+ * @brief   Fair ticket lock
+ *
+ * @details Each CPU takes a ticket with an @c amoadd and waits for it to be
+ *          called, so the lock is handed out strictly in arrival order and
+ *          nobody starves. Every waiter still spins on the same line, so for
+ *          locks that many CPUs fight over, prefer @ref mcslock.h.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef TICKETLOCK_H
+#define TICKETLOCK_H
+
+#include <hal.h>
+#include <sync/lock_stats.h>
+
+/**
+ * @brief A ticket lock
+ */
+typedef struct
+{
+    uint32_t next;    /**< Ticket the next CPU to arrive gets */
+    uint32_t serving; /**< Ticket of the CPU that holds the lock. Only the holder writes this */
+    SRV_LOCK_STATS_FIELD
+} srv_ticketlock_t;
+
+/**
+ * @brief Static initializer for an unlocked ticket lock
+ *
+ * @param[in] name Name the lock's statistics are reported under
+ */
+#define SRV_TICKETLOCK_INIT(name) {.next = 0U, .serving = 0U SRV_LOCK_STATS_INIT(name)}
+
+/**
+ * @brief Initialize a ticket lock as unlocked
+ *
+ * @param[out] lock The lock
+ * @param[in]  name Name the lock's statistics are reported under
+ */
+static inline void srv_ticketlock_Init(srv_ticketlock_t* lock, const char* name)
+{
+    lock->next    = 0U;
+    lock->serving = 0U;
+    SRV_LOCK_STATS_SET_NAME(lock, name);
+}
+
+/**
+ * @brief Take a ticket lock, waiting for everyone who arrived first
+ *
+ * @param[in] lock The lock
+ */
+static inline void srv_ticketlock_Lock(srv_ticketlock_t* lock)
+{
+    const uint32_t ticket = __atomic_fetch_add(&lock->next, 1U, __ATOMIC_RELAXED);
+    uint64_t       spins  = 0ULL;
+
+    while (__atomic_load_n(&lock->serving, __ATOMIC_ACQUIRE) != ticket)
+    {
+        spins++;
+    }
+
+    SRV_LOCK_STATS_ACQUIRED(lock, spins);
+}
+
+/**
+ * @brief Release a ticket lock, handing it to the next CPU in line
+ *
+ * @param[in] lock The lock
+ */
+static inline void srv_ticketlock_Unlock(srv_ticketlock_t* lock)
+{
+    SRV_LOCK_STATS_RELEASED(lock);
+    __atomic_store_n(&lock->serving, __atomic_load_n(&lock->serving, __ATOMIC_RELAXED) + 1U, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Mask interrupts and take a ticket lock
+ *
+ * @param[in] lock The lock
+ *
+ * @return The interrupt state to hand back to @ref srv_ticketlock_UnlockIRQRestore
+ */
+static inline srv_irq_state_t srv_ticketlock_LockIRQSave(srv_ticketlock_t* lock)
+{
+    const srv_irq_state_t state = srv_hal_SaveAndDisableInterrupts();
+
+    srv_ticketlock_Lock(lock);
+
+    return state;
+}
+
+/**
+ * @brief Release a ticket lock taken by @ref srv_ticketlock_LockIRQSave
+ *
+ * @param[in] lock  The lock
+ * @param[in] state The value returned by @ref srv_ticketlock_LockIRQSave
+ */
+static inline void srv_ticketlock_UnlockIRQRestore(srv_ticketlock_t* lock, srv_irq_state_t state)
+{
+    srv_ticketlock_Unlock(lock);
+    srv_hal_RestoreInterrupts(state);
+}
+
+#endif
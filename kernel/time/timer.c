@@ -0,0 +1,448 @@
+/****************************************************************
+ * @file    timer.c
+ * @brief   Implementation of @ref timer.h
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <time/timer.h>
+
+#include <drivers/fdt/fdt.h>
+#include <panic.h>
+#include <smp/smp.h>
+#include <string.h>
+#include <sync/spinlock.h>
+
+#define TIMER_DEFAULT_FREQUENCY 10000000ULL                                         /**< Timebase to assume if the DTB doesn't give one. QEMU virt's */
+#define TIMER_SLOT_MASK         (SRV_TIMER_SLOTS - 1U)                              /**< Mask to get a slot index out of a time */
+#define TIMER_MAX_DELTA         (1ULL << (SRV_TIMER_LEVEL_BITS * SRV_TIMER_LEVELS)) /**< Furthest ahead the wheel reaches, in units */
+
+/**
+ * @brief A CPU's timing wheel
+ *
+ * @details Times in here are in units of @ref SRV_TIMER_UNIT ticks. The wheel
+ *          has dealt with everything due before @ref clock.
+ */
+typedef struct [[gnu::aligned(SRV_HAL_CACHE_LINE_SIZE)]]
+{
+    srv_spinlock_t lock;                                     /**< Protects the wheel. Other CPUs take it to arm timers here */
+    uint64_t       clock;                                    /**< First unit not yet dealt with */
+    uint64_t       programmed;                               /**< Deadline the CPU's timer is programmed for, in ticks. Only the CPU itself changes this */
+    bool           kick;                                     /**< Another CPU armed a timer here that is due before @ref programmed, and sent an IPI about it */
+    uint64_t       occupied[SRV_TIMER_LEVELS];               /**< Bit per slot that has timers in it */
+    srv_timer_t*   slots[SRV_TIMER_LEVELS][SRV_TIMER_SLOTS]; /**< Timers, by level and slot */
+} timer_wheel_t;
+
+static timer_wheel_t timer_wheels[SRV_HAL_MAX_CPUS];
+static uint64_t      timer_frequency = TIMER_DEFAULT_FREQUENCY; /**< Timebase ticks per second */
+
+/**
+ * @brief Check whether the boot CPU has the Sstc extension
+ *
+ * @details Newer DTBs list extensions in @c riscv,isa-extensions, older ones
+ *          only spell them out in the @c riscv,isa string
+ */
+static bool timer_HasSstc(const void* fdt)
+{
+    const int32_t cpus = srv_fdt_PathOffset(fdt, "/cpus");
+    if (cpus < 0)
+    {
+        return false;
+    }
+
+    /* Every hart on the platforms we boot on is the same, so the first tells us about all of them */
+    for (int32_t cpu = srv_fdt_FirstSubnode(fdt, cpus); cpu >= 0; cpu = srv_fdt_NextSubnode(fdt, cpu))
+    {
+        uint32_t    length     = 0U;
+        const char* extensions = (const char*)srv_fdt_GetProp(fdt, cpu, "riscv,isa-extensions", &length);
+
+        if (extensions != NULL)
+        {
+            for (uint32_t offset = 0U; offset < length; offset += (uint32_t)strlen(&extensions[offset]) + 1U)
+            {
+                if (strcmp(&extensions[offset], "sstc") == 0)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        const char* isa = (const char*)srv_fdt_GetProp(fdt, cpu, "riscv,isa", NULL);
+        if (isa == NULL)
+        {
+            continue;
+        }
+
+        /* Multi-letter extensions come after the single letter ones, each behind an underscore */
+        for (const char* underscore = isa; (underscore = strchr(underscore, '_')) != NULL; underscore++)
+        {
+            if ((strncmp(underscore + 1, "sstc", 4U) == 0) && ((underscore[5] == '_') || (underscore[5] == '\0')))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Get the time the slots of a level with something in them next come round
+ *
+ * @details Level 0 slots come round at their own time. Higher level slots come
+ *          round when they are cascaded, at the start of the time they cover.
+ *          The higher level slot @ref timer_wheel_t::clock is in has already
+ *          been cascaded, so anything in it is for its next time round.
+ *
+ * @return The time in units, or @ref SRV_TIMER_NEVER if the level is empty
+ */
+static inline uint64_t timer_NextInLevel(const timer_wheel_t* wheel, uint32_t level)
+{
+    const uint64_t occupied = wheel->occupied[level];
+    if (occupied == 0U)
+    {
+        return SRV_TIMER_NEVER;
+    }
+
+    const uint32_t shift = level * SRV_TIMER_LEVEL_BITS;
+    const uint64_t base  = wheel->clock >> shift;
+    const uint32_t turn  = (uint32_t)(base & TIMER_SLOT_MASK);
+
+    /* Rotate so bit n is the slot n places on from the current one */
+    const uint64_t rotated = (occupied >> turn) | (occupied << ((SRV_TIMER_SLOTS - turn) & TIMER_SLOT_MASK));
+    uint64_t       ahead   = (uint64_t)__builtin_ctzll(rotated);
+
+    if (level != 0U)
+    {
+        const uint64_t later = rotated & ~1ULL;
+        ahead                = (later != 0U) ? (uint64_t)__builtin_ctzll(later) : SRV_TIMER_SLOTS;
+    }
+
+    return (base + ahead) << shift;
+}
+
+/**
+ * @brief Check whether a wheel has no timers in it
+ */
+static inline bool timer_IsEmpty(const timer_wheel_t* wheel)
+{
+    for (uint32_t level = 0U; level < SRV_TIMER_LEVELS; level++)
+    {
+        if (wheel->occupied[level] != 0U)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Get the next time the wheel has something to do
+ *
+ * @return The time in units, or @ref SRV_TIMER_NEVER if the wheel is empty
+ */
+static uint64_t timer_NextEvent(const timer_wheel_t* wheel)
+{
+    uint64_t next = SRV_TIMER_NEVER;
+
+    for (uint32_t level = 0U; level < SRV_TIMER_LEVELS; level++)
+    {
+        const uint64_t level_next = timer_NextInLevel(wheel, level);
+        if (level_next < next)
+        {
+            next = level_next;
+        }
+    }
+
+    return next;
+}
+
+/**
+ * @brief Put a timer in the slot its deadline falls in
+ */
+static void timer_Insert(timer_wheel_t* wheel, srv_timer_t* timer)
+{
+    /* Round up, so the timer never expires early */
+    const uint64_t expires = (timer->deadline >> SRV_TIMER_UNIT_SHIFT) + (((timer->deadline & (SRV_TIMER_UNIT - 1ULL)) != 0U) ? 1U : 0U);
+    uint64_t       delta   = (expires > wheel->clock) ? (expires - wheel->clock) : 0U;
+
+    /* Beyond the top level, park it as far out as the wheel goes. It is put back in properly when that slot cascades */
+    if (delta >= TIMER_MAX_DELTA)
+    {
+        delta = TIMER_MAX_DELTA - 1U;
+    }
+
+    const uint32_t level = (delta < SRV_TIMER_SLOTS) ? 0U : ((63U - (uint32_t)__builtin_clzll(delta)) / SRV_TIMER_LEVEL_BITS);
+    const uint32_t slot  = (uint32_t)(((wheel->clock + delta) >> (level * SRV_TIMER_LEVEL_BITS)) & TIMER_SLOT_MASK);
+
+    srv_timer_t** head = &wheel->slots[level][slot];
+
+    timer->level = (uint8_t)level;
+    timer->slot  = (uint8_t)slot;
+    timer->next  = *head;
+    timer->pprev = head;
+
+    if (*head != NULL)
+    {
+        (*head)->pprev = &timer->next;
+    }
+
+    *head = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+/**
+ * @brief Take a timer out of its slot
+ */
+static void timer_Unlink(timer_wheel_t* wheel, srv_timer_t* timer)
+{
+    *timer->pprev = timer->next;
+
+    if (timer->next != NULL)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+
+    if (wheel->slots[timer->level][timer->slot] == NULL)
+    {
+        wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+
+    timer->next  = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * @brief Move the clock on, cascading any higher level slots that start at the new time
+ *
+ * @param[in] clock The new time, in units. Nothing due before it may be left
+ */
+static void timer_SetClock(timer_wheel_t* wheel, uint64_t clock)
+{
+    wheel->clock = clock;
+
+    for (uint32_t level = 1U; level < SRV_TIMER_LEVELS; level++)
+    {
+        const uint32_t shift = level * SRV_TIMER_LEVEL_BITS;
+
+        if ((clock & ((1ULL << shift) - 1ULL)) != 0U)
+        {
+            break;
+        }
+
+        const uint32_t slot  = (uint32_t)((clock >> shift) & TIMER_SLOT_MASK);
+        srv_timer_t*   timer = wheel->slots[level][slot];
+
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1ULL << slot);
+
+        /* Everything in the slot is due within the slot's width, so lands in a lower level */
+        while (timer != NULL)
+        {
+            srv_timer_t* next = timer->next;
+
+            timer_Insert(wheel, timer);
+            timer = next;
+        }
+    }
+}
+
+/**
+ * @brief Take the next expired timer out of the wheel
+ *
+ * @details The clock is moved on as far as @c now, jumping straight over
+ *          stretches with nothing in them
+ *
+ * @param[in] now The current time, in units
+ *
+ * @return The timer, or @c NULL once nothing more is due
+ */
+static srv_timer_t* timer_Expire(timer_wheel_t* wheel, uint64_t now)
+{
+    for (;;)
+    {
+        srv_timer_t* timer = wheel->slots[0U][wheel->clock & TIMER_SLOT_MASK];
+        if (timer != NULL)
+        {
+            timer_Unlink(wheel, timer);
+            return timer;
+        }
+
+        if (wheel->clock >= now)
+        {
+            return NULL;
+        }
+
+        /* Nothing comes round before then, so there is nothing to cascade on the way */
+        const uint64_t next = timer_NextEvent(wheel);
+        if (next > now)
+        {
+            wheel->clock = now;
+            return NULL;
+        }
+
+        timer_SetClock(wheel, next);
+    }
+}
+
+/**
+ * @brief Program the executing CPU's timer for the next thing its wheel has to do
+ *
+ * @details Only reprograms if the deadline changed, since without Sstc that costs a trip to the firmware
+ */
+static void timer_Program(timer_wheel_t* wheel)
+{
+    const uint64_t next     = timer_NextEvent(wheel);
+    const uint64_t deadline = (next == SRV_TIMER_NEVER) ? SRV_TIMER_NEVER : (next << SRV_TIMER_UNIT_SHIFT);
+
+    __atomic_store_n(&wheel->kick, false, __ATOMIC_RELAXED);
+
+    if (deadline != wheel->programmed)
+    {
+        wheel->programmed = deadline;
+        srv_hal_SetTimer(deadline);
+    }
+}
+
+void srv_timer_Init(const void* fdt)
+{
+    const srv_fdt_node_t* cpus      = srv_fdt_FindNodeByPath("/cpus");
+    uint32_t              frequency = 0U;
+
+    if ((cpus != NULL) && srv_fdt_GetPropertyU32(cpus, "timebase-frequency", &frequency) && (frequency != 0U))
+    {
+        timer_frequency = frequency;
+    }
+
+    srv_hal_InitTimer(timer_HasSstc(fdt));
+
+    const uint64_t now = srv_hal_GetTime() >> SRV_TIMER_UNIT_SHIFT;
+
+    for (uint32_t cpu = 0U; cpu < SRV_HAL_MAX_CPUS; cpu++)
+    {
+        srv_spinlock_Init(&timer_wheels[cpu].lock, "timer-wheel");
+        timer_wheels[cpu].clock = now;
+
+        /* Nothing has programmed the CPU's timer yet, so the first pass has to. Each CPU makes one in kmain */
+        timer_wheels[cpu].programmed = 0U;
+    }
+}
+
+uint64_t srv_timer_GetFrequency(void)
+{
+    return timer_frequency;
+}
+
+uint64_t srv_timer_FromMicroseconds(uint64_t microseconds)
+{
+    return (microseconds * timer_frequency) / 1000000ULL;
+}
+
+void srv_timer_Setup(srv_timer_t* timer, srv_timer_callback_t callback, void* argument)
+{
+    *timer = (srv_timer_t){
+        .callback = callback,
+        .argument = argument,
+    };
+}
+
+bool srv_timer_Arm(srv_timer_t* timer, uint64_t deadline, uint32_t cpu)
+{
+    if (cpu >= SRV_HAL_MAX_CPUS)
+    {
+        srv_KernelPanic("timer: armed for a CPU that doesn't exist");
+    }
+
+    const bool            was_armed = srv_timer_Cancel(timer);
+    timer_wheel_t*        wheel     = &timer_wheels[cpu];
+    const srv_irq_state_t irq_state = srv_spinlock_LockIRQSave(&wheel->lock);
+
+    /* An empty wheel can jump to the present, so a new timer starts off in the finest level it can */
+    if (timer_IsEmpty(wheel))
+    {
+        const uint64_t now = srv_hal_GetTime() >> SRV_TIMER_UNIT_SHIFT;
+        if (now > wheel->clock)
+        {
+            wheel->clock = now;
+        }
+    }
+
+    timer->deadline = deadline;
+    timer->cpu      = cpu;
+    timer_Insert(wheel, timer);
+
+    bool kick = false;
+
+    if (cpu == srv_hal_GetExecutingCPU())
+    {
+        timer_Program(wheel);
+    }
+    else if (deadline < wheel->programmed)
+    {
+        /* Only the CPU itself can program its timer. One IPI does for every kick until it has */
+        kick = !__atomic_exchange_n(&wheel->kick, true, __ATOMIC_RELAXED);
+    }
+
+    srv_spinlock_UnlockIRQRestore(&wheel->lock, irq_state);
+
+    if (kick)
+    {
+        srv_smp_SendIPI(1ULL << cpu);
+    }
+
+    return was_armed;
+}
+
+bool srv_timer_Cancel(srv_timer_t* timer)
+{
+    timer_wheel_t*        wheel     = &timer_wheels[timer->cpu];
+    const srv_irq_state_t irq_state = srv_spinlock_LockIRQSave(&wheel->lock);
+    const bool            armed     = (timer->pprev != NULL);
+
+    /* The CPU's timer is left alone. If it goes off for nothing, it just gets reprogrammed */
+    if (armed)
+    {
+        timer_Unlink(wheel, timer);
+    }
+
+    srv_spinlock_UnlockIRQRestore(&wheel->lock, irq_state);
+
+    return armed;
+}
+
+void srv_timer_Run(void)
+{
+    const srv_irq_state_t irq_state = srv_hal_SaveAndDisableInterrupts();
+    timer_wheel_t*        wheel     = &timer_wheels[srv_hal_GetExecutingCPU()];
+    const uint64_t        now       = srv_hal_GetTime();
+
+    /* The common case for idle CPUs, so it stays off the lock */
+    if ((now < wheel->programmed) && !__atomic_load_n(&wheel->kick, __ATOMIC_RELAXED))
+    {
+        srv_hal_RestoreInterrupts(irq_state);
+        return;
+    }
+
+    srv_spinlock_Lock(&wheel->lock);
+
+    for (srv_timer_t* timer = timer_Expire(wheel, now >> SRV_TIMER_UNIT_SHIFT); timer != NULL; timer = timer_Expire(wheel, now >> SRV_TIMER_UNIT_SHIFT))
+    {
+        const srv_timer_callback_t callback = timer->callback;
+        void*                      argument = timer->argument;
+
+        /* Let go while it runs, so the callback can arm timers (even itself again) */
+        srv_spinlock_Unlock(&wheel->lock);
+        callback(argument);
+        srv_spinlock_Lock(&wheel->lock);
+    }
+
+    timer_Program(wheel);
+
+    srv_spinlock_Unlock(&wheel->lock);
+    srv_hal_RestoreInterrupts(irq_state);
+}
@@ -0,0 +1,133 @@
+/****************************************************************
+ * @file    timer.h
+ * @brief   One-shot Kernel timers
+ *
+ * @details Every CPU keeps its pending timers in a hierarchical timing
+ *          wheel. Level 0 has a slot per unit of time, and each level above
+ *          it has slots @ref SRV_TIMER_SLOTS times as wide. Arming a timer
+ *          drops it straight into a slot and cancelling unlinks it, so both
+ *          are O(1). Timers in the upper levels cascade down as their slot
+ *          comes round.
+ *
+ *          The system is tickless. A CPU's timer is only ever programmed for
+ *          the next slot that has something in it, so a CPU with nothing due
+ *          takes no timer interrupts at all.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <hal.h>
+#include <stddef.h>
+
+#define SRV_TIMER_LEVELS     4U                             /**< Number of levels in each wheel */
+#define SRV_TIMER_LEVEL_BITS 6U                             /**< log2 of the number of slots per level */
+#define SRV_TIMER_SLOTS      (1U << SRV_TIMER_LEVEL_BITS)   /**< Number of slots per level */
+#define SRV_TIMER_UNIT_SHIFT 10U                            /**< A level 0 slot is 2^this timebase ticks wide, about 100 us at 10 MHz */
+#define SRV_TIMER_UNIT       (1ULL << SRV_TIMER_UNIT_SHIFT) /**< Width of a level 0 slot, in timebase ticks */
+#define SRV_TIMER_NEVER      UINT64_MAX                     /**< A deadline that never comes */
+
+/**
+ * @brief Function run when a timer expires
+ *
+ * @details Runs on the CPU the timer was armed for, with interrupts masked
+ *
+ * @param[in] argument The value given to @ref srv_timer_Setup
+ */
+typedef void (*srv_timer_callback_t)(void* argument);
+
+/**
+ * @brief A one-shot timer
+ *
+ * @details Owned by the caller, who has to keep it alive while it is armed
+ */
+typedef struct srv_timer
+{
+    struct srv_timer*    next;     /**< Next timer in the same slot */
+    struct srv_timer**   pprev;    /**< The link pointing at this timer, or @c NULL if it isn't armed */
+    uint64_t             deadline; /**< When the timer expires, in timebase ticks */
+    srv_timer_callback_t callback; /**< Run when the timer expires */
+    void*                argument; /**< Passed to @ref callback */
+    uint32_t             cpu;      /**< CPU whose wheel the timer is in */
+    uint8_t              level;    /**< Wheel level the timer is in */
+    uint8_t              slot;     /**< Slot within that level */
+} srv_timer_t;
+
+/**
+ * @brief Find the timebase and how CPU timers are programmed, and start every CPU's wheel
+ *
+ * @warning Must be called once, on the boot CPU, before any other CPU starts
+ *
+ * @param[in] fdt Pointer to the DTB
+ */
+void srv_timer_Init(const void* fdt);
+
+/**
+ * @brief Get the rate of the timebase
+ *
+ * @return Timebase ticks per second
+ */
+uint64_t srv_timer_GetFrequency(void);
+
+/**
+ * @brief Convert a length of time to timebase ticks
+ *
+ * @param[in] microseconds The length of time, in microseconds
+ *
+ * @return The length of time, in timebase ticks
+ */
+uint64_t srv_timer_FromMicroseconds(uint64_t microseconds);
+
+/**
+ * @brief Give a timer its callback
+ *
+ * @warning The timer must not be armed
+ *
+ * @param[out] timer    The timer
+ * @param[in]  callback Run when the timer expires
+ * @param[in]  argument Passed to @c callback
+ */
+void srv_timer_Setup(srv_timer_t* timer, srv_timer_callback_t callback, void* argument);
+
+/**
+ * @brief Arm a timer, or move it if it is already armed
+ *
+ * @details The callback never runs early, but may run up to
+ *          @ref SRV_TIMER_UNIT ticks late. A timer must not be armed or
+ *          cancelled from two places at once.
+ *
+ * @param[in,out] timer    The timer
+ * @param[in]     deadline Value of @ref srv_hal_GetTime to expire at. A deadline that has passed expires straight away
+ * @param[in]     cpu      Logical number of the online CPU the callback runs on
+ *
+ * @return @c true if the timer was already armed
+ */
+bool srv_timer_Arm(srv_timer_t* timer, uint64_t deadline, uint32_t cpu);
+
+/**
+ * @brief Disarm a timer
+ *
+ * @note The callback may already be running on the timer's CPU, in which case this returns @c false
+ *
+ * @param[in,out] timer The timer
+ *
+ * @return @c true if the timer was armed, and now won't expire
+ */
+bool srv_timer_Cancel(srv_timer_t* timer);
+
+/**
+ * @brief Run the executing CPU's expired timers, and program its timer for the next
+ *
+ * @details Called from the timer interrupt, and from the IPI another CPU
+ *          sends when it arms a timer here that is due before the one the
+ *          timer is programmed for. It returns straight away when nothing
+ *          is due.
+ *
+ * @warning Every CPU must call this once before it takes interrupts. Until
+ *          then its timer counts as due, which no other CPU sends an IPI for.
+ */
+void srv_timer_Run(void);
+
+#endif
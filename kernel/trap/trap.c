@@ -0,0 +1,54 @@
+/****************************************************************
+ * @file    trap.c
+ * @brief   The Kernel's trap handlers, called from the HAL's trap entry code
+ *
+ * @details Handlers run with interrupts masked. Anything that can make a
+ *          thread want the CPU ends with @ref srv_sched_Preempt, so that is
+ *          where preemption happens.
+ *
+ * @copyright SPDX-License-Identifier: GPL-3.0-or-later
+ ****************************************************************/
+
+#include <drivers/irq/plic.h>
+#include <hal.h>
+#include <kstdlib/stdio.h>
+#include <panic.h>
+#include <sched/sched.h>
+#include <smp/smp.h>
+#include <time/timer.h>
+
+#define TRAP_INTERRUPT_BIT (1ULL << 63ULL) /**< Set in an RV64 cause for interrupts */
+
+void srv_trap_HandleTimer(void)
+{
+    /* Runs the slice timer too, which is what asks the running thread to make way */
+    srv_timer_Run();
+    srv_sched_Preempt();
+}
+
+void srv_trap_HandleSoftware(void)
+{
+    /* Other CPUs send these with calls to run, or to have us look at a timer they armed here */
+    srv_smp_HandleIPI();
+    srv_timer_Run();
+    srv_sched_Preempt();
+}
+
+void srv_trap_HandleExternal(void)
+{
+    /* Only the PLIC driver unmasks these, so it has something to claim */
+    srv_plic_HandleInterrupt();
+    srv_sched_Preempt();
+}
+
+void srv_trap_HandleException(uintptr_t cause, uintptr_t pc, uintptr_t value)
+{
+    /* Nothing is recoverable yet */
+    kprintf("trap: %s %d at pc 0x%lx, value 0x%lx\n",
+            ((cause & TRAP_INTERRUPT_BIT) != 0U) ? "unexpected interrupt" : "exception",
+            (int)(cause & ~TRAP_INTERRUPT_BIT),
+            (uint64_t)pc,
+            (uint64_t)value);
+
+    srv_KernelPanic("trap: unhandled exception");
+}
@@ -0,0 +1,207 @@
+#
+# System-RV trace ring decoder
+#
+# Turns a raw dump of the Kernel's srv_trace_rings array back into text,
+# resolving format strings (and string arguments) from the Kernel ELF.
+#
+# Grab the dump from a running (or stopped) Kernel with GDB:
+#   dump binary memory trace.bin &srv_trace_rings ((char*)&srv_trace_rings)+sizeof(srv_trace_rings)
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+
+from argparse import ArgumentParser
+from dataclasses import dataclass
+import struct
+
+# These must match kernel/kstdlib/trace.h
+TRACE_MAX_ARGS = 5
+TRACE_RING_RECORDS = 256
+TRACE_RING_HEADER_SIZE = 64
+TRACE_RECORD_FORMAT = f'<QQII{TRACE_MAX_ARGS}Q'
+TRACE_RECORD_SIZE = struct.calcsize(TRACE_RECORD_FORMAT)
+TRACE_RING_SIZE = TRACE_RING_HEADER_SIZE + (TRACE_RING_RECORDS * TRACE_RECORD_SIZE)
+TRACE_RINGS_SYMBOL = 'srv_trace_rings'
+
+ELF_SHT_SYMTAB = 2
+ELF_SHT_NOBITS = 8
+ELF_SHF_ALLOC = 0x2
+
+
+@dataclass
+class ElfSection:
+    address: int
+    offset: int
+    size: int
+    kind: int
+    flags: int
+    link: int
+
+
+@dataclass
+class TraceRecord:
+    cpu: int
+    timestamp: int
+    format_address: int
+    args: list[int]
+
+
+class KernelElf:
+    """Just enough of an ELF64 reader to find symbols and read static data"""
+
+    def __init__(self, path: str):
+        with open(path, 'rb') as elf_file:
+            self.data = elf_file.read()
+
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 2 or self.data[5] != 1:
+            raise ValueError(f'{path} is not a little endian ELF64 file')
+
+        (section_offset,) = struct.unpack_from('<Q', self.data, 0x28)
+        section_entry_size, section_count = struct.unpack_from('<HH', self.data, 0x3A)
+
+        self.sections = []
+        for index in range(section_count):
+            (_, kind, flags, address, offset, size, link) = struct.unpack_from(
+                '<IIQQQQI', self.data, section_offset + (index * section_entry_size))
+            self.sections.append(ElfSection(address, offset, size, kind, flags, link))
+
+    def find_symbol(self, name: str) -> tuple[int, int]:
+        """Get the address and size of a symbol"""
+        for section in self.sections:
+            if section.kind != ELF_SHT_SYMTAB:
+                continue
+
+            strings = self.sections[section.link]
+            for offset in range(section.offset, section.offset + section.size, 24):
+                (name_offset, _, _, _, value, size) = struct.unpack_from('<IBBHQQ', self.data, offset)
+                if self._read_c_string_at(strings.offset + name_offset) == name:
+                    return value, size
+
+        raise KeyError(f'symbol {name} not found')
+
+    def read_string(self, address: int) -> str | None:
+        """Read a NUL terminated string from the loaded image, if the address is in it"""
+        for section in self.sections:
+            if not (section.flags & ELF_SHF_ALLOC) or section.kind == ELF_SHT_NOBITS:
+                continue
+
+            if section.address <= address < section.address + section.size:
+                return self._read_c_string_at(section.offset + (address - section.address))
+
+        return None
+
+    def _read_c_string_at(self, offset: int) -> str:
+        end = self.data.index(b'\x00', offset)
+        return self.data[offset:end].decode('utf-8', errors='replace')
+
+
+def _format(elf: KernelElf, format_string: str, args: list[int]) -> str:
+    """Format a record the same way the Kernel's printf_internal would"""
+    output = []
+    arg_index = 0
+    index = 0
+
+    def next_arg() -> int:
+        nonlocal arg_index
+        value = args[arg_index] if arg_index < len(args) else 0
+        arg_index += 1
+        return value
+
+    while index < len(format_string):
+        character = format_string[index]
+        index += 1
+
+        if character != '%' or index >= len(format_string):
+            output.append(character)
+            continue
+
+        conversion = format_string[index]
+        index += 1
+
+        # %lx and %lu take a whole word, however many l's there are
+        if conversion == 'l':
+            while index < len(format_string) and format_string[index] == 'l':
+                index += 1
+
+            if index < len(format_string) and format_string[index] in 'xu':
+                conversion = 'l' + format_string[index]
+                index += 1
+
+        if conversion == 'c':
+            output.append(chr(next_arg() & 0xFF))
+        elif conversion == 'd':
+            value = next_arg() & 0xFFFFFFFF
+            output.append(str(value - (1 << 32) if value & 0x80000000 else value))
+        elif conversion == 'x':
+            output.append(f'{next_arg() & 0xFFFFFFFF:08X}')
+        elif conversion == 'lx':
+            output.append(f'{next_arg() & 0xFFFFFFFFFFFFFFFF:016X}')
+        elif conversion == 'lu':
+            output.append(str(next_arg() & 0xFFFFFFFFFFFFFFFF))
+        elif conversion == 's':
+            address = next_arg()
+            string = elf.read_string(address)
+            output.append(string if string is not None else f'<string @ {address:#x}>')
+        elif conversion == '%':
+            output.append('%')
+
+    return ''.join(output)
+
+
+def _read_rings(dump: bytes) -> list[TraceRecord]:
+    records = []
+
+    for cpu in range(len(dump) // TRACE_RING_SIZE):
+        ring_offset = cpu * TRACE_RING_SIZE
+        (head,) = struct.unpack_from('<Q', dump, ring_offset)
+
+        # Only the last ring's worth of records can still be there
+        for position in range(max(0, head - TRACE_RING_RECORDS), head):
+            record_offset = ring_offset + TRACE_RING_HEADER_SIZE + \
+                ((position % TRACE_RING_RECORDS) * TRACE_RECORD_SIZE)
+            (format_address, timestamp, sequence, count, *args) = struct.unpack_from(
+                TRACE_RECORD_FORMAT, dump, record_offset)
+
+            # Reserved but never finished, e.g. the dump was taken mid-write
+            if sequence != ((position + 1) & 0xFFFFFFFF):
+                continue
+
+            records.append(TraceRecord(cpu, timestamp, format_address, args[:min(count, TRACE_MAX_ARGS)]))
+
+    return records
+
+
+def parse_arguments() -> ArgumentParser:
+    args_parser = ArgumentParser('System-RV trace decoder')
+
+    args_parser.add_argument('kernel_path',
+                             help='Path to the Kernel ELF the dump was taken from')
+    args_parser.add_argument('dump_path',
+                             help=f'Path to a raw dump of {TRACE_RINGS_SYMBOL}')
+
+    return args_parser
+
+
+def decode(kernel_path: str, dump_path: str) -> None:
+    elf = KernelElf(kernel_path)
+    _, rings_size = elf.find_symbol(TRACE_RINGS_SYMBOL)
+
+    with open(dump_path, 'rb') as dump_file:
+        dump = dump_file.read()
+
+    if len(dump) != rings_size:
+        print(f'warning: dump is {len(dump)} bytes, but {TRACE_RINGS_SYMBOL} is {rings_size}')
+
+    # Cycle counters aren't synchronized between harts, so the merge is only approximate
+    for record in sorted(_read_rings(dump), key=lambda record: record.timestamp):
+        format_string = elf.read_string(record.format_address)
+        if format_string is None:
+            format_string = f'<format @ {record.format_address:#x}>\n'
+
+        print(f'[cpu{record.cpu} {record.timestamp:016X}] {_format(elf, format_string, record.args)}', end='')
+
+
+if __name__ == "__main__":
+    args = parse_arguments()
+
+    decode(**vars(args.parse_args()))